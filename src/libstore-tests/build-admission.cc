@@ -0,0 +1,115 @@
+#include <gtest/gtest.h>
+
+#include "nix/store/build/build-admission.hh"
+#include "nix/store/globals.hh"
+#include "nix/util/finally.hh"
+
+namespace nix {
+
+using namespace std::chrono_literals;
+
+TEST(BuildAdmission, noLimits)
+{
+    BuildAdmission admission(settings.getWorkerSettings());
+    auto now = BuildAdmission::time_point::clock::now();
+
+    ASSERT_FALSE(admission.hasLoadLimits());
+    ASSERT_TRUE(admission.mayStartBuild(0, now));
+    ASSERT_TRUE(admission.mayStartBuild(100, now));
+    ASSERT_EQ(admission.maxBuilds(8), 8);
+}
+
+TEST(BuildAdmission, oomKills)
+{
+    BuildAdmission admission(settings.getWorkerSettings());
+
+    /* Killed while 3 other builds were running. */
+    admission.buildKilledByOom(3);
+    ASSERT_EQ(admission.maxBuilds(8), 3);
+    ASSERT_EQ(admission.maxBuilds(2), 2);
+
+    /* A later kill with more builds running doesn't raise the limit. */
+    admission.buildKilledByOom(5);
+    ASSERT_EQ(admission.maxBuilds(8), 3);
+
+    /* At least one build is allowed, unless max-jobs is 0. */
+    admission.buildKilledByOom(0);
+    ASSERT_EQ(admission.maxBuilds(8), 1);
+    ASSERT_EQ(admission.maxBuilds(0), 0);
+}
+
+#ifdef __linux__
+
+TEST(BuildAdmission, pressure)
+{
+    auto & workerSettings = settings.getWorkerSettings();
+    workerSettings.maxCpuPressure = 50;
+    Finally resetSettings([&]() { workerSettings.maxCpuPressure = 0; });
+
+    BuildAdmission admission(workerSettings);
+    ASSERT_TRUE(admission.hasLoadLimits());
+
+    double cpuPressure = 80;
+    admission.getPressure = [&](std::string_view resource) -> std::optional<double> {
+        if (resource == "cpu")
+            return cpuPressure;
+        return std::nullopt;
+    };
+
+    auto now = BuildAdmission::time_point::clock::now();
+
+    /* One build is always allowed. */
+    ASSERT_TRUE(admission.mayStartBuild(0, now));
+    ASSERT_FALSE(admission.mayStartBuild(1, now));
+
+    /* The load is sampled at most once a second. */
+    cpuPressure = 10;
+    ASSERT_FALSE(admission.mayStartBuild(1, now + 500ms));
+    ASSERT_TRUE(admission.mayStartBuild(1, now + 1s));
+
+    /* A build that was just started gets some time to cause load. */
+    admission.buildStarted(now + 1s);
+    ASSERT_FALSE(admission.mayStartBuild(2, now + 1500ms));
+    ASSERT_TRUE(admission.mayStartBuild(2, now + 2s));
+}
+
+TEST(BuildAdmission, buildMemory)
+{
+    auto & workerSettings = settings.getWorkerSettings();
+    workerSettings.maxBuildMemory = 1000;
+    Finally resetSettings([&]() { workerSettings.maxBuildMemory = 0; });
+
+    BuildAdmission admission(workerSettings);
+
+    std::optional<uint64_t> usage = 2000;
+    admission.getBuildMemoryUsage = [&]() { return usage; };
+
+    auto now = BuildAdmission::time_point::clock::now();
+
+    ASSERT_FALSE(admission.mayStartBuild(1, now));
+
+    usage = 500;
+    ASSERT_TRUE(admission.mayStartBuild(1, now + 1s));
+
+    /* Unknown usage doesn't hold back builds. */
+    usage = std::nullopt;
+    ASSERT_TRUE(admission.mayStartBuild(1, now + 2s));
+}
+
+#endif
+
+TEST(getBuildResourceLimit, byFeature)
+{
+    StringMap limits{{"big-parallel", "64G"}, {"kvm", "16G"}, {"default", "8G"}};
+
+    ASSERT_EQ(getBuildResourceLimit(limits, {}), "8G");
+    ASSERT_EQ(getBuildResourceLimit(limits, {"big-parallel"}), "64G");
+    ASSERT_EQ(getBuildResourceLimit(limits, {"nixos-test"}), "8G");
+
+    /* The first feature in alphabetical order wins. */
+    ASSERT_EQ(getBuildResourceLimit(limits, {"kvm", "big-parallel"}), "64G");
+
+    ASSERT_EQ(getBuildResourceLimit({{"kvm", "16G"}}, {"big-parallel"}), std::nullopt);
+}
+
+} // namespace nix
@@ -0,0 +1,49 @@
+#include <gtest/gtest.h>
+
+#include "nix/store/build/build-durations.hh"
+#include "nix/util/file-system.hh"
+
+namespace nix {
+
+TEST(BuildDurations, recordAndLookup)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+    auto dbPath(tmpDir / "build-durations.sqlite");
+
+    BuildDurations::Key gcc{.name = "gcc", .system = "x86_64-linux"};
+    BuildDurations::Key gccDarwin{.name = "gcc", .system = "aarch64-darwin"};
+
+    {
+        auto durations = BuildDurations::getTest(dbPath);
+        ASSERT_EQ(durations->lookup(gcc), std::nullopt);
+
+        durations->record(gcc, 1000);
+        ASSERT_EQ(durations->lookup(gcc), 1000);
+        ASSERT_EQ(durations->lookup(gccDarwin), std::nullopt);
+
+        /* Later builds are averaged in. */
+        durations->record(gcc, 2000);
+        ASSERT_EQ(durations->lookup(gcc), 1250);
+    }
+
+    /* The history is persistent. */
+    auto durations = BuildDurations::getTest(dbPath);
+    ASSERT_EQ(durations->lookup(gcc), 1250);
+}
+
+TEST(BuildDurations, keyFromDerivation)
+{
+    BasicDerivation drv;
+    drv.name = "gcc-13.2.0";
+    drv.platform = "x86_64-linux";
+
+    auto key = BuildDurations::Key::fromDerivation(drv);
+    ASSERT_EQ(key.name, "gcc");
+    ASSERT_EQ(key.system, "x86_64-linux");
+
+    drv.env["pname"] = "gcc-wrapper";
+    ASSERT_EQ(BuildDurations::Key::fromDerivation(drv).name, "gcc-wrapper");
+}
+
+} // namespace nix
@@ -90,6 +90,38 @@ INSTANTIATE_TEST_SUITE_P(
                 .cpuUser = std::chrono::seconds(500),
                 .cpuSystem = std::chrono::seconds(604),
             },
+        },
+        std::pair{
+            "success-resources",
+            BuildResult{
+                .inner{BuildResult::Success{
+                    .status = BuildResult::Success::Built,
+                    .builtOutputs{
+                        {
+                            "out",
+                            {
+                                .outPath = StorePath{"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo"},
+                            },
+                        },
+                    },
+                }},
+                .timesBuilt = 1,
+                .startTime = 30,
+                .stopTime = 50,
+                .cpuUser = std::chrono::seconds(15),
+                .cpuSystem = std::chrono::seconds(3),
+                .memoryPeak = 1 << 30,
+                .ioReadBytes = 4096,
+                .ioWriteBytes = 1 << 20,
+                .cpuStall = std::chrono::milliseconds(250),
+                .memoryStall = std::chrono::microseconds(0),
+                .ioStall = std::chrono::milliseconds(1200),
+                .phaseTimes{
+                    {"build", std::chrono::seconds(19)},
+                    {"register", std::chrono::milliseconds(600)},
+                    {"setup", std::chrono::milliseconds(40)},
+                },
+            },
         }));
 
 } // namespace nix
@@ -5,6 +5,8 @@
 
 #include "nix/util/archive.hh"
 #include "nix/util/memory-source-accessor.hh"
+
+#include <thread>
 // Needed for template specialisations. This is not good! When we
 // overhaul how store configs work, this should be fixed.
 #include "nix/util/args.hh"
@@ -229,6 +231,119 @@ INSTANTIATE_TEST_SUITE_P(
         return std::string(printHashAlgo(std::get<HashAlgorithm>(info.param)));
     });
 
+TEST(LocalStore, queryPathInfos)
+{
+    AutoDelete tempStoreDir(canonPath(createTempDir(), /*resolveSymlinks=*/true));
+    auto store = make_ref<LocalStore>(make_ref<LocalStoreConfig>(tempStoreDir.path(), StoreConfig::Params{}));
+
+    auto addText = [&](std::string_view name, std::string_view contents, const StorePathSet & references) {
+        StringSource source{contents};
+        return store->addToStoreFromDump(
+            source,
+            name,
+            FileSerialisationMethod::Flat,
+            ContentAddressMethod::Raw::Text,
+            HashAlgorithm::SHA256,
+            references,
+            NoRepair);
+    };
+
+    auto dep = addText("dep", "dep", {});
+    auto top = addText("top", store->printStorePath(dep), {dep});
+    StorePath invalid{"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-invalid"};
+
+    store->clearPathInfoCache();
+    auto infos = store->queryPathInfos({dep, top, invalid});
+    store->clearPathInfoCache();
+
+    ASSERT_EQ(infos.size(), 2);
+    EXPECT_FALSE(infos.contains(invalid));
+    EXPECT_EQ(*infos.at(dep), *store->queryPathInfo(dep));
+    EXPECT_EQ(*infos.at(top), *store->queryPathInfo(top));
+    EXPECT_EQ(infos.at(top)->references, StorePathSet{dep});
+}
+
+TEST(LocalStore, computeFSClosure)
+{
+    AutoDelete tempStoreDir(canonPath(createTempDir(), /*resolveSymlinks=*/true));
+    auto store = make_ref<LocalStore>(make_ref<LocalStoreConfig>(tempStoreDir.path(), StoreConfig::Params{}));
+
+    auto addText = [&](std::string_view name, std::string_view contents, const StorePathSet & references) {
+        StringSource source{contents};
+        return store->addToStoreFromDump(
+            source,
+            name,
+            FileSerialisationMethod::Flat,
+            ContentAddressMethod::Raw::Text,
+            HashAlgorithm::SHA256,
+            references,
+            NoRepair);
+    };
+
+    auto a = addText("a", "a", {});
+    auto b = addText("b", store->printStorePath(a), {a});
+    auto c = addText("c", store->printStorePath(a), {a});
+    auto d = addText("d", store->printStorePath(b) + store->printStorePath(c), {b, c});
+    StorePath invalid{"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-invalid"};
+
+    for (bool flipDirection : {false, true}) {
+        for (auto & start : {StorePathSet{d}, StorePathSet{a}, StorePathSet{b, c}}) {
+            StorePathSet closure, expected;
+            store->computeFSClosure(start, closure, flipDirection);
+            store->Store::computeFSClosure(start, expected, flipDirection);
+            EXPECT_EQ(closure, expected);
+        }
+    }
+
+    StorePathSet closure;
+    store->computeFSClosure(d, closure);
+    EXPECT_EQ(closure, (StorePathSet{a, b, c, d}));
+
+    /* Paths already in the output are not traversed. */
+    closure = {b};
+    store->computeFSClosure(d, closure);
+    EXPECT_EQ(closure, (StorePathSet{a, b, c, d}));
+
+    EXPECT_THROW(store->computeFSClosure(invalid, closure), InvalidPath);
+}
+
+TEST(LocalStore, pathContentsMatch)
+{
+    AutoDelete tempStoreDir(canonPath(createTempDir(), /*resolveSymlinks=*/true));
+    auto store = make_ref<LocalStore>(make_ref<LocalStoreConfig>(tempStoreDir.path(), StoreConfig::Params{}));
+
+    using namespace std::string_view_literals;
+    StringSource source{"hello"sv};
+    auto path = store->addToStoreFromDump(
+        source,
+        "hello",
+        FileSerialisationMethod::Flat,
+        ContentAddressMethod::Raw::Text,
+        HashAlgorithm::SHA256,
+        {},
+        NoRepair);
+    auto narHash = store->queryPathInfo(path)->narHash;
+    auto realPath = store->toRealPath(path);
+
+    /* Let the change time of the file become old enough for the
+       verified hash to be recorded. */
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+
+    EXPECT_TRUE(store->pathContentsMatch(path, narHash));
+    EXPECT_TRUE(store->pathContentsMatch(path, narHash));
+    EXPECT_FALSE(store->pathContentsMatch(path, hashString(HashAlgorithm::SHA256, "other")));
+
+    /* Changing the contents changes the metadata, so the recorded hash
+       is not used. */
+    chmod(realPath, 0644);
+    writeFile(realPath, "world");
+    chmod(realPath, 0444);
+    EXPECT_FALSE(store->pathContentsMatch(path, narHash));
+
+    deletePath(realPath);
+    EXPECT_FALSE(store->pathContentsMatch(path, narHash));
+}
+
 #endif
 
 } // namespace nix
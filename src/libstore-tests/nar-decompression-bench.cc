@@ -0,0 +1,53 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/util/compression.hh"
+#include "nix/util/serialise.hh"
+
+#include <random>
+
+namespace nix {
+
+static constexpr uint64_t narSize = 2ULL * 1024 * 1024 * 1024;
+
+/**
+ * A 2 GiB NAR compressed the way binary caches compress NARs, i.e. as
+ * independent 16 MiB zstd frames. The contents are random lowercase
+ * letters, which compress to a bit over half their size.
+ */
+static const std::string & getCompressedNar()
+{
+    static const std::string compressed = []() {
+        std::mt19937 urng(0);
+        std::uniform_int_distribution<int> dist('a', 'z');
+        std::string block(64 * 1024 * 1024, 0);
+        for (auto & c : block)
+            c = dist(urng);
+
+        StringSink sink;
+        auto compressionSink = makeCompressionSink(CompressionAlgo::zstd, sink);
+        for (uint64_t n = 0; n < narSize; n += block.size())
+            (*compressionSink)(block);
+        compressionSink->finish();
+        return std::move(sink.s);
+    }();
+    return compressed;
+}
+
+static void BM_ZstdDecompressNar(benchmark::State & state)
+{
+    auto threads = state.range(0);
+    auto & compressed = getCompressedNar();
+
+    for (auto _ : state) {
+        NullSink nullSink;
+        auto sink = makeZstdDecompressionSink(nullSink, threads);
+        (*sink)(compressed);
+        sink->finish();
+    }
+
+    state.SetBytesProcessed(state.iterations() * narSize);
+}
+
+BENCHMARK(BM_ZstdDecompressNar)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+} // namespace nix
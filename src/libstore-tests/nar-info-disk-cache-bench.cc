@@ -0,0 +1,126 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/store/globals.hh"
+#include "nix/store/nar-info-disk-cache.hh"
+#include "nix/store/sqlite.hh"
+#include "nix/util/file-system.hh"
+
+namespace nix {
+
+static constexpr std::string_view cacheUri = "https://cache.example.org";
+
+static const std::string storeDir = "/nix/store";
+
+static constexpr size_t pathCount = 10000;
+
+static constexpr size_t lookupCount = 100000;
+
+static std::vector<std::string> makeHashParts()
+{
+    std::vector<std::string> hashParts;
+    for (size_t i = 0; i < pathCount; ++i)
+        hashParts.push_back(std::string(StorePath::random("bench").hashPart()));
+    return hashParts;
+}
+
+/**
+ * A disk cache database containing `pathCount` NAR infos, shared by all
+ * benchmarks.
+ */
+struct BenchDatabase
+{
+    std::filesystem::path tmpDir = createTempDir();
+    AutoDelete delTmpDir{tmpDir};
+    std::filesystem::path dbPath = tmpDir / "binary-cache.sqlite";
+    std::vector<std::string> hashParts = makeHashParts();
+
+    BenchDatabase()
+    {
+        auto cache = open();
+
+        std::vector<std::pair<std::string, std::shared_ptr<const ValidPathInfo>>> infos;
+        for (auto & hashPart : hashParts) {
+            auto info = std::make_shared<NarInfo>(
+                storeDir,
+                StorePath(hashPart + "-bench"),
+                Hash::parseSRI("sha256-FePFYIlMuycIXPZbWi7LGEiMmZSX9FMbaQenWBzm1Sc="));
+            info->url = "nar/" + hashPart + ".nar.xz";
+            info->narSize = 1234;
+            infos.emplace_back(hashPart, info);
+        }
+        cache->upsertNarInfos(std::string(cacheUri), infos);
+    }
+
+    ref<NarInfoDiskCache> open()
+    {
+        auto cache =
+            NarInfoDiskCache::getTest(settings.getNarInfoDiskCacheSettings(), {.useWAL = settings.useSQLiteWAL}, dbPath);
+        cache->createCache(std::string(cacheUri), storeDir, {});
+        return cache;
+    }
+};
+
+static BenchDatabase & getBenchDatabase()
+{
+    static BenchDatabase db;
+    return db;
+}
+
+/**
+ * `lookupCount` lookups per iteration, spread over the benchmark's
+ * threads, against a cache object that all threads share.
+ */
+static void BM_NarInfoDiskCacheLookup(benchmark::State & state)
+{
+    auto & db = getBenchDatabase();
+    static std::shared_ptr<NarInfoDiskCache> cache;
+    if (state.thread_index() == 0)
+        cache = db.open();
+
+    auto perThread = lookupCount / state.threads();
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < perThread; ++i) {
+            auto & hashPart = db.hashParts[(i * state.threads() + state.thread_index()) % db.hashParts.size()];
+            auto res = cache->lookupNarInfo(std::string(cacheUri), hashPart);
+            benchmark::DoNotOptimize(res);
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * perThread);
+}
+
+BENCHMARK(BM_NarInfoDiskCacheLookup)->Threads(1)->Threads(16)->UseRealTime();
+
+/**
+ * Looking up every path with a fresh cache object, as a new process
+ * would, one path at a time or in one batch.
+ */
+static void BM_NarInfoDiskCacheColdLookup(benchmark::State & state)
+{
+    auto & db = getBenchDatabase();
+    bool batched = state.range(0);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto cache = db.open();
+        state.ResumeTiming();
+
+        if (batched) {
+            auto res = cache->lookupNarInfos(
+                std::string(cacheUri), std::set<std::string>(db.hashParts.begin(), db.hashParts.end()));
+            benchmark::DoNotOptimize(res);
+        } else {
+            for (auto & hashPart : db.hashParts) {
+                auto res = cache->lookupNarInfo(std::string(cacheUri), hashPart);
+                benchmark::DoNotOptimize(res);
+            }
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * db.hashParts.size());
+}
+
+BENCHMARK(BM_NarInfoDiskCacheColdLookup)->Arg(0)->Arg(1);
+
+} // namespace nix
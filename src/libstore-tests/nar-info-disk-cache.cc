@@ -126,4 +126,64 @@ TEST(NarInfoDiskCacheImpl, create_and_read)
     }
 }
 
+TEST(NarInfoDiskCacheImpl, batch_lookup_and_upsert)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+    auto dbPath(tmpDir / "test-narinfo-disk-cache.sqlite");
+
+    auto storeDir = "/nix/store";
+    auto uri = "http://foo";
+
+    StorePath present{"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-present"};
+    StorePath absent{"h1w7hy3qh1w7hy3qh1w7hy3qh1w7hy3q-absent"};
+    StorePath unknown{"i1w7hy3qi1w7hy3qi1w7hy3qi1w7hy3q-unknown"};
+
+    auto info = std::make_shared<NarInfo>(
+        storeDir, present, Hash::parseSRI("sha256-FePFYIlMuycIXPZbWi7LGEiMmZSX9FMbaQenWBzm1Sc="));
+    info->url = "nar/foo.nar.xz";
+    info->compression = CompressionAlgo::xz;
+    info->narSize = 1234;
+
+    {
+        auto cache = NarInfoDiskCache::getTest(
+            settings.getNarInfoDiskCacheSettings(), {.useWAL = settings.useSQLiteWAL}, dbPath);
+        cache->createCache(uri, storeDir, {});
+
+        cache->upsertNarInfos(
+            uri,
+            {
+                {std::string(present.hashPart()), info},
+                {std::string(absent.hashPart()), nullptr},
+            });
+
+        auto res = cache->lookupNarInfos(
+            uri,
+            {std::string(present.hashPart()), std::string(absent.hashPart()), std::string(unknown.hashPart())});
+        ASSERT_EQ(res.size(), 3);
+        ASSERT_EQ(res[std::string(present.hashPart())].first, NarInfoDiskCache::oValid);
+        ASSERT_EQ(res[std::string(present.hashPart())].second->url, info->url);
+        ASSERT_EQ(res[std::string(absent.hashPart())].first, NarInfoDiskCache::oInvalid);
+        ASSERT_EQ(res[std::string(unknown.hashPart())].first, NarInfoDiskCache::oUnknown);
+    }
+
+    // A new cache object has to go to the database.
+    {
+        auto cache = NarInfoDiskCache::getTest(
+            settings.getNarInfoDiskCacheSettings(), {.useWAL = settings.useSQLiteWAL}, dbPath);
+        cache->createCache(uri, storeDir, {});
+
+        auto res = cache->lookupNarInfos(uri, {std::string(present.hashPart()), std::string(absent.hashPart())});
+        ASSERT_EQ(res[std::string(present.hashPart())].first, NarInfoDiskCache::oValid);
+        ASSERT_EQ(res[std::string(present.hashPart())].second->path, present);
+        ASSERT_EQ(res[std::string(present.hashPart())].second->narSize, 1234);
+        ASSERT_EQ(res[std::string(present.hashPart())].second->narHash, info->narHash);
+        ASSERT_EQ(res[std::string(absent.hashPart())].first, NarInfoDiskCache::oInvalid);
+
+        auto single = cache->lookupNarInfo(uri, std::string(present.hashPart()));
+        ASSERT_EQ(single.first, NarInfoDiskCache::oValid);
+        ASSERT_EQ(single.second->url, info->url);
+    }
+}
+
 } // namespace nix
@@ -82,6 +82,16 @@ static NarInfo makeNarInfo(const Store & store, bool includeImpureInfo)
     return info;
 }
 
+static NarDelta makeNarDelta()
+{
+    return {
+        .base = StorePath{"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo"},
+        .baseNarHash = Hash::parseSRI("sha256-FePFYIlMuycIXPZbWi7LGEiMmZSX9FMbaQenWBzm1Sc="),
+        .url = "nar/1w1fff338fvdw53sqgamddn1b2xgds473pv6y13gizdbqjv4i5p3.delta",
+        .fileSize = 1234,
+    };
+}
+
 #define JSON_READ_TEST_V1(STEM, PURE)                              \
     TEST_F(NarInfoTestV1, NarInfo_##STEM##_from_json)              \
     {                                                              \
@@ -169,6 +179,56 @@ JSON_TEST_V2(impure, true)
 JSON_TEST_V3(pure, false)
 JSON_TEST_V3(impure, true)
 
+TEST_F(NarInfoTestV3, NarInfo_impure_deltas_from_json)
+{
+    readTest("impure_deltas", [&](const auto & encoded_) {
+        auto encoded = json::parse(encoded_);
+        auto expected = makeNarInfo(*store, true);
+        expected.deltas.push_back(makeNarDelta());
+        auto got = UnkeyedNarInfo::fromJSON(nullptr, encoded);
+        ASSERT_EQ(got, expected);
+    });
+}
+
+TEST_F(NarInfoTestV3, NarInfo_impure_deltas_to_json)
+{
+    writeTest(
+        "impure_deltas",
+        [&]() -> json {
+            auto info = makeNarInfo(*store, true);
+            info.deltas.push_back(makeNarDelta());
+            return info.toJSON(nullptr, true, PathInfoJsonFormat::V3);
+        },
+        [](const auto & file) { return json::parse(readFile(file)); },
+        [](const auto & file, const auto & got) { return writeFile(file, got.dump(2) + "\n"); });
+}
+
+class NarInfoTest : public LibStoreTest
+{};
+
+TEST_F(NarInfoTest, deltasRoundTrip)
+{
+    auto info = makeNarInfo(*store, true);
+    info.deltas.push_back(makeNarDelta());
+
+    auto s = info.to_string(*store);
+    ASSERT_NE(
+        s.find("Delta: g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo "
+               "sha256:09ymwqf5i9q7d4dm7x4pjjcqqj0qrcp5lnznbh42gfsci5hcbqqm "
+               "nar/1w1fff338fvdw53sqgamddn1b2xgds473pv6y13gizdbqjv4i5p3.delta 1234\n"),
+        std::string::npos);
+
+    NarInfo info2(*store, s, "test");
+    ASSERT_EQ(info2.deltas, info.deltas);
+
+    for (auto format : {PathInfoJsonFormat::V1, PathInfoJsonFormat::V2}) {
+        auto json = info.toJSON(&*store, true, format);
+        ASSERT_EQ(json.at("deltas").size(), 1);
+        ASSERT_EQ(json.at("deltas").at(0).at("downloadSize"), 1234);
+        ASSERT_EQ(UnkeyedNarInfo::fromJSON(&*store, json).deltas, info.deltas);
+    }
+}
+
 #undef JSON_TEST_V1
 #undef JSON_READ_TEST_V1
 #undef JSON_WRITE_TEST_V1
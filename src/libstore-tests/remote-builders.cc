@@ -0,0 +1,66 @@
+#include "nix/store/build/remote-builders.hh"
+
+#include <gtest/gtest.h>
+
+namespace nix {
+
+static RemoteBuilders makeRemoteBuilders()
+{
+    return RemoteBuilders(
+        Machine::parseConfig(
+            {"x86_64-linux"},
+            "ssh://cold x86_64-linux - 2 1 big-parallel\n"
+            "ssh://warm x86_64-linux - 2 1\n"
+            "ssh://aarch x86_64-linux,aarch64-linux - 1 1"));
+}
+
+TEST(RemoteBuilders, selectsByFeatures)
+{
+    auto builders = makeRemoteBuilders();
+    bool rightType;
+
+    auto host = builders.select("x86_64-linux", {"big-parallel"}, {}, 60, rightType);
+    ASSERT_TRUE(rightType);
+    ASSERT_EQ(host, builders.hosts[0].get());
+
+    ASSERT_EQ(builders.select("riscv64-linux", {}, {}, 60, rightType), nullptr);
+    ASSERT_FALSE(rightType);
+}
+
+TEST(RemoteBuilders, prefersLeastLoaded)
+{
+    auto builders = makeRemoteBuilders();
+    bool rightType;
+
+    builders.hosts[0]->running = 1;
+    builders.hosts[2]->running = 1;
+    ASSERT_EQ(builders.select("x86_64-linux", {}, {}, 60, rightType), builders.hosts[1].get());
+
+    /* Machines without a free slot are never selected. */
+    builders.hosts[1]->running = 2;
+    builders.hosts[0]->running = 2;
+    ASSERT_EQ(builders.select("x86_64-linux", {}, {}, 60, rightType), nullptr);
+    ASSERT_TRUE(rightType);
+}
+
+TEST(RemoteBuilders, prefersMachineWithInputs)
+{
+    auto builders = makeRemoteBuilders();
+    bool rightType;
+
+    StorePath toolchain{"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-toolchain"};
+    std::map<StorePath, uint64_t> inputs{{toolchain, 4ULL << 30}};
+
+    builders.hosts[1]->addKnownPaths({toolchain});
+
+    /* Even though the machine with the inputs is busier, copying the
+       inputs elsewhere would take longer. */
+    builders.hosts[1]->running = 1;
+    ASSERT_EQ(builders.select("x86_64-linux", {}, inputs, 60, rightType), builders.hosts[1].get());
+
+    /* But not for tiny inputs. */
+    inputs[toolchain] = 1024;
+    ASSERT_EQ(builders.select("x86_64-linux", {}, inputs, 60, rightType), builders.hosts[0].get());
+}
+
+} // namespace nix
@@ -0,0 +1,128 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/store/build.hh"
+#include "nix/store/derivations.hh"
+#include "nix/store/globals.hh"
+#include "nix/store/store-open.hh"
+#include "nix/util/config-global.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/users.hh"
+
+#ifdef __linux__
+
+namespace nix {
+
+/**
+ * Build a trivial derivation with `inputCount` inputs in `store`, and
+ * then rebuild it once per iteration of `state`. Almost all of the
+ * time is spent setting up and tearing down the sandbox.
+ */
+static void rebuildTrivialDerivation(benchmark::State & state, Store & store, int inputCount)
+{
+    auto srcDir = createTempDir();
+    AutoDelete delSrcDir(srcDir, true);
+    writeFile(srcDir / "file", "");
+
+    Derivation drv{
+        .outputs = {{"out", DerivationOutput{DerivationOutput::Deferred{}}}},
+        .platform = settings.thisSystem,
+        .builder = "/bin/sh",
+        .args = {"-c", "echo > $out"},
+        .env = {{"out", ""}},
+        .name = "sandbox-setup-bench",
+    };
+
+    for (int i = 0; i < inputCount; ++i)
+        drv.inputs.insert(
+            SingleDerivedPath::Opaque{store.addToStore(fmt("input-%d", i), SourcePath{makeFSSourceAccessor(srcDir)})});
+
+    fillInOutputPaths(drv, store);
+    auto drvPath = store.writeDerivation(drv);
+
+    std::vector<DerivedPath> paths{DerivedPath::Built{
+        .drvPath = makeConstantStorePathRef(drvPath),
+        .outputs = OutputsSpec::All{},
+    }};
+
+    auto builder = store.getBuilder();
+    builder->buildPaths(paths);
+
+    for (auto _ : state)
+        builder->buildPaths(paths, bmCheck);
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+/**
+ * Rebuild a trivial derivation with `range(0)` inputs in the sandbox,
+ * with (`range(1) == 1`) or without the store view.
+ *
+ * This needs to run as root.
+ */
+static void BM_SandboxSetup(benchmark::State & state)
+{
+    const int inputCount = state.range(0);
+    const bool storeView = state.range(1);
+
+    if (!isRootUser()) {
+        state.SkipWithError("sandbox benchmarks need to run as root");
+        return;
+    }
+
+    globalConfig.set("sandbox", "true");
+    globalConfig.set("sandbox-fallback", "false");
+    globalConfig.set("build-users-group", "");
+    globalConfig.set("sandbox-store-view", storeView ? "true" : "false");
+
+    auto tmpRoot = createTempDir();
+    AutoDelete delTmpRoot(tmpRoot, true);
+
+    auto store = openStore(fmt("local?root=%s", tmpRoot.string()));
+
+    rebuildTrivialDerivation(state, *store, inputCount);
+}
+
+BENCHMARK(BM_SandboxSetup)
+    ->ArgsProduct({{10, 1000, 3000}, {0, 1}})
+    ->ArgNames({"inputs", "store-view"})
+    ->Unit(benchmark::kMillisecond);
+
+/**
+ * Rebuild a derivation without inputs in the sandbox, with
+ * (`range(0) == 1`) or without reusing the network namespace of the
+ * build user. The network namespace is only reused for builds that
+ * have a build user, so this uses automatically allocated UIDs.
+ *
+ * This needs to run as root.
+ */
+static void BM_SandboxNamespacePool(benchmark::State & state)
+{
+    const bool namespacePool = state.range(0);
+
+    if (!isRootUser()) {
+        state.SkipWithError("sandbox benchmarks need to run as root");
+        return;
+    }
+
+    globalConfig.set("extra-experimental-features", "auto-allocate-uids");
+    globalConfig.set("sandbox", "true");
+    globalConfig.set("sandbox-fallback", "false");
+    globalConfig.set("auto-allocate-uids", "true");
+    globalConfig.set("sandbox-store-view", "false");
+    globalConfig.set("sandbox-namespace-pool", namespacePool ? "true" : "false");
+
+    auto tmpRoot = createTempDir();
+    AutoDelete delTmpRoot(tmpRoot, true);
+
+    auto store = openStore(fmt("local?root=%s", tmpRoot.string()));
+
+    rebuildTrivialDerivation(state, *store, 0);
+
+    globalConfig.set("auto-allocate-uids", "false");
+}
+
+BENCHMARK(BM_SandboxNamespacePool)->Arg(0)->Arg(1)->ArgName("namespace-pool")->Unit(benchmark::kMillisecond);
+
+} // namespace nix
+
+#endif
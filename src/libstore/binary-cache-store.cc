@@ -10,11 +10,15 @@
 #include "nix/util/nar-accessor.hh"
 #include "nix/util/thread-pool.hh"
 #include "nix/util/callback.hh"
+#include "nix/util/chunking.hh"
 #include "nix/util/signals.hh"
 #include "nix/util/archive.hh"
 #include "nix/util/util.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/file-descriptor.hh"
 
 #include <chrono>
+#include <deque>
 #include <future>
 #include <array>
 #include <regex>
@@ -27,6 +31,56 @@ namespace nix {
 
 void BinaryCacheStoreConfig::anchor() {}
 
+/**
+ * The suffix of the chunk manifests that replace NARs in binary caches
+ * with `nar-chunking` enabled.
+ */
+static constexpr std::string_view chunkManifestExtension = ".chunks";
+
+static std::string compressionExtension(CompressionAlgo compression)
+{
+    return compression == CompressionAlgo::xz       ? ".xz"
+           : compression == CompressionAlgo::bzip2  ? ".bz2"
+           : compression == CompressionAlgo::zstd   ? ".zst"
+           : compression == CompressionAlgo::lzip   ? ".lzip"
+           : compression == CompressionAlgo::lz4    ? ".lz4"
+           : compression == CompressionAlgo::brotli ? ".br"
+                                                    : "";
+}
+
+namespace {
+
+/**
+ * A sink that skips the first `skip` bytes written to it, passes on
+ * the next `left` bytes to `next`, and discards the rest.
+ */
+struct SliceSink : Sink
+{
+    Sink & next;
+    uint64_t skip;
+    uint64_t left;
+
+    SliceSink(Sink & next, uint64_t skip, uint64_t left)
+        : next(next)
+        , skip(skip)
+        , left(left)
+    {
+    }
+
+    void operator()(std::string_view data) override
+    {
+        auto n = std::min<uint64_t>(skip, data.size());
+        data.remove_prefix(n);
+        skip -= n;
+        n = std::min<uint64_t>(left, data.size());
+        if (n)
+            next(data.substr(0, n));
+        left -= n;
+    }
+};
+
+} // namespace
+
 void BinaryCacheStore::anchor() {}
 
 void NoSuchBinaryCacheFile::anchor() {}
@@ -144,6 +198,14 @@ void BinaryCacheStore::writeNarInfo(ref<NarInfo> narInfo)
             std::shared_ptr<NarInfo>(narInfo));
 }
 
+void BinaryCacheStore::getFileRange(const std::string & path, uint64_t offset, uint64_t length, Sink & sink)
+{
+    SliceSink slice{sink, offset, length};
+    getFile(path, slice);
+    if (slice.left)
+        throw Error("file '%s' in binary cache '%s' is too short", path, config.getHumanReadableURI());
+}
+
 ref<NarInfo> BinaryCacheStore::uploadData(Source & narSource, RepairFlag repair, fun<ValidPathInfo(HashResult)> mkInfo)
 {
     auto fdTemp = createAnonymousTempFile();
@@ -156,14 +218,79 @@ ref<NarInfo> BinaryCacheStore::uploadData(Source & narSource, RepairFlag repair,
     HashSink fileHashSink{HashAlgorithm::SHA256};
     std::shared_ptr<NarAccessor> narAccessor;
     HashSink narHashSink{HashAlgorithm::SHA256};
-    {
+
+    /* Keep the NAR in memory if we may need to create a delta against
+       it, unless it turns out to be too big. */
+    std::optional<std::string> nar;
+    if (config.writeNarDeltas && !config.narChunking)
+        nar.emplace();
+    LambdaSink narCaptureSink([&](std::string_view data) {
+        if (!nar)
+            return;
+        if (nar->size() + data.size() > config.narDeltaMaxSize)
+            nar.reset();
+        else
+            nar->append(data);
+    });
+    TeeSink narSink{narHashSink, narCaptureSink};
+
+    size_t nrChunks = 0;
+    if (config.narChunking) {
+        /* Upload the NAR as content-addressed chunks, and write a
+           manifest listing them in place of the compressed NAR. Chunks
+           that the binary cache already has (e.g. from a previous
+           version of this path) are not uploaded again. */
+        FdSink fileSink(fdTemp.get());
+        TeeSink teeSinkManifest{fileSink, fileHashSink};
+
+        auto chunks = nlohmann::json::array();
+        std::vector<std::pair<std::string, std::string>> batch;
+
+        auto uploadBatch = [&]() {
+            ThreadPool threadPool(16);
+            for (auto & [path, chunk] : batch)
+                threadPool.enqueue([&]() {
+                    checkInterrupt();
+                    if (!repair && fileExists(path))
+                        return;
+                    upsertFile(
+                        path,
+                        compress(config.compression, chunk, false, config.compressionLevel),
+                        "application/octet-stream");
+                });
+            threadPool.process();
+            batch.clear();
+        };
+
+        ChunkingSink chunkingSink([&](std::string_view chunk) {
+            auto hash = hashString(HashAlgorithm::SHA256, chunk);
+            chunks.push_back({hash.to_string(HashFormat::Nix32, false), chunk.size()});
+            batch.emplace_back(chunkPath(hash), chunk);
+            if (batch.size() >= 16)
+                uploadBatch();
+        });
+
+        TeeSink teeSinkUncompressed{chunkingSink, narSink};
+        TeeSource teeSource{narSource, teeSinkUncompressed};
+        narAccessor = makeNarAccessor(parseNarListing(teeSource));
+        chunkingSink.finish();
+        uploadBatch();
+
+        nrChunks = chunks.size();
+        nlohmann::json manifest = {
+            {"version", 1},
+            {"chunks", std::move(chunks)},
+        };
+        teeSinkManifest(manifest.dump());
+        fileSink.flush();
+    } else {
         FdSink fileSink(fdTemp.get());
         TeeSink teeSinkCompressed{fileSink, fileHashSink};
         bool parallel = config.parallelCompression.overridden ? config.parallelCompression.get()
                                                               : config.compression.get() == CompressionAlgo::zstd;
         auto compressionSink =
             makeCompressionSink(config.compression, teeSinkCompressed, parallel, config.compressionLevel);
-        TeeSink teeSinkUncompressed{*compressionSink, narHashSink};
+        TeeSink teeSinkUncompressed{*compressionSink, narSink};
         TeeSource teeSource{narSource, teeSinkUncompressed};
         narAccessor = makeNarAccessor(parseNarListing(teeSource));
         compressionSink->finish();
@@ -178,23 +305,26 @@ ref<NarInfo> BinaryCacheStore::uploadData(Source & narSource, RepairFlag repair,
     auto [fileHash, fileSize] = fileHashSink.finish();
     narInfo->fileHash = fileHash;
     narInfo->fileSize = fileSize;
-    narInfo->url = "nar/" + narInfo->fileHash->to_string(HashFormat::Nix32, false) + ".nar"
-                   + (config.compression == CompressionAlgo::xz       ? ".xz"
-                      : config.compression == CompressionAlgo::bzip2  ? ".bz2"
-                      : config.compression == CompressionAlgo::zstd   ? ".zst"
-                      : config.compression == CompressionAlgo::lzip   ? ".lzip"
-                      : config.compression == CompressionAlgo::lz4    ? ".lz4"
-                      : config.compression == CompressionAlgo::brotli ? ".br"
-                                                                      : "");
+    narInfo->url = "nar/" + narInfo->fileHash->to_string(HashFormat::Nix32, false)
+                   + (config.narChunking ? chunkManifestExtension : ".nar" + compressionExtension(config.compression));
 
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now2 - now1).count();
-    printMsg(
-        lvlTalkative,
-        "copying path '%1%' (%2% bytes, compressed %3$.1f%% in %4% ms) to binary cache",
-        printStorePath(narInfo->path),
-        info.narSize,
-        ((1.0 - (double) fileSize / info.narSize) * 100.0),
-        duration);
+    if (config.narChunking)
+        printMsg(
+            lvlTalkative,
+            "copying path '%1%' (%2% bytes, %3% chunks in %4% ms) to binary cache",
+            printStorePath(narInfo->path),
+            info.narSize,
+            nrChunks,
+            duration);
+    else
+        printMsg(
+            lvlTalkative,
+            "copying path '%1%' (%2% bytes, compressed %3$.1f%% in %4% ms) to binary cache",
+            printStorePath(narInfo->path),
+            info.narSize,
+            ((1.0 - (double) fileSize / info.narSize) * 100.0),
+            duration);
 
     /* Optionally write a JSON file containing a listing of the
        contents of the NAR. */
@@ -207,6 +337,27 @@ ref<NarInfo> BinaryCacheStore::uploadData(Source & narSource, RepairFlag repair,
         upsertFile(std::string(info.path.hashPart()) + ".ls", j.dump(), "application/json");
     }
 
+    /* Optionally write an index of the zstd frames in the compressed
+       NAR. Since frames can be decompressed independently, this
+       allows reading parts of the NAR without fetching all of it. */
+    if (config.writeNARFrameIndex && config.compression == CompressionAlgo::zstd && !config.narChunking) {
+        FdSource source{fdTemp.get()};
+        source.restart();
+        if (auto frames = listZstdFrames(source)) {
+            auto jframes = nlohmann::json::array();
+            for (auto & frame : *frames)
+                jframes.push_back({frame.contentOffset, frame.compressedOffset});
+
+            nlohmann::json j = {
+                {"version", 1},
+                {"fileSize", fileSize},
+                {"frames", std::move(jframes)},
+            };
+
+            upsertFile(std::string(info.path.hashPart()) + ".frames", j.dump(), "application/json");
+        }
+    }
+
     /* Optionally maintain an index of DWARF debug info files
        consisting of JSON files named 'debuginfo/<build-id>' that
        specify the NAR file and member containing the debug info. */
@@ -263,11 +414,18 @@ ref<NarInfo> BinaryCacheStore::uploadData(Source & narSource, RepairFlag repair,
         }
     }
 
-    /* Atomically write the NAR file. */
+    if (nar)
+        addNarDelta(*narInfo, *nar);
+
+    /* Atomically write the NAR file (or the chunk manifest). */
     if (repair || !fileExists(narInfo->url)) {
         FdSource source{fdTemp.get()};
         source.restart(); /* Seek back to the start of the file. */
-        upsertFile(narInfo->url, source, "application/x-nix-nar", narInfo->fileSize);
+        upsertFile(
+            narInfo->url,
+            source,
+            config.narChunking ? "application/json" : "application/x-nix-nar",
+            narInfo->fileSize);
     }
 
     return narInfo;
@@ -292,6 +450,57 @@ void BinaryCacheStore::uploadNarInfo(ref<NarInfo> narInfo)
 
     /* Atomically write the NAR info file.*/
     writeNarInfo(narInfo);
+
+    /* Make this the base of deltas for future versions of this path. */
+    if (config.writeNarDeltas)
+        upsertFile(deltaIndexFileFor(narInfo->path.name()), std::string(narInfo->path.to_string()), "text/plain");
+}
+
+std::string BinaryCacheStore::deltaIndexFileFor(std::string_view name)
+{
+    return "nar-deltas/" + hashString(HashAlgorithm::SHA256, name).to_string(HashFormat::Nix32, false);
+}
+
+void BinaryCacheStore::addNarDelta(NarInfo & narInfo, std::string_view nar)
+{
+    auto base = getFile(deltaIndexFileFor(narInfo.path.name()));
+    if (!base)
+        return;
+
+    try {
+        StorePath basePath(trim(*base));
+        if (basePath == narInfo.path)
+            return;
+
+        auto baseInfo = queryPathInfo(basePath);
+        if (baseInfo->narSize > config.narDeltaMaxSize)
+            return;
+
+        StringSink baseNar;
+        narFromPath(basePath, baseNar);
+
+        auto delta = makeZstdDelta(baseNar.s, nar, config.compressionLevel);
+        if (delta.size() >= narInfo.fileSize)
+            return;
+
+        NarDelta narDelta{
+            .base = basePath,
+            .baseNarHash = baseInfo->narHash,
+            .url = "nar/" + hashString(HashAlgorithm::SHA256, delta).to_string(HashFormat::Nix32, false) + ".delta",
+            .fileSize = delta.size(),
+        };
+
+        debug(
+            "created a delta of %d bytes from '%s' to '%s'",
+            narDelta.fileSize,
+            printStorePath(basePath),
+            printStorePath(narInfo.path));
+
+        upsertFile(narDelta.url, std::move(delta), "application/octet-stream");
+        narInfo.deltas.push_back(std::move(narDelta));
+    } catch (Error & e) {
+        warn("unable to create a delta for '%s': %s", printStorePath(narInfo.path), e.info().msg);
+    }
 }
 
 ref<const ValidPathInfo> BinaryCacheStore::addToStoreCommon(
@@ -542,10 +751,252 @@ std::optional<StorePath> BinaryCacheStore::queryPathFromHashPart(const std::stri
     }
 }
 
+std::string BinaryCacheStore::chunkPath(const Hash & hash)
+{
+    return "chunks/" + hash.to_string(HashFormat::Nix32, false) + compressionExtension(config.compression);
+}
+
+void BinaryCacheStore::narFromChunks(const NarInfo & info, Sink & sink)
+{
+    auto manifest = getFile(info.url);
+    if (!manifest)
+        throw SubstituteGone(
+            "chunk manifest '%s' does not exist in binary cache '%s'", info.url, config.getHumanReadableURI());
+
+    struct Chunk
+    {
+        Hash hash;
+        uint64_t size;
+    };
+
+    std::vector<Chunk> chunks;
+    auto json = nlohmann::json::parse(*manifest);
+    if (json.at("version") != 1)
+        throw Error("chunk manifest '%s' has an unsupported version", info.url);
+    for (auto & chunk : json.at("chunks"))
+        chunks.push_back({
+            .hash = Hash::parseNonSRIUnprefixed(chunk.at(0).get<std::string>(), HashAlgorithm::SHA256),
+            .size = chunk.at(1).get<uint64_t>(),
+        });
+
+    auto compression = info.compression.value_or(CompressionAlgo::none);
+
+    auto cacheDir = config.localChunkCache.get();
+    if (cacheDir)
+        createDirs(*cacheDir);
+
+    auto cachePath = [&](const Hash & hash) { return *cacheDir / hash.to_string(HashFormat::Nix32, false); };
+
+    auto isChunk = [](const Chunk & chunk, std::string_view data) {
+        return data.size() == chunk.size && hashString(HashAlgorithm::SHA256, data) == chunk.hash;
+    };
+
+    /* A chunk that is either in the local chunk cache, or being
+       downloaded. */
+    struct Pending
+    {
+        const Chunk & chunk;
+        std::optional<std::string> cached;
+        std::future<std::optional<std::string>> download;
+    };
+
+    /* Keep a few downloads in flight to hide latency. */
+    constexpr size_t maxInFlight = 16;
+    std::deque<Pending> inFlight;
+    size_t next = 0;
+
+    auto start = [&](const Chunk & chunk) {
+        Pending pending{.chunk = chunk};
+
+        if (cacheDir) {
+            try {
+                pending.cached = readFile(cachePath(chunk.hash));
+                if (!isChunk(chunk, *pending.cached))
+                    pending.cached.reset();
+                else {
+                    /* Record the access for trimChunkCache(). */
+                    std::error_code ec;
+                    std::filesystem::last_write_time(
+                        cachePath(chunk.hash), std::filesystem::file_time_type::clock::now(), ec);
+                }
+            } catch (SystemError &) {
+            }
+        }
+
+        if (!pending.cached) {
+            auto promise = std::make_shared<std::promise<std::optional<std::string>>>();
+            pending.download = promise->get_future();
+            getFile(chunkPath(chunk.hash), {[promise](std::future<std::optional<std::string>> result) {
+                        try {
+                            promise->set_value(result.get());
+                        } catch (...) {
+                            promise->set_exception(std::current_exception());
+                        }
+                    }});
+        }
+
+        inFlight.push_back(std::move(pending));
+    };
+
+    uint64_t downloaded = 0;
+    bool addedToCache = false;
+
+    while (next < chunks.size() || !inFlight.empty()) {
+        while (next < chunks.size() && inFlight.size() < maxInFlight)
+            start(chunks[next++]);
+
+        auto pending = std::move(inFlight.front());
+        inFlight.pop_front();
+
+        std::string data;
+        if (pending.cached)
+            data = std::move(*pending.cached);
+        else {
+            auto compressed = pending.download.get();
+            if (!compressed)
+                throw SubstituteGone(
+                    "chunk '%s' of '%s' does not exist in binary cache '%s'",
+                    chunkPath(pending.chunk.hash),
+                    printStorePath(info.path),
+                    config.getHumanReadableURI());
+            downloaded += compressed->size();
+            data = decompress(compression, *compressed);
+            if (!isChunk(pending.chunk, data))
+                throw Error(
+                    "chunk '%s' of '%s' in binary cache '%s' is corrupt",
+                    chunkPath(pending.chunk.hash),
+                    printStorePath(info.path),
+                    config.getHumanReadableURI());
+
+            if (cacheDir) {
+                try {
+                    static std::atomic<int> counter{0};
+                    auto path = cachePath(pending.chunk.hash);
+                    auto tmp = path;
+                    tmp += fmt(".tmp.%d.%d", getpid(), ++counter);
+                    writeFile(tmp, data);
+                    std::filesystem::rename(tmp, path);
+                    addedToCache = true;
+                } catch (...) {
+                    ignoreExceptionExceptInterrupt();
+                }
+            }
+        }
+
+        sink(data);
+    }
+
+    debug(
+        "fetched '%s' from %d chunks, downloading %d bytes", printStorePath(info.path), chunks.size(), downloaded);
+
+    if (addedToCache) {
+        try {
+            trimChunkCache();
+        } catch (...) {
+            ignoreExceptionExceptInterrupt();
+        }
+    }
+}
+
+void BinaryCacheStore::trimChunkCache()
+{
+    auto cacheDir = config.localChunkCache.get();
+    uint64_t maxSize = config.localChunkCacheSize;
+    if (!cacheDir || !maxSize)
+        return;
+
+    std::vector<std::tuple<std::filesystem::file_time_type, uint64_t, std::filesystem::path>> files;
+    uint64_t totalSize = 0;
+
+    for (auto & entry : DirectoryIterator{*cacheDir}) {
+        checkInterrupt();
+        std::error_code ec;
+        auto size = entry.file_size(ec);
+        auto time = ec ? std::filesystem::file_time_type{} : entry.last_write_time(ec);
+        if (ec)
+            continue;
+        totalSize += size;
+        files.emplace_back(time, size, entry.path());
+    }
+
+    if (totalSize <= maxSize)
+        return;
+
+    /* Evict the least recently used chunks first. Chunks that are
+       being written by other processes have a recent time and a
+       temporary name, so they are unlikely to be deleted. */
+    std::sort(files.begin(), files.end());
+
+    for (auto & [time, size, path] : files) {
+        if (totalSize <= maxSize)
+            break;
+        debug("evicting chunk %s from the chunk cache", PathFmt(path));
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+        totalSize -= size;
+    }
+}
+
+void BinaryCacheStore::narFromPathWithBase(const StorePath & storePath, Store & baseStore, Sink & sink)
+{
+    auto info = queryPathInfo(storePath).cast<const NarInfo>();
+
+    if (config.useNarDeltas && info->narSize <= config.narDeltaMaxSize)
+        for (auto & delta : info->deltas) {
+            std::string nar;
+
+            try {
+                if (!baseStore.isValidPath(delta.base))
+                    continue;
+
+                /* Input-addressed paths can have different contents on
+                   different machines, so check that ours is the one
+                   the delta was made against. */
+                auto baseInfo = baseStore.queryPathInfo(delta.base);
+                if (baseInfo->narHash != delta.baseNarHash || baseInfo->narSize > config.narDeltaMaxSize)
+                    continue;
+
+                auto data = getFile(delta.url);
+                if (!data)
+                    throw SubstituteGone(
+                        "delta '%s' does not exist in binary cache '%s'", delta.url, config.getHumanReadableURI());
+
+                StringSink baseNar;
+                baseStore.narFromPath(delta.base, baseNar);
+
+                nar = applyZstdDelta(baseNar.s, *data, info->narSize);
+
+                if (hashString(HashAlgorithm::SHA256, nar) != info->narHash)
+                    throw Error("NAR reconstructed from delta '%s' has an incorrect hash", delta.url);
+
+                debug(
+                    "fetched '%s' as a delta of %d bytes against '%s'",
+                    printStorePath(storePath),
+                    data->size(),
+                    baseStore.printStorePath(delta.base));
+            } catch (Error & e) {
+                warn(
+                    "unable to substitute '%s' using a delta against '%s', fetching the full NAR: %s",
+                    printStorePath(storePath),
+                    baseStore.printStorePath(delta.base),
+                    e.info().msg);
+                continue;
+            }
+
+            sink(nar);
+            return;
+        }
+
+    narFromPath(storePath, sink);
+}
+
 void BinaryCacheStore::narFromPath(const StorePath & storePath, Sink & sink)
 {
     auto info = queryPathInfo(storePath).cast<const NarInfo>();
 
+    if (hasSuffix(info->url, chunkManifestExtension))
+        return narFromChunks(*info, sink);
+
     /* makeDecompressionSink used to treat empty strings as "none". It seems
        impossible that it would actually end up here with an empty string though
        (since an empty `Compression: ' is treated as bzip2 when parsed from a
@@ -563,6 +1014,35 @@ void BinaryCacheStore::narFromPath(const StorePath & storePath, Sink & sink)
     decompressor->finish();
 }
 
+fun<void(Sink &)> BinaryCacheStore::fetchNar(const StorePath & storePath, Store & baseStore)
+{
+    auto info = queryPathInfo(storePath).cast<const NarInfo>();
+
+    /* Chunked NARs and deltas are reassembled while fetching them. */
+    if (hasSuffix(info->url, chunkManifestExtension)
+        || (config.useNarDeltas && info->narSize <= config.narDeltaMaxSize && !info->deltas.empty()))
+        return Store::fetchNar(storePath, baseStore);
+
+    /* Keep the NAR compressed until it's needed. */
+    auto fd = std::make_shared<AutoCloseFD>(createAnonymousTempFile());
+    FdSink fileSink(fd->get());
+
+    try {
+        getFile(info->url, fileSink);
+    } catch (NoSuchBinaryCacheFile & e) {
+        throw SubstituteGone(std::move(e.info()));
+    }
+
+    fileSink.flush();
+
+    return [fd, size = fileSink.written, compression = info->compression.value_or(CompressionAlgo::none)](
+               Sink & sink) {
+        auto decompressor = makeDecompressionSink(compression, sink);
+        copyFdRange(fd->get(), 0, size, *decompressor);
+        decompressor->finish();
+    };
+}
+
 void BinaryCacheStore::queryPathInfoUncached(
     const StorePath & storePath, Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept
 {
@@ -689,9 +1169,93 @@ void BinaryCacheStore::registerDrvOutputUnchecked(const Realisation & info)
         "application/json");
 }
 
+std::shared_ptr<SourceAccessor> BinaryCacheStore::openSeekableNar(const StorePath & storePath)
+{
+    auto info = queryPathInfo(storePath).cast<const NarInfo>();
+    auto compression = info->compression.value_or(CompressionAlgo::none);
+    if ((compression != CompressionAlgo::none && compression != CompressionAlgo::zstd)
+        || hasSuffix(info->url, chunkManifestExtension))
+        return nullptr;
+
+    auto hashPart = std::string(storePath.hashPart());
+
+    /* Pairs of (NAR offset, compressed NAR offset), one per frame. */
+    std::vector<std::pair<uint64_t, uint64_t>> frames;
+    uint64_t fileSize = 0;
+    if (compression == CompressionAlgo::zstd) {
+        auto index = getFile(hashPart + ".frames");
+        if (!index)
+            return nullptr;
+        auto j = nlohmann::json::parse(*index);
+        if (j.at("version") != 1)
+            return nullptr;
+        frames = j.at("frames");
+        fileSize = j.at("fileSize");
+        if (frames.empty() || frames[0].first != 0)
+            throw Error("invalid NAR frame index for '%s'", printStorePath(storePath));
+    }
+
+    auto listing = getFile(hashPart + ".ls");
+    if (!listing)
+        return nullptr;
+    auto j = nlohmann::json::parse(*listing);
+    if (j.at("version") != 1)
+        return nullptr;
+    auto root = j.at("root").get<NarListing>();
+
+    debug("reading NAR of '%s' from binary cache using range requests", printStorePath(storePath));
+
+    auto self = ref<BinaryCacheStore>(std::dynamic_pointer_cast<BinaryCacheStore>(shared_from_this()));
+
+    if (compression == CompressionAlgo::none)
+        return makeLazyNarAccessor(
+            std::move(root), [self, url(info->url)](uint64_t offset, uint64_t length, Sink & sink) {
+                if (length)
+                    self->getFileRange(url, offset, length, sink);
+            });
+
+    return makeLazyNarAccessor(
+        std::move(root),
+        [self, url(info->url), frames(std::move(frames)), fileSize](uint64_t offset, uint64_t length, Sink & sink) {
+            if (!length)
+                return;
+
+            /* Fetch and decompress the frames that overlap the
+               requested range, then cut the range out of them. */
+            auto isBefore = [](uint64_t narOffset, const std::pair<uint64_t, uint64_t> & frame) {
+                return narOffset < frame.first;
+            };
+            auto first = std::upper_bound(frames.begin(), frames.end(), offset, isBefore) - 1;
+            auto end = std::upper_bound(first, frames.end(), offset + length - 1, isBefore);
+            auto fileOffset = first->second;
+            auto fileEnd = end == frames.end() ? fileSize : end->second;
+
+            SliceSink slice{sink, offset - first->first, length};
+            auto decompressor = makeZstdDecompressionSink(slice);
+            self->getFileRange(url, fileOffset, fileEnd - fileOffset, *decompressor);
+            decompressor->finish();
+            if (slice.left)
+                throw Error("NAR '%s' is shorter than its frame index says", url);
+        });
+}
+
 ref<RemoteFSAccessor> BinaryCacheStore::getRemoteFSAccessor(bool requireValidPath)
 {
-    return make_ref<RemoteFSAccessor>(ref<Store>(shared_from_this()), requireValidPath, config.localNarCache);
+    ref<NarCache> sharedNarCache = [&]() {
+        auto narCache_(narCache.lock());
+        if (!*narCache_)
+            *narCache_ = std::make_shared<NarCache>(
+                config.localNarCache.get(),
+                NarCache::Limits{
+                    .maxMemorySize = config.narCacheSize,
+                    .maxDiskSize = config.localNarCacheSize,
+                    .maxOpenFiles = config.narCacheOpenFiles,
+                });
+        return ref<NarCache>(*narCache_);
+    }();
+    auto accessor = make_ref<RemoteFSAccessor>(ref<Store>(shared_from_this()), requireValidPath, sharedNarCache);
+    accessor->openSeekableNar = [this](const StorePath & storePath) { return openSeekableNar(storePath); };
+    return accessor;
 }
 
 ref<SourceAccessor> BinaryCacheStore::getFSAccessor(bool requireValidPath)
@@ -141,6 +141,72 @@ std::strong_ordering BuildError::operator<=>(const BuildError & other) const noe
     return message() <=> other.message();
 }
 
+nlohmann::json buildResourcesToJSON(const BuildResult & br)
+{
+    auto res = nlohmann::json::object();
+
+    auto addDuration = [&](const char * name, const std::optional<std::chrono::microseconds> & value) {
+        if (value)
+            res[name] = value->count();
+    };
+
+    auto addBytes = [&](const char * name, const std::optional<uint64_t> & value) {
+        if (value)
+            res[name] = *value;
+    };
+
+    addDuration("cpuUser", br.cpuUser);
+    addDuration("cpuSystem", br.cpuSystem);
+    addBytes("memoryPeak", br.memoryPeak);
+    addBytes("ioReadBytes", br.ioReadBytes);
+    addBytes("ioWriteBytes", br.ioWriteBytes);
+    addDuration("cpuStall", br.cpuStall);
+    addDuration("memoryStall", br.memoryStall);
+    addDuration("ioStall", br.ioStall);
+
+    if (!br.phaseTimes.empty()) {
+        auto & phaseTimes = res["phaseTimes"] = nlohmann::json::object();
+        for (auto & [phase, time] : br.phaseTimes)
+            phaseTimes[phase] = time.count();
+    }
+
+    return res;
+}
+
+void buildResourcesFromJSON(BuildResult & br, const nlohmann::json & _json)
+{
+    auto & json = getObject(_json);
+
+    if (auto cpuUser = optionalValueAt(json, "cpuUser")) {
+        br.cpuUser = std::chrono::microseconds(getUnsigned(*cpuUser));
+    }
+    if (auto cpuSystem = optionalValueAt(json, "cpuSystem")) {
+        br.cpuSystem = std::chrono::microseconds(getUnsigned(*cpuSystem));
+    }
+    if (auto memoryPeak = optionalValueAt(json, "memoryPeak")) {
+        br.memoryPeak = getUnsigned(*memoryPeak);
+    }
+    if (auto ioReadBytes = optionalValueAt(json, "ioReadBytes")) {
+        br.ioReadBytes = getUnsigned(*ioReadBytes);
+    }
+    if (auto ioWriteBytes = optionalValueAt(json, "ioWriteBytes")) {
+        br.ioWriteBytes = getUnsigned(*ioWriteBytes);
+    }
+    if (auto cpuStall = optionalValueAt(json, "cpuStall")) {
+        br.cpuStall = std::chrono::microseconds(getUnsigned(*cpuStall));
+    }
+    if (auto memoryStall = optionalValueAt(json, "memoryStall")) {
+        br.memoryStall = std::chrono::microseconds(getUnsigned(*memoryStall));
+    }
+    if (auto ioStall = optionalValueAt(json, "ioStall")) {
+        br.ioStall = std::chrono::microseconds(getUnsigned(*ioStall));
+    }
+    if (auto phaseTimes = optionalValueAt(json, "phaseTimes")) {
+        for (auto & [phase, time] : getObject(*phaseTimes))
+            br.phaseTimes.insert_or_assign(phase, std::chrono::microseconds(getUnsigned(time)));
+    }
+}
+
 } // namespace nix
 
 namespace nlohmann {
@@ -156,12 +222,7 @@ void adl_serializer<nix::BuildResult>::to_json(json & res, const nix::BuildResul
     res["startTime"] = br.startTime;
     res["stopTime"] = br.stopTime;
 
-    if (br.cpuUser.has_value()) {
-        res["cpuUser"] = br.cpuUser->count();
-    }
-    if (br.cpuSystem.has_value()) {
-        res["cpuSystem"] = br.cpuSystem->count();
-    }
+    res.update(buildResourcesToJSON(br));
 
     // Handle success or failure variant
     std::visit(
@@ -194,12 +255,7 @@ nix::BuildResult adl_serializer<nix::BuildResult>::from_json(const json & _json)
     br.startTime = getUnsigned(valueAt(json, "startTime"));
     br.stopTime = getUnsigned(valueAt(json, "stopTime"));
 
-    if (auto cpuUser = optionalValueAt(json, "cpuUser")) {
-        br.cpuUser = std::chrono::microseconds(getUnsigned(*cpuUser));
-    }
-    if (auto cpuSystem = optionalValueAt(json, "cpuSystem")) {
-        br.cpuSystem = std::chrono::microseconds(getUnsigned(*cpuSystem));
-    }
+    buildResourcesFromJSON(br, _json);
 
     // Determine success or failure based on success field
     bool success = getBoolean(valueAt(json, "success"));
@@ -0,0 +1,109 @@
+#include "nix/store/build/build-admission.hh"
+#include "nix/store/worker-settings.hh"
+#include "nix/util/logging.hh"
+#include "nix/util/util.hh"
+
+#ifdef __linux__
+#  include "nix/util/cgroup.hh"
+#endif
+
+namespace nix {
+
+BuildAdmission::BuildAdmission(const WorkerSettings & settings)
+    : settings(settings)
+    , getPressure{[](std::string_view resource) -> std::optional<double> {
+#ifdef __linux__
+        if (auto stats = linux::getPressureStats(resource))
+            return stats->someAvg10;
+#endif
+        return std::nullopt;
+    }}
+    , getBuildMemoryUsage{[]() -> std::optional<uint64_t> {
+#ifdef __linux__
+        if (auto cgroupFS = linux::getCgroupFS())
+            return linux::getCgroupMemoryUsage(*cgroupFS / linux::getRootCgroup().rel());
+#endif
+        return std::nullopt;
+    }}
+{
+}
+
+bool BuildAdmission::hasLoadLimits() const
+{
+#ifdef __linux__
+    return settings.maxCpuPressure || settings.maxMemoryPressure || settings.maxIoPressure || settings.maxBuildMemory;
+#else
+    return false;
+#endif
+}
+
+bool BuildAdmission::mayStartBuild(size_t running, time_point now)
+{
+#ifdef __linux__
+    /* Always allow one build, otherwise we might never make progress. */
+    if (!hasLoadLimits() || running == 0)
+        return true;
+
+    /* Give the load caused by the last build we started some time to
+       show up before starting another one. */
+    if (now < lastStart + std::chrono::seconds(1))
+        return false;
+
+    if (now < lastSample + std::chrono::seconds(1))
+        return allowed;
+
+    lastSample = now;
+    allowed = true;
+
+    auto checkPressure = [&](std::string_view resource, unsigned int max) {
+        if (!max || !allowed)
+            return;
+        if (auto pressure = getPressure(resource); pressure && *pressure > max) {
+            debug("%s pressure is %.1f%%, not starting another build", resource, *pressure);
+            allowed = false;
+        }
+    };
+
+    checkPressure("cpu", settings.maxCpuPressure);
+    checkPressure("memory", settings.maxMemoryPressure);
+    checkPressure("io", settings.maxIoPressure);
+
+    if (settings.maxBuildMemory && allowed) {
+        if (auto usage = getBuildMemoryUsage(); usage && *usage > settings.maxBuildMemory) {
+            debug("builds are using %d bytes of memory, not starting another build", *usage);
+            allowed = false;
+        }
+    }
+
+    return allowed;
+#else
+    return true;
+#endif
+}
+
+void BuildAdmission::buildStarted(time_point now)
+{
+    lastStart = now;
+}
+
+void BuildAdmission::buildKilledByOom(size_t running)
+{
+    oomLimit = std::max<size_t>(1, std::min(running, oomLimit.value_or(running)));
+}
+
+size_t BuildAdmission::maxBuilds(size_t maxJobs) const
+{
+    return oomLimit ? std::min(maxJobs, *oomLimit) : maxJobs;
+}
+
+std::optional<std::string> getBuildResourceLimit(const StringMap & limits, const StringSet & requiredFeatures)
+{
+    for (auto & feature : requiredFeatures)
+        if (auto limit = get(limits, feature))
+            return *limit;
+    if (auto limit = get(limits, "default"))
+        return *limit;
+    return std::nullopt;
+}
+
+} // namespace nix
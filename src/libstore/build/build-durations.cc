@@ -0,0 +1,105 @@
+#include "nix/store/build/build-durations.hh"
+#include "nix/store/names.hh"
+#include "nix/store/sqlite.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/sync.hh"
+#include "nix/util/users.hh"
+#include "nix/util/util.hh"
+
+namespace nix {
+
+static const char * schema = R"sql(
+
+create table if not exists BuildDurations (
+    name      text not null,
+    system    text not null,
+    duration  integer not null,
+    builds    integer not null,
+    timestamp integer not null,
+    primary key (name, system)
+);
+
+)sql";
+
+BuildDurations::Key BuildDurations::Key::fromDerivation(const BasicDerivation & drv)
+{
+    auto pname = nix::get(drv.env, "pname");
+    return {
+        .name = pname && !pname->empty() ? *pname : DrvName(drv.name).name,
+        .system = drv.platform,
+    };
+}
+
+struct BuildDurationsImpl : BuildDurations
+{
+private:
+    void anchor() override;
+public:
+
+    struct State
+    {
+        SQLite db;
+        SQLiteStmt query, upsert;
+    };
+
+    Sync<State> _state;
+
+    BuildDurationsImpl(std::filesystem::path dbPath = getCacheDir() / "build-durations-v1.sqlite")
+    {
+        auto state(_state.lock());
+
+        createDirs(dbPath.parent_path());
+
+        state->db = SQLite(dbPath, {.useWAL = true});
+
+        state->db.isCache();
+
+        state->db.exec(schema);
+
+        state->query.create(state->db, "select duration from BuildDurations where name = ? and system = ?");
+
+        /* Weigh the latest build by 1/4, so that a single outlier
+           doesn't throw off the estimate too much. */
+        state->upsert.create(
+            state->db,
+            "insert into BuildDurations(name, system, duration, builds, timestamp) values (?1, ?2, ?3, 1, ?4) "
+            "on conflict (name, system) do update set duration = (duration * 3 + ?3) / 4, builds = builds + 1, "
+            "timestamp = ?4");
+    }
+
+    std::optional<time_t> lookup(const Key & key) override
+    {
+        return retrySQLite<std::optional<time_t>>([&]() -> std::optional<time_t> {
+            auto state(_state.lock());
+            auto query(state->query.use().apply(key.name).apply(key.system));
+            if (!query.next())
+                return std::nullopt;
+            return query.getInt(0);
+        });
+    }
+
+    void record(const Key & key, time_t duration) override
+    {
+        retrySQLite<void>([&]() {
+            auto state(_state.lock());
+            state->upsert.use().apply(key.name).apply(key.system).apply(duration).apply(time(nullptr)).exec();
+        });
+    }
+};
+
+void BuildDurations::anchor() {}
+
+void BuildDurationsImpl::anchor() {}
+
+ref<BuildDurations> BuildDurations::get()
+{
+    static ref<BuildDurations> durations = make_ref<BuildDurationsImpl>();
+    return durations;
+}
+
+ref<BuildDurations> BuildDurations::getTest(std::filesystem::path dbPath)
+{
+    return make_ref<BuildDurationsImpl>(dbPath);
+}
+
+} // namespace nix
@@ -49,13 +49,46 @@ DerivationBuildingGoal::DerivationBuildingGoal(
     worker.store.addTempRoot(this->drvPath);
 }
 
-DerivationBuildingGoal::~DerivationBuildingGoal() = default;
+DerivationBuildingGoal::~DerivationBuildingGoal()
+{
+    cleanup();
+}
+
+void DerivationBuildingGoal::cleanup()
+{
+    try {
+        if (remoteBuild.valid()) {
+            /* Don't wait for the remote build, but do wait for the
+               outputs being copied back, since that relies on our
+               output locks. */
+            bool copyingOutputs;
+            {
+                auto state(remoteBuildState->lock());
+                state->cancelled = true;
+                copyingOutputs = state->copyingOutputs;
+            }
+            if (copyingOutputs)
+                remoteBuild.wait();
+            remoteBuild = {};
+            worker.childTerminated(this, JobCategory::Build);
+        }
+    } catch (...) {
+        ignoreExceptionInDestructor();
+    }
+}
 
 std::string DerivationBuildingGoal::key()
 {
     return "dd$" + std::string(drvPath.name()) + "$" + worker.store.printStorePath(drvPath);
 }
 
+time_t DerivationBuildingGoal::estimatedDuration()
+{
+    if (!cachedEstimatedDuration)
+        cachedEstimatedDuration = worker.estimateBuildDuration(*drv);
+    return *cachedEstimatedDuration;
+}
+
 template<typename InputsType>
 std::string
 showKnownOutputs(const StoreDirConfig & store, const derivation::Derivation<InputsType, derivation::Output> & drv)
@@ -152,10 +185,21 @@ static std::unique_ptr<PostBuildHookState> runPostBuildHook(
     const StorePath & drvPath,
     const StorePathSet & outputPaths);
 
+/**
+ * Add the time since `start` to the time spent in `phase` by the build.
+ */
+static void recordPhaseTime(BuildResult & buildResult, const std::string & phase, std::chrono::steady_clock::time_point start)
+{
+    buildResult.phaseTimes[phase] +=
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+}
+
 /* At least one of the output paths could not be
    produced using a substitute.  So we have to build instead. */
 Goal::Co DerivationBuildingGoal::gaveUpOnSubstitution()
 {
+    auto inputsStart = std::chrono::steady_clock::now();
+
     Goals waitees;
 
     /* Copy the input sources from the eval store to the build
@@ -186,6 +230,8 @@ Goal::Co DerivationBuildingGoal::gaveUpOnSubstitution()
 
     trace("all inputs realised");
 
+    recordPhaseTime(buildResult, "inputs", inputsStart);
+
     if (nrFailed != 0) {
         auto msg =
             fmt("Cannot build '%s'.\n"
@@ -469,13 +515,18 @@ Goal::Co DerivationBuildingGoal::tryToBuild(StorePathSet inputPaths)
             if (valid)
                 co_return doneSuccess(BuildResult::Success::AlreadyValid, checkPathValidity(initialOutputs).second);
 
-            switch (tryBuildHook(drvOptions)) {
+            switch (tryBuildHook(drvOptions, inputPaths)) {
             case rpAccept:
                 /* Yes, it has started doing so.  Wait until we get
                    EOF from the hook. */
                 valid = true;
-                co_return buildWithHook(
-                    std::move(inputPaths), std::move(initialOutputs), std::move(drvOptions), std::move(outputLocks));
+                co_return remoteBuilder
+                    ? buildRemotely(std::move(inputPaths), std::move(initialOutputs), std::move(outputLocks))
+                    : buildWithHook(
+                          std::move(inputPaths),
+                          std::move(initialOutputs),
+                          std::move(drvOptions),
+                          std::move(outputLocks));
             case rpDecline:
                 // We should do it ourselves.
                 co_return Return{};
@@ -502,7 +553,7 @@ Goal::Co DerivationBuildingGoal::tryToBuild(StorePathSet inputPaths)
                 if (valid)
                     break;
 
-                switch (tryBuildHook(drvOptions)) {
+                switch (tryBuildHook(drvOptions, inputPaths)) {
                 case rpAccept:
                     /* Yes, it has started doing so.  Wait until we get
                        EOF from the hook. */
@@ -524,8 +575,10 @@ Goal::Co DerivationBuildingGoal::tryToBuild(StorePathSet inputPaths)
         if (valid) {
             co_return doneSuccess(BuildResult::Success::AlreadyValid, checkPathValidity(initialOutputs).second);
         } else {
-            co_return buildWithHook(
-                std::move(inputPaths), std::move(initialOutputs), std::move(drvOptions), std::move(outputLocks));
+            co_return remoteBuilder
+                ? buildRemotely(std::move(inputPaths), std::move(initialOutputs), std::move(outputLocks))
+                : buildWithHook(
+                      std::move(inputPaths), std::move(initialOutputs), std::move(drvOptions), std::move(outputLocks));
         }
     };
 
@@ -758,6 +811,157 @@ Goal::Co DerivationBuildingGoal::buildWithHook(
         co_return doneFailure(std::move(e));
     }
 
+    co_return finishRemoteBuild(std::move(initialOutputs), std::move(outputLocks));
+#endif
+}
+
+Goal::Co DerivationBuildingGoal::buildRemotely(
+    StorePathSet inputPaths, std::map<std::string, InitialOutput> initialOutputs, PathLocks outputLocks)
+{
+    auto & host = *remoteBuilder;
+    remoteBuilder = nullptr;
+
+    /* Occupy a slot on the machine until the build is done. */
+    MaintainCount<unsigned int> mcMachineSlot(host.running);
+
+    auto machineName = host.machine.storeUri.render();
+
+    StringSet missingOutputs;
+    for (auto & [outputName, status] : initialOutputs) {
+        if (buildMode != bmCheck && status.known && status.known->isValid())
+            continue;
+        missingOutputs.insert(outputName);
+    }
+
+    buildResult.startTime = time(nullptr);
+
+    Activity act(
+        *logger,
+        lvlInfo,
+        actBuild,
+        fmt("building '%s' on '%s'", worker.store.printStorePath(drvPath), machineName),
+        std::to_array<Logger::Field>({worker.store.printStorePath(drvPath), machineName, 1, 1}));
+    mcRunningBuilds = std::make_unique<MaintainCount<uint64_t>>(worker.runningBuilds);
+    worker.updateProgress();
+
+    auto result = std::make_shared<BuildResult>();
+    auto connectError = std::make_shared<std::optional<std::string>>();
+    remoteBuildState = std::make_shared<Sync<RemoteBuildState>>();
+
+    /* Be careful with ownership: the worker may be gone by the time
+       the job runs, see `PathSubstitutionGoal`. The machine outlives
+       the job, because the worker waits for all remote builds. */
+    remoteBuild = worker.startRemoteBuild(
+        weak_from_this(),
+        [&host,
+         drvPath = drvPath,
+         inputPaths,
+         missingOutputs,
+         result,
+         connectError,
+         state = remoteBuildState,
+         useSubstitutes = worker.settings.buildersUseSubstitutes.get(),
+         actId = act.id,
+         maybeWorkerStore = worker.store.weak_from_this()]() {
+            auto workerStore = maybeWorkerStore.lock();
+            if (!workerStore)
+                return;
+
+            PushActivity pact(actId);
+
+            /* Connecting may take a while, so it happens here rather
+               than when the machine is selected. */
+            std::shared_ptr<Store> remoteStore;
+            try {
+                remoteStore = host.getStore();
+            } catch (Error & e) {
+                *connectError = e.msg();
+                return;
+            }
+
+            if (state->lock()->cancelled)
+                return;
+
+            auto uploadStart = std::chrono::steady_clock::now();
+            host.copyInputs(*workerStore, inputPaths, useSubstitutes);
+            auto buildStart = std::chrono::steady_clock::now();
+
+            if (state->lock()->cancelled)
+                return;
+
+            *result = buildOnRemoteStore(*workerStore, *remoteStore, drvPath, inputPaths, missingOutputs, [&]() {
+                auto state_(state->lock());
+                if (state_->cancelled)
+                    return false;
+                state_->copyingOutputs = true;
+                return true;
+            });
+
+            result->phaseTimes["upload"] =
+                std::chrono::duration_cast<std::chrono::microseconds>(buildStart - uploadStart);
+            recordPhaseTime(*result, "build", buildStart);
+
+            if (auto * success = result->tryGetSuccess()) {
+                StorePathSet outputPaths;
+                for (auto & [_, realisation] : success->builtOutputs)
+                    outputPaths.insert(realisation.outPath);
+                host.addKnownPaths(outputPaths);
+            }
+        });
+
+    worker.childStarted(shared_from_this(), /*channels=*/{}, /*inBuildSlot=*/false, /*respectTimeouts=*/false);
+    co_await waitUntilWoken();
+
+    trace("remote build done");
+
+    auto future = std::move(remoteBuild);
+    worker.childTerminated(this);
+
+    /* If we couldn't connect to the machine, don't use it again and
+       try to build somewhere else. */
+    if (*connectError) {
+        printError("cannot build on '%s': %s", machineName, **connectError);
+        host.enabled = false;
+        mcRunningBuilds.reset();
+        outputLocks.unlock();
+        co_return tryToBuild(std::move(inputPaths));
+    }
+
+    buildResult.timesBuilt++;
+    buildResult.stopTime = time(nullptr);
+
+    try {
+        future.get();
+    } catch (Error & e) {
+        outputLocks.unlock();
+        co_return doneFailure(BuildError(
+            BuildResult::Failure::MiscFailure,
+            "remote build of '%s' on '%s' failed: %s",
+            worker.store.printStorePath(drvPath),
+            machineName,
+            e.msg()));
+    }
+
+    for (auto & [phase, time] : result->phaseTimes)
+        buildResult.phaseTimes[phase] += time;
+    act.result(resBuildResources, buildResourcesToJSON(buildResult).dump());
+
+    if (auto * failure = result->tryGetFailure()) {
+        outputLocks.unlock();
+        co_return doneFailure(BuildError(
+            failure->status,
+            "build of '%s' on '%s' failed: %s",
+            worker.store.printStorePath(drvPath),
+            machineName,
+            failure->message()));
+    }
+
+    co_return finishRemoteBuild(std::move(initialOutputs), std::move(outputLocks));
+}
+
+Goal::Co DerivationBuildingGoal::finishRemoteBuild(
+    std::map<std::string, InitialOutput> initialOutputs, PathLocks outputLocks)
+{
     /* Compute the FS closure of the outputs and register them as
        being valid. */
     auto builtOutputs =
@@ -783,6 +987,7 @@ Goal::Co DerivationBuildingGoal::buildWithHook(
         outputPaths.insert(output.outPath);
 
     if (worker.settings.postBuildHook.get() != "") {
+        auto hookStart = std::chrono::steady_clock::now();
         auto hookState = runPostBuildHook(worker.settings, worker.store, *logger, drvPath, outputPaths);
         worker.childStarted(shared_from_this(), {hookState->out->readSide.get()}, false, false);
         while (true) {
@@ -792,6 +997,7 @@ Goal::Co DerivationBuildingGoal::buildWithHook(
             } else if (std::get_if<ChildEOF>(&event)) {
                 hookState->complete();
                 worker.childTerminated(this);
+                recordPhaseTime(buildResult, "postBuildHook", hookStart);
                 break;
             }
         }
@@ -805,7 +1011,6 @@ Goal::Co DerivationBuildingGoal::buildWithHook(
     outputLocks.unlock();
 
     co_return doneSuccess(BuildResult::Success::Built, std::move(builtOutputs));
-#endif
 }
 
 Goal::Co DerivationBuildingGoal::buildLocally(
@@ -855,7 +1060,7 @@ Goal::Co DerivationBuildingGoal::buildLocally(
     while (true) {
 
         unsigned int curBuilds = worker.getNrLocalBuilds();
-        if (curBuilds >= worker.settings.maxBuildJobs) {
+        if (curBuilds >= worker.getMaxLocalBuilds() || !worker.mayStartBuild()) {
             outputLocks.unlock();
             co_await waitForBuildSlot();
             co_return tryToBuild(std::move(inputPaths));
@@ -973,7 +1178,11 @@ Goal::Co DerivationBuildingGoal::buildLocally(
                                 std::move(params));
         }
 
-        if (auto builderOutOpt = builder->startBuild()) {
+        auto setupStart = std::chrono::steady_clock::now();
+        auto builderOutOpt = builder->startBuild();
+        recordPhaseTime(buildResult, "setup", setupStart);
+
+        if (builderOutOpt) {
             builderOut = *std::move(builderOutOpt);
         } else {
             if (!actLock)
@@ -995,6 +1204,12 @@ Goal::Co DerivationBuildingGoal::buildLocally(
 
     started();
 
+    auto reportResources = [&]() {
+        buildLog->act->result(resBuildResources, buildResourcesToJSON(buildResult).dump());
+    };
+
+    auto buildStart = std::chrono::steady_clock::now();
+
     uint64_t logSize = 0;
 
     while (true) {
@@ -1021,18 +1236,45 @@ Goal::Co DerivationBuildingGoal::buildLocally(
 
     trace("build done");
 
+    recordPhaseTime(buildResult, "build", buildStart);
+
+    auto registerStart = std::chrono::steady_clock::now();
+
     SingleDrvOutputs builtOutputs;
+    bool retryAfterOom = false;
     try {
         builtOutputs = builder->unprepareBuild();
     } catch (BuilderFailureError & e) {
+        recordPhaseTime(buildResult, "register", registerStart);
+        reportResources();
         builder.reset();
         outputLocks.unlock();
-        co_return doneFailure(fixupBuilderFailureErrorMessage(std::move(e), *buildLog));
+        if (e.oomKilled)
+            worker.buildKilledByOom();
+        if (!e.oomKilled || retriedAfterOom)
+            co_return doneFailure(fixupBuilderFailureErrorMessage(std::move(e), *buildLog));
+        retryAfterOom = true;
     } catch (BuildError & e) {
+        recordPhaseTime(buildResult, "register", registerStart);
+        reportResources();
         builder.reset();
         outputLocks.unlock();
         co_return doneFailure(std::move(e));
     }
+
+    /* A build that was killed for lack of memory may well succeed
+       when fewer builds run at the same time, so try once more. */
+    if (retryAfterOom) {
+        retriedAfterOom = true;
+        warn(
+            "build of '%s' was killed by the out-of-memory killer; retrying it with at most %d concurrent builds",
+            worker.store.printStorePath(drvPath),
+            worker.getMaxLocalBuilds());
+        co_await waitForBuildSlot();
+        co_return tryToBuild(std::move(inputPaths));
+    }
+
+    recordPhaseTime(buildResult, "register", registerStart);
     {
         builder.reset();
         StorePathSet outputPaths;
@@ -1051,6 +1293,7 @@ Goal::Co DerivationBuildingGoal::buildLocally(
         }
 
         if (worker.settings.postBuildHook.get() != "") {
+            auto hookStart = std::chrono::steady_clock::now();
             auto hookState = runPostBuildHook(worker.settings, worker.store, *logger, drvPath, outputPaths);
             worker.childStarted(shared_from_this(), {hookState->out->readSide.get()}, false, false);
             while (true) {
@@ -1060,6 +1303,7 @@ Goal::Co DerivationBuildingGoal::buildLocally(
                 } else if (std::get_if<ChildEOF>(&event)) {
                     hookState->complete();
                     worker.childTerminated(this);
+                    recordPhaseTime(buildResult, "postBuildHook", hookStart);
                     break;
                 }
             }
@@ -1069,6 +1313,8 @@ Goal::Co DerivationBuildingGoal::buildLocally(
            lockers will see that the output paths are valid; they will
            not create new lock files with the same names as the old
            (unlinked) lock files. */
+        reportResources();
+
         outputLocks.setDeletion(true);
         outputLocks.unlock();
         co_return doneSuccess(BuildResult::Success::Built, std::move(builtOutputs));
@@ -1162,14 +1408,21 @@ BuildError DerivationBuildingGoal::fixupBuilderFailureErrorMessage(BuilderFailur
     return BuildError{e.status, msg};
 }
 
-HookReply DerivationBuildingGoal::tryBuildHook(const DerivationOptions<StorePath> & drvOptions)
+HookReply
+DerivationBuildingGoal::tryBuildHook(const DerivationOptions<StorePath> & drvOptions, const StorePathSet & inputPaths)
 {
 #ifdef _WIN32 // TODO enable build hook on Windows
     return rpDecline;
 #else
     /* This should use `worker.evalStore`, but per #13179 the build hook
        doesn't work with eval store anyways. */
-    if (worker.settings.buildHook.get().empty() || !worker.tryBuildHook || !worker.store.isValidPath(drvPath))
+    if (!worker.tryBuildHook || !worker.store.isValidPath(drvPath))
+        return rpDecline;
+
+    if (worker.settings.buildersInProcess)
+        return selectRemoteBuilder(drvOptions, inputPaths);
+
+    if (worker.settings.buildHook.get().empty())
         return rpDecline;
 
     if (!worker.hook)
@@ -1233,6 +1486,52 @@ HookReply DerivationBuildingGoal::tryBuildHook(const DerivationOptions<StorePath
 #endif
 }
 
+HookReply DerivationBuildingGoal::selectRemoteBuilder(
+    const DerivationOptions<StorePath> & drvOptions, const StorePathSet & inputPaths)
+{
+    auto & remoteBuilders = worker.getRemoteBuilders();
+
+    if (remoteBuilders.hosts.empty()) {
+        worker.tryBuildHook = false;
+        return rpDecline;
+    }
+
+    auto requiredFeatures = drvOptions.getRequiredSystemFeatures(*drv);
+
+    bool couldBuildLocally =
+        worker.settings.maxBuildJobs > 0
+        && (drv->platform == settings.thisSystem || settings.extraPlatforms.get().count(drv->platform) > 0)
+        && std::ranges::all_of(requiredFeatures, [&](const std::string & feature) {
+               return worker.store.config.systemFeatures.get().count(feature) > 0;
+           });
+    bool canBuildLocally = couldBuildLocally && worker.getNrLocalBuilds() < worker.settings.maxBuildJobs;
+
+    /* Prefer machines that already have most of the inputs. */
+    std::map<StorePath, uint64_t> inputSizes;
+    for (auto & path : inputPaths)
+        inputSizes.emplace(path, worker.store.queryPathInfo(path)->narSize);
+
+    bool rightType;
+    auto host = remoteBuilders.select(drv->platform, requiredFeatures, inputSizes, estimatedDuration(), rightType);
+
+    if (!host) {
+        if (rightType && !canBuildLocally)
+            return rpPostpone;
+        printMsg(
+            couldBuildLocally ? lvlChatty : lvlWarn,
+            "no remote machine can build '%s', which requires system '%s' and features [%s]",
+            worker.store.printStorePath(drvPath),
+            drv->platform,
+            concatStringsSep(", ", requiredFeatures));
+        return rpDecline;
+    }
+
+    /* The connection is made by the build job (see `buildRemotely()`),
+       so as not to block the worker. */
+    remoteBuilder = host;
+    return rpAccept;
+}
+
 LogFile::LogFile(Store & store, const StorePath & drvPath, const LogFileSettings & logSettings)
 {
     if (!logSettings.keepLog)
@@ -1373,8 +1672,11 @@ Goal::Done DerivationBuildingGoal::doneSuccess(BuildResult::Success::Status stat
 {
     mcRunningBuilds.reset();
 
-    if (status == BuildResult::Success::Built)
+    if (status == BuildResult::Success::Built) {
         worker.doneBuilds++;
+        if (buildMode == bmNormal && buildResult.startTime && buildResult.stopTime >= buildResult.startTime)
+            worker.recordBuildDuration(*drv, buildResult.stopTime - buildResult.startTime);
+    }
 
     worker.updateProgress();
 
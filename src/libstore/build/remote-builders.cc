@@ -0,0 +1,340 @@
+#include "nix/store/build/remote-builders.hh"
+#include "nix/store/build.hh"
+#include "nix/store/derivations.hh"
+#include "nix/store/derivation/full-inputs.hh"
+#include "nix/store/globals.hh"
+#include "nix/store/legacy-ssh-store.hh"
+#include "nix/store/local-store.hh"
+#include "nix/store/realisation.hh"
+#include "nix/store/remote-store.hh"
+#include "nix/store/store-api.hh"
+#include "nix/util/finally.hh"
+#include "nix/util/logging.hh"
+
+namespace nix {
+
+/**
+ * The upload throughput assumed for machines that no inputs have been
+ * copied to yet, in bytes per second.
+ */
+static constexpr double defaultUploadRate = 100e6;
+
+/**
+ * Copies smaller than this are dominated by latency rather than
+ * throughput, so they are not used to estimate the latter.
+ */
+static constexpr uint64_t minMeasuredUpload = 1 << 20;
+
+RemoteBuilders::Host::Host(Machine machine)
+    : machine(std::move(machine))
+    , uploadRate(defaultUploadRate)
+{
+}
+
+ref<Store> RemoteBuilders::Host::getStore()
+{
+    auto store(store_.lock());
+    if (!*store) {
+        Activity act(*logger, lvlTalkative, actUnknown, fmt("connecting to '%s'", machine.storeUri.render()));
+        auto newStore = machine.openStore();
+        newStore->connect();
+        *store = newStore;
+    }
+    return ref<Store>(*store);
+}
+
+void RemoteBuilders::Host::shutdown()
+{
+    auto store = *store_.lock();
+    if (auto remoteStore = std::dynamic_pointer_cast<RemoteStore>(store))
+        remoteStore->shutdownConnections();
+    else if (auto legacySSHStore = std::dynamic_pointer_cast<LegacySSHStore>(store))
+        legacySSHStore->shutdownConnections();
+}
+
+void RemoteBuilders::Host::copyInputs(Store & localStore, const StorePathSet & paths, bool useSubstitutes)
+{
+    StorePathSet missing;
+    {
+        auto knownPaths_(knownPaths.lock());
+        for (auto & path : paths)
+            if (!knownPaths_->count(path))
+                missing.insert(path);
+    }
+
+    if (!missing.empty()) {
+        auto store = getStore();
+        auto substitute = useSubstitutes ? Substitute : NoSubstitute;
+
+        /* Remember what the machine already has, so that it counts in
+           the selection of machines for later builds. */
+        auto valid = store->queryValidPaths(missing, substitute);
+        addKnownPaths(valid);
+
+        StorePathSet toCopy;
+        uint64_t bytes = 0;
+        for (auto & path : missing)
+            if (!valid.count(path)) {
+                toCopy.insert(path);
+                bytes += localStore.queryPathInfo(path)->narSize;
+            }
+
+        if (!toCopy.empty()) {
+            /* Builds on the same machine upload concurrently. Paths
+               that are uploaded by two builds at once are rare and
+               harmless. */
+            Activity act(
+                *logger, lvlTalkative, actUnknown, fmt("copying dependencies to '%s'", machine.storeUri.render()));
+            auto before = std::chrono::steady_clock::now();
+            copyPaths(localStore, *store, toCopy, NoRepair, NoCheckSigs, substitute);
+            recordUpload(bytes, std::chrono::steady_clock::now() - before);
+        }
+    }
+
+    addKnownPaths(paths);
+}
+
+void RemoteBuilders::Host::recordUpload(uint64_t bytes, std::chrono::steady_clock::duration elapsed)
+{
+    auto seconds = std::chrono::duration<double>(elapsed).count();
+    if (bytes < minMeasuredUpload || seconds <= 0)
+        return;
+    auto uploadRate_(uploadRate.lock());
+    *uploadRate_ = *uploadRate_ * 0.75 + bytes / seconds * 0.25;
+}
+
+uint64_t RemoteBuilders::Host::bytesToCopy(const std::map<StorePath, uint64_t> & paths)
+{
+    uint64_t bytes = 0;
+    auto knownPaths_(knownPaths.lock());
+    for (auto & [path, narSize] : paths)
+        if (!knownPaths_->count(path))
+            bytes += narSize;
+    return bytes;
+}
+
+double RemoteBuilders::Host::estimateCopyTime(uint64_t bytes)
+{
+    return bytes / *uploadRate.lock();
+}
+
+void RemoteBuilders::Host::addKnownPaths(const StorePathSet & paths)
+{
+    knownPaths.lock()->insert(paths.begin(), paths.end());
+}
+
+RemoteBuilders::RemoteBuilders(const Machines & machines)
+{
+    for (auto & machine : machines)
+        hosts.push_back(std::make_unique<Host>(machine));
+}
+
+unsigned int RemoteBuilders::totalSlots() const
+{
+    unsigned int slots = 0;
+    for (auto & host : hosts)
+        slots += host->machine.maxJobs;
+    return slots;
+}
+
+RemoteBuilders::Host * RemoteBuilders::select(
+    std::string_view system,
+    const StringSet & requiredFeatures,
+    const std::map<StorePath, uint64_t> & inputs,
+    time_t duration,
+    bool & rightType)
+{
+    rightType = false;
+
+    Host * best = nullptr;
+    double bestCost = 0;
+
+    for (auto & host : hosts) {
+        auto & m = host->machine;
+
+        if (!host->enabled || !m.systemSupported(std::string(system)) || !m.allSupported(requiredFeatures)
+            || !m.mandatoryMet(requiredFeatures))
+            continue;
+
+        rightType = true;
+
+        if (host->running >= m.maxJobs)
+            continue;
+
+        /* Estimate when the build would be done on this machine: the
+           inputs have to be copied first, and a busy machine builds
+           more slowly. Prefer the fastest and then the least loaded
+           machine if that's the same. */
+        auto cost = host->estimateCopyTime(host->bytesToCopy(inputs))
+                    + duration * (1.0 + (double) host->running / m.maxJobs) / m.speedFactor;
+
+        if (!best || cost < bestCost
+            || (cost == bestCost
+                && (m.speedFactor > best->machine.speedFactor
+                    || (m.speedFactor == best->machine.speedFactor && host->running < best->running)))) {
+            best = host.get();
+            bestCost = cost;
+        }
+    }
+
+    if (best)
+        debug(
+            "selected remote machine '%s' with an estimated %.1f seconds to copy the inputs and build",
+            best->machine.storeUri.render(),
+            bestCost);
+
+    return best;
+}
+
+BuildResult buildOnRemoteStore(
+    Store & localStore,
+    Store & remoteStore,
+    const StorePath & drvPath,
+    const StorePathSet & inputs,
+    const StringSet & wantedOutputs,
+    std::function<bool()> mayCopyOutputs)
+{
+    auto drv = localStore.readDerivation(drvPath);
+
+    BuildResult result;
+
+    // If we don't know whether we are trusted (e.g. `ssh://`
+    // stores), we assume we are. This is necessary for backwards
+    // compat.
+    bool trustedOrLegacy = ({
+        std::optional trusted = remoteStore.isTrustedClient();
+        !trusted || *trusted;
+    });
+
+    // See the very large comment in `case WorkerProto::Op::BuildDerivation:` in
+    // `src/libstore/daemon.cc` that explains the trust model here.
+    //
+    // This condition mirrors that: that code enforces the "rules" outlined there;
+    // we do the best we can given those "rules".
+    if (trustedOrLegacy || type(drv).isCA()) {
+        // Check if there are any derivation inputs
+        bool hasInputDrvs = std::ranges::any_of(drv.inputs, [](const auto & input) {
+            return std::holds_alternative<SingleDerivedPath::Built>(input.raw());
+        });
+
+        BasicDerivation resolvedDrv{
+            .outputs = drv.outputs,
+            // Hijack the inputs paths of the derivation to include
+            // all the paths that come from the `inputDrvs` set. We
+            // don't do that for the derivations whose `inputDrvs`
+            // is empty because:
+            //
+            // 1. It's not needed
+            //
+            // 2. Changing the `inputSrcs` set changes the
+            //    associated output ids, which break CA derivations
+            .inputs =
+                hasInputDrvs ? inputs : [&] {
+                    StorePathSet srcs;
+                    for (auto & input : drv.inputs)
+                        if (auto * op = std::get_if<SingleDerivedPath::Opaque>(&input.raw()))
+                            srcs.insert(op->path);
+                    return srcs;
+                }(),
+            .platform = drv.platform,
+            .builder = drv.builder,
+            .args = drv.args,
+            .env = drv.env,
+            .structuredAttrs = drv.structuredAttrs,
+            .name = drv.name,
+        };
+        result = remoteStore.getBuilder()->buildDerivation(drvPath, resolvedDrv);
+    } else {
+        copyClosure(
+            localStore,
+            remoteStore,
+            StorePathSet{drvPath},
+            NoRepair,
+            NoCheckSigs,
+            settings.getWorkerSettings().buildersUseSubstitutes ? Substitute : NoSubstitute);
+        auto res = remoteStore.getBuilder()->buildPathsWithResults({DerivedPath::Built{
+            .drvPath = makeConstantStorePathRef(drvPath),
+            .outputs = OutputsSpec::All{},
+        }});
+        // One path to build should produce exactly one build result
+        assert(res.size() == 1);
+        result = std::move(res[0]);
+    }
+
+    if (result.tryGetFailure()) {
+        if (settings.keepFailed) {
+            warn(
+                "The failed build directory was kept on the remote builder due to `--keep-failed`.%s",
+                (settings.thisSystem == drv.platform || settings.extraPlatforms.get().count(drv.platform) > 0)
+                    ? " You can re-run the command with `--builders ''` to disable remote building for this invocation."
+                    : "");
+        }
+        return result;
+    }
+
+    std::set<Realisation> missingRealisations;
+    StorePathSet missingPaths;
+    if (experimentalFeatureSettings.isEnabled(Xp::CaDerivations) && !type(drv).hasKnownOutputPaths()) {
+        for (auto & outputName : wantedOutputs) {
+            auto thisOutputId = DrvOutput{drvPath, outputName};
+            if (!localStore.queryRealisation(thisOutputId)) {
+                debug("missing output %s", outputName);
+                if (auto * successP = result.tryGetSuccess()) {
+                    auto & success = *successP;
+                    auto i = success.builtOutputs.find(outputName);
+                    assert(i != success.builtOutputs.end());
+                    auto & newRealisation = i->second;
+                    missingRealisations.insert({newRealisation, thisOutputId});
+                    missingPaths.insert(newRealisation.outPath);
+                }
+            }
+        }
+    } else {
+        auto outputPaths = outputsAndOptPaths(drv, localStore);
+        for (auto & [outputName, hopefullyOutputPath] : outputPaths) {
+            assert(hopefullyOutputPath.second);
+            if (!localStore.isValidPath(*hopefullyOutputPath.second))
+                missingPaths.insert(*hopefullyOutputPath.second);
+        }
+    }
+
+    if (mayCopyOutputs && !mayCopyOutputs())
+        return result;
+
+    if (!missingPaths.empty()) {
+        Activity act(
+            *logger,
+            lvlTalkative,
+            actUnknown,
+            fmt("copying outputs from '%s'", remoteStore.config.getHumanReadableURI()));
+
+        /* The caller holds the locks on the output paths, so don't let
+           the local store try to acquire them again. */
+        auto local = dynamic_cast<LocalStore *>(&localStore);
+        if (local) {
+            auto locksHeld(local->locksHeld.lock());
+            for (auto & path : missingPaths)
+                locksHeld->insert(localStore.printStorePath(path));
+        }
+        Finally releaseLocks([&]() {
+            if (local) {
+                auto locksHeld(local->locksHeld.lock());
+                for (auto & path : missingPaths)
+                    locksHeld->erase(localStore.printStorePath(path));
+            }
+        });
+
+        copyPaths(remoteStore, localStore, missingPaths, NoRepair, NoCheckSigs, NoSubstitute);
+    }
+    // XXX: Should be done as part of `copyPaths`
+    for (auto & realisation : missingRealisations) {
+        // Should hold, because if the feature isn't enabled the set
+        // of missing realisations should be empty
+        experimentalFeatureSettings.require(Xp::CaDerivations);
+        localStore.registerDrvOutput(realisation, NoCheckSigs);
+    }
+
+    return result;
+}
+
+} // namespace nix
@@ -206,59 +206,48 @@ Goal::Co PathSubstitutionGoal::tryToRun(
     auto maintainRunningSubstitutions = std::make_unique<MaintainCount<uint64_t>>(worker.runningSubstitutions);
     worker.updateProgress();
 
-    auto promise = std::promise<void>();
-    auto future = promise.get_future();
-
-    /* Be careful with ownership. cleanup() doesn't signal the worker thread
-       to cleanly shutdown, so the worker can die while the thread is still
-       running. That's why we use weak_ptr for everything that is owned by the
-       Worker. */
-    thr = std::thread([weakGoal = weak_from_this(),
-                       promise = std::move(promise),
-                       subPath,
-                       storePath = storePath,
-                       repair = repair,
-                       sub,
-                       maybeWaker = worker.getCrossThreadWaker(),
-                       maybeWorkerStore = worker.store.weak_from_this()]() mutable {
-        try {
-            ReceiveInterrupts receiveInterrupts;
-
-            /* The Worker might have died while we were starting up. */
+    /* Be careful with ownership. cleanup() doesn't signal the job to
+       cleanly shut down, so the worker can die while the job is still
+       running. That's why we use weak_ptr for everything that is owned
+       by the Worker. */
+    job = worker.startSubstitution(
+        weak_from_this(),
+        [subPath,
+         storePath = storePath,
+         repair = repair,
+         sub,
+         maybeWorkerStore = worker.store.weak_from_this()]() -> fun<void()> {
+            /* The Worker might have died while we were queued. */
             auto workerStore = maybeWorkerStore.lock();
             if (!workerStore)
-                return;
+                return []() {};
 
-            Activity act(
+            auto act = std::make_shared<Activity>(
                 *logger,
                 actSubstitute,
                 std::to_array<Logger::Field>(
                     {workerStore->printStorePath(storePath), sub->config.getHumanReadableURI()}));
-            PushActivity pact(act.id);
-
-            copyStorePath(*sub, *workerStore, subPath, repair, sub->config.isTrusted ? NoCheckSigs : CheckSigs);
+            PushActivity pact(act->id);
 
-            promise.set_value();
-        } catch (...) {
-            promise.set_exception(std::current_exception());
-        }
+            /* Only the fetch happens here; adding the path to the store
+               happens on a CPU thread. */
+            auto restore =
+                fetchStorePath(*sub, *workerStore, subPath, repair, sub->config.isTrusted ? NoCheckSigs : CheckSigs);
 
-        /* The Worker might have already died (and the waker with it) by the
-           time we finished. N.B. if enqueueing to the waker throws, we better
-           std::terminate, since something has gone very wrong. This intentionally
-           lets the thread crash on exceptions for that reason. */
-        if (auto waker = maybeWaker.lock())
-            waker->enqueue(weakGoal);
-    });
+            return [workerStore, sub, act, restore]() {
+                PushActivity pact(act->id);
+                restore();
+            };
+        });
 
     /* Use up the substitution slot. */
     worker.childStarted(shared_from_this(), /*channels=*/{}, /*inBuildSlot=*/true, /*respectTimeouts=*/false);
-    /* Suspend until the thread finishes. */
+    /* Suspend until the job finishes. */
     co_await waitUntilWoken();
 
     trace("substitute finished");
 
-    thr.join();
+    auto future = std::move(job);
     worker.childTerminated(this);
 
     try {
@@ -309,9 +298,9 @@ Goal::Co PathSubstitutionGoal::tryToRun(
 void PathSubstitutionGoal::cleanup()
 {
     try {
-        if (thr.joinable()) {
-            // FIXME: signal worker thread to quit.
-            thr.join();
+        if (job.valid()) {
+            // FIXME: signal the job to quit.
+            job.wait();
             worker.childTerminated(this, JobCategory::Substitution);
         }
     } catch (...) {
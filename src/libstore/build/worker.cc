@@ -8,12 +8,20 @@
 #include "nix/store/build/derivation-resolution-goal.hh"
 #include "nix/store/build/derivation-building-goal.hh"
 #include "nix/store/build/derivation-trampoline-goal.hh"
+#include "nix/store/build/build-durations.hh"
+#include "nix/store/build/remote-builders.hh"
 #ifndef _WIN32 // TODO Enable building on Windows
 #  include "nix/store/build/hook-instance.hh"
 #endif
 #include "nix/util/signals.hh"
+#include "nix/util/current-process.hh"
 #include "nix/store/globals.hh"
 
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+
+#include <thread>
+
 namespace nix {
 
 Worker::Worker(Store & store, Store & evalStore)
@@ -28,6 +36,7 @@ Worker::Worker(Store & store, Store & evalStore)
     , store(store)
     , evalStore(evalStore)
     , settings(nix::settings.getWorkerSettings())
+    , admission(nix::settings.getWorkerSettings())
     , getSubstituters{[] {
         return nix::settings.getWorkerSettings().useSubstitutes ? getDefaultSubstituters() : std::list<ref<Store>>{};
     }}
@@ -44,12 +53,30 @@ Worker::Worker(Store & store, Store & evalStore)
 
 Worker::~Worker()
 {
+    /* Remote builds that are still running are abandoned, so break
+       their connections rather than waiting for them to finish on the
+       remote side. */
+    if (remoteBuilders)
+        for (auto & host : remoteBuilders->hosts)
+            host->shutdown();
+
     /* Explicitly get rid of all strong pointers now.  After this all
        goals that refer to this worker should be gone.  (Otherwise we
        are in trouble, since goals may call childTerminated() etc. in
        their destructors). */
     topGoals.clear();
 
+    /* The substitution threads hand their work over to the CPU
+       pool, so the latter must be joined last. */
+    if (substitutionPool)
+        substitutionPool->join();
+
+    if (substitutionCpuPool)
+        substitutionCpuPool->join();
+
+    if (remoteBuildPool)
+        remoteBuildPool->join();
+
     assert(expectedSubstitutions == 0);
     assert(expectedDownloadSize == 0);
     assert(expectedNarSize == 0);
@@ -209,6 +236,7 @@ void Worker::childStarted(
             break;
         case JobCategory::Build:
             nrLocalBuilds++;
+            admission.buildStarted(child.timeStarted);
             break;
         case JobCategory::Administration:
         default:
@@ -258,7 +286,7 @@ void Worker::waitForBuildSlot(GoalPtr goal)
         if (goal->jobCategory() == JobCategory::Substitution)
             return getNrSubstitutions() < settings.maxSubstitutionJobs;
         else
-            return getNrLocalBuilds() < settings.maxBuildJobs;
+            return getNrLocalBuilds() < getMaxLocalBuilds() && mayStartBuild();
     }();
 
     if (slotAvailable)
@@ -267,6 +295,22 @@ void Worker::waitForBuildSlot(GoalPtr goal)
         addToWeakGoals(goal->jobCategory() == JobCategory::Substitution ? wantingToSubstitute : wantingToBuild, goal);
 }
 
+bool Worker::mayStartBuild()
+{
+    return admission.mayStartBuild(getNrLocalBuilds(), steady_time_point::clock::now());
+}
+
+size_t Worker::getMaxLocalBuilds()
+{
+    return admission.maxBuilds(settings.maxBuildJobs);
+}
+
+void Worker::buildKilledByOom()
+{
+    oomKilledBuilds++;
+    admission.buildKilledByOom(getNrLocalBuilds());
+}
+
 void Worker::waitForAWhile(GoalPtr goal)
 {
     goal->trace("wait for a while");
@@ -324,30 +368,30 @@ void Worker::run(const Goals & _topGoals)
                     break; // stuff may have been cancelled
             }
 
-            auto wakeSlotWaiters = [this](WeakGoals & waiting, size_t running, size_t limit) {
-                auto it = waiting.begin();
-                while (it != waiting.end() && running < limit) {
-                    auto goal = it->lock();
-                    it = waiting.erase(it);
-                    if (!goal)
-                        continue;
-                    wakeUp(goal);
-                    ++running;
-                }
-            };
-
-            wakeSlotWaiters(
-                wantingToSubstitute, getNrSubstitutions(), std::max<std::size_t>(1, settings.maxSubstitutionJobs));
-            wakeSlotWaiters(wantingToBuild, getNrLocalBuilds(), settings.maxBuildJobs);
+            auto running = getNrSubstitutions();
+            auto it = wantingToSubstitute.begin();
+            while (it != wantingToSubstitute.end() && running < std::max<std::size_t>(1, settings.maxSubstitutionJobs)) {
+                auto goal = it->lock();
+                it = wantingToSubstitute.erase(it);
+                if (!goal)
+                    continue;
+                wakeUp(goal);
+                ++running;
+            }
+
+            wakeBuildSlotWaiters();
         }
 
         if (topGoals.empty())
             break;
 
         /* Wait for input or completion callbacks. */
-        if (!children.empty() || !waitingForAWhile.empty() || !waitingForCompletion.empty())
+        if (!children.empty() || !waitingForAWhile.empty() || !waitingForCompletion.empty()) {
             waitForInput();
-        else if (awake.empty() && 0U == settings.maxBuildJobs) {
+            /* The system load may have changed in the meantime. */
+            if (admission.deferred)
+                wakeBuildSlotWaiters();
+        } else if (awake.empty() && 0U == settings.maxBuildJobs) {
             if (Machine::parseConfig({nix::settings.thisSystem}, nix::settings.getWorkerSettings().builders).empty())
                 throw Error(
                     "Unable to start any build; either increase '--max-jobs' or enable remote builds.\n"
@@ -369,6 +413,145 @@ void Worker::run(const Goals & _topGoals)
     assert(!settings.keepGoing || wantingToBuild.empty());
     assert(!settings.keepGoing || wantingToSubstitute.empty());
     assert(!settings.keepGoing || children.empty());
+
+    if (deferredBuilds)
+        printMsg(lvlTalkative, "deferred starting builds %d times because of system load", deferredBuilds);
+    if (oomKilledBuilds)
+        printMsg(lvlTalkative, "%d builds were killed by the out-of-memory killer", oomKilledBuilds);
+}
+
+/**
+ * The estimated duration of builds of packages that haven't been built
+ * before.
+ */
+static constexpr time_t defaultBuildDuration = 60;
+
+BuildDurations * Worker::getBuildDurations()
+{
+    if (!buildDurationsOpened) {
+        buildDurationsOpened = true;
+        try {
+            buildDurations = BuildDurations::get();
+        } catch (Error & e) {
+            debug("cannot open the build duration history: %s", e.msg());
+        }
+    }
+    return buildDurations.get();
+}
+
+time_t Worker::estimateBuildDuration(const BasicDerivation & drv)
+{
+    if (auto durations = getBuildDurations()) {
+        try {
+            if (auto duration = durations->lookup(BuildDurations::Key::fromDerivation(drv)))
+                return *duration;
+        } catch (Error & e) {
+            debug("cannot look up the build duration of '%s': %s", drv.name, e.msg());
+        }
+    }
+    return defaultBuildDuration;
+}
+
+void Worker::recordBuildDuration(const BasicDerivation & drv, time_t duration)
+{
+    if (auto durations = getBuildDurations()) {
+        try {
+            durations->record(BuildDurations::Key::fromDerivation(drv), duration);
+        } catch (Error & e) {
+            debug("cannot record the build duration of '%s': %s", drv.name, e.msg());
+        }
+    }
+}
+
+time_t Worker::criticalPath(Goal & goal, std::map<Goal *, time_t> & memo)
+{
+    if (auto i = memo.find(&goal); i != memo.end())
+        return i->second;
+
+    time_t rest = 0;
+    for (auto & i : goal.waiters)
+        if (auto waiter = i.lock())
+            rest = std::max(rest, criticalPath(*waiter, memo));
+
+    auto res = goal.estimatedDuration() + rest;
+    memo.emplace(&goal, res);
+    return res;
+}
+
+void Worker::wakeBuildSlotWaiters()
+{
+    std::map<Goal *, time_t> memo;
+
+    auto running = getNrLocalBuilds();
+
+    if (running < getMaxLocalBuilds() && !wantingToBuild.empty()) {
+        std::vector<GoalPtr> waiting;
+        for (auto & i : wantingToBuild)
+            if (auto goal = i.lock())
+                waiting.push_back(goal);
+        wantingToBuild.clear();
+
+        /* If there are more waiting goals than free slots, start the
+           ones that the most other work depends on first, rather than
+           letting a long chain of builds (like a compiler) start last. */
+        if (waiting.size() > getMaxLocalBuilds() - running)
+            std::ranges::stable_sort(
+                waiting, std::ranges::greater{}, [&](const GoalPtr & goal) { return criticalPath(*goal, memo); });
+
+        /* If the system load is too high, only wake up goals once it
+           has gone down. Woken goals check this again before starting
+           the build, so wake up only one at a time. */
+        bool deferred = !mayStartBuild();
+        if (deferred && !admission.deferred)
+            deferredBuilds++;
+        admission.deferred = deferred;
+
+        for (auto & goal : waiting) {
+            if (running < getMaxLocalBuilds() && !deferred) {
+                wakeUp(goal);
+                ++running;
+                deferred = admission.hasLoadLimits();
+            } else
+                addToWeakGoals(wantingToBuild, goal);
+        }
+    } else
+        admission.deferred = false;
+
+    updateEstimatedTime(memo);
+}
+
+void Worker::updateEstimatedTime(std::map<Goal *, time_t> & memo)
+{
+    if (derivationBuildingGoals.empty())
+        return;
+
+    auto now = steady_time_point::clock::now();
+
+    std::map<Goal *, time_t> elapsed;
+    for (auto & child : children)
+        elapsed[child.goal2] =
+            std::chrono::duration_cast<std::chrono::seconds>(now - child.timeStarted).count();
+
+    /* The remaining time is at least the longest critical path, and
+       at least the remaining work divided over the build slots. */
+    time_t longestPath = 0, totalWork = 0;
+
+    for (auto & [_, i] : derivationBuildingGoals) {
+        auto goal = i.lock();
+        if (!goal || goal->exitCode != Goal::ecBusy)
+            continue;
+        auto done = std::min(getOr(elapsed, goal.get(), 0), goal->estimatedDuration());
+        longestPath = std::max(longestPath, criticalPath(*goal, memo) - done);
+        totalWork += goal->estimatedDuration() - done;
+    }
+
+    auto estimate = std::max(longestPath, totalWork / (time_t) std::max<size_t>(1, settings.maxBuildJobs));
+
+    if (lastEstimatedTime && std::abs(estimate - *lastEstimatedTime) < 10)
+        return;
+
+    lastEstimatedTime = estimate;
+    act.result(resEstimatedTime, (uint64_t) estimate);
 }
 
 void Worker::waitForInput()
@@ -404,6 +587,10 @@ void Worker::waitForInput()
         if (0 != settings.buildTimeout)
             nearest = std::min(nearest, i.timeStarted + std::chrono::seconds(settings.buildTimeout));
     }
+    /* If builds are held back because of the system load, check it
+       again soon. */
+    if (admission.deferred)
+        nearest = std::min(nearest, before + std::chrono::seconds(1));
     if (nearest != steady_time_point::max()) {
         timeout = std::max(1L, (long) std::chrono::duration_cast<std::chrono::seconds>(nearest - before).count());
         useTimeout = true;
@@ -521,6 +708,110 @@ std::weak_ptr<Worker::Waker> Worker::getCrossThreadWaker()
     return wakerState.get_ptr();
 }
 
+std::future<void> Worker::startSubstitution(WeakGoalPtr goal, fun<fun<void()>()> fetch)
+{
+    /* Reusing threads rather than starting one per substitution
+       matters when substituting many small paths. */
+    if (!substitutionPool)
+        substitutionPool =
+            std::make_unique<boost::asio::thread_pool>(std::max(1U, (unsigned int) settings.maxSubstitutionJobs));
+
+    /* Decompressing and unpacking NARs is CPU-bound, so it gets a pool
+       sized to the machine. That way the number of concurrent
+       downloads can be far above the number of cores. */
+    if (!substitutionCpuPool) {
+        auto threads = getMaxCPU();
+        if (threads == 0)
+            threads = std::thread::hardware_concurrency();
+        substitutionCpuPool = std::make_unique<boost::asio::thread_pool>(std::max(1U, threads));
+    }
+
+    auto promise = std::make_shared<std::promise<void>>();
+    auto future = promise->get_future();
+
+    /* The CPU pool outlives the substitution pool (see ~Worker), so
+       it's safe to refer to it from the fetch. */
+    boost::asio::post(
+        *substitutionPool,
+        [goal, fetch, promise, cpuPool = substitutionCpuPool.get(), maybeWaker = getCrossThreadWaker()]() {
+            try {
+                ReceiveInterrupts receiveInterrupts;
+                auto restore = fetch();
+                boost::asio::post(*cpuPool, [goal, restore, promise, maybeWaker]() {
+                    std::exception_ptr ex;
+                    try {
+                        ReceiveInterrupts receiveInterrupts;
+                        restore();
+                    } catch (...) {
+                        ex = std::current_exception();
+                    }
+                    finishJob(*promise, ex, goal, maybeWaker);
+                });
+            } catch (...) {
+                finishJob(*promise, std::current_exception(), goal, maybeWaker);
+            }
+        });
+
+    return future;
+}
+
+RemoteBuilders & Worker::getRemoteBuilders()
+{
+    if (!remoteBuilders)
+        remoteBuilders = std::make_unique<RemoteBuilders>(
+            Machine::parseConfig({nix::settings.thisSystem}, settings.builders));
+    return *remoteBuilders;
+}
+
+std::future<void> Worker::startRemoteBuild(WeakGoalPtr goal, fun<void()> job)
+{
+    /* Remote builds spend most of their time waiting for the remote
+       machine, so every build slot gets a thread. */
+    if (!remoteBuildPool)
+        remoteBuildPool =
+            std::make_unique<boost::asio::thread_pool>(std::max(1U, getRemoteBuilders().totalSlots()));
+
+    return startJob(*remoteBuildPool, std::move(goal), std::move(job));
+}
+
+std::future<void> Worker::startJob(boost::asio::thread_pool & pool, WeakGoalPtr goal, fun<void()> job)
+{
+    auto promise = std::make_shared<std::promise<void>>();
+    auto future = promise->get_future();
+
+    /* The worker may be gone by the time the job finishes, so only
+       hold on to the waker weakly. */
+    boost::asio::post(pool, [goal, job, promise, maybeWaker = getCrossThreadWaker()]() {
+        std::exception_ptr ex;
+        try {
+            ReceiveInterrupts receiveInterrupts;
+            job();
+        } catch (...) {
+            ex = std::current_exception();
+        }
+        finishJob(*promise, ex, goal, maybeWaker);
+    });
+
+    return future;
+}
+
+void Worker::finishJob(
+    std::promise<void> & promise,
+    std::exception_ptr ex,
+    const WeakGoalPtr & goal,
+    const std::weak_ptr<Waker> & maybeWaker)
+{
+    if (ex)
+        promise.set_exception(ex);
+    else
+        promise.set_value();
+
+    /* N.B. if enqueueing to the waker throws, we better
+       std::terminate, since something has gone very wrong. */
+    if (auto waker = maybeWaker.lock())
+        waker->enqueue(goal);
+}
+
 void Worker::Waker::wakeAll(Worker & worker)
 {
     /* Wake up all goals that have been enqueued by asynchronous completion callbacks. */
@@ -557,9 +848,13 @@ bool Worker::pathContentsGood(const StorePath & path)
     printInfo("checking path '%s'...", store.printStorePath(path));
     auto info = store.queryPathInfo(path);
     bool res = false;
-    if (auto accessor = store.getFSAccessor(path, /*requireValidPath=*/false)) {
+    Hash nullHash(HashAlgorithm::SHA256);
+    /* The local store can skip hashing paths that haven't changed
+       since they were last verified. */
+    if (auto localStore = dynamic_cast<LocalStore *>(&store); localStore && info->narHash != nullHash)
+        res = localStore->pathContentsMatch(path, info->narHash);
+    else if (auto accessor = store.getFSAccessor(path, /*requireValidPath=*/false)) {
         auto current = hashPath({ref{accessor}}, FileIngestionMethod::NixArchive, info->narHash.algo).first;
-        Hash nullHash(HashAlgorithm::SHA256);
         res = info->narHash == nullHash || info->narHash == current;
     }
     pathContentsGoodCache.insert_or_assign(path, res);
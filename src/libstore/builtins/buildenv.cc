@@ -18,6 +18,12 @@ RegisterBuiltinBuilder::BuiltinBuilders & RegisterBuiltinBuilder::builtinBuilder
     return builders;
 }
 
+StringSet & RegisterBuiltinBuilder::inProcessBuiltinBuilders()
+{
+    static StringSet builders;
+    return builders;
+}
+
 namespace {
 
 struct State
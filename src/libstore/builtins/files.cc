@@ -0,0 +1,150 @@
+#include "nix/store/builtins.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/signals.hh"
+
+#include <nlohmann/json.hpp>
+
+namespace nix {
+
+/* These builders only write their outputs and only read their inputs,
+   so they can run in the worker process instead of in a sandbox (see
+   `BuiltinBuilderContext::inputPaths`). */
+
+static const std::string & getAttr(const BuiltinBuilderContext & ctx, const std::string & name)
+{
+    auto i = ctx.drv.env.find(name);
+    if (i == ctx.drv.env.end())
+        throw Error("attribute '%s' missing", name);
+    return i->second;
+}
+
+static bool getBoolAttr(const BuiltinBuilderContext & ctx, const std::string & name)
+{
+    auto value = get(ctx.drv.env, name);
+    return value && *value == "1";
+}
+
+/**
+ * Parse a path relative to the output. A leading slash is ignored, so
+ * that `/bin/foo` refers to `$out/bin/foo`.
+ */
+static std::filesystem::path parseRelativePath(std::string_view s)
+{
+    auto path = std::filesystem::path(s).relative_path();
+    if (path.empty())
+        throw Error("path '%s' is empty", s);
+    for (auto & component : path)
+        if (component == "." || component == "..")
+            throw Error("path '%s' must not contain '.' or '..'", s);
+    return path;
+}
+
+/**
+ * Return the real path of the input file `path`, checking that it's in
+ * the input closure if the builder runs in the worker process.
+ */
+static std::filesystem::path resolveInput(const BuiltinBuilderContext & ctx, const std::string & path)
+{
+    auto resolved = std::filesystem::canonical(path);
+
+    if (!ctx.inputPaths)
+        return resolved;
+
+    for (auto p = resolved; p != p.parent_path(); p = p.parent_path())
+        if (ctx.inputPaths->count(p))
+            return resolved;
+
+    throw Error("'%s' is not in the input closure of the derivation", path);
+}
+
+static void writeOutputFile(const std::filesystem::path & path, std::string_view contents, bool executable)
+{
+    writeFile(path, contents, 0444, FsSync::No, FinalSymlink::DontFollow);
+    chmod(path, executable ? 0555 : 0444);
+}
+
+/**
+ * Write the attribute `text` to `$out`, or to `$out/<destination>` if
+ * `destination` is set. The file is executable if `executable` is set.
+ */
+static void builtinWriteFile(const BuiltinBuilderContext & ctx)
+{
+    std::filesystem::path out{ctx.outputs.at("out")};
+    auto & text = getAttr(ctx, "text");
+    auto executable = getBoolAttr(ctx, "executable");
+
+    auto destination = get(ctx.drv.env, "destination");
+    if (!destination || destination->empty()) {
+        writeOutputFile(out, text, executable);
+        return;
+    }
+
+    auto target = out / parseRelativePath(*destination);
+    createDirs(target.parent_path());
+    chmod(out, 0755);
+    writeOutputFile(target, text, executable);
+}
+
+static RegisterBuiltinBuilder registerWriteFile("write-file", builtinWriteFile, true);
+
+/**
+ * Create a directory `$out` of symlinks from the attribute `links`,
+ * which is a JSON list of objects with a relative `name` and a
+ * `target`.
+ */
+static void builtinSymlinkFarm(const BuiltinBuilderContext & ctx)
+{
+    std::filesystem::path out{ctx.outputs.at("out")};
+
+    auto links = nlohmann::json::parse(getAttr(ctx, "links"));
+
+    createDir(out, 0755);
+    chmod(out, 0755);
+
+    /* Make sure that no link is created in a directory that is itself
+       a link, which would allow writing outside of the output. */
+    std::set<std::filesystem::path> created;
+
+    for (auto & link : links) {
+        checkInterrupt();
+
+        auto name = parseRelativePath(link.at("name").get<std::string>());
+        auto target = link.at("target").get<std::string>();
+
+        for (auto p = name.parent_path(); !p.empty(); p = p.parent_path())
+            if (created.count(p))
+                throw Error("symlink '%s' is inside symlink '%s'", name.string(), p.string());
+
+        if (!created.insert(name).second)
+            throw Error("duplicate symlink '%s'", name.string());
+
+        if (name.has_parent_path())
+            createDirs(out / name.parent_path());
+
+        /* This fails if an earlier link is inside this one. */
+        createSymlink(target, out / name);
+    }
+}
+
+static RegisterBuiltinBuilder registerSymlinkFarm("symlink-farm", builtinSymlinkFarm, true);
+
+/**
+ * Write the concatenation of the files in the attribute `srcs` to
+ * `$out`. The file is executable if `executable` is set.
+ */
+static void builtinConcatFiles(const BuiltinBuilderContext & ctx)
+{
+    std::filesystem::path out{ctx.outputs.at("out")};
+
+    std::string contents;
+    for (auto & src : tokenizeString<Strings>(getAttr(ctx, "srcs"))) {
+        checkInterrupt();
+        contents += readFile(resolveInput(ctx, src));
+    }
+
+    writeOutputFile(out, contents, getBoolAttr(ctx, "executable"));
+}
+
+static RegisterBuiltinBuilder registerConcatFiles("concat-files", builtinConcatFiles, true);
+
+} // namespace nix
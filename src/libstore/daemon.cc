@@ -16,6 +16,7 @@
 #include "nix/store/path-with-outputs.hh"
 #include "nix/util/finally.hh"
 #include "nix/util/archive.hh"
+#include "nix/util/compression.hh"
 #include "nix/store/derivations.hh"
 #include "nix/store/derivation/resolution.hh"
 #include "nix/store/derivation/aterm.hh"
@@ -312,6 +313,17 @@ struct ClientSettings
     }
 };
 
+/**
+ * Read the level at which the client wants the NAR(s) of the current
+ * operation to be compressed, if it supports compression.
+ */
+static unsigned int readNarCompressionLevel(WorkerProto::BasicServerConnection & conn)
+{
+    if (!conn.protoVersion.features.contains(WorkerProto::featureNarCompression))
+        return 0;
+    return std::min(readNum<unsigned int>(conn.from), WorkerProto::maxNarCompressionLevel);
+}
+
 static void performOp(
     TunnelLogger * logger,
     ref<Store> store,
@@ -536,10 +548,15 @@ static void performOp(
         conn.from >> repair >> dontCheckSigs;
         if (!trusted && dontCheckSigs)
             dontCheckSigs = false;
+        auto compressionLevel = readNarCompressionLevel(conn);
 
         logger->startWork();
         {
-            FramedSource source(conn.from);
+            FramedSource framedSource(conn.from);
+            auto decompressionSource = compressionLevel
+                                           ? makeDecompressionSource(CompressionAlgo::zstd, framedSource)
+                                           : nullptr;
+            Source & source = decompressionSource ? *decompressionSource : framedSource;
             auto expected = readNum<uint64_t>(source);
             for (uint64_t i = 0; i < expected; ++i) {
                 auto info = WorkerProto::Serialise<ValidPathInfo>::read(
@@ -915,6 +932,40 @@ static void performOp(
         break;
     }
 
+    case WorkerProto::Op::BatchQueryPathInfos: {
+        if (!conn.protoVersion.features.contains(WorkerProto::featureBatchQueryPathInfos))
+            throw Error(
+                "BatchQueryPathInfos requires the '%s' protocol feature", WorkerProto::featureBatchQueryPathInfos);
+        auto paths = WorkerProto::Serialise<StorePathSet>::read(*store, rconn);
+        logger->startWork();
+        auto infos = store->queryPathInfos(paths);
+        logger->stopWork();
+        conn.to << infos.size();
+        for (auto & [_, info] : infos)
+            WorkerProto::write(*store, wconn, *info);
+        break;
+    }
+
+    case WorkerProto::Op::QueryClosure: {
+        if (!conn.protoVersion.features.contains(WorkerProto::featureQueryClosure))
+            throw Error("QueryClosure requires the '%s' protocol feature", WorkerProto::featureQueryClosure);
+        auto paths = WorkerProto::Serialise<StorePathSet>::read(*store, rconn);
+        bool flipDirection, includeOutputs, includeDerivers;
+        conn.from >> flipDirection >> includeOutputs >> includeDerivers;
+        logger->startWork();
+        StorePathSet closure;
+        store->computeFSClosure(paths, closure, flipDirection, includeOutputs, includeDerivers);
+        auto infos = store->queryPathInfos(closure);
+        logger->stopWork();
+        /* Send the closure separately, since it may contain paths whose
+           info can't be looked up (e.g. if they were just deleted). */
+        WorkerProto::write(*store, wconn, closure);
+        conn.to << infos.size();
+        for (auto & [_, info] : infos)
+            WorkerProto::write(*store, wconn, *info);
+        break;
+    }
+
     case WorkerProto::Op::OptimiseStore:
         logger->startWork();
         store->optimiseStore();
@@ -946,9 +997,16 @@ static void performOp(
 
     case WorkerProto::Op::NarFromPath: {
         auto path = WorkerProto::Serialise<StorePath>::read(*store, rconn);
+        auto compressionLevel = readNarCompressionLevel(conn);
         logger->startWork();
         logger->stopWork();
-        store->narFromPath(path, conn.to);
+        if (compressionLevel) {
+            FramedSink framedSink(conn.to, []() {});
+            auto compressionSink = makeCompressionSink(CompressionAlgo::zstd, framedSink, false, compressionLevel);
+            store->narFromPath(path, *compressionSink);
+            compressionSink->finish();
+        } else
+            store->narFromPath(path, conn.to);
         break;
     }
 
@@ -970,9 +1028,14 @@ static void performOp(
             info.ultimate = false;
 
         if (conn.protoVersion >= WorkerProto::Version{.number = {1, 23}}) {
+            auto compressionLevel = readNarCompressionLevel(conn);
             logger->startWork();
             {
-                FramedSource source(conn.from);
+                FramedSource framedSource(conn.from);
+                auto decompressionSource = compressionLevel
+                                               ? makeDecompressionSource(CompressionAlgo::zstd, framedSource)
+                                               : nullptr;
+                Source & source = decompressionSource ? *decompressionSource : framedSource;
                 store->addToStore(info, source, (RepairFlag) repair, dontCheckSigs ? NoCheckSigs : CheckSigs);
             }
             logger->stopWork();
@@ -1164,6 +1227,9 @@ void processConnection(
     if (recursive == RecursiveFlag::NotRecursive) {
         logger = tunnelLogger;
         applyJSONLogger();
+        /* Note: `trace-file` is not applied here, since concurrent
+           connections would overwrite each other's trace. The client
+           traces the activities that we forward to it. */
     }
 
     unsigned int opCount = 0;
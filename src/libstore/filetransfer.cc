@@ -341,6 +341,13 @@ struct curlFileTransfer : public FileTransfer
             size_t realSize = size * nmemb;
             result.bodySize += realSize;
 
+            if (request.range && getHTTPStatus() == static_cast<long>(HttpStatus::Ok))
+                throw FileTransferError(
+                    FileTransfer::Misc,
+                    {},
+                    "server does not support range requests for '%s'",
+                    request.displayUri());
+
             if (!errorSink && !successfulStatuses.count(getHTTPStatus())) {
                 // In this case we want to construct a TeeSink, to keep
                 // the response around (which we figure won't be big
@@ -584,7 +591,7 @@ struct curlFileTransfer : public FileTransfer
                Skip for uploads (Accept-Encoding is meaningless when sending data)
                and when resuming from an offset (byte ranges don't work with
                compressed content). */
-            if (writtenToSink == 0 && !request.data)
+            if (writtenToSink == 0 && !request.data && !request.range)
                 /* Empty string means to enable all supported (that libcurl has
                    been linked to support) encodings. */
                 curl_easy_setopt(req, CURLOPT_ACCEPT_ENCODING, "");
@@ -680,7 +687,16 @@ struct curlFileTransfer : public FileTransfer
             curl_easy_setopt(req, CURLOPT_NETRC_FILE, fileTransfer.settings.netrcFile.get().string().c_str());
             curl_easy_setopt(req, CURLOPT_NETRC, CURL_NETRC_OPTIONAL);
 
-            if (writtenToSink)
+            if (request.range) {
+                assert(request.range->length > 0);
+                curl_easy_setopt(
+                    req,
+                    CURLOPT_RANGE,
+                    fmt("%d-%d",
+                        request.range->offset + writtenToSink,
+                        request.range->offset + request.range->length - 1)
+                        .c_str());
+            } else if (writtenToSink)
                 curl_easy_setopt(req, CURLOPT_RESUME_FROM_LARGE, writtenToSink);
 
             /* Note that the underlying strings get copied by libcurl, so the path -> string conversion is ok:
@@ -916,7 +932,7 @@ struct curlFileTransfer : public FileTransfer
                 // byte ranges AND the response to be uncompressed (the Range
                 // applies to the encoded stream, but the sink saw decoded bytes).
                 if (request.dataCallback && writtenToSink != 0)
-                    return acceptRanges && !hasContentEncoding;
+                    return (acceptRanges || request.range) && !hasContentEncoding;
                 return true;
             }();
 
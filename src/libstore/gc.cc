@@ -11,6 +11,7 @@
 #include "nix/util/serialise.hh"
 #include "nix/util/util.hh"
 #include "nix/util/file-system.hh"
+#include "nix/util/thread-pool.hh"
 #include "nix/store/posix-fs-canonicalise.hh"
 
 #include "store-config-private.hh"
@@ -354,6 +355,132 @@ void LocalStore::findRuntimeRoots(Roots & roots, bool censor)
 struct GCLimitReached
 {};
 
+/**
+ * Number of dead paths that the garbage collector invalidates in a
+ * single database transaction.
+ */
+static constexpr size_t gcBatchSize = 4096;
+
+/**
+ * An in-memory copy of the reference graph of all valid paths, used
+ * by the mark-and-sweep garbage collector. Paths are identified by
+ * their index in `paths`, and edges are stored in compressed sparse
+ * row form, so each edge costs only 4 bytes.
+ */
+struct GCGraph
+{
+    std::vector<StorePath> paths;
+
+    /**
+     * Indices into `paths`, sorted by hash part.
+     */
+    std::vector<uint32_t> byHashPart;
+
+    /**
+     * The references of path `i` (excluding itself) are `refs[j]` for
+     * `refsStart[i] <= j < refsStart[i + 1]`.
+     */
+    std::vector<uint32_t> refsStart, refs;
+
+    /**
+     * Other paths kept alive by path `i`, in the same format as
+     * `refs`: its deriver if `keep-derivations` is set, and its
+     * outputs if it is a derivation and `keep-outputs` is set.
+     */
+    std::vector<uint32_t> extraStart, extra;
+
+    std::optional<uint32_t> find(std::string_view hashPart) const
+    {
+        auto i = std::lower_bound(byHashPart.begin(), byHashPart.end(), hashPart, [&](uint32_t i, std::string_view h) {
+            return paths[i].hashPart() < h;
+        });
+        if (i == byHashPart.end() || paths[*i].hashPart() != hashPart)
+            return std::nullopt;
+        return *i;
+    }
+};
+
+/**
+ * Build the edge arrays `start` and `edges` of a `GCGraph` for `n`
+ * nodes. `forEachEdge` is called twice: once to count the edges of
+ * each node and once to fill them in.
+ */
+static void buildGCEdges(
+    size_t n,
+    std::vector<uint32_t> & start,
+    std::vector<uint32_t> & edges,
+    fun<void(fun<void(uint32_t from, uint32_t to)>)> forEachEdge)
+{
+    start.assign(n + 1, 0);
+    forEachEdge([&](uint32_t from, uint32_t to) { start[from + 1]++; });
+    for (size_t i = 0; i < n; ++i)
+        start[i + 1] += start[i];
+
+    edges.resize(start[n]);
+    auto next = start;
+    forEachEdge([&](uint32_t from, uint32_t to) {
+        /* The table may have changed between the two passes if
+           another process holds a write transaction, so be careful not
+           to overflow. */
+        if (next[from] < start[from + 1])
+            edges[next[from]++] = to;
+    });
+}
+
+static GCGraph loadGCGraph(SQLite & db, const StoreDirConfig & store, bool keepOutputs, bool keepDerivations)
+{
+    GCGraph graph;
+
+    /* Map database row ids to indices into `graph.paths`. */
+    boost::unordered_flat_map<int64_t, uint32_t> ids;
+
+    {
+        SQLiteStmt stmt(db, "select id, path from ValidPaths");
+        auto use(stmt.use());
+        while (use.next()) {
+            checkInterrupt();
+            ids.emplace(use.getInt(0), graph.paths.size());
+            graph.paths.push_back(store.parseStorePath(use.getStr(1)));
+        }
+    }
+
+    auto n = graph.paths.size();
+
+    graph.byHashPart.resize(n);
+    for (uint32_t i = 0; i < n; ++i)
+        graph.byHashPart[i] = i;
+    std::sort(graph.byHashPart.begin(), graph.byHashPart.end(), [&](uint32_t a, uint32_t b) {
+        return graph.paths[a].hashPart() < graph.paths[b].hashPart();
+    });
+
+    /* Run a query returning pairs of row ids, and call `f` on the
+       corresponding indices. */
+    auto queryEdges = [&](const std::string & sql, fun<void(uint32_t from, uint32_t to)> f) {
+        SQLiteStmt stmt(db, sql);
+        auto use(stmt.use());
+        while (use.next()) {
+            checkInterrupt();
+            auto from = ids.find(use.getInt(0));
+            auto to = ids.find(use.getInt(1));
+            if (from != ids.end() && to != ids.end() && from->second != to->second)
+                f(from->second, to->second);
+        }
+    };
+
+    buildGCEdges(n, graph.refsStart, graph.refs, [&](fun<void(uint32_t, uint32_t)> f) {
+        queryEdges("select referrer, reference from Refs", f);
+    });
+
+    buildGCEdges(n, graph.extraStart, graph.extra, [&](fun<void(uint32_t, uint32_t)> f) {
+        if (keepDerivations)
+            queryEdges("select v.id, d.id from ValidPaths v join ValidPaths d on v.deriver = d.path", f);
+        if (keepOutputs)
+            queryEdges("select o.drv, v.id from DerivationOutputs o join ValidPaths v on o.path = v.path", f);
+    });
+
+    return graph;
+}
+
 void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
 {
     const auto & gcSettings = config->getLocalSettings().getGCSettings();
@@ -376,9 +503,13 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
         // ignore suffixes like '.lock', '.chroot' and '.check'.
         boost::unordered_flat_set<std::string, StringViewHash, std::equal_to<>> tempRoots;
 
-        // Hash part of the store path currently being deleted, if
+        // Hash part of the store path currently being visited, if
         // any.
         std::optional<std::string> pending;
+
+        // Hash parts of the store paths currently being invalidated
+        // and moved out of the store directory.
+        boost::unordered_flat_set<std::string, StringViewHash, std::equal_to<>> pendingBatch;
     };
 
     Sync<Shared> _shared;
@@ -486,7 +617,7 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
                                    done. FIXME: ideally we would use a
                                    FD for this so we don't block the
                                    poll loop. */
-                                while (shared->pending == hashPart) {
+                                while (shared->pending == hashPart || shared->pendingBatch.contains(hashPart)) {
                                     debug("synchronising with deletion of path '%s'", path);
                                     shared.wait(wakeup);
                                 }
@@ -537,9 +668,29 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
     if (auto p = getEnv("_NIX_TEST_GC_SYNC_2"))
         readFile(*p);
 
-    /* Helper function that deletes a path from the store and throws
-       GCLimitReached if we've deleted enough garbage. */
-    auto deleteFromStore = [&](std::string_view baseName, bool isKnownPath) {
+    /* Dead paths are moved into this directory and deleted by
+       `deletionPool` in the background. Other garbage collectors skip
+       it because we hold a lock on it. */
+    std::optional<std::pair<std::filesystem::path, AutoCloseFD>> trashDir;
+
+    /* The number of bytes freed by completed deletions, and the
+       expected number of bytes freed by deletions still in progress. */
+    std::atomic<uint64_t> bytesFreed{0}, bytesPending{0};
+
+    ThreadPool deletionPool(gcSettings.gcDeleteJobs);
+
+    /* Helper function that throws GCLimitReached if we've deleted
+       enough garbage. */
+    auto checkLimit = [&]() {
+        if (bytesFreed + bytesPending > options.maxFreed) {
+            printInfo("deleted more than %d bytes; stopping", options.maxFreed);
+            throw GCLimitReached();
+        }
+    };
+
+    /* Helper function that deletes a path from the store. `narSize`
+       is the expected number of bytes freed, if known. */
+    auto deleteFromStore = [&](std::string_view baseName, bool isKnownPath, uint64_t narSize = 0) {
         assert(!std::filesystem::path(baseName).is_absolute());
         /* Using `std::string` since this is the logical store dir. Hopefully that is the right choice. */
         std::string path = storeDir + "/" + std::string(baseName);
@@ -561,18 +712,161 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
 
         results.paths.insert(path);
 
-        uint64_t bytesFreed;
-        deleteStorePath(realPath, bytesFreed, isKnownPath);
+        /* Moving the path out of the store directory is a single
+           rename(), after which the path can be recreated by others,
+           so the actual deletion doesn't have to block anyone. */
+        std::optional<std::filesystem::path> trashPath;
+        if (canDeleteInBackground()) {
+            if (!trashDir)
+                trashDir = createTempDirInStore();
+            try {
+                movePath(realPath, trashDir->first / std::string(baseName));
+                trashPath = trashDir->first / std::string(baseName);
+            } catch (SystemError & e) {
+                debug(
+                    "cannot move %s to %s, deleting it in place: %s",
+                    PathFmt(realPath),
+                    PathFmt(trashDir->first),
+                    e.msg());
+            }
+        }
+
+        if (!trashPath) {
+            uint64_t freed;
+            deleteStorePath(realPath, freed, isKnownPath);
+            bytesFreed += freed;
+            return;
+        }
+
+        bytesPending += narSize;
+
+        try {
+            deletionPool.enqueue([this, &bytesFreed, &bytesPending, trashPath{*trashPath}, isKnownPath, narSize]() {
+                uint64_t freed;
+                deleteStorePath(trashPath, freed, isKnownPath);
+                bytesFreed += freed;
+                bytesPending -= narSize;
+            });
+        } catch (ThreadPoolShutDown &) {
+            /* A previous deletion failed, so rethrow its exception. */
+            deletionPool.process();
+        }
+    };
 
+    /* Helper function that waits for all background deletions to
+       finish. */
+    auto finishDeletions = [&]() {
+        deletionPool.process();
+        if (trashDir) {
+            deletePath(trashDir->first);
+            trashDir.reset();
+        }
         results.bytesFreed += bytesFreed;
+        bytesFreed = 0;
+    };
+
+    boost::unordered_flat_map<StorePath, StorePathSet, std::hash<StorePath>> referrersCache;
 
-        if (results.bytesFreed > options.maxFreed) {
+    auto markAlive = [&](const StorePath & p) {
+        alive.insert(p);
+        try {
+            StorePathSet closure;
+            bool includeOutputs = false;
+            bool includeDerivers = false;
+            std::visit(
+                overloaded{
+                    [&](const GCOptions::WholeStore &) {
+                        includeOutputs = gcSettings.keepOutputs;
+                        includeDerivers = gcSettings.keepDerivations;
+                    },
+                    [](const GCOptions::SpecificPaths &) {},
+                },
+                options.pathsToDelete);
+            computeFSClosure(
+                p,
+                closure,
+                /* flipDirection */ false,
+                includeOutputs,
+                includeDerivers);
+            for (auto & c : closure)
+                alive.insert(c);
+        } catch (InvalidPath &) {
+        }
+    };
+
+    /* Dead paths that have not been invalidated and deleted yet, in
+       topological order (referrers first). */
+    std::vector<StorePath> batch;
+
+    /* Helper function that invalidates the paths in `batch` in a
+       single database transaction and deletes them. */
+    auto flushBatch = [&]() {
+        if (batch.empty())
+            return;
+
+        std::vector<StorePath> toDelete;
+        std::vector<StorePath> newRoots;
+
+        /* Re-check tempRoots before deleting and mark the paths as
+           pending to synchronise with addTempRoot. Between the BFS and
+           this point, new temproots may have been added via the GC
+           socket by a concurrent process (e.g. an evaluator calling
+           addTempRoot). The BFS only checks tempRoots when it first
+           visits a path, but the "pending" mechanism only blocks the
+           socket handler for the single path currently being visited,
+           not for paths already queued for deletion. */
+        {
+            auto shared(_shared.lock());
+            for (auto & path : batch) {
+                auto hashPart = std::string(path.hashPart());
+                if (shared->tempRoots.contains(hashPart)) {
+                    debug(
+                        "not deleting '%s' because it became a temporary root after initial scan",
+                        printStorePath(path));
+                    newRoots.push_back(path);
+                    continue;
+                }
+                shared->pendingBatch.insert(std::move(hashPart));
+                toDelete.push_back(path);
+            }
+        }
+
+        batch.clear();
+
+        /* Wake up any GC client waiting for deletion of these paths to
+           finish. */
+        Finally releasePending([&]() {
+            auto shared(_shared.lock());
+            shared->pendingBatch.clear();
+            wakeup.notify_all();
+        });
+
+        for (auto & path : newRoots)
+            markAlive(path);
+
+        /* Don't try to delete the closures of the new roots. */
+        std::erase_if(toDelete, [&](const StorePath & path) { return alive.contains(path); });
+
+        auto invalidated = invalidatePathsChecked(
+            toDelete, options.maxFreed - std::min<uint64_t>(options.maxFreed, bytesFreed + bytesPending));
+
+        for (auto & path : invalidated.inUse)
+            // If we end up here, it's likely a new occurrence
+            // of https://github.com/NixOS/nix/issues/11923
+            printError("BUG: cannot delete path '%s' because it is still in use", printStorePath(path));
+
+        for (auto & [path, narSize] : invalidated.paths) {
+            deleteFromStore(path.to_string(), true, narSize);
+            referrersCache.erase(path);
+        }
+
+        if (invalidated.limitReached) {
             printInfo("deleted more than %d bytes; stopping", options.maxFreed);
             throw GCLimitReached();
         }
-    };
 
-    boost::unordered_flat_map<StorePath, StorePathSet, std::hash<StorePath>> referrersCache;
+        checkLimit();
+    };
 
     /* Helper function that visits all paths reachable from `start`
        via the referrers edges and optionally derivers and derivation
@@ -595,33 +889,6 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
                 todo.push(path);
         };
 
-        auto markAlive = [&](const StorePath & p) {
-            alive.insert(p);
-            try {
-                StorePathSet closure;
-                bool includeOutputs = false;
-                bool includeDerivers = false;
-                std::visit(
-                    overloaded{
-                        [&](const GCOptions::WholeStore &) {
-                            includeOutputs = gcSettings.keepOutputs;
-                            includeDerivers = gcSettings.keepDerivations;
-                        },
-                        [](const GCOptions::SpecificPaths &) {},
-                    },
-                    options.pathsToDelete);
-                computeFSClosure(
-                    p,
-                    closure,
-                    /* flipDirection */ false,
-                    includeOutputs,
-                    includeDerivers);
-                for (auto & c : closure)
-                    alive.insert(c);
-            } catch (InvalidPath &) {
-            }
-        };
-
         enqueue(start);
 
         while (auto path = pop(todo)) {
@@ -715,44 +982,138 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
         for (auto & path : topoSortPaths(visited)) {
             if (!dead.insert(path).second)
                 continue;
+            if (shouldDelete)
+                batch.push_back(path);
+        }
+
+        if (batch.size() >= gcBatchSize)
+            flushBatch();
+    };
+
+    /* Alternative to calling maybeDeleteReferrersClosure() on every
+       entry in the store directory: load the whole reference graph,
+       mark everything reachable from the roots, and sweep the rest in
+       topological order. */
+    auto markAndSweep = [&]() {
+        printInfo("loading the reference graph...");
+
+        auto graph = retrySQLite<GCGraph>([&]() {
+            auto state(_state->lock());
+            SQLiteTxn txn(state->db);
+            auto graph = loadGCGraph(state->db, *this, gcSettings.keepOutputs, gcSettings.keepDerivations);
+            txn.commit();
+            return graph;
+        });
+
+        auto n = graph.paths.size();
+
+        /* Mark. */
+        std::vector<bool> marked(n, false);
+        std::vector<uint32_t> stack;
+
+        auto mark = [&](uint32_t i) {
+            if (!marked[i]) {
+                marked[i] = true;
+                stack.push_back(i);
+            }
+        };
+
+        for (auto & root : roots)
+            if (auto i = graph.find(root.hashPart()))
+                mark(*i);
+
+        for (auto & hashPart : _shared.lock()->tempRoots)
+            if (auto i = graph.find(hashPart))
+                mark(*i);
+
+        size_t liveCount = 0;
+
+        while (!stack.empty()) {
+            checkInterrupt();
+            auto i = stack.back();
+            stack.pop_back();
+            liveCount++;
+            for (auto j = graph.refsStart[i]; j < graph.refsStart[i + 1]; ++j)
+                mark(graph.refs[j]);
+            for (auto j = graph.extraStart[i]; j < graph.extraStart[i + 1]; ++j)
+                mark(graph.extra[j]);
+        }
+
+        printInfo("found %d live and %d dead store paths", liveCount, n - liveCount);
+
+        if (options.action == GCOptions::gcReturnLive)
+            for (uint32_t i = 0; i < n; ++i)
+                if (marked[i])
+                    alive.insert(graph.paths[i]);
+
+        /* Sweep the dead paths, referrers first. All referrers of a
+           dead path are dead, so this visits every dead path. Live
+           paths may have dead referrers, so they must not be counted
+           or visited. */
+        std::vector<uint32_t> referrerCount(n, 0);
+        for (uint32_t i = 0; i < n; ++i)
+            if (!marked[i])
+                for (auto j = graph.refsStart[i]; j < graph.refsStart[i + 1]; ++j)
+                    if (!marked[graph.refs[j]])
+                        referrerCount[graph.refs[j]]++;
+
+        for (uint32_t i = 0; i < n; ++i)
+            if (!marked[i] && referrerCount[i] == 0)
+                stack.push_back(i);
+
+        while (!stack.empty()) {
+            checkInterrupt();
+            auto i = stack.back();
+            stack.pop_back();
+
+            for (auto j = graph.refsStart[i]; j < graph.refsStart[i + 1]; ++j)
+                if (!marked[graph.refs[j]] && --referrerCount[graph.refs[j]] == 0)
+                    stack.push_back(graph.refs[j]);
+
+            auto & path = graph.paths[i];
+            dead.insert(path);
             if (shouldDelete) {
-                /* Re-check tempRoots before deleting and set pending
-                   to synchronise with addTempRoot. Between the BFS
-                   and this deletion loop, new temproots may have been
-                   added via the GC socket by a concurrent process
-                   (e.g. an evaluator calling addTempRoot). The BFS
-                   only checks tempRoots when it first visits a path,
-                   but the "pending" mechanism only blocks the socket
-                   handler for the single path currently being visited,
-                   not for paths already queued for deletion. */
-                {
-                    auto hashPart = std::string(path.hashPart());
-                    auto shared(_shared.lock());
-                    if (shared->tempRoots.contains(hashPart)) {
-                        debug(
-                            "not deleting '%s' because it became a temporary root after initial scan",
-                            printStorePath(path));
-                        markAlive(path);
-                        continue;
-                    }
-                    shared->pending = hashPart;
-                }
-                Finally resetPending([&]() {
-                    auto shared(_shared.lock());
-                    shared->pending.reset();
-                    wakeup.notify_all();
-                });
-                try {
-                    invalidatePathChecked(path);
-                    deleteFromStore(path.to_string(), true);
-                    referrersCache.erase(path);
-                } catch (PathInUse & e) {
-                    // If we end up here, it's likely a new occurrence
-                    // of https://github.com/NixOS/nix/issues/11923
-                    printError("BUG: %s", e.what());
+                batch.push_back(path);
+                if (batch.size() >= gcBatchSize)
+                    flushBatch();
+            }
+        }
+
+        flushBatch();
+
+        /* Delete everything in the store directory that isn't a valid
+           path. Paths that became valid after we loaded the graph must
+           be temporary roots, which flushBatch() takes care of. */
+        AutoCloseDir dir(opendir(config->realStoreDir.get().string().c_str()));
+        if (!dir)
+            throw SysError("opening directory %1%", PathFmt(config->realStoreDir.get()));
+
+        auto linksName = linksDir.filename();
+        struct dirent * dirent;
+        while (errno = 0, dirent = readdir(dir.get())) {
+            checkInterrupt();
+            std::string name = dirent->d_name;
+            if (name == "." || name == ".." || name == linksName)
+                continue;
+
+            if (auto storePath = maybeParseStorePath(storeDir + "/" + name)) {
+                if (auto i = graph.find(storePath->hashPart()); i && graph.paths[*i] == *storePath)
+                    continue;
+                if (_shared.lock()->tempRoots.contains(storePath->hashPart()))
+                    continue;
+                dead.insert(*storePath);
+                if (shouldDelete) {
+                    batch.push_back(*storePath);
+                    if (batch.size() >= gcBatchSize)
+                        flushBatch();
                 }
+            } else if (shouldDelete) {
+                deleteFromStore(name, false);
+                checkLimit();
             }
         }
+
+        flushBatch();
     };
 
     try {
@@ -775,15 +1136,20 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
                     for (auto & i : pathsToDelete.paths) {
                         maybeDeleteReferrersClosure(i);
 
-                        if (options.action == GCOptions::gcDeleteSpecific && !dead.contains(i))
+                        if (options.action == GCOptions::gcDeleteSpecific && !dead.contains(i)) {
+                            /* Still delete the paths we found so far. */
+                            flushBatch();
+                            finishDeletions();
                             throw Error(
                                 "Cannot delete path '%1%' since it is still alive. "
                                 "To find out why, use: "
                                 "nix-store --query --roots and nix-store --query --referrers",
                                 printStorePath(i));
-                        else if (!dead.contains(i))
+                        } else if (!dead.contains(i))
                             debug("cannot delete '%s' because it's still alive", printStorePath(i));
                     }
+
+                    flushBatch();
                 },
                 [&](const GCOptions::WholeStore & _) {
                     if (options.maxFreed == 0)
@@ -800,6 +1166,9 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
                         printInfo("determining live/dead paths...");
                     }
 
+                    if (gcSettings.gcMarkAndSweep)
+                        return markAndSweep();
+
                     AutoCloseDir dir(opendir(config->realStoreDir.get().string().c_str()));
                     if (!dir)
                         throw SysError("opening directory %1%", PathFmt(config->realStoreDir.get()));
@@ -817,9 +1186,13 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
 
                         if (auto storePath = maybeParseStorePath(storeDir + "/" + name))
                             maybeDeleteReferrersClosure(*storePath);
-                        else
+                        else {
                             deleteFromStore(name, false);
+                            checkLimit();
+                        }
                     }
+
+                    flushBatch();
                 },
             },
             options.pathsToDelete);
@@ -838,11 +1211,25 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
         return;
     }
 
+    /* All dead paths are now invalid and have been moved out of the
+       store directory, so other processes don't need to synchronise
+       with us anymore. Release the big GC lock before waiting for the
+       background deletions to finish. */
+    lockFile(fdGCLock.get(), ltNone, false);
+    gcLock.acquired = false;
+
+    /* Synchronisation point for testing, see tests/functional/gc-delete-jobs.sh. */
+    if (auto p = getEnv("_NIX_TEST_GC_SYNC_3"))
+        readFile(*p);
+
+    finishDeletions();
+
     /* Unlink all files in /nix/store/.links that have a link count of 1,
        which indicates that there are no other links and so they can be
        safely deleted.  FIXME: race condition with optimisePath(): we
        might see a link count of 1 just before optimisePath() increases
-       the link count. */
+       the link count. Since we no longer hold the GC lock, another
+       garbage collector may be deleting links at the same time. */
     if (options.action == GCOptions::gcDeleteDead || options.action == GCOptions::gcDeleteSpecific) {
         printInfo("deleting unused links...");
 
@@ -860,17 +1247,19 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
                 continue;
             auto path = linksDir / name;
 
-            auto st = lstat(path);
+            auto st = maybeLstat(path);
+            if (!st)
+                continue;
 
-            if (st.st_nlink != 1) {
-                actualSize += st.st_size;
-                unsharedSize += (st.st_nlink - 1) * st.st_size;
+            if (st->st_nlink != 1) {
+                actualSize += st->st_size;
+                unsharedSize += (st->st_nlink - 1) * st->st_size;
                 continue;
             }
 
             printMsg(lvlTalkative, "deleting unused link %1%", PathFmt(path));
 
-            unlink(path);
+            unlinkIfExists(path);
 
             /* Do not account for deleted file here. Rely on deletePath()
                accounting.  */
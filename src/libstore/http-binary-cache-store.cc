@@ -292,6 +292,25 @@ void HttpBinaryCacheStore::getFile(const std::string & path, Sink & sink)
     }
 }
 
+void HttpBinaryCacheStore::getFileRange(const std::string & path, uint64_t offset, uint64_t length, Sink & sink)
+{
+    if (!length)
+        return;
+    checkEnabled();
+    auto request(makeRequest(path));
+    request.range = {.offset = offset, .length = length};
+    try {
+        fileTransfer->download(std::move(request), sink);
+    } catch (FileTransferError & e) {
+        if (e.error == FileTransfer::NotFound || e.error == FileTransfer::Forbidden)
+            throw NoSuchBinaryCacheFile(
+                "file '%s' does not exist in binary cache '%s'", path, config->getHumanReadableURI());
+        /* Don't disable the binary cache here: this may just be a
+           server that doesn't support range requests. */
+        throw;
+    }
+}
+
 void HttpBinaryCacheStore::getFile(const std::string & path, Callback<std::optional<std::string>> callback) noexcept
 {
     auto callbackPtr = std::make_shared<decltype(callback)>(std::move(callback));
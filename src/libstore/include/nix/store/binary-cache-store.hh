@@ -2,6 +2,7 @@
 ///@file
 
 #include "nix/util/compression-settings.hh"
+#include "nix/util/nar-cache.hh"
 #include "nix/store/store-api.hh"
 #include "nix/store/log-store.hh"
 
@@ -37,6 +38,75 @@ public:
     Setting<bool> writeNARListing{
         this, false, "write-nar-listing", "Whether to write a JSON file that lists the files in each NAR."};
 
+    Setting<bool> writeNARFrameIndex{
+        this,
+        false,
+        "write-nar-frame-index",
+        R"(
+          Whether to write a JSON file that maps offsets in each NAR to offsets in the compressed NAR, one entry per zstd frame.
+          Together with the NAR listing (see `write-nar-listing`), this allows commands such as `nix store cat` to fetch individual files from the binary cache using HTTP range requests, rather than downloading the entire NAR.
+          This only has an effect if `compression` is `zstd`.
+        )"};
+
+    Setting<bool> narChunking{
+        this,
+        false,
+        "nar-chunking",
+        R"(
+          Whether to split NARs into content-defined chunks that are compressed and stored individually under `chunks/`, instead of storing each NAR as a single file.
+          The `.narinfo` file then refers to a manifest listing the chunks of the NAR, and its `FileSize` is the size of that manifest.
+
+          Chunks are shared between all NARs in the binary cache, so uploading a new version of a store path only uploads the chunks that changed.
+          Versions of Nix that don't support this layout cannot substitute from such a binary cache.
+        )"};
+
+    Setting<std::optional<AbsolutePath>> localChunkCache{
+        this,
+        std::nullopt,
+        "local-chunk-cache",
+        R"(
+          Path to a local cache of NAR chunks fetched from this binary cache, if it uses [`nar-chunking`](#store-http-binary-cache-store-nar-chunking).
+          Chunks in this cache are not downloaded again when substituting other store paths that contain them.
+        )"};
+
+    Setting<uint64_t> localChunkCacheSize{
+        this,
+        4ULL * 1024 * 1024 * 1024,
+        "local-chunk-cache-size",
+        R"(
+          Maximum size in bytes of the [`local-chunk-cache`](#store-http-binary-cache-store-local-chunk-cache) directory.
+          When it is exceeded after substituting a store path, the least recently used chunks are deleted.
+          0 means unlimited.
+        )"};
+
+    Setting<bool> writeNarDeltas{
+        this,
+        false,
+        "write-nar-deltas",
+        R"(
+          Whether to publish a delta from the previous version of each store path uploaded to this binary cache, i.e. the last uploaded path with the same name.
+          Clients that already have the previous version can then substitute the new one by downloading only the delta.
+          Deltas are only created for NARs of up to [`nar-delta-max-size`](#store-http-binary-cache-store-nar-delta-max-size), and only if they are smaller than the compressed NAR.
+        )"};
+
+    Setting<uint64_t> narDeltaMaxSize{
+        this,
+        128 * 1024 * 1024,
+        "nar-delta-max-size",
+        R"(
+          Maximum size in bytes of the NARs between which deltas are created or applied.
+          Both NARs are held in memory while doing so, and zstd needs a window that spans both of them.
+        )"};
+
+    Setting<bool> useNarDeltas{
+        this,
+        true,
+        "use-nar-deltas",
+        R"(
+          Whether to substitute store paths using deltas published by this binary cache (see [`write-nar-deltas`](#store-http-binary-cache-store-write-nar-deltas)) if the path they are relative to is valid in the local store.
+          The reconstructed NAR is verified against its NAR hash, and the full NAR is downloaded if that fails.
+        )"};
+
     Setting<bool> writeDebugInfo{
         this,
         false,
@@ -58,6 +128,37 @@ public:
         "local-nar-cache",
         "Path to a local cache of NARs fetched from this binary cache, used by commands such as `nix store cat`."};
 
+    Setting<uint64_t> localNarCacheSize{
+        this,
+        0,
+        "local-nar-cache-size",
+        R"(
+          Maximum size in bytes of the [`local-nar-cache`](#store-http-binary-cache-store-local-nar-cache) directory.
+          When it is exceeded, the least recently used NARs are deleted.
+          0 means unlimited.
+        )"};
+
+    Setting<uint64_t> narCacheSize{
+        this,
+        NarCache::Limits{}.maxMemorySize,
+        "nar-cache-size",
+        R"(
+          Maximum size in bytes of the NARs that commands such as `nix store cat` keep in memory.
+          NARs that are stored in the [`local-nar-cache`](#store-http-binary-cache-store-local-nar-cache) are read from there, so only their listing counts.
+          When it is exceeded, the least recently used NARs are dropped.
+          0 means unlimited.
+        )"};
+
+    Setting<size_t> narCacheOpenFiles{
+        this,
+        NarCache::Limits{}.maxOpenFiles,
+        "nar-cache-open-files",
+        R"(
+          Maximum number of NARs in the [`local-nar-cache`](#store-http-binary-cache-store-local-nar-cache) that commands such as `nix store cat` keep open.
+          When it is exceeded, the least recently used of them are dropped.
+          0 means unlimited.
+        )"};
+
     Setting<bool> parallelCompression{
         this,
         false,
@@ -100,6 +201,12 @@ private:
 
     std::vector<std::unique_ptr<Signer>> signers;
 
+    /**
+     * The NAR cache shared by all accessors returned by
+     * `getFSAccessor()`, created on first use.
+     */
+    Sync<std::shared_ptr<NarCache>> narCache;
+
 protected:
 
     /**
@@ -171,6 +278,13 @@ public:
 
     std::optional<std::string> getFile(const std::string & path);
 
+    /**
+     * Dump `length` bytes of the specified file, starting at `offset`,
+     * to a sink. The default implementation fetches the entire file
+     * and discards the rest.
+     */
+    virtual void getFileRange(const std::string & path, uint64_t offset, uint64_t length, Sink & sink);
+
 public:
 
     virtual void init() override;
@@ -181,6 +295,37 @@ private:
 
     std::string narInfoFileFor(const StorePath & storePath);
 
+    /**
+     * The file recording the last path with the given name that was
+     * uploaded, to be used as the base of deltas for later versions.
+     */
+    std::string deltaIndexFileFor(std::string_view name);
+
+    /**
+     * Create a delta for `narInfo` from the previous version of this
+     * path, if there is one, and add it to `narInfo.deltas`.
+     */
+    void addNarDelta(NarInfo & narInfo, std::string_view nar);
+
+    /**
+     * The path of the chunk with the given (uncompressed) hash, if
+     * `nar-chunking` is enabled.
+     */
+    std::string chunkPath(const Hash & hash);
+
+    /**
+     * Reassemble a NAR from the chunks listed in the manifest that
+     * `info.url` refers to.
+     */
+    void narFromChunks(const NarInfo & info, Sink & sink);
+
+    /**
+     * Delete the least recently used chunks from the
+     * `local-chunk-cache` directory until it fits in
+     * `local-chunk-cache-size`.
+     */
+    void trimChunkCache();
+
     void writeNarInfo(ref<NarInfo> narInfo);
 
     /**
@@ -203,6 +348,15 @@ private:
     ref<const ValidPathInfo> addToStoreCommon(
         Source & narSource, RepairFlag repair, CheckSigsFlag checkSigs, fun<ValidPathInfo(HashResult)> mkInfo);
 
+    /**
+     * Return an accessor for the NAR of `storePath` that fetches only
+     * the parts of the NAR that are actually read, using the NAR
+     * listing and, for zstd-compressed NARs, the frame index written
+     * by `uploadData()`. Returns nullptr if the binary cache doesn't
+     * have these for `storePath`.
+     */
+    std::shared_ptr<SourceAccessor> openSeekableNar(const StorePath & storePath);
+
     /**
      * Same as `getFSAccessor`, but with a more preceise return type.
      */
@@ -248,6 +402,10 @@ public:
 
     void narFromPath(const StorePath & path, Sink & sink) override;
 
+    void narFromPathWithBase(const StorePath & path, Store & baseStore, Sink & sink) override;
+
+    fun<void(Sink &)> fetchNar(const StorePath & path, Store & baseStore) override;
+
     ref<SourceAccessor> getFSAccessor(bool requireValidPath = true) override;
 
     std::shared_ptr<SourceAccessor> getFSAccessor(const StorePath &, bool requireValidPath = true) override;
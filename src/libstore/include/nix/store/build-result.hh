@@ -3,6 +3,7 @@
 
 #include <string>
 #include <chrono>
+#include <map>
 #include <optional>
 
 #include "nix/store/derived-path.hh"
@@ -193,6 +194,29 @@ struct BuildResult
      */
     std::optional<std::chrono::microseconds> cpuUser, cpuSystem;
 
+    /**
+     * Peak memory usage of the build in bytes.
+     */
+    std::optional<uint64_t> memoryPeak;
+
+    /**
+     * Bytes read from and written to block devices by the build.
+     */
+    std::optional<uint64_t> ioReadBytes, ioWriteBytes;
+
+    /**
+     * Time during which some processes of the build were stalled on
+     * the CPU, memory or I/O, according to the pressure stall
+     * information of its cgroup.
+     */
+    std::optional<std::chrono::microseconds> cpuStall, memoryStall, ioStall;
+
+    /**
+     * Wall time spent in each phase of the build, such as `inputs`,
+     * `setup`, `build`, `register` and `postBuildHook`.
+     */
+    std::map<std::string, std::chrono::microseconds> phaseTimes;
+
     bool operator==(const BuildResult &) const noexcept;
     std::strong_ordering operator<=>(const BuildResult &) const noexcept;
 };
@@ -270,6 +294,19 @@ struct ExitStatusFlags
     unsigned int failingExitStatus() const;
 };
 
+/**
+ * Return the resource usage of a build (its CPU, memory and I/O usage,
+ * stall times and phase times) as a JSON object. These fields are also
+ * part of the JSON representation of `BuildResult`.
+ */
+nlohmann::json buildResourcesToJSON(const BuildResult & br);
+
+/**
+ * Set the resource usage fields of `br` from a JSON object as returned
+ * by `buildResourcesToJSON()`. Missing fields are left unchanged.
+ */
+void buildResourcesFromJSON(BuildResult & br, const nlohmann::json & json);
+
 } // namespace nix
 
 JSON_IMPL(nix::BuildResult)
@@ -0,0 +1,102 @@
+#pragma once
+///@file
+
+#include "nix/util/types.hh"
+
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <string_view>
+
+namespace nix {
+
+struct WorkerSettings;
+
+/**
+ * Decides whether the worker may start another local build, based on
+ * the system load (see `max-cpu-pressure` and friends) and on builds
+ * that were killed by the out-of-memory killer.
+ */
+struct BuildAdmission
+{
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    const WorkerSettings & settings;
+
+    /**
+     * Return the system-wide pressure stall percentage of `resource`
+     * (`cpu`, `memory` or `io`), if the kernel reports it. Can be
+     * overridden for testing.
+     */
+    std::function<std::optional<double>(std::string_view resource)> getPressure;
+
+    /**
+     * Return the memory used by the builds in bytes, as reported by
+     * the cgroup of this process, if available. Can be overridden for
+     * testing.
+     */
+    std::function<std::optional<uint64_t>()> getBuildMemoryUsage;
+
+    /**
+     * Whether goals are waiting in `wantingToBuild` for the load to go
+     * down, rather than for a build slot. Maintained by the worker.
+     */
+    bool deferred = false;
+
+    BuildAdmission(const WorkerSettings & settings);
+
+    /**
+     * Whether any of the settings that limit local builds based on
+     * system load are enabled.
+     */
+    bool hasLoadLimits() const;
+
+    /**
+     * Whether the system load permits starting another local build at
+     * `now`, while `running` local builds are running. This doesn't
+     * check whether a build slot is free (see `maxBuilds()`). At least
+     * one build is always allowed.
+     */
+    bool mayStartBuild(size_t running, time_point now);
+
+    /**
+     * Record that a local build was started at `now`, so that its
+     * load can show up before the next one is started.
+     */
+    void buildStarted(time_point now);
+
+    /**
+     * Record that a build was killed by the out-of-memory killer while
+     * `running` other local builds were running. From then on, no more
+     * than that many builds (but at least one) run at the same time.
+     */
+    void buildKilledByOom(size_t running);
+
+    /**
+     * Return the number of local builds that may run at the same time,
+     * given `max-jobs`.
+     */
+    size_t maxBuilds(size_t maxJobs) const;
+
+private:
+
+    /**
+     * When the system load was last sampled, and whether it was low
+     * enough to start another build.
+     */
+    time_point lastSample = time_point::min();
+    bool allowed = true;
+
+    time_point lastStart = time_point::min();
+
+    std::optional<size_t> oomLimit;
+};
+
+/**
+ * Return the value in `limits` (a setting such as `cgroup-memory-high`)
+ * that applies to a build that requires `requiredFeatures`: that of
+ * the first required feature that has one, or else that of `default`.
+ */
+std::optional<std::string> getBuildResourceLimit(const StringMap & limits, const StringSet & requiredFeatures);
+
+} // namespace nix
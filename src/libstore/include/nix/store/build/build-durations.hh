@@ -0,0 +1,66 @@
+#pragma once
+///@file
+
+#include "nix/store/derivations.hh"
+#include "nix/util/ref.hh"
+
+#include <ctime>
+#include <filesystem>
+#include <optional>
+#include <string>
+
+namespace nix {
+
+/**
+ * A record of how long previous builds took, used by the worker to
+ * estimate how long a build will take.
+ *
+ * Builds are identified by the derivation's package name (without the
+ * version) and system, so that the history of a package carries over
+ * to new versions of it.
+ */
+struct BuildDurations
+{
+private:
+    /* VTable anchor to avoid weak linkage of the vtable - it breaks
+       dynamic_cast across shared libraries on Darwin. */
+    virtual void anchor();
+public:
+
+    struct Key
+    {
+        std::string name;
+        std::string system;
+
+        /**
+         * Use the `pname` attribute of the derivation if it has one,
+         * and otherwise its name with the version stripped.
+         */
+        static Key fromDerivation(const BasicDerivation & drv);
+    };
+
+    virtual ~BuildDurations() {}
+
+    /**
+     * Return the expected duration in seconds of a build of `key`, if
+     * it has been built before.
+     */
+    virtual std::optional<time_t> lookup(const Key & key) = 0;
+
+    /**
+     * Record that a build of `key` took `duration` seconds. The
+     * estimate is a moving average, so that it follows changes in the
+     * package or the machine.
+     */
+    virtual void record(const Key & key, time_t duration) = 0;
+
+    /**
+     * Return a singleton object that can be used concurrently by
+     * multiple threads.
+     */
+    static ref<BuildDurations> get();
+
+    static ref<BuildDurations> getTest(std::filesystem::path dbPath);
+};
+
+} // namespace nix
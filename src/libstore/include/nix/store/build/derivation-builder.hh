@@ -42,7 +42,13 @@ public:
 
     std::string extraMsgAfter;
 
-    BuilderFailureError(BuildResult::Failure::Status status, int builderStatus, std::string extraMsgAfter)
+    /**
+     * Whether the out-of-memory killer killed a process of the build.
+     */
+    bool oomKilled;
+
+    BuilderFailureError(
+        BuildResult::Failure::Status status, int builderStatus, std::string extraMsgAfter, bool oomKilled = false)
         : CloneableError{
             status,
               /* No message for now, because the caller will make for
@@ -51,6 +57,7 @@ public:
           }
         , builderStatus{std::move(builderStatus)}
         , extraMsgAfter{std::move(extraMsgAfter)}
+        , oomKilled{oomKilled}
     {
     }
 };
@@ -248,6 +255,14 @@ using DerivationBuilderUnique = std::unique_ptr<DerivationBuilder, DerivationBui
 DerivationBuilderUnique makeDerivationBuilder(
     LocalStore & store, std::shared_ptr<DerivationBuilderCallbacks> miscMethods, DerivationBuilderParams params);
 
+/**
+ * Make a builder that runs a builtin builder in
+ * `RegisterBuiltinBuilder::inProcessBuiltinBuilders()` in the worker
+ * process.
+ */
+DerivationBuilderUnique makeInProcessDerivationBuilder(
+    LocalStore & store, std::shared_ptr<DerivationBuilderCallbacks> miscMethods, DerivationBuilderParams params);
+
 /**
  * @param handler Must be chosen such that it supports the given
  * derivation.
@@ -10,6 +10,9 @@
 #include "nix/store/pathlocks.hh"
 #include "nix/store/build/goal.hh"
 #include "nix/store/build/build-log.hh"
+#include "nix/store/build/remote-builders.hh"
+
+#include <future>
 
 namespace nix {
 
@@ -59,6 +62,46 @@ private:
 
     std::unique_ptr<MaintainCount<uint64_t>> mcRunningBuilds;
 
+    /**
+     * Memoised result of estimatedDuration().
+     */
+    std::optional<time_t> cachedEstimatedDuration;
+
+    /**
+     * Whether the build was already retried after being killed by the
+     * out-of-memory killer.
+     */
+    bool retriedAfterOom = false;
+
+    /**
+     * The machine selected by `selectRemoteBuilder()`, if any.
+     */
+    RemoteBuilders::Host * remoteBuilder = nullptr;
+
+    /**
+     * The remote build started by `buildRemotely()`, while it runs.
+     */
+    std::future<void> remoteBuild;
+
+    struct RemoteBuildState
+    {
+        /**
+         * Set when the goal is cancelled, after which the job doesn't
+         * copy any outputs back.
+         */
+        bool cancelled = false;
+
+        /**
+         * Set by the job when it starts copying outputs back.
+         */
+        bool copyingOutputs = false;
+    };
+
+    /**
+     * Shared with the job of `remoteBuild`.
+     */
+    std::shared_ptr<Sync<RemoteBuildState>> remoteBuildState;
+
     std::string key() override;
 
     struct LocalBuildCapability
@@ -77,6 +120,9 @@ private:
         std::map<std::string, InitialOutput> initialOutputs,
         DerivationOptions<StorePath> drvOptions,
         PathLocks outputLocks);
+    Co buildRemotely(
+        StorePathSet inputPaths, std::map<std::string, InitialOutput> initialOutputs, PathLocks outputLocks);
+    Co finishRemoteBuild(std::map<std::string, InitialOutput> initialOutputs, PathLocks outputLocks);
     Co buildLocally(
         LocalBuildCapability localBuildCap,
         StorePathSet inputPaths,
@@ -87,7 +133,15 @@ private:
     /**
      * Is the build hook willing to perform the build?
      */
-    HookReply tryBuildHook(const DerivationOptions<StorePath> & drvOptions);
+    HookReply tryBuildHook(const DerivationOptions<StorePath> & drvOptions, const StorePathSet & inputPaths);
+
+    /**
+     * Select a machine for the build if `builders-in-process` is
+     * enabled, in which case it replaces the build hook.
+     */
+    HookReply selectRemoteBuilder(const DerivationOptions<StorePath> & drvOptions, const StorePathSet & inputPaths);
+
+    void cleanup() override;
 
     Done doneFailureLogTooLong(BuildLog & buildLog);
 
@@ -116,6 +170,8 @@ private:
     {
         return JobCategory::Build;
     };
+
+    time_t estimatedDuration() override;
 };
 
 } // namespace nix
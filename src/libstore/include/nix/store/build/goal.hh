@@ -632,6 +632,16 @@ public:
      */
     virtual JobCategory jobCategory() const = 0;
 
+    /**
+     * Hint for the scheduler: the expected number of seconds that this
+     * goal will occupy a job slot. Used to start goals on the critical
+     * path first.
+     */
+    virtual time_t estimatedDuration()
+    {
+        return 0;
+    }
+
 protected:
     Co await(Goals waitees);
 
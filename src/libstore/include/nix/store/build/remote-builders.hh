@@ -0,0 +1,145 @@
+#pragma once
+///@file
+
+#include "nix/store/build-result.hh"
+#include "nix/store/machines.hh"
+#include "nix/store/path.hh"
+#include "nix/util/sync.hh"
+
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace nix {
+
+class Store;
+
+/**
+ * The remote builders used by the worker when remote builds are
+ * dispatched in-process (see `builders-in-process`) rather than by
+ * the build hook.
+ *
+ * The worker thread selects machines and keeps track of their load.
+ * The builds themselves run on other threads, which share a single
+ * store per machine so that connections are reused between builds.
+ */
+struct RemoteBuilders
+{
+    struct Host
+    {
+        const Machine machine;
+
+        /**
+         * Number of builds currently dispatched to this machine. Only
+         * accessed by the worker thread.
+         */
+        unsigned int running = 0;
+
+        /**
+         * Cleared when connecting to the machine failed, so that no
+         * further builds are sent there.
+         */
+        std::atomic<bool> enabled = true;
+
+        Host(Machine machine);
+
+        /**
+         * Return the store of the machine, connecting to it on first
+         * use.
+         */
+        ref<Store> getStore();
+
+        /**
+         * Break the connections to the machine, so that the builds
+         * that are using them fail promptly rather than running to
+         * completion. Called when the worker gives up on those builds.
+         */
+        void shutdown();
+
+        /**
+         * Copy those `paths` that the machine doesn't have yet to it.
+         * Paths that have been copied to or from the machine before,
+         * or that it reported as valid, are skipped without asking it.
+         */
+        void copyInputs(Store & localStore, const StorePathSet & paths, bool useSubstitutes);
+
+        /**
+         * Record that the machine has `paths`.
+         */
+        void addKnownPaths(const StorePathSet & paths);
+
+        /**
+         * Return the total size of those `paths` (mapped to their NAR
+         * size) that are not known to be on the machine.
+         */
+        uint64_t bytesToCopy(const std::map<StorePath, uint64_t> & paths);
+
+        /**
+         * Return the estimated time in seconds to copy `bytes` to the
+         * machine, based on the throughput of previous copies.
+         */
+        double estimateCopyTime(uint64_t bytes);
+
+    private:
+
+        Sync<std::shared_ptr<Store>> store_;
+
+        Sync<StorePathSet> knownPaths;
+
+        /**
+         * Moving average of the upload throughput in bytes per second.
+         */
+        Sync<double> uploadRate;
+
+        void recordUpload(uint64_t bytes, std::chrono::steady_clock::duration elapsed);
+    };
+
+    std::vector<std::unique_ptr<Host>> hosts;
+
+    RemoteBuilders(const Machines & machines);
+
+    /**
+     * The total number of builds that may run on all machines at once.
+     */
+    unsigned int totalSlots() const;
+
+    /**
+     * Select the machine with a free build slot that can build
+     * derivations for `system` with `requiredFeatures` soonest.
+     *
+     * Machines are ranked by the estimated time to copy those of the
+     * `inputs` (mapped to their NAR size) that they don't have yet,
+     * plus the estimated build time `duration` adjusted for their
+     * speed factor and load.
+     *
+     * @param rightType Set if some enabled machine can build the
+     * derivation, even if none of them have a free slot.
+     */
+    Host * select(
+        std::string_view system,
+        const StringSet & requiredFeatures,
+        const std::map<StorePath, uint64_t> & inputs,
+        time_t duration,
+        bool & rightType);
+};
+
+/**
+ * Build the derivation `drvPath` on `remoteStore`, to which `inputs`
+ * have already been copied, and copy those of its outputs named in
+ * `wantedOutputs` that `localStore` doesn't have back. Nothing is
+ * copied if the build failed, or if `mayCopyOutputs` is set and
+ * returns false.
+ */
+BuildResult buildOnRemoteStore(
+    Store & localStore,
+    Store & remoteStore,
+    const StorePath & drvPath,
+    const StorePathSet & inputs,
+    const StringSet & wantedOutputs,
+    std::function<bool()> mayCopyOutputs = {});
+
+} // namespace nix
@@ -23,9 +23,10 @@ struct PathSubstitutionGoal : public Goal
     RepairFlag repair;
 
     /**
-     * The substituter thread.
+     * The outcome of copying the path from the substituter, which
+     * runs on one of the worker's substitution threads.
      */
-    std::thread thr;
+    std::future<void> job;
 
     std::unique_ptr<MaintainCount<uint64_t>> maintainExpectedSubstitutions, maintainRunningSubstitutions,
         maintainExpectedNar, maintainExpectedDownload;
@@ -6,6 +6,7 @@
 #include "nix/store/build.hh"
 #include "nix/store/derived-path-map.hh"
 #include "nix/store/build/goal.hh"
+#include "nix/store/build/build-admission.hh"
 #include "nix/store/build-result.hh"
 #include "nix/store/realisation.hh"
 #include "nix/util/muxable-pipe.hh"
@@ -15,10 +16,16 @@
 #include <thread>
 #include <queue>
 
+namespace boost::asio {
+class thread_pool;
+}
+
 namespace nix {
 
 /* Forward definition. */
 struct WorkerSettings;
+struct BuildDurations;
+struct RemoteBuilders;
 struct DerivationTrampolineGoal;
 struct DerivationGoal;
 struct DerivationResolutionGoal;
@@ -181,6 +188,47 @@ private:
      */
     std::map<StorePath, bool> pathContentsGoodCache;
 
+    /**
+     * History of build durations, opened on first use. Null if it
+     * couldn't be opened.
+     */
+    std::shared_ptr<BuildDurations> buildDurations;
+
+    bool buildDurationsOpened = false;
+
+    /**
+     * The last estimate of the remaining build time that was reported
+     * to the logger.
+     */
+    std::optional<time_t> lastEstimatedTime;
+
+    /**
+     * Admission of local builds based on system load, see
+     * `mayStartBuild()`.
+     */
+    BuildAdmission admission;
+
+    /**
+     * Return the estimated time in seconds until `goal` and the goals
+     * waiting for it, transitively, are done. `memo` caches the result
+     * for every goal visited.
+     */
+    time_t criticalPath(Goal & goal, std::map<Goal *, time_t> & memo);
+
+    /**
+     * Wake up goals waiting for a build slot while slots are free,
+     * starting with the ones with the longest critical path.
+     */
+    void wakeBuildSlotWaiters();
+
+    /**
+     * Report the estimated time until all builds are done to the
+     * logger, if it changed significantly.
+     */
+    void updateEstimatedTime(std::map<Goal *, time_t> & memo);
+
+    BuildDurations * getBuildDurations();
+
     class Waker
     {
 #ifndef _WIN32
@@ -217,6 +265,40 @@ private:
      */
     ref<Waker> wakerState;
 
+    /**
+     * Threads on which substitutions fetch paths from substituters.
+     * Created on first use, with `max-substitution-jobs` threads.
+     */
+    std::unique_ptr<boost::asio::thread_pool> substitutionPool;
+
+    /**
+     * Threads on which fetched paths are decompressed and added to
+     * the store. Created on first use, with one thread per core.
+     */
+    std::unique_ptr<boost::asio::thread_pool> substitutionCpuPool;
+
+    /**
+     * The machines that builds are sent to if `builders-in-process`
+     * is enabled, and the threads on which those builds run. Created
+     * on first use.
+     */
+    std::unique_ptr<RemoteBuilders> remoteBuilders;
+    std::unique_ptr<boost::asio::thread_pool> remoteBuildPool;
+
+    /**
+     * Run `job` on `pool`, and wake up `goal` when it has finished.
+     */
+    std::future<void> startJob(boost::asio::thread_pool & pool, WeakGoalPtr goal, fun<void()> job);
+
+    /**
+     * Store the outcome of a job in `promise`, and wake up `goal`.
+     */
+    static void finishJob(
+        std::promise<void> & promise,
+        std::exception_ptr ex,
+        const WeakGoalPtr & goal,
+        const std::weak_ptr<Waker> & maybeWaker);
+
 public:
 
     const Activity act;
@@ -254,6 +336,13 @@ public:
     uint64_t failedBuilds = 0;
     uint64_t runningBuilds = 0;
 
+    /**
+     * Number of times a local build was held back because of system
+     * load, and number of builds killed by the out-of-memory killer.
+     */
+    uint64_t deferredBuilds = 0;
+    uint64_t oomKilledBuilds = 0;
+
     uint64_t expectedSubstitutions = 0;
     uint64_t doneSubstitutions = 0;
     uint64_t failedSubstitutions = 0;
@@ -340,6 +429,24 @@ public:
      */
     std::weak_ptr<Waker> getCrossThreadWaker();
 
+    /**
+     * Run `fetch` on a substitution thread, then run the function it
+     * returns on a CPU thread, and wake up `goal` when that has
+     * finished. The returned future holds the outcome of either.
+     */
+    std::future<void> startSubstitution(WeakGoalPtr goal, fun<fun<void()>()> fetch);
+
+    /**
+     * Return the machines for `builders-in-process`.
+     */
+    RemoteBuilders & getRemoteBuilders();
+
+    /**
+     * Run `job`, which performs a remote build, on a thread of its
+     * own, and wake up `goal` when it has finished.
+     */
+    std::future<void> startRemoteBuild(WeakGoalPtr goal, fun<void()> job);
+
     /**
      * Return the number of local build processes currently running (but not
      * remote builds via the build hook).
@@ -384,6 +491,27 @@ public:
      */
     void waitForBuildSlot(GoalPtr goal);
 
+    /**
+     * Whether the system load permits starting another local build,
+     * according to `max-cpu-pressure`, `max-memory-pressure`,
+     * `max-io-pressure` and `max-build-memory`. This doesn't check
+     * whether a build slot is free.
+     */
+    bool mayStartBuild();
+
+    /**
+     * Return the number of local builds that may run at the same time.
+     * This is `max-jobs`, unless builds were killed by the
+     * out-of-memory killer.
+     */
+    size_t getMaxLocalBuilds();
+
+    /**
+     * Record that a local build was killed by the out-of-memory
+     * killer, and run fewer builds at the same time from now on.
+     */
+    void buildKilledByOom();
+
     /**
      * Wait for a few seconds and then retry this goal.  Used when
      * waiting for a lock held by another process.  This kind of
@@ -415,6 +543,14 @@ public:
 
     void markContentsGood(const StorePath & path);
 
+    /**
+     * Return the expected duration of a build of `drv` in seconds,
+     * based on previous builds of the same package.
+     */
+    time_t estimateBuildDuration(const BasicDerivation & drv);
+
+    void recordBuildDuration(const BasicDerivation & drv, time_t duration);
+
     void updateProgress()
     {
         actDerivations.progress(doneBuilds, expectedBuilds + doneBuilds, runningBuilds, failedBuilds);
@@ -19,6 +19,13 @@ struct BuiltinBuilderContext
     Strings hashedMirrors;
     std::filesystem::path tmpDirInSandbox;
 
+    /**
+     * The real paths of the input closure, if the builder runs in the
+     * worker process rather than in a sandbox. It must not read any
+     * other files.
+     */
+    std::optional<std::set<std::filesystem::path>> inputPaths;
+
 #if NIX_WITH_AWS_AUTH
     /**
      * Pre-resolved AWS credentials for S3 URLs in builtin:fetchurl.
@@ -36,9 +43,19 @@ struct RegisterBuiltinBuilder
 
     static BuiltinBuilders & builtinBuilders();
 
-    RegisterBuiltinBuilder(const std::string & name, BuiltinBuilder && builder)
+    /**
+     * The names of the builtin builders that can run in the worker
+     * process, without forking or setting up a sandbox. Such builders
+     * must only write their outputs and must only read the paths in
+     * `BuiltinBuilderContext::inputPaths`.
+     */
+    static StringSet & inProcessBuiltinBuilders();
+
+    RegisterBuiltinBuilder(const std::string & name, BuiltinBuilder && builder, bool inProcess = false)
     {
         builtinBuilders().insert_or_assign(name, std::move(builder));
+        if (inProcess)
+            inProcessBuiltinBuilders().insert(name);
     }
 };
 
@@ -273,6 +273,19 @@ struct FileTransferRequest
      */
     std::optional<std::filesystem::path> tlsKey;
 
+    struct ByteRange
+    {
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    /**
+     * If set, only download the given (non-empty) range of bytes,
+     * using an HTTP `Range` request. The transfer fails if the server
+     * responds with the entire file instead.
+     */
+    std::optional<ByteRange> range;
+
     struct UploadData
     {
         UploadData(StringSource & s)
@@ -5,6 +5,7 @@
 #include "nix/store/ssh.hh"
 #include "nix/util/callback.hh"
 #include "nix/util/pool.hh"
+#include "nix/util/sync.hh"
 #include "nix/store/serve-protocol.hh"
 
 namespace nix {
@@ -37,6 +38,16 @@ public:
 
     Setting<int> maxConnections{this, 1, "max-connections", "Maximum number of concurrent SSH connections."};
 
+    Setting<unsigned int> narCompressionLevel{
+        this,
+        0,
+        "nar-compression-level",
+        R"(
+          If nonzero, NARs copied to and from the remote machine are compressed with zstd at this level.
+          This is usually much faster than SSH's own compression (see [`compress`](#store-ssh-compress)).
+          It only has an effect if the remote Nix supports it; otherwise NARs are sent uncompressed.
+        )"};
+
     /**
      * Hack for hydra
      */
@@ -78,12 +89,25 @@ public:
 
     ref<Pool<Connection>> connections;
 
+    /**
+     * All connections that have been opened, for
+     * `shutdownConnections()`.
+     */
+    Sync<std::vector<std::weak_ptr<Connection>>> allConnections;
+
     SSHMaster master;
 
     LegacySSHStore(ref<const Config>);
 
     ref<Connection> openConnection();
 
+    /**
+     * Kill the SSH processes of all connections (both idle and in-use)
+     * to break any blocking I/O, like
+     * `RemoteStore::shutdownConnections()`.
+     */
+    void shutdownConnections();
+
     void queryPathInfoUncached(
         const StorePath & path, Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept override;
 
@@ -146,6 +146,12 @@ private:
     void queryPathInfoUncached(
         const StorePath & path, Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept override;
 
+    /**
+     * Check lower store for the paths the upper DB does not have.
+     */
+    std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+    queryPathInfosUncached(const StorePathSet & paths) override;
+
     /**
      * Check lower store if upper DB does not have.
      *
@@ -164,6 +170,22 @@ private:
      */
     StorePathSet queryValidDerivers(const StorePath & path) override;
 
+    using Store::computeFSClosure;
+
+    /**
+     * Use the generic traversal, which goes through the overrides
+     * above, since the closure may span both stores.
+     */
+    void computeFSClosure(
+        const StorePathSet & paths,
+        StorePathSet & out,
+        bool flipDirection = false,
+        bool includeOutputs = false,
+        bool includeDerivers = false) override
+    {
+        Store::computeFSClosure(paths, out, flipDirection, includeOutputs, includeDerivers);
+    }
+
     /**
      * Check lower store if upper DB does not have.
      */
@@ -192,6 +214,15 @@ private:
      */
     void deleteStorePath(const std::filesystem::path & path, uint64_t & bytesFreed, bool isKnownPath) override;
 
+    /**
+     * Moving a store object out of the merged directory would copy it
+     * up or create a whiteout, so always delete via `deleteStorePath`.
+     */
+    bool canDeleteInBackground() override
+    {
+        return false;
+    }
+
     /**
      * Deduplicate by removing store objects from the upper layer that
      * are now in the lower layer.
@@ -126,6 +126,44 @@ public:
         "min-free-check-interval",
         "Number of seconds between checking free disk space.",
     };
+
+    Setting<bool> gcMarkAndSweep{
+        this,
+        false,
+        "gc-mark-and-sweep",
+        R"(
+          If `true`, a garbage collection of the whole store loads the
+          references of all valid store paths from the Nix database into
+          memory at once, marks everything reachable from the roots and
+          deletes the rest. If `false` (the default), the garbage
+          collector instead queries the referrers of each store path
+          individually.
+
+          Both strategies delete the same paths and honour
+          [`keep-outputs`](#conf-keep-outputs) and
+          [`keep-derivations`](#conf-keep-derivations) in the same way.
+          Mark-and-sweep is much faster on stores with millions of valid
+          paths, at the cost of holding the reference graph in memory
+          (roughly 100 bytes per valid path).
+
+          This option does not affect deleting explicit paths.
+        )",
+    };
+
+    Setting<unsigned int> gcDeleteJobs{
+        this,
+        0,
+        "gc-delete-jobs",
+        R"(
+          The number of threads the garbage collector uses to delete the
+          files of dead store paths. Dead paths are first invalidated in
+          batches and moved out of the store directory, and then deleted
+          in the background while the collector continues looking for
+          garbage.
+
+          If set to `0` (the default), Nix uses the number of CPU cores.
+        )",
+    };
 };
 
 const uint32_t maxIdsPerBuild =
@@ -268,6 +306,37 @@ public:
     Setting<size_t> narBufferSize{
         this, 32 * 1024 * 1024, "nar-buffer-size", "Maximum size of NARs before spilling them to disk."};
 
+    Setting<unsigned int> verifyJobs{
+        this,
+        0,
+        "verify-jobs",
+        R"(
+          The number of threads used by `nix-store --verify --check-contents`
+          to hash store paths concurrently. Paths are hashed in the order of
+          their inode numbers, which approximates their on-disk locality.
+
+          If set to `0` (the default), Nix uses the number of CPU cores.
+          Set this to `1` to hash paths sequentially, e.g. on rotational
+          disks where concurrent reads cause excessive seeking.
+        )"};
+
+    Setting<bool> cacheVerifiedHashes{
+        this,
+        true,
+        "cache-verified-hashes",
+        R"(
+          If set to `true` (the default), Nix records in its database the
+          file metadata (inode numbers, change times, sizes and modes) of
+          store paths whose contents it has hashed and found to be correct
+          during `nix-store --verify --check-contents` or `--repair`. When
+          such a path is checked again and its metadata hasn't changed, Nix
+          skips hashing its contents.
+
+          Set this to `false` to always hash the contents, e.g. if you
+          suspect corruption that doesn't change file metadata, such as
+          bit rot on the underlying disk.
+        )"};
+
     Setting<bool> allowSymlinkedStore{
         this,
         false,
@@ -349,6 +418,34 @@ public:
           Cgroups are required and enabled automatically for derivations
           that require the `uid-range` system feature.
         )"};
+
+    Setting<StringMap> cgroupMemoryHigh{
+        this,
+        {},
+        "cgroup-memory-high",
+        R"(
+          The [`memory.high`](https://docs.kernel.org/admin-guide/cgroup-v2.html#memory-interface-files) limit to set on the cgroup of a build, depending on the [system features](#conf-system-features) that the derivation requires.
+          This is a list of `feature=limit` pairs, where the first feature in alphabetical order that the derivation requires determines the limit.
+          The feature `default` applies to derivations that don't require any of the listed features.
+          For example:
+
+          ```
+          cgroup-memory-high = big-parallel=64G default=8G
+          ```
+
+          Builds that exceed the limit are throttled and put under memory reclaim pressure, rather than killed.
+          This only has an effect if builds run in cgroups (see [`use-cgroups`](#conf-use-cgroups)) and the memory controller is available to them.
+        )"};
+
+    Setting<StringMap> cgroupCpuWeight{
+        this,
+        {},
+        "cgroup-cpu-weight",
+        R"(
+          Like [`cgroup-memory-high`](#conf-cgroup-memory-high), but for the [`cpu.weight`](https://docs.kernel.org/admin-guide/cgroup-v2.html#cpu-interface-files) of the cgroup of a build, which determines its share of CPU time relative to other builds.
+          The weight ranges from 1 to 10000, and defaults to 100.
+          For example, `cgroup-cpu-weight = big-parallel=400` gives builds that require `big-parallel` four times the CPU time of other builds when the CPUs are contended.
+        )"};
 #endif
 
     Setting<bool> impersonateLinux26{
@@ -454,6 +551,52 @@ public:
             description of the `size` option of `tmpfs` in mount(8). The default
             is `50%`.
         )"};
+
+    Setting<bool> sandboxStoreView{
+        this,
+        false,
+        "sandbox-store-view",
+        R"(
+            *Linux only*
+
+            If set to `true`, the input closure of a sandboxed build is made
+            available in the sandbox through a single overlay filesystem mount,
+            rather than by bind-mounting every store path separately. This
+            makes setting up the sandbox much faster for derivations with large
+            closures. The sandbox still only contains the store paths in the
+            input closure.
+
+            This requires Nix to run as root, a kernel that supports
+            `fsopen(2)`, and the [`build-dir`](#conf-build-dir) to be on the
+            same file system as the Nix store. If these requirements are not
+            met, Nix falls back to bind-mounting every store path.
+        )"};
+
+    Setting<bool> sandboxNamespacePool{
+        this,
+        false,
+        "sandbox-namespace-pool",
+        R"(
+            *Linux only*
+
+            If set to `true`, the network namespace of a sandboxed build is
+            created when a [build user](#conf-build-users-group) is first
+            used, and reused by later builds of that build user, rather than
+            being created and destroyed for every build. Destroying network
+            namespaces is expensive, so this considerably reduces the
+            overhead of small builds.
+
+            Builds cannot change the configuration of a reused network
+            namespace, since they don't own it. Builds that use the
+            `uid-range` system feature always get a fresh network namespace.
+
+            The namespaces are only reused within a single process. The
+            Nix daemon handles each client connection in a separate
+            process, so each invocation of a command such as `nix build`
+            starts with no namespaces to reuse. This mostly helps commands
+            that perform many builds, rather than many commands that each
+            perform a few builds.
+        )"};
 #endif
 
 #if defined(__linux__) || defined(__FreeBSD__)
@@ -253,9 +253,11 @@ private:
 public:
 
     /**
-     * Hack for build-remote.cc.
+     * Paths whose locks are held by the caller, so that adding them
+     * doesn't try to lock them again. Hack for copying the outputs of
+     * remote builds.
      */
-    PathSet locksHeld;
+    Sync<PathSet> locksHeld;
 
     /**
      * Initialise the local store, upgrading the schema if
@@ -278,10 +280,22 @@ public:
     void queryPathInfoUncached(
         const StorePath & path, Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept override;
 
+    std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+    queryPathInfosUncached(const StorePathSet & paths) override;
+
     void queryReferrers(const StorePath & path, StorePathSet & referrers) override;
 
     StorePathSet queryValidDerivers(const StorePath & path) override;
 
+    using Store::computeFSClosure;
+
+    void computeFSClosure(
+        const StorePathSet & paths,
+        StorePathSet & out,
+        bool flipDirection = false,
+        bool includeOutputs = false,
+        bool includeDerivers = false) override;
+
     std::map<std::string, std::optional<StorePath>>
     queryStaticPartialDerivationOutputMap(const StorePath & path) override;
 
@@ -295,6 +309,8 @@ public:
 
     void addToStore(const ValidPathInfo & info, Source & source, RepairFlag repair, CheckSigsFlag checkSigs) override;
 
+    std::shared_ptr<AddLock> lockPathForAdding(const StorePath & path) override;
+
     StorePath addToStoreFromDump(
         Source & dump,
         std::string_view name,
@@ -384,6 +400,17 @@ public:
      */
     virtual void deleteStorePath(const std::filesystem::path & path, uint64_t & bytesFreed, bool isKnownPath);
 
+    /**
+     * Whether `collectGarbage` may move dead paths out of the store
+     * directory into a private trash directory and delete them there
+     * in the background, rather than calling `deleteStorePath` on
+     * them in place.
+     */
+    virtual bool canDeleteInBackground()
+    {
+        return true;
+    }
+
     /**
      * Optimise the disk space usage of the Nix store by hard-linking
      * files with the same contents.
@@ -400,6 +427,14 @@ public:
 
     bool verifyStore(bool checkContents, RepairFlag repair) override;
 
+    /**
+     * Like `verifyStore()`, but if `registeredBefore` is set, only
+     * check the contents of store paths that were registered before
+     * that time. This allows spreading a contents check of a large
+     * store over several runs.
+     */
+    bool verifyStore(bool checkContents, RepairFlag repair, std::optional<time_t> registeredBefore);
+
 protected:
 
     /**
@@ -424,6 +459,15 @@ protected:
      */
     virtual VerificationResult verifyAllValidPaths(RepairFlag repair);
 
+    /**
+     * Second, optional step of `verifyStore`: hash the contents of the
+     * `.links` directory and of `validPaths` concurrently, ordered by
+     * inode number.
+     *
+     * @return true if errors remain.
+     */
+    bool verifyContents(const StorePathSet & validPaths, RepairFlag repair, std::optional<time_t> registeredBefore);
+
 public:
 
     /**
@@ -438,6 +482,16 @@ public:
 
     virtual void registerValidPaths(const ValidPathInfos & infos);
 
+    /**
+     * Check whether the contents of the valid path `path` have the NAR
+     * hash `narHash`. Hashing is skipped if the contents were verified
+     * before and their file metadata hasn't changed since (see the
+     * `cache-verified-hashes` setting).
+     *
+     * @return false if the path doesn't exist or has a different hash.
+     */
+    bool pathContentsMatch(const StorePath & path, const Hash & narHash);
+
     unsigned int getProtocol() override;
 
     std::optional<TrustedFlag> isTrustedClient() override;
@@ -499,6 +553,25 @@ private:
 
     uint64_t queryValidPathId(State & state, const StorePath & path);
 
+    /**
+     * Return a hash of the metadata of every file in `path`, or
+     * `std::nullopt` if verified hashes aren't cached or if a file
+     * changed too recently for its metadata to reliably detect further
+     * changes.
+     */
+    std::optional<Hash> fingerprintPath(const StorePath & path);
+
+    /**
+     * Whether the contents of `path` were verified to have the NAR hash
+     * `narHash` when their metadata had the fingerprint `fingerprint`.
+     */
+    bool isVerifiedHash(const StorePath & path, const Hash & narHash, const Hash & fingerprint);
+
+    /**
+     * Record that the contents of `path` have the NAR hash `narHash`.
+     */
+    void recordVerifiedHash(const StorePath & path, const Hash & narHash, const Hash & fingerprint);
+
     uint64_t addValidPath(State & state, const ValidPathInfo & info);
 
     void invalidatePath(State & state, const StorePath & path);
@@ -508,8 +581,53 @@ private:
      */
     void invalidatePathChecked(const StorePath & path);
 
+    /**
+     * Result of `invalidatePathsChecked`.
+     */
+    struct InvalidatedPaths
+    {
+        /**
+         * The paths that were invalidated, in order, with their NAR
+         * sizes. Paths that were already invalid are included with a
+         * size of 0.
+         */
+        std::vector<std::pair<StorePath, uint64_t>> paths;
+
+        /**
+         * The sum of the NAR sizes of `paths`.
+         */
+        uint64_t narSize = 0;
+
+        /**
+         * The paths that were skipped because they still have valid
+         * referrers.
+         */
+        StorePathSet inUse;
+
+        /**
+         * Whether we stopped early because of `maxNarSize`.
+         */
+        bool limitReached = false;
+    };
+
+    /**
+     * Like `invalidatePathChecked`, but invalidate many paths in a
+     * single database transaction. `paths` must list referrers before
+     * their references. Paths that still have valid referrers are
+     * skipped. Stops once the invalidated paths add up to at least
+     * `maxNarSize` bytes.
+     */
+    InvalidatedPaths invalidatePathsChecked(const std::vector<StorePath> & paths, uint64_t maxNarSize);
+
     std::shared_ptr<const ValidPathInfo> queryPathInfoInternal(State & state, const StorePath & path);
 
+    /**
+     * Read a row with the columns of the `QueryPathInfo` statement
+     * (`id, hash, registrationTime, deriver, narSize, ultimate, sigs,
+     * ca`), excluding the references.
+     */
+    std::shared_ptr<ValidPathInfo> readPathInfo(const StorePath & path, SQLiteStmt::Use & use);
+
     void updatePathInfo(State & state, const ValidPathInfo & info);
 
     void findRoots(const std::filesystem::path & path, std::filesystem::file_type type, Roots & roots);
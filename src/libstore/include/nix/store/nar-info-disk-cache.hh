@@ -48,9 +48,25 @@ public:
     virtual std::pair<Outcome, std::shared_ptr<NarInfo>>
     lookupNarInfo(const std::string & uri, const std::string & hashPart) = 0;
 
+    /**
+     * Look up the NAR info of several paths at once. This is much
+     * cheaper than calling `lookupNarInfo()` for each path. The result
+     * has an entry for every element of `hashParts`.
+     */
+    virtual std::map<std::string, std::pair<Outcome, std::shared_ptr<NarInfo>>>
+    lookupNarInfos(const std::string & uri, const std::set<std::string> & hashParts) = 0;
+
     virtual void
     upsertNarInfo(const std::string & uri, const std::string & hashPart, std::shared_ptr<const ValidPathInfo> info) = 0;
 
+    /**
+     * Insert or update the NAR info of several paths in a single
+     * transaction. A null info records that the path doesn't exist.
+     */
+    virtual void upsertNarInfos(
+        const std::string & uri,
+        const std::vector<std::pair<std::string, std::shared_ptr<const ValidPathInfo>>> & infos) = 0;
+
     virtual void upsertRealisation(const std::string & uri, const Realisation & realisation) = 0;
     virtual void upsertAbsentRealisation(const std::string & uri, const DrvOutput & id) = 0;
     virtual std::pair<Outcome, std::shared_ptr<Realisation>>
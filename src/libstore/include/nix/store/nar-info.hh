@@ -10,12 +10,42 @@ namespace nix {
 
 struct StoreDirConfig;
 
+/**
+ * A zstd delta from which the NAR can be reconstructed given the NAR of
+ * another store path (see `makeZstdDelta()`).
+ */
+struct NarDelta
+{
+    StorePath base;
+
+    /**
+     * The NAR hash of `base`. Input-addressed store paths can have
+     * different contents on different machines, so the delta can only
+     * be applied if the local copy of `base` has this hash.
+     */
+    Hash baseNarHash;
+
+    std::string url;
+    uint64_t fileSize = 0;
+
+    bool operator==(const NarDelta &) const = default;
+
+    /**
+     * Render as the value of a `Delta` field in a `.narinfo` file,
+     * i.e. `<base> <base NAR hash> <URL> <file size>`.
+     */
+    std::string to_string() const;
+
+    static NarDelta parse(std::string_view s);
+};
+
 struct UnkeyedNarInfo : virtual UnkeyedValidPathInfo
 {
     std::string url;
     std::optional<CompressionAlgo> compression;
     std::optional<Hash> fileHash;
     uint64_t fileSize = 0;
+    std::vector<NarDelta> deltas;
 
     UnkeyedNarInfo(UnkeyedValidPathInfo info)
         : UnkeyedValidPathInfo(std::move(info))
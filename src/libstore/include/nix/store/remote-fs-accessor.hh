@@ -4,6 +4,7 @@
 #include "nix/util/source-accessor.hh"
 #include "nix/util/ref.hh"
 #include "nix/util/nar-cache.hh"
+#include "nix/util/sync.hh"
 #include "nix/store/store-api.hh"
 
 namespace nix {
@@ -19,9 +20,21 @@ class RemoteFSAccessor : public SourceAccessor
      * in the NAR cache. The indirection allows avoiding opening multiple
      * redundant NAR accessors for the same NAR.
      */
-    std::map<std::string, Hash, std::less<>> narHashes;
+    Sync<std::map<std::string, Hash, std::less<>>> narHashes;
 
-    NarCache narCache;
+    ref<NarCache> narCache;
+
+    /**
+     * If set, used to open NARs without fetching them in their
+     * entirety. It returns nullptr for store paths for which that is
+     * not possible.
+     */
+    std::function<std::shared_ptr<SourceAccessor>(const StorePath &)> openSeekableNar;
+
+    /**
+     * Map from store path hash part to the result of `openSeekableNar`.
+     */
+    Sync<std::map<std::string, std::shared_ptr<SourceAccessor>, std::less<>>> seekableNars;
 
     bool requireValidPath;
 
@@ -38,7 +51,8 @@ public:
      */
     std::shared_ptr<SourceAccessor> accessObject(const StorePath & path);
 
-    RemoteFSAccessor(ref<Store> store, bool requireValidPath = true, std::optional<AbsolutePath> cacheDir = {});
+    RemoteFSAccessor(
+        ref<Store> store, bool requireValidPath = true, ref<NarCache> narCache = make_ref<NarCache>());
 
     std::optional<Stat> maybeLstat(const CanonPath & path) override;
 
@@ -8,6 +8,7 @@
 #include "nix/store/store-api.hh"
 #include "nix/store/submit-store.hh"
 #include "nix/util/sync.hh"
+#include "nix/util/nar-cache.hh"
 #include "nix/util/file-descriptor.hh"
 #include "nix/store/gc-store.hh"
 #include "nix/store/log-store.hh"
@@ -41,6 +42,15 @@ public:
         std::numeric_limits<unsigned int>::max(),
         "max-connection-age",
         "Maximum age of a connection before it is closed."};
+
+    Setting<unsigned int> narCompressionLevel{
+        this,
+        0,
+        "nar-compression-level",
+        R"(
+          If nonzero, NARs copied to and from the Nix daemon are compressed with zstd at this level, which can speed up copying over slow links.
+          This only has an effect if the daemon supports it; otherwise NARs are sent uncompressed.
+        )"};
 };
 
 /**
@@ -70,10 +80,22 @@ public:
     void queryPathInfoUncached(
         const StorePath & path, Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept override;
 
+    std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+    queryPathInfosUncached(const StorePathSet & paths) override;
+
     void queryReferrers(const StorePath & path, StorePathSet & referrers) override;
 
     StorePathSet queryValidDerivers(const StorePath & path) override;
 
+    using Store::computeFSClosure;
+
+    void computeFSClosure(
+        const StorePathSet & paths,
+        StorePathSet & out,
+        bool flipDirection = false,
+        bool includeOutputs = false,
+        bool includeDerivers = false) override;
+
     StorePathSet queryDerivationOutputs(const StorePath & path) override;
 
     std::map<std::string, std::optional<StorePath>>
@@ -165,7 +187,7 @@ public:
      * This is called on interrupt to allow graceful termination when the client
      * disconnects during a long-running operation.
      */
-    void shutdownConnections();
+    virtual void shutdownConnections();
 
     struct Connection;
 
@@ -211,6 +233,12 @@ private:
      */
     Sync<std::set<Descriptor>> connectionFds;
 
+    /**
+     * The NAR cache shared by all accessors returned by
+     * `getFSAccessor()`.
+     */
+    ref<NarCache> narCache = make_ref<NarCache>();
+
     friend struct RemoteBuilder;
 };
 
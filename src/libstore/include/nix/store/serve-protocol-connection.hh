@@ -81,7 +81,16 @@ struct ServeProto::BasicClientConnection
      */
     BuildResult getBuildDerivationResponse(const StoreDirConfig & store);
 
-    void narFromPath(const StoreDirConfig & store, const StorePath & path, fun<void(Source &)> receiveNar);
+    /**
+     * Fetch the NAR of `path`. If `compressionLevel` is nonzero and the
+     * remote side supports it, the NAR is transferred in compressed
+     * form. Either way, `receiveNar` gets the uncompressed NAR.
+     */
+    void narFromPath(
+        const StoreDirConfig & store,
+        const StorePath & path,
+        fun<void(Source &)> receiveNar,
+        unsigned int compressionLevel = 0);
 
     void importPaths(const StoreDirConfig & store, fun<void(Sink &)> sendPaths);
 };
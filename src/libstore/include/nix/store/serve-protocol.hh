@@ -8,7 +8,7 @@ namespace nix {
 #define SERVE_MAGIC_1 0x390c9deb
 #define SERVE_MAGIC_2 0x5452eecb
 
-#define SERVE_PROTOCOL_VERSION (2 << 8 | 8)
+#define SERVE_PROTOCOL_VERSION (2 << 8 | 9)
 #define GET_PROTOCOL_MAJOR(x) ((x) & 0xff00)
 #define GET_PROTOCOL_MINOR(x) ((x) & 0x00ff)
 struct StoreDirConfig;
@@ -69,9 +69,26 @@ struct ServeProto
 
     static constexpr Version latest = {
         .major = 2,
-        .minor = 8,
+        .minor = 9,
     };
 
+    /**
+     * Since version 2.9, the `DumpStorePath` and `AddToStoreNar`
+     * commands take the zstd level at which the client wants the NAR to
+     * be compressed (0 meaning no compression). Compressed NARs are
+     * sent as frames (see `FramedSink`).
+     */
+    static constexpr Version narCompressionVersion = {
+        .major = 2,
+        .minor = 9,
+    };
+
+    /**
+     * The highest zstd level that `nix-store --serve` will use for
+     * compressing NARs, regardless of what the client asks for.
+     */
+    static constexpr unsigned int maxNarCompressionLevel = 19;
+
     /**
      * A unidirectional read connection, to be used by the read half of the
      * canonical serializers below.
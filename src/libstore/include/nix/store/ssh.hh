@@ -74,6 +74,14 @@ public:
          * `[0, INT_MAX]`.
          */
         void trySetBufferSize(size_t size);
+
+        /**
+         * Kill the SSH process, so that any blocking I/O on this
+         * connection fails. This doesn't wait for the process, which
+         * is left to the destructor, so it may be called while another
+         * thread is using the connection.
+         */
+        void shutdown();
     };
 
     /**
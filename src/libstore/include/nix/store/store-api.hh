@@ -9,6 +9,7 @@
 #include "nix/util/serialise.hh"
 #include "nix/util/lru-cache.hh"
 #include "nix/util/sync.hh"
+#include "nix/util/fun.hh"
 #include "nix/util/configuration.hh"
 #include "nix/store/path-info.hh"
 #include "nix/util/repair-flag.hh"
@@ -546,6 +547,18 @@ public:
      */
     std::optional<std::shared_ptr<const ValidPathInfo>> queryPathInfoFromClientCache(const StorePath & path);
 
+    /**
+     * Query information about a set of paths. Paths that are not
+     * valid are omitted from the result. Like queryPathInfo(), the
+     * name part of the store paths may be omitted; the result is
+     * keyed by the paths as given.
+     *
+     * This is equivalent to calling queryPathInfo() on every path,
+     * but stores that can answer the query in bulk (a single
+     * database query or daemon round trip) do so.
+     */
+    std::map<StorePath, ref<const ValidPathInfo>> queryPathInfos(const StorePathSet & paths);
+
     /**
      * Query the information about a realisation.
      */
@@ -581,6 +594,17 @@ protected:
 
     virtual void
     queryPathInfoUncached(const StorePath & path, Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept = 0;
+
+    /**
+     * Bulk version of queryPathInfoUncached(), used by
+     * queryPathInfos() for the paths that are not in the client
+     * cache. The result must be keyed by the paths as given and omit
+     * invalid paths. The default implementation calls
+     * queryPathInfoUncached() for all paths concurrently.
+     */
+    virtual std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+    queryPathInfosUncached(const StorePathSet & paths);
+
     virtual void queryRealisationUncached(
         const DrvOutput &, Callback<std::shared_ptr<const UnkeyedRealisation>> callback) noexcept = 0;
 
@@ -674,6 +698,27 @@ public:
         RepairFlag repair = NoRepair,
         CheckSigsFlag checkSigs = CheckSigs) = 0;
 
+    /**
+     * A lock on a store path, see `lockPathForAdding()`.
+     */
+    struct AddLock
+    {
+        virtual ~AddLock() = default;
+    };
+
+    /**
+     * Keep other processes from adding `path` to this store until the
+     * returned lock is destroyed, while `addToStore()` of `path` in
+     * this process can still go ahead. This lets a caller fetch a path
+     * on one thread and add it on another without another process
+     * fetching it as well. Returns nullptr if the store has no such
+     * locks.
+     */
+    virtual std::shared_ptr<AddLock> lockPathForAdding(const StorePath & path)
+    {
+        return nullptr;
+    }
+
     /**
      * A list of paths infos along with a source providing the content
      * of the associated store path
@@ -768,6 +813,25 @@ public:
      */
     virtual void narFromPath(const StorePath & path, Sink & sink);
 
+    /**
+     * Like `narFromPath()`, but the NAR may be reconstructed from store
+     * paths that are already valid in `baseStore` (e.g. a previous
+     * version of `path`) rather than transferred in full.
+     */
+    virtual void narFromPathWithBase(const StorePath & path, Store & baseStore, Sink & sink)
+    {
+        narFromPath(path, sink);
+    }
+
+    /**
+     * Like `narFromPathWithBase()`, but split into two stages: this
+     * function does all I/O against this store, and the function it
+     * returns writes the NAR to a sink. The latter may still do
+     * CPU-bound work such as decompression, so that the two stages
+     * can run on different threads.
+     */
+    virtual fun<void(Sink &)> fetchNar(const StorePath & path, Store & baseStore);
+
     /**
      * Add a store path as a temporary root of the garbage collector.
      * The root disappears as soon as we exit.
@@ -1037,6 +1101,18 @@ void copyStorePath(
     RepairFlag repair = NoRepair,
     CheckSigsFlag checkSigs = CheckSigs);
 
+/**
+ * Like `copyStorePath()`, but only fetch the path from `srcStore`
+ * (see `Store::fetchNar()`). The returned function adds it to
+ * `dstStore`.
+ */
+fun<void()> fetchStorePath(
+    Store & srcStore,
+    Store & dstStore,
+    const StorePath & storePath,
+    RepairFlag repair = NoRepair,
+    CheckSigsFlag checkSigs = CheckSigs);
+
 /**
  * Copy store paths from one store to another. The paths may be copied
  * in parallel. They are copied in a topologically sorted order (i.e. if
@@ -105,6 +105,27 @@ struct WorkerProto::BasicClientConnection : WorkerProto::BasicConnection
     std::optional<UnkeyedValidPathInfo>
     queryPathInfo(const StoreDirConfig & store, bool * daemonException, const StorePath & path);
 
+    /**
+     * Requires `featureBatchQueryPathInfos`. Invalid paths are omitted
+     * from the result.
+     */
+    std::vector<ValidPathInfo>
+    queryPathInfos(const StoreDirConfig & store, bool * daemonException, const StorePathSet & paths);
+
+    /**
+     * Requires `featureQueryClosure`. Computes the closure on the
+     * remote side (see `Store::computeFSClosure()`) and returns all
+     * paths in it, together with the path infos of those that the
+     * remote side could look up.
+     */
+    std::pair<StorePathSet, std::vector<ValidPathInfo>> queryClosure(
+        const StoreDirConfig & store,
+        bool * daemonException,
+        const StorePathSet & paths,
+        bool flipDirection,
+        bool includeOutputs,
+        bool includeDerivers);
+
     void putBuildDerivationRequest(
         const StoreDirConfig & store,
         bool * daemonException,
@@ -118,8 +139,18 @@ struct WorkerProto::BasicClientConnection : WorkerProto::BasicConnection
      */
     BuildResult getBuildDerivationResponse(const StoreDirConfig & store, bool * daemonException);
 
+    /**
+     * Fetch the NAR of `path`. If `compressionLevel` is nonzero and the
+     * daemon supports `featureNarCompression`, the NAR is transferred
+     * in compressed form. Either way, `receiveNar` gets the
+     * uncompressed NAR.
+     */
     void narFromPath(
-        const StoreDirConfig & store, bool * daemonException, const StorePath & path, fun<void(Source &)> receiveNar);
+        const StoreDirConfig & store,
+        bool * daemonException,
+        const StorePath & path,
+        fun<void(Source &)> receiveNar,
+        unsigned int compressionLevel = 0);
 };
 
 struct WorkerProto::BasicServerConnection : WorkerProto::BasicConnection
@@ -151,6 +151,38 @@ struct WorkerProto
      */
     static constexpr std::string_view featureSubmitOutput = "submit-output";
 
+    /**
+     * Feature for enabling the `BatchQueryPathInfos` operation. This is
+     * distinct from the `QueryPathInfos` operation reserved for
+     * DeterminateSystems/nix-src#539, whose wire format may differ.
+     */
+    static constexpr std::string_view featureBatchQueryPathInfos = "batch-query-path-infos";
+
+    /**
+     * Feature for enabling the `QueryClosure` operation
+     */
+    static constexpr std::string_view featureQueryClosure = "query-closure";
+
+    /**
+     * Feature for compressing NARs with zstd in the `NarFromPath`,
+     * `AddToStoreNar` and `AddMultipleToStore` operations. The client
+     * chooses the compression level (0 meaning no compression) and
+     * sends it with each of these operations.
+     */
+    static constexpr std::string_view featureNarCompression = "nar-compression";
+
+    /**
+     * Feature for transmitting the resource usage of builds (peak
+     * memory, I/O, stall and phase times) in `BuildResult`.
+     */
+    static constexpr std::string_view featureBuildResources = "build-resources";
+
+    /**
+     * The highest zstd level that the daemon will use for compressing
+     * NARs, regardless of what the client asks for.
+     */
+    static constexpr unsigned int maxNarCompressionLevel = 19;
+
     /**
      * A unidirectional read connection, to be used by the read half of the
      * canonical serializers below.
@@ -275,6 +307,8 @@ enum struct WorkerProto::Op : uint64_t {
     // QueryActiveBuilds = 48, // reserved for https://github.com/NixOS/nix/pull/15979
     // AddTempRoots = 49, // reserved for https://github.com/NixOS/nix/pull/16113
     // QueryPathInfos = 50, // reserved for https://github.com/DeterminateSystems/nix-src/pull/539
+    QueryClosure = 51,
+    BatchQueryPathInfos = 52,
     SubmitOutput = 1000, // Only used within derivations with feature
     AddToStoreScanning = 1001,
 };
@@ -372,6 +406,10 @@ DECLARE_WORKER_SERIALISER(std::optional<TrustedFlag>);
 template<>
 DECLARE_WORKER_SERIALISER(std::optional<std::chrono::microseconds>);
 template<>
+DECLARE_WORKER_SERIALISER(std::chrono::microseconds);
+template<>
+DECLARE_WORKER_SERIALISER(std::optional<uint64_t>);
+template<>
 DECLARE_WORKER_SERIALISER(WorkerProto::ClientHandshakeInfo);
 
 template<>
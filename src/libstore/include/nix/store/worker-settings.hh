@@ -81,9 +81,55 @@ public:
           This option defines the maximum number of substitution jobs that Nix
           tries to run in parallel. The default is `16`. The minimum value
           one can choose is `1` and lower values are interpreted as `1`.
+
+          This only limits the number of concurrent downloads. Decompressing
+          and unpacking the downloaded paths happens on a separate set of
+          threads, one per CPU core, so this setting can be far higher than
+          the number of cores on fast or high-latency connections.
         )",
         {"substitution-max-jobs"}};
 
+#ifdef __linux__
+    Setting<unsigned int> maxCpuPressure{
+        this,
+        0,
+        "max-cpu-pressure",
+        R"(
+          If set to a value between 1 and 100, Nix doesn't start another local build while the system's CPU [pressure](https://docs.kernel.org/accounting/psi.html) (the percentage of time in the last 10 seconds that some runnable task was waiting for a CPU) exceeds this value.
+          This allows setting [`max-jobs`](#conf-max-jobs) high enough to use all cores during single-threaded build phases, without oversubscribing the machine during parallel ones.
+
+          At least one build is always allowed to run.
+          The default is `0`, which disables this check.
+          This is only supported on Linux.
+        )"};
+
+    Setting<unsigned int> maxMemoryPressure{
+        this,
+        0,
+        "max-memory-pressure",
+        R"(
+          Like [`max-cpu-pressure`](#conf-max-cpu-pressure), but for memory pressure, i.e. the percentage of time that some task was stalled waiting for memory to be reclaimed.
+        )"};
+
+    Setting<unsigned int> maxIoPressure{
+        this,
+        0,
+        "max-io-pressure",
+        R"(
+          Like [`max-cpu-pressure`](#conf-max-cpu-pressure), but for I/O pressure.
+        )"};
+
+    Setting<uint64_t> maxBuildMemory{
+        this,
+        0,
+        "max-build-memory",
+        R"(
+          If nonzero, Nix doesn't start another local build while the builds use more than this many bytes of memory, as reported by the cgroup of the Nix daemon (or of the Nix process, if not using the daemon).
+          At least one build is always allowed to run.
+          This requires the cgroup memory controller, and is only supported on Linux.
+        )"};
+#endif
+
     Setting<time_t> maxSilentTime{
         this,
         0,
@@ -268,6 +314,20 @@ public:
           If set to `true`, Nix ignores the [`allowSubstitutes`](@docroot@/language/advanced-attributes.md) attribute in derivations and always attempt to use [available substituters](#conf-substituters).
         )"};
 
+    Setting<bool> buildersInProcess{
+        this,
+        false,
+        "builders-in-process",
+        R"(
+          If set to `true`, Nix sends builds to the [remote build machines](#conf-builders) itself, rather than through the [build hook](#conf-build-hook).
+          Nix then keeps a connection to every machine for the duration of the build, tracks their load in memory rather than with lock files, and uploads the inputs of several builds to a machine concurrently, skipping paths that it already copied to or from that machine.
+          This reduces the overhead of dispatching many short builds.
+
+          The load of the machines is not shared with other Nix processes, and the Nix daemon handles every client connection in a separate process.
+          Enable this only if a single Nix command at a time performs remote builds on this machine; otherwise the machines may get more builds than their [maximum number of jobs](#conf-builders).
+          The logs of builds performed this way are shown, but not stored locally.
+        )"};
+
     Setting<bool> buildersUseSubstitutes{
         this,
         false,
@@ -1,6 +1,7 @@
 #include "nix/store/legacy-ssh-store.hh"
 #include "nix/store/common-ssh-store-config.hh"
 #include "nix/util/archive.hh"
+#include "nix/util/compression.hh"
 #include "nix/util/pool.hh"
 #include "nix/store/remote-store.hh"
 #include "nix/store/common-protocol.hh"
@@ -140,9 +141,22 @@ ref<LegacySSHStore::Connection> LegacySSHStore::openConnection()
         throw Error("cannot connect to '%1%'", config->authority.host);
     }
 
+    {
+        auto allConnections_(allConnections.lock());
+        std::erase_if(*allConnections_, [](auto & c) { return c.expired(); });
+        allConnections_->push_back(conn.get_ptr());
+    }
+
     return conn;
 };
 
+void LegacySSHStore::shutdownConnections()
+{
+    for (auto & weak : *allConnections.lock())
+        if (auto conn = weak.lock(); conn && conn->sshConn)
+            conn->sshConn->shutdown();
+}
+
 StoreReference LegacySSHStoreConfig::getReference() const
 {
     return {
@@ -210,8 +224,19 @@ void LegacySSHStore::addToStore(const ValidPathInfo & info, Source & source, Rep
     conn->to << info.registrationTime << info.narSize << info.ultimate;
     ServeProto::write(*this, *conn, info.sigs);
     conn->to << renderContentAddress(info.ca);
+    unsigned int compressionLevel = 0;
+    if (conn->remoteVersion >= ServeProto::narCompressionVersion) {
+        compressionLevel = config->narCompressionLevel;
+        conn->to << compressionLevel;
+    }
     try {
-        copyNAR(source, conn->to);
+        if (compressionLevel) {
+            FramedSink framedSink(conn->to, []() {});
+            auto compressionSink = makeCompressionSink(CompressionAlgo::zstd, framedSink, false, compressionLevel);
+            copyNAR(source, *compressionSink);
+            compressionSink->finish();
+        } else
+            copyNAR(source, conn->to);
     } catch (...) {
         conn->good = false;
         throw;
@@ -230,7 +255,7 @@ void LegacySSHStore::narFromPath(const StorePath & path, Sink & sink)
 void LegacySSHStore::narFromPath(const StorePath & path, fun<void(Source &)> receiveNar)
 {
     auto conn(connections->get());
-    conn->narFromPath(*this, path, receiveNar);
+    conn->narFromPath(*this, path, receiveNar, config->narCompressionLevel);
 }
 
 static ServeProto::BuildOptions buildSettings()
@@ -25,11 +25,30 @@ struct ChrootLinuxDerivationBuilder : ChrootDerivationBuilder, LinuxDerivationBu
      */
     bool usingUserNamespace = true;
 
+    /**
+     * The pooled network namespace that the builder runs in (see
+     * `sandbox-namespace-pool`), or `INVALID_DESCRIPTOR` if it
+     * gets a new one.
+     */
+    Descriptor pooledNetworkNamespace = INVALID_DESCRIPTOR;
+
     /**
      * The cgroup of the builder, if any.
      */
     std::optional<std::filesystem::path> cgroup;
 
+    /**
+     * Whether to make the input closure available in the sandbox
+     * through an overlay file system (see `sandbox-store-view`).
+     */
+    bool useStoreView = false;
+
+    /**
+     * The detached overlay mount that provides the input closure, if
+     * `useStoreView` is set and it could be created.
+     */
+    AutoCloseFD storeView;
+
     ChrootLinuxDerivationBuilder(
         LocalStore & store, std::shared_ptr<DerivationBuilderCallbacks> miscMethods, DerivationBuilderParams params)
         : DerivationBuilderImpl{store, miscMethods, params}
@@ -46,8 +65,16 @@ struct ChrootLinuxDerivationBuilder : ChrootDerivationBuilder, LinuxDerivationBu
 
     void prepareUser() override;
 
+    std::filesystem::path getChrootParentDir() override;
+
     void prepareSandbox() override;
 
+    /**
+     * Create `storeView` and remove the store paths that it provides
+     * from `pathsInChroot`.
+     */
+    void setupStoreView();
+
     void startChild() override;
 
     void enterChroot() override;
@@ -6,6 +6,7 @@
 #include "store-config-private.hh"
 
 #include "nix/store/globals.hh"
+#include "nix/store/build/build-admission.hh"
 #include "nix/store/personality.hh"
 #include "nix/store/filetransfer.hh"
 #include "nix/util/cgroup.hh"
@@ -13,6 +14,7 @@
 #include "nix/util/file-system-at.hh"
 #include "nix/util/logging.hh"
 #include "nix/util/serialise.hh"
+#include "nix/util/sync.hh"
 #include "linux/fchmodat2-compat.hh"
 
 #include <algorithm>
@@ -30,6 +32,7 @@
 #include <sys/mount.h>
 #include <sys/syscall.h>
 #include <sys/prctl.h>
+#include <sys/xattr.h>
 #include <grp.h>
 
 #if HAVE_SECCOMP
@@ -74,6 +77,44 @@ static int move_mount(int sourceDirFd, const char * source, int destDirFd, const
 
 #endif
 
+#if !HAVE_FSOPEN
+
+#  ifndef FSOPEN_CLOEXEC
+#    define FSOPEN_CLOEXEC 0x00000001
+#  endif
+
+static int fsopen(const char * fsName, unsigned int flags)
+{
+    return ::syscall(__NR_fsopen, fsName, flags);
+}
+
+#endif
+
+#if !HAVE_FSCONFIG
+
+#  define FSCONFIG_SET_STRING 1
+#  define FSCONFIG_CMD_CREATE 6
+
+static int fsconfig(int fd, unsigned int cmd, const char * key, const void * value, int aux)
+{
+    return ::syscall(__NR_fsconfig, fd, cmd, key, value, aux);
+}
+
+#endif
+
+#if !HAVE_FSMOUNT
+
+#  ifndef FSMOUNT_CLOEXEC
+#    define FSMOUNT_CLOEXEC 0x00000001
+#  endif
+
+static int fsmount(int fsFd, unsigned int flags, unsigned int attrFlags)
+{
+    return ::syscall(__NR_fsmount, fsFd, flags, attrFlags);
+}
+
+#endif
+
 namespace nix {
 
 void setupSeccomp(const LocalSettings & localSettings)
@@ -396,6 +437,76 @@ static void doBind(
 
 static const std::filesystem::path procPath = "/proc";
 
+/**
+ * Bring up the loopback interface of the current network namespace.
+ */
+static void initLoopback()
+{
+    AutoCloseFD fd(socket(PF_INET, SOCK_DGRAM, IPPROTO_IP));
+    if (!fd)
+        throw SysError("cannot open IP socket");
+
+    using namespace std::string_view_literals;
+    struct ifreq ifr = {};
+    std::ranges::copy("lo"sv, ifr.ifr_name);
+    ifr.ifr_flags = IFF_UP | IFF_LOOPBACK | IFF_RUNNING;
+    if (ioctl(fd.get(), SIOCSIFFLAGS, &ifr) == -1)
+        throw SysError("cannot set loopback interface flags");
+}
+
+/**
+ * The network namespaces that are reused by the builds of each build
+ * user, keyed by the UID of the build user.
+ */
+static Sync<std::map<uid_t, AutoCloseFD>> networkNamespacePool;
+
+/**
+ * Return the pooled network namespace of the build user `uid`,
+ * creating it if necessary.
+ *
+ * The namespace is owned by our user namespace, so builds cannot
+ * change its configuration and it doesn't need to be reset between
+ * builds. Sockets are closed when the processes of a build are killed.
+ */
+static Descriptor getPooledNetworkNamespace(uid_t uid)
+{
+    auto pool(networkNamespacePool.lock());
+
+    if (auto * ns = get(*pool, uid))
+        return ns->get();
+
+    /* Network namespaces are a property of threads, so creating one
+       in this thread and switching back doesn't affect other
+       threads. */
+    AutoCloseFD origNs = open("/proc/thread-self/ns/net", O_RDONLY | O_CLOEXEC);
+    if (!origNs)
+        throw SysError("opening the current network namespace");
+
+    if (unshare(CLONE_NEWNET) == -1)
+        throw SysError("creating a network namespace");
+
+    auto restore = [&]() {
+        if (setns(origNs.get(), CLONE_NEWNET) == -1)
+            throw SysError("switching back to the original network namespace");
+    };
+
+    AutoCloseFD ns;
+    try {
+        initLoopback();
+        ns = open("/proc/thread-self/ns/net", O_RDONLY | O_CLOEXEC);
+        if (!ns)
+            throw SysError("opening the new network namespace");
+    } catch (...) {
+        restore();
+        throw;
+    }
+    restore();
+
+    debug("created the pooled network namespace of build user %d", uid);
+
+    return pool->emplace(uid, std::move(ns)).first->second.get();
+}
+
 void LinuxDerivationBuilder::enterChroot()
 {
     auto & localSettings = store.config->getLocalSettings();
@@ -489,10 +600,121 @@ void ChrootLinuxDerivationBuilder::prepareUser()
     DerivationBuilderImpl::prepareUser();
 }
 
+std::filesystem::path ChrootLinuxDerivationBuilder::getChrootParentDir()
+{
+    /* The store view is an overlay file system that has the Nix store
+       as a lower directory and the chroot's store as its upper
+       directory, and these must not overlap. So put the chroot in the
+       build directory instead, if outputs can be moved from there to
+       the Nix store. */
+    if (store.config->getLocalSettings().sandboxStoreView && isRootUser()) {
+        auto buildDirSt = lstat(topTmpDir);
+        auto storeSt = lstat(store.config->realStoreDir.get());
+        if (buildDirSt.st_dev == storeSt.st_dev) {
+            useStoreView = true;
+            return topTmpDir / "chroot";
+        }
+        debug("not using a store view for the sandbox because the build directory is on a different file system");
+    }
+
+    return ChrootDerivationBuilder::getChrootParentDir();
+}
+
+void ChrootLinuxDerivationBuilder::setupStoreView()
+{
+    /* The overlay has two lower directories: the view directory and
+       the real Nix store. The view contains an opaque store directory
+       with an entry for every input directory that redirects to the
+       corresponding directory in the real Nix store. So the store
+       directory of the overlay contains exactly those inputs, plus the
+       contents of the chroot's store, which is its upper directory.
+
+       Only directories can be redirected, so other inputs are still
+       bind-mounted. These are rare. */
+    std::filesystem::path chrootStoreDir = chrootRootDir / std::filesystem::path(store.storeDir).relative_path();
+    std::filesystem::path realStoreDir = store.config->realStoreDir.get();
+    auto viewDir = topTmpDir / "store-view";
+    auto viewStoreDir = viewDir / chrootStoreDir.filename();
+
+    if (realStoreDir.native().find(':') != std::string::npos || viewDir.native().find(':') != std::string::npos)
+        throw Error("the store view cannot be used with paths that contain ':'");
+
+    createDir(viewDir, 0755);
+    createDir(viewStoreDir, 0755);
+    createDir(topTmpDir / "store-view-work", 0700);
+    createDir(topTmpDir / "store-view-mnt", 0700);
+
+    auto setXattr = [](const std::filesystem::path & path, const char * name, const std::string & value) {
+        if (lsetxattr(path.c_str(), name, value.data(), value.size(), 0) == -1)
+            throw SysError("setting extended attribute '%s' on %s", name, PathFmt(path));
+    };
+
+    setXattr(viewStoreDir, "trusted.overlay.opaque", "y");
+
+    std::vector<std::filesystem::path> inView;
+
+    for (auto & [target, chrootPath] : pathsInChroot) {
+        if (target.parent_path() != store.storeDir || chrootPath.source != realStoreDir / target.filename())
+            continue;
+
+        auto st = maybeLstat(chrootPath.source);
+        if (!st || !S_ISDIR(st->st_mode))
+            continue;
+
+        /* Give the entry the attributes of the input, since they are
+           the ones that the overlay reports. */
+        auto entry = viewStoreDir / target.filename();
+        if (mkdir(entry.c_str(), st->st_mode & 07777) == -1)
+            throw SysError("creating directory %s", PathFmt(entry));
+        setXattr(entry, "trusted.overlay.redirect", "/" + target.filename().native());
+        struct timespec times[2] = {st->st_atim, st->st_mtim};
+        if (utimensat(AT_FDCWD, entry.c_str(), times, AT_SYMLINK_NOFOLLOW) == -1)
+            throw SysError("setting the timestamps of %s", PathFmt(entry));
+
+        inView.push_back(target);
+    }
+
+    AutoCloseFD fsFd{fsopen("overlay", FSOPEN_CLOEXEC)};
+    if (!fsFd)
+        throw SysError("creating an overlay file system");
+
+    auto setOption = [&](const char * key, const std::string & value) {
+        if (fsconfig(fsFd.get(), FSCONFIG_SET_STRING, key, value.c_str(), 0) == -1)
+            throw SysError("setting overlay option '%s' to '%s'", key, value);
+    };
+
+    setOption("lowerdir", viewDir.native() + ":" + realStoreDir.native());
+    setOption("upperdir", chrootStoreDir.parent_path().native());
+    setOption("workdir", (topTmpDir / "store-view-work").native());
+    setOption("redirect_dir", "follow");
+    setOption("metacopy", "off");
+
+    if (fsconfig(fsFd.get(), FSCONFIG_CMD_CREATE, nullptr, nullptr, 0) == -1)
+        throw SysError("creating the overlay file system for the sandbox");
+
+    storeView = AutoCloseFD{fsmount(fsFd.get(), FSMOUNT_CLOEXEC, 0)};
+    if (!storeView)
+        throw SysError("mounting the overlay file system for the sandbox");
+
+    for (auto & target : inView)
+        pathsInChroot.erase(target);
+
+    debug("providing %d store paths in the sandbox through a store view", inView.size());
+}
+
 void ChrootLinuxDerivationBuilder::prepareSandbox()
 {
     ChrootDerivationBuilder::prepareSandbox();
 
+    if (useStoreView) {
+        try {
+            setupStoreView();
+        } catch (Error & e) {
+            static bool haveWarned = false;
+            warnOnce(haveWarned, "cannot set up a store view for the sandbox, falling back to bind mounts: %s", e.msg());
+        }
+    }
+
     if (cgroup) {
         if (mkdir(cgroup->c_str(), 0755) != 0)
             throw SysError("creating cgroup %s", PathFmt(*cgroup));
@@ -500,6 +722,33 @@ void ChrootLinuxDerivationBuilder::prepareSandbox()
         chownToBuilder(*cgroup / "cgroup.procs");
         chownToBuilder(*cgroup / "cgroup.threads");
         // chownToBuilder(*cgroup / "cgroup.subtree_control");
+
+        /* Apply the resource limits for the system features that the
+           derivation requires. */
+        auto requiredFeatures = drvOptions.getRequiredSystemFeatures(drv);
+
+        auto applyLimit = [&](const StringMap & limits, std::string_view file) {
+            auto limit = getBuildResourceLimit(limits, requiredFeatures);
+            if (!limit)
+                return;
+            try {
+                /* The controller must be enabled in the parent cgroup
+                   for the file to exist. */
+                auto controller = std::string(file.substr(0, file.find('.')));
+                writeFile(cgroup->parent_path() / "cgroup.subtree_control", "+" + controller);
+                writeFile(*cgroup / file, *limit);
+            } catch (SystemError & e) {
+                warn(
+                    "cannot set '%s' of the cgroup for building '%s': %s",
+                    file,
+                    store.printStorePath(drvPath),
+                    e.msg());
+            }
+        };
+
+        auto & localSettings = store.config->getLocalSettings();
+        applyLimit(localSettings.cgroupMemoryHigh, "memory.high");
+        applyLimit(localSettings.cgroupCpuWeight, "cpu.weight");
     }
 }
 
@@ -549,6 +798,12 @@ void ChrootLinuxDerivationBuilder::startChild()
 
     usingUserNamespace = userNamespacesSupported();
 
+    /* Builds that use a UID range mount sysfs, which requires them to
+       own their network namespace. */
+    if (derivationType.isSandboxed() && buildUser && buildUser->getUIDCount() == 1
+        && store.config->getLocalSettings().sandboxNamespacePool)
+        pooledNetworkNamespace = getPooledNetworkNamespace(buildUser->getUID());
+
     Pipe sendPid;
     sendPid.create();
 
@@ -571,9 +826,14 @@ void ChrootLinuxDerivationBuilder::startChild()
                         "setgroups failed. Set the require-drop-supplementary-groups option to false to skip this step.");
             }
 
+            /* The builder inherits the pooled network namespace from
+               us. */
+            if (pooledNetworkNamespace != INVALID_DESCRIPTOR && setns(pooledNetworkNamespace, CLONE_NEWNET) == -1)
+                throw SysError("entering the pooled network namespace");
+
             ProcessOptions options;
             options.cloneFlags = CLONE_NEWPID | CLONE_NEWNS | CLONE_NEWIPC | CLONE_NEWUTS | CLONE_PARENT | SIGCHLD;
-            if (derivationType.isSandboxed())
+            if (derivationType.isSandboxed() && pooledNetworkNamespace == INVALID_DESCRIPTOR)
                 options.cloneFlags |= CLONE_NEWNET;
             if (usingUserNamespace)
                 options.cloneFlags |= CLONE_NEWUSER;
@@ -618,6 +878,10 @@ void ChrootLinuxDerivationBuilder::startChild()
     auto ss = tokenizeString<std::vector<std::string>>(sendPidSource.readLine());
     assert(ss.size() == 1);
     pid = string2Int<pid_t>(ss[0]).value();
+
+    /* The child has attached the store view by now, or will do so
+       with its own copy of the descriptor. */
+    storeView.close();
     auto thisProcPath = procPath / std::to_string(static_cast<pid_t>(pid));
 
     if (usingUserNamespace) {
@@ -690,20 +954,10 @@ void ChrootLinuxDerivationBuilder::enterChroot()
 
     userNamespaceSync.readSide = -1;
 
-    if (derivationType.isSandboxed()) {
-
-        /* Initialise the loopback interface. */
-        AutoCloseFD fd(socket(PF_INET, SOCK_DGRAM, IPPROTO_IP));
-        if (!fd)
-            throw SysError("cannot open IP socket");
-
-        using namespace std::string_view_literals;
-        struct ifreq ifr = {};
-        std::ranges::copy("lo"sv, ifr.ifr_name);
-        ifr.ifr_flags = IFF_UP | IFF_LOOPBACK | IFF_RUNNING;
-        if (ioctl(fd.get(), SIOCSIFFLAGS, &ifr) == -1)
-            throw SysError("cannot set loopback interface flags");
-    }
+    /* Initialise the loopback interface. A pooled network namespace
+       already has it. */
+    if (derivationType.isSandboxed() && pooledNetworkNamespace == INVALID_DESCRIPTOR)
+        initLoopback();
 
     /* Set the hostname etc. to fixed values. */
     char hostname[] = "localhost";
@@ -739,7 +993,23 @@ void ChrootLinuxDerivationBuilder::enterChroot()
        to fail with EINVAL. Don't know why. */
     std::filesystem::path chrootStoreDir = chrootRootDir / std::filesystem::path(store.storeDir).relative_path();
 
-    if (mount(chrootStoreDir.c_str(), chrootStoreDir.c_str(), 0, MS_BIND, 0) == -1)
+    if (storeView) {
+        /* Attach the store view somewhere outside of the chroot, and
+           bind-mount only its store directory into the chroot, since
+           the root of the overlay contains the whole Nix store. */
+        auto viewMountDir = topTmpDir / "store-view-mnt";
+
+        if (move_mount(storeView.get(), "", AT_FDCWD, viewMountDir.c_str(), MOVE_MOUNT_F_EMPTY_PATH) == -1)
+            throw SysError("unable to attach the store view at %1%", PathFmt(viewMountDir));
+
+        if (mount((viewMountDir / chrootStoreDir.filename()).c_str(), chrootStoreDir.c_str(), 0, MS_BIND, 0) == -1)
+            throw SysError("unable to bind mount the store view at %1%", PathFmt(chrootStoreDir));
+
+        if (umount2(viewMountDir.c_str(), MNT_DETACH) == -1)
+            throw SysError("unable to unmount %1%", PathFmt(viewMountDir));
+
+        storeView.close();
+    } else if (mount(chrootStoreDir.c_str(), chrootStoreDir.c_str(), 0, MS_BIND, 0) == -1)
         throw SysError("unable to bind mount the Nix store at %1%", PathFmt(chrootStoreDir));
 
     if (mount(0, chrootStoreDir.c_str(), 0, MS_SHARED, 0) == -1)
@@ -948,6 +1218,13 @@ void ChrootLinuxDerivationBuilder::killSandbox(bool getStats)
         if (getStats) {
             buildResult.cpuUser = stats.cpuUser;
             buildResult.cpuSystem = stats.cpuSystem;
+            buildResult.memoryPeak = stats.memoryPeak;
+            buildResult.ioReadBytes = stats.ioReadBytes;
+            buildResult.ioWriteBytes = stats.ioWriteBytes;
+            buildResult.cpuStall = stats.cpuStall;
+            buildResult.memoryStall = stats.memoryStall;
+            buildResult.ioStall = stats.ioStall;
+            oomKilled = stats.oomKills > 0;
         }
         return;
     }
@@ -99,6 +99,21 @@ protected:
         }
     }
 
+    void getFileRange(const std::string & path, uint64_t offset, uint64_t length, Sink & sink) override
+    {
+        auto path2 = checkBinaryCachePath(config->binaryCacheDir, path);
+        try {
+            auto fd = openFileReadonly(path2);
+            if (!fd)
+                throw NativeSysError("opening %s", PathFmt(path2));
+            copyFdRange(fd.get(), offset, length, sink);
+        } catch (SystemError & e) {
+            if (e.is(std::errc::no_such_file_or_directory))
+                throw NoSuchBinaryCacheFile("file '%s' does not exist in binary cache", path);
+            throw;
+        }
+    }
+
     StorePathSet queryAllValidPaths() override
     {
         StorePathSet paths;
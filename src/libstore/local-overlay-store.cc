@@ -114,6 +114,23 @@ void LocalOverlayStore::queryPathInfoUncached(
         }});
 }
 
+std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+LocalOverlayStore::queryPathInfosUncached(const StorePathSet & paths)
+{
+    auto res = LocalStore::queryPathInfosUncached(paths);
+
+    StorePathSet missing;
+    for (auto & path : paths)
+        if (!res.contains(path))
+            missing.insert(path);
+
+    // If we don't have them, check lower store
+    for (auto & [path, info] : lowerStore->queryPathInfos(missing))
+        res.emplace(path, info.get_ptr());
+
+    return res;
+}
+
 void LocalOverlayStore::queryRealisationUncached(
     const DrvOutput & drvOutput, Callback<std::shared_ptr<const UnkeyedRealisation>> callback) noexcept
 {
@@ -18,6 +18,7 @@
 #include "nix/store/keys.hh"
 #include "nix/util/users.hh"
 #include "nix/store/store-registration.hh"
+#include "nix/util/thread-pool.hh"
 
 #include <algorithm>
 #include <cstring>
@@ -110,6 +111,8 @@ struct LocalStore::State::Stmts
     SQLiteStmt QueryPathInfo;
     SQLiteStmt QueryReferences;
     SQLiteStmt QueryReferrers;
+    SQLiteStmt QueryReferenceIds;
+    SQLiteStmt QueryReferrerIds;
     SQLiteStmt InvalidatePath;
     SQLiteStmt AddDerivationOutput;
     SQLiteStmt RegisterRealisedOutput;
@@ -120,6 +123,8 @@ struct LocalStore::State::Stmts
     SQLiteStmt QueryRealisedOutput;
     SQLiteStmt QueryPathFromHashPart;
     SQLiteStmt QueryValidPaths;
+    SQLiteStmt QueryVerifiedHash;
+    SQLiteStmt RecordVerifiedHash;
 };
 
 LocalStore::LocalStore(ref<const Config> config)
@@ -364,6 +369,10 @@ LocalStore::LocalStore(ref<const Config> config)
     state->stmts->QueryReferrers.create(
         state->db,
         "select path from Refs join ValidPaths on referrer = id where reference = (select id from ValidPaths where path = ?);");
+    state->stmts->QueryReferenceIds.create(
+        state->db, "select id, path from Refs join ValidPaths on reference = id where referrer = ?;");
+    state->stmts->QueryReferrerIds.create(
+        state->db, "select id, path from Refs join ValidPaths on referrer = id where reference = ?;");
     state->stmts->InvalidatePath.create(state->db, "delete from ValidPaths where path = ?;");
     state->stmts->AddDerivationOutput.create(
         state->db, "insert or replace into DerivationOutputs (drv, id, path) values (?, ?, ?);");
@@ -374,6 +383,16 @@ LocalStore::LocalStore(ref<const Config> config)
     // ensure efficient lookup.
     state->stmts->QueryPathFromHashPart.create(state->db, "select path from ValidPaths where path >= ? limit 1;");
     state->stmts->QueryValidPaths.create(state->db, "select path from ValidPaths");
+    /* The schema isn't upgraded in read-only mode, so the table may
+       not exist. */
+    if (!config->readOnly) {
+        state->stmts->QueryVerifiedHash.create(
+            state->db,
+            "select 1 from VerifiedHashes where id = (select id from ValidPaths where path = ?) and hash = ? and fingerprint = ?;");
+        state->stmts->RecordVerifiedHash.create(
+            state->db,
+            "insert or replace into VerifiedHashes (id, hash, fingerprint, timestamp) select id, ?, ?, ? from ValidPaths where path = ?;");
+    }
     if (experimentalFeatureSettings.isEnabled(Xp::CaDerivations)) {
         state->stmts->RegisterRealisedOutput.create(
             state->db,
@@ -650,6 +669,20 @@ bool LocalStore::upgradeDBSchema(State & state, bool dryRun)
 
     maybeUpgrade("20260309-drop-redundant-indexreferrer", "drop index if exists IndexReferrer");
 
+    /* The NAR hashes of paths whose contents were last verified when
+       their file metadata had the given fingerprint. */
+    maybeUpgrade(
+        "20261018-verified-hashes",
+        R"(
+            create table if not exists VerifiedHashes (
+                id          integer primary key not null,
+                hash        text not null,
+                fingerprint text not null,
+                timestamp   integer not null,
+                foreign key (id) references ValidPaths(id) on delete cascade
+            )
+        )");
+
     return ret;
 }
 
@@ -791,43 +824,118 @@ void LocalStore::queryPathInfoUncached(
     }
 }
 
-std::shared_ptr<const ValidPathInfo> LocalStore::queryPathInfoInternal(State & state, const StorePath & path)
+std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+LocalStore::queryPathInfosUncached(const StorePathSet & paths)
 {
-    /* Get the path info. */
-    auto useQueryPathInfo(state.stmts->QueryPathInfo.use().apply(printStorePath(path)));
+    /* Stay well below SQLite's limit on the number of host
+       parameters. */
+    static constexpr size_t chunkSize = 500;
 
-    if (!useQueryPathInfo.next())
-        return std::shared_ptr<ValidPathInfo>();
+    return retrySQLite<std::map<StorePath, std::shared_ptr<const ValidPathInfo>>>([&]() {
+        auto state(_state->lock());
+        SQLiteTxn txn(state->db);
 
-    auto id = useQueryPathInfo.getInt(0);
+        std::map<StorePath, std::shared_ptr<const ValidPathInfo>> res;
+
+        auto placeholders = [](size_t n) { return concatStringsSep(", ", std::vector<std::string>(n, "?")); };
+
+        std::vector<const StorePath *> chunk;
+
+        auto flush = [&]() {
+            if (chunk.empty())
+                return;
+
+            std::map<std::string, const StorePath *> byPath;
+            for (auto path : chunk)
+                byPath.emplace(printStorePath(*path), path);
+            chunk.clear();
+
+            SQLiteStmt queryPathInfos(
+                state->db,
+                "select id, hash, registrationTime, deriver, narSize, ultimate, sigs, ca, path from ValidPaths "
+                "where path in ("
+                    + placeholders(byPath.size()) + ");");
+            auto useQueryPathInfos(queryPathInfos.use());
+            for (auto & [s, _] : byPath)
+                useQueryPathInfos.apply(s);
+
+            std::map<int64_t, std::shared_ptr<ValidPathInfo>> byId;
+            while (useQueryPathInfos.next()) {
+                auto & path = *byPath.at(useQueryPathInfos.getStr(8));
+                auto info = readPathInfo(path, useQueryPathInfos);
+                byId.emplace(useQueryPathInfos.getInt(0), info);
+                res.emplace(path, std::move(info));
+            }
+
+            if (byId.empty())
+                return;
+
+            SQLiteStmt queryReferences(
+                state->db,
+                "select referrer, path from Refs join ValidPaths on reference = id where referrer in ("
+                    + placeholders(byId.size()) + ");");
+            auto useQueryReferences(queryReferences.use());
+            for (auto & [id, _] : byId)
+                useQueryReferences.apply(id);
+
+            while (useQueryReferences.next())
+                byId.at(useQueryReferences.getInt(0))
+                    ->references.insert(parseStorePath(useQueryReferences.getStr(1)));
+        };
+
+        for (auto & path : paths) {
+            chunk.push_back(&path);
+            if (chunk.size() >= chunkSize)
+                flush();
+        }
+        flush();
+
+        txn.commit();
+        return res;
+    });
+}
 
+std::shared_ptr<ValidPathInfo> LocalStore::readPathInfo(const StorePath & path, SQLiteStmt::Use & use)
+{
     auto narHash = Hash::dummy;
     try {
-        narHash = Hash::parseAnyPrefixed(useQueryPathInfo.getStr(1));
+        narHash = Hash::parseAnyPrefixed(use.getStr(1));
     } catch (BadHash & e) {
         throw Error("invalid-path entry for '%s': %s", printStorePath(path), e.what());
     }
 
     auto info = std::make_shared<ValidPathInfo>(path, UnkeyedValidPathInfo(*this, narHash));
 
-    info->registrationTime = useQueryPathInfo.getInt(2);
+    info->registrationTime = use.getInt(2);
 
-    auto s = (const char *) sqlite3_column_text(state.stmts->QueryPathInfo, 3);
-    if (s)
-        info->deriver = parseStorePath(s);
+    if (!use.isNull(3))
+        info->deriver = parseStorePath(use.getStr(3));
 
     /* Note that narSize = NULL yields 0. */
-    info->narSize = useQueryPathInfo.getInt(4);
+    info->narSize = use.getInt(4);
+
+    info->ultimate = use.getInt(5) == 1;
+
+    if (!use.isNull(6))
+        info->sigs = Signature::parseMany(tokenizeString<StringSet>(use.getStr(6), " "));
+
+    if (!use.isNull(7))
+        info->ca = ContentAddress::parseOpt(use.getStr(7));
+
+    return info;
+}
 
-    info->ultimate = useQueryPathInfo.getInt(5) == 1;
+std::shared_ptr<const ValidPathInfo> LocalStore::queryPathInfoInternal(State & state, const StorePath & path)
+{
+    /* Get the path info. */
+    auto useQueryPathInfo(state.stmts->QueryPathInfo.use().apply(printStorePath(path)));
+
+    if (!useQueryPathInfo.next())
+        return std::shared_ptr<ValidPathInfo>();
 
-    s = (const char *) sqlite3_column_text(state.stmts->QueryPathInfo, 6);
-    if (s)
-        info->sigs = Signature::parseMany(tokenizeString<StringSet>(s, " "));
+    auto id = useQueryPathInfo.getInt(0);
 
-    s = (const char *) sqlite3_column_text(state.stmts->QueryPathInfo, 7);
-    if (s)
-        info->ca = ContentAddress::parseOpt(s);
+    auto info = readPathInfo(path, useQueryPathInfo);
 
     /* Get the references. */
     auto useQueryReferences(state.stmts->QueryReferences.use().apply(id));
@@ -918,6 +1026,64 @@ StorePathSet LocalStore::queryValidDerivers(const StorePath & path)
     });
 }
 
+void LocalStore::computeFSClosure(
+    const StorePathSet & startPaths,
+    StorePathSet & out,
+    bool flipDirection,
+    bool includeOutputs,
+    bool includeDerivers)
+{
+    /* Following outputs and derivers may require reading derivations
+       and realisations, so leave that to the generic implementation. */
+    if (includeOutputs || includeDerivers)
+        return Store::computeFSClosure(startPaths, out, flipDirection, includeOutputs, includeDerivers);
+
+    /* Walk the Refs table directly by row id, rather than fetching
+       the full path info of every path in the closure. */
+    auto added = retrySQLite<StorePathSet>([&]() {
+        auto state(_state->lock());
+        SQLiteTxn txn(state->db);
+
+        StorePathSet added;
+        std::vector<int64_t> todo;
+
+        auto visit = [&](int64_t id, std::string_view path) {
+            auto storePath = parseStorePath(path);
+            if (out.contains(storePath) || !added.insert(std::move(storePath)).second)
+                return;
+            todo.push_back(id);
+        };
+
+        for (auto & path : startPaths) {
+            if (out.contains(path) || added.contains(path))
+                continue;
+            auto use(state->stmts->QueryPathInfo.use().apply(printStorePath(path)));
+            if (use.next())
+                visit(use.getInt(0), printStorePath(path));
+            else if (flipDirection)
+                added.insert(path);
+            else
+                throw InvalidPath("path '%s' is not valid", printStorePath(path));
+        }
+
+        auto & stmt = flipDirection ? state->stmts->QueryReferrerIds : state->stmts->QueryReferenceIds;
+
+        while (!todo.empty()) {
+            checkInterrupt();
+            auto id = todo.back();
+            todo.pop_back();
+            auto use(stmt.use().apply(id));
+            while (use.next())
+                visit(use.getInt(0), use.getStr(1));
+        }
+
+        txn.commit();
+        return added;
+    });
+
+    out.merge(added);
+}
+
 std::map<std::string, std::optional<StorePath>>
 LocalStore::queryStaticPartialDerivationOutputMap(const StorePath & path)
 {
@@ -1071,6 +1237,36 @@ bool LocalStore::realisationIsUntrusted(const Realisation & realisation)
     return config->requireSigs && !realisation.checkSignatures(realisation.id, getPublicKeys());
 }
 
+namespace {
+
+struct LocalStoreAddLock : Store::AddLock
+{
+    ref<LocalStore> store;
+    std::string pathS;
+    PathLocks lock;
+
+    LocalStoreAddLock(ref<LocalStore> store, const StorePath & path)
+        : store(store)
+        , pathS(store->printStorePath(path))
+        , lock({store->toRealPath(path)})
+    {
+        store->locksHeld.lock()->insert(pathS);
+    }
+
+    ~LocalStoreAddLock()
+    {
+        store->locksHeld.lock()->erase(pathS);
+    }
+};
+
+} // namespace
+
+std::shared_ptr<Store::AddLock> LocalStore::lockPathForAdding(const StorePath & path)
+{
+    return std::make_shared<LocalStoreAddLock>(
+        ref<LocalStore>(std::dynamic_pointer_cast<LocalStore>(shared_from_this())), path);
+}
+
 void LocalStore::addToStore(const ValidPathInfo & info, Source & source, RepairFlag repair, CheckSigsFlag checkSigs)
 {
     if (checkSigs && pathInfoIsUntrusted(info))
@@ -1088,7 +1284,7 @@ void LocalStore::addToStore(const ValidPathInfo & info, Source & source, RepairF
             /* Lock the output path.  But don't lock if we're being called
                from a build hook (whose parent process already acquired a
                lock on this path). */
-            if (!locksHeld.count(printStorePath(info.path)))
+            if (!locksHeld.lock()->count(printStorePath(info.path)))
                 outputLock.lockPaths({realPath});
 
             /* The path may have been created by another process in the meantime, so check again. */
@@ -1436,7 +1632,54 @@ void LocalStore::invalidatePathChecked(const StorePath & path)
     });
 }
 
+LocalStore::InvalidatedPaths LocalStore::invalidatePathsChecked(const std::vector<StorePath> & paths, uint64_t maxNarSize)
+{
+    return retrySQLite<InvalidatedPaths>([&]() {
+        InvalidatedPaths res;
+
+        auto state(_state->lock());
+
+        SQLiteTxn txn(state->db);
+
+        for (auto & path : paths) {
+            if (res.narSize >= maxNarSize) {
+                res.limitReached = true;
+                break;
+            }
+
+            auto info = queryPathInfoInternal(*state, path);
+            if (!info) {
+                /* Already invalid, but it may still have to be
+                   deleted. */
+                res.paths.emplace_back(path, 0);
+                continue;
+            }
+
+            StorePathSet referrers;
+            queryReferrers(*state, path, referrers);
+            referrers.erase(path); /* ignore self-references */
+            if (!referrers.empty()) {
+                res.inUse.insert(path);
+                continue;
+            }
+
+            invalidatePath(*state, path);
+            res.paths.emplace_back(path, info->narSize);
+            res.narSize += info->narSize;
+        }
+
+        txn.commit();
+
+        return res;
+    });
+}
+
 bool LocalStore::verifyStore(bool checkContents, RepairFlag repair)
+{
+    return verifyStore(checkContents, repair, std::nullopt);
+}
+
+bool LocalStore::verifyStore(bool checkContents, RepairFlag repair, std::optional<time_t> registeredBefore)
 {
     printInfo("reading the Nix store...");
 
@@ -1448,87 +1691,347 @@ bool LocalStore::verifyStore(bool checkContents, RepairFlag repair)
     auto [errors, validPaths] = verifyAllValidPaths(repair);
 
     /* Optionally, check the content hashes (slow). */
-    if (checkContents) {
+    if (checkContents && verifyContents(validPaths, repair, registeredBefore))
+        errors = true;
+
+    return errors;
+}
+
+/**
+ * Sort `items` by the inode number of the corresponding file, which
+ * on most file systems approximates the on-disk layout. Hashing in
+ * this order keeps reads mostly sequential even when several threads
+ * are reading at the same time. Items that cannot be stat'ed keep
+ * their relative order at the end.
+ */
+template<typename T>
+static std::vector<T> sortByInode(std::vector<T> items, fun<std::filesystem::path(const T &)> getPath)
+{
+    std::vector<std::pair<uint64_t, T>> keyed;
+    keyed.reserve(items.size());
+    for (auto & item : items) {
+        checkInterrupt();
+        auto st = maybeLstat(getPath(item));
+        keyed.emplace_back(st ? (uint64_t) st->st_ino : std::numeric_limits<uint64_t>::max(), std::move(item));
+    }
 
+    std::stable_sort(keyed.begin(), keyed.end(), [](auto & a, auto & b) { return a.first < b.first; });
+
+    std::vector<T> res;
+    res.reserve(keyed.size());
+    for (auto & [_, item] : keyed)
+        res.push_back(std::move(item));
+    return res;
+}
+
+std::optional<Hash> LocalStore::fingerprintPath(const StorePath & path)
+{
+    if (config->readOnly || !config->getLocalSettings().cacheVerifiedHashes)
+        return std::nullopt;
+
+    /* Change times have a granularity of a second, so a file that was
+       changed in the current second could be changed again without its
+       metadata changing. Don't trust the fingerprint in that case. */
+    auto now = time(nullptr);
+
+    HashSink sink(HashAlgorithm::SHA256);
+
+    auto realPath = toRealPath(path);
+
+    bool recent = false;
+
+    auto add = [&](const std::filesystem::path & relPath, const PosixStat & st) {
+        if (st.st_ctime >= now)
+            recent = true;
+        auto name = relPath.string();
+        sink(
+            fmt("%d:%s %d %d %d %o\n",
+                name.size(),
+                name,
+                (uint64_t) st.st_ino,
+                (int64_t) st.st_ctime,
+                (uint64_t) st.st_size,
+                (unsigned int) st.st_mode));
+    };
+
+    auto rootSt = lstat(realPath);
+    sink(fmt("%d\n", (uint64_t) rootSt.st_dev));
+    add("", rootSt);
+
+    std::function<void(const std::filesystem::path &)> recurse;
+    recurse = [&](const std::filesystem::path & relPath) {
+        checkInterrupt();
+
+        std::vector<std::filesystem::path> names;
+        for (auto & entry : DirectoryIterator{realPath / relPath})
+            names.push_back(entry.path().filename());
+        std::sort(names.begin(), names.end());
+
+        for (auto & name : names) {
+            auto st = lstat(realPath / relPath / name);
+            add(relPath / name, st);
+            if (S_ISDIR(st.st_mode))
+                recurse(relPath / name);
+        }
+    };
+
+    if (S_ISDIR(rootSt.st_mode))
+        recurse("");
+
+    if (recent)
+        return std::nullopt;
+
+    return sink.finish().hash;
+}
+
+bool LocalStore::isVerifiedHash(const StorePath & path, const Hash & narHash, const Hash & fingerprint)
+{
+    return retrySQLite<bool>([&]() {
+        auto state(_state->lock());
+        return state->stmts->QueryVerifiedHash.use()
+            .apply(printStorePath(path))
+            .apply(narHash.to_string(HashFormat::Base16, true))
+            .apply(fingerprint.to_string(HashFormat::Base16, false))
+            .next();
+    });
+}
+
+void LocalStore::recordVerifiedHash(const StorePath & path, const Hash & narHash, const Hash & fingerprint)
+{
+    retrySQLite<void>([&]() {
+        auto state(_state->lock());
+        state->stmts->RecordVerifiedHash.use()
+            .apply(narHash.to_string(HashFormat::Base16, true))
+            .apply(fingerprint.to_string(HashFormat::Base16, false))
+            .apply(time(nullptr))
+            .apply(printStorePath(path))
+            .exec();
+    });
+}
+
+bool LocalStore::pathContentsMatch(const StorePath & path, const Hash & narHash)
+{
+    if (!pathExists(toRealPath(path)))
+        return false;
+
+    auto fingerprint = fingerprintPath(path);
+    if (fingerprint && isVerifiedHash(path, narHash, *fingerprint)) {
+        debug("contents of '%s' are unchanged since they were last verified", printStorePath(path));
+        return true;
+    }
+
+    HashSink hashSink(narHash.algo);
+    dumpPath(toRealPath(path), hashSink);
+    if (hashSink.finish().hash != narHash)
+        return false;
+
+    if (fingerprint)
+        recordVerifiedHash(path, narHash, *fingerprint);
+
+    return true;
+}
+
+bool LocalStore::verifyContents(
+    const StorePathSet & validPaths, RepairFlag repair, std::optional<time_t> registeredBefore)
+{
+    std::atomic<bool> errors{false};
+
+    /* Number of bytes hashed so far, for reporting throughput. */
+    std::atomic<uint64_t> bytesHashed{0};
+    auto startTime = std::chrono::steady_clock::now();
+    Sync<std::chrono::steady_clock::time_point> lastReport_{startTime};
+
+    auto throughput = [&]() {
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        return renderSize(elapsed > 0 ? bytesHashed / elapsed : 0);
+    };
+
+    auto jobs = config->getLocalSettings().verifyJobs.get();
+
+    {
         printInfo("checking link hashes...");
 
+        std::vector<std::filesystem::path> links;
         for (auto & link : DirectoryIterator{linksDir}) {
             checkInterrupt();
-            auto name = link.path().filename();
+            links.push_back(link.path());
+        }
+
+        links = sortByInode<std::filesystem::path>(std::move(links), [](auto & p) { return p; });
+
+        ThreadPool pool(jobs);
+
+        auto doLink = [&](const std::filesystem::path & link) {
+            checkInterrupt();
+            auto name = link.filename();
             printMsg(lvlTalkative, "checking contents of %s", PathFmt(name));
-            std::string hash =
-                hashPath(makeFSSourceAccessor(link.path()), FileIngestionMethod::NixArchive, HashAlgorithm::SHA256)
-                    .first.to_string(HashFormat::Nix32, false);
-            if (hash != name.string()) {
-                printError(
-                    "link %s was modified! expected hash %s, got '%s'", PathFmt(link.path()), name.string(), hash);
+            auto [hash, size] =
+                hashPath(makeFSSourceAccessor(link), FileIngestionMethod::NixArchive, HashAlgorithm::SHA256);
+            bytesHashed += size.value_or(0);
+            auto hashS = hash.to_string(HashFormat::Nix32, false);
+            if (hashS != name.string()) {
+                printError("link %s was modified! expected hash %s, got '%s'", PathFmt(link), name.string(), hashS);
                 if (repair) {
-                    unlinkIfExists(link.path());
-                    printInfo("removed link %s", PathFmt(link.path()));
+                    unlinkIfExists(link);
+                    printInfo("removed link %s", PathFmt(link));
                 } else {
                     errors = true;
                 }
             }
-        }
+        };
 
-        printInfo("checking store hashes...");
+        for (auto & link : links)
+            pool.enqueue(std::bind(doLink, link));
+
+        pool.process();
+    }
 
-        Hash nullHash(HashAlgorithm::SHA256);
+    printInfo("checking store hashes...");
 
-        for (auto & i : validPaths) {
+    std::vector<StorePath> paths;
+    for (auto & i : validPaths) {
+        if (registeredBefore) {
             try {
-                auto info =
-                    std::const_pointer_cast<ValidPathInfo>(std::shared_ptr<const ValidPathInfo>(queryPathInfo(i)));
-
-                /* Check the content hash (optionally - slow). */
-                printMsg(lvlTalkative, "checking contents of '%s'", printStorePath(i));
-
-                auto hashSink = HashSink(info->narHash.algo);
-
-                dumpPath(toRealPath(i), hashSink);
-                auto current = hashSink.finish();
-
-                if (info->narHash != nullHash && info->narHash != current.hash) {
-                    printError(
-                        "path '%s' was modified! expected hash '%s', got '%s'",
-                        printStorePath(i),
-                        info->narHash.to_string(HashFormat::Nix32, true),
-                        current.hash.to_string(HashFormat::Nix32, true));
-                    if (repair)
-                        getBuilder()->repairPath(i);
-                    else
-                        errors = true;
-                } else {
+                if (queryPathInfo(i)->registrationTime >= *registeredBefore)
+                    continue;
+            } catch (InvalidPath &) {
+                continue;
+            }
+        }
+        paths.push_back(i);
+    }
 
-                    bool update = false;
+    if (registeredBefore)
+        printInfo("checking %d of %d paths registered before the given time", paths.size(), validPaths.size());
 
-                    /* Fill in missing hashes. */
-                    if (info->narHash == nullHash) {
-                        printInfo("fixing missing hash on '%s'", printStorePath(i));
-                        info->narHash = current.hash;
-                        update = true;
-                    }
+    paths = sortByInode<StorePath>(std::move(paths), [&](auto & p) { return toRealPath(p); });
 
-                    /* Fill in missing narSize fields (from old stores). */
-                    if (info->narSize == 0) {
-                        printInfo("updating size field on '%s' to %s", printStorePath(i), current.numBytesDigested);
-                        info->narSize = current.numBytesDigested;
-                        update = true;
-                    }
+    Activity act(*logger, lvlInfo, actVerifyPaths, "checking store hashes");
+
+    std::atomic<size_t> done{0}, active{0}, failed{0}, skipped{0};
+
+    auto update = [&]() {
+        act.progress(done, paths.size(), active, failed);
+
+        auto now = std::chrono::steady_clock::now();
+        {
+            auto lastReport(lastReport_.lock());
+            if (now - *lastReport < std::chrono::seconds(10))
+                return;
+            *lastReport = now;
+        }
+        printInfo(
+            "checked %d of %d paths, %s hashed (%s/s)", done, paths.size(), renderSize(bytesHashed), throughput());
+    };
+
+    /* Repairing a path runs a substitution or build, which we don't
+       want to do from several threads at once, so collect the paths
+       and repair them afterwards. */
+    Sync<StorePathSet> toRepair_;
+
+    Hash nullHash(HashAlgorithm::SHA256);
+
+    ThreadPool pool(jobs);
+
+    auto doPath = [&](const StorePath & i) {
+        MaintainCount<std::atomic<size_t>> mcActive(active);
 
-                    if (update)
-                        updatePathInfo(*_state->lock(), *info);
+        try {
+            checkInterrupt();
+
+            auto info = std::const_pointer_cast<ValidPathInfo>(std::shared_ptr<const ValidPathInfo>(queryPathInfo(i)));
+
+            /* Paths with missing hashes or sizes need to be hashed to
+               fill them in. */
+            std::optional<Hash> fingerprint;
+            if (info->narHash != nullHash && info->narSize != 0) {
+                fingerprint = fingerprintPath(i);
+                if (fingerprint && isVerifiedHash(i, info->narHash, *fingerprint)) {
+                    printMsg(lvlTalkative, "skipping unchanged '%s'", printStorePath(i));
+                    skipped++;
+                    done++;
+                    update();
+                    return;
                 }
+            }
+
+            /* Check the content hash (optionally - slow). */
+            printMsg(lvlTalkative, "checking contents of '%s'", printStorePath(i));
+
+            auto hashSink = HashSink(info->narHash.algo);
 
-            } catch (Error & e) {
-                /* It's possible that the path got GC'ed, so ignore
-                   errors on invalid paths. */
-                if (isValidPath(i))
-                    logError(e.info());
+            dumpPath(toRealPath(i), hashSink);
+            auto current = hashSink.finish();
+
+            bytesHashed += current.numBytesDigested;
+
+            if (info->narHash != nullHash && info->narHash != current.hash) {
+                printError(
+                    "path '%s' was modified! expected hash '%s', got '%s'",
+                    printStorePath(i),
+                    info->narHash.to_string(HashFormat::Nix32, true),
+                    current.hash.to_string(HashFormat::Nix32, true));
+                act.result(resCorruptedPath, printStorePath(i));
+                if (repair)
+                    toRepair_.lock()->insert(i);
                 else
-                    logWarning(e.info());
-                errors = true;
+                    errors = true;
+            } else {
+
+                bool update = false;
+
+                /* Fill in missing hashes. */
+                if (info->narHash == nullHash) {
+                    printInfo("fixing missing hash on '%s'", printStorePath(i));
+                    info->narHash = current.hash;
+                    update = true;
+                }
+
+                /* Fill in missing narSize fields (from old stores). */
+                if (info->narSize == 0) {
+                    printInfo("updating size field on '%s' to %s", printStorePath(i), current.numBytesDigested);
+                    info->narSize = current.numBytesDigested;
+                    update = true;
+                }
+
+                if (update)
+                    retrySQLite<void>([&]() { updatePathInfo(*_state->lock(), *info); });
+
+                if (fingerprint)
+                    recordVerifiedHash(i, info->narHash, *fingerprint);
             }
+
+            done++;
+
+        } catch (Error & e) {
+            /* It's possible that the path got GC'ed, so ignore
+               errors on invalid paths. */
+            if (isValidPath(i))
+                logError(e.info());
+            else
+                logWarning(e.info());
+            errors = true;
+            failed++;
+        }
+
+        update();
+    };
+
+    for (auto & i : paths)
+        pool.enqueue(std::bind(doPath, i));
+
+    pool.process();
+
+    printInfo("checked %d paths, %s hashed in total (%s/s)", paths.size(), renderSize(bytesHashed), throughput());
+    if (skipped)
+        printInfo("skipped hashing %d paths that were unchanged since they were last verified", skipped);
+
+    for (auto & i : *toRepair_.lock()) {
+        try {
+            getBuilder()->repairPath(i);
+        } catch (Error & e) {
+            logError(e.info());
+            errors = true;
         }
     }
 
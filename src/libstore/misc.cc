@@ -93,14 +93,20 @@ querySubstitutablePathInfosAsync(Store & store, const StorePathCAMap & paths, Su
     if (!settings.getWorkerSettings().useSubstitutes)
         co_return;
 
-    co_await forEachAsync(paths, [&store, &infos](auto path) -> asio::awaitable<void> {
-        std::optional<Error> lastStoresException = std::nullopt;
-        for (auto & sub : getDefaultSubstituters()) {
-            if (lastStoresException.has_value()) {
-                logError(lastStoresException->info());
-                lastStoresException.reset();
-            }
+    auto subs = getDefaultSubstituters();
+
+    co_await forEachAsync(paths, [&store, &infos, &subs](auto path) -> asio::awaitable<void> {
+        struct Query
+        {
+            ref<Store> sub;
+            StorePath subPath;
+            std::shared_ptr<const ValidPathInfo> info;
+            std::optional<Error> error;
+        };
+
+        std::vector<Query> queries;
 
+        for (auto & sub : subs) {
             auto subPath(path.first);
 
             // Recompute store path so that we can use a different store root.
@@ -118,35 +124,61 @@ querySubstitutablePathInfosAsync(Store & store, const StorePathCAMap & paths, Su
             } else if (sub->storeDir != store.storeDir)
                 continue;
 
+            queries.push_back({.sub = sub, .subPath = std::move(subPath)});
+        }
+
+        /* Ask all substituters at once rather than one after the
+           other, so that a miss in a high-priority substituter doesn't
+           add a round trip. The answers are still considered in
+           priority order below. */
+        co_await forEachAsync(queries, [](Query & query) -> asio::awaitable<void> {
             debug(
                 "checking substituter '%s' for path '%s'",
-                sub->config.getHumanReadableURI(),
-                sub->printStorePath(subPath));
+                query.sub->config.getHumanReadableURI(),
+                query.sub->printStorePath(query.subPath));
             try {
-                auto info = co_await callbackToAwaitable<ref<const ValidPathInfo>>(
-                    [subPath, &sub](Callback<ref<const ValidPathInfo>> cb) {
-                        sub->queryPathInfo(subPath, std::move(cb));
-                    });
-
-                if (sub->storeDir != store.storeDir && !(info->isContentAddressed(*sub) && info->references.empty()))
-                    continue;
-
-                auto narInfo = std::dynamic_pointer_cast<const NarInfo>(std::shared_ptr<const ValidPathInfo>(info));
-                infos.insert_or_assign(
-                    path.first,
-                    SubstitutablePathInfo{
-                        .deriver = info->deriver,
-                        .references = info->references,
-                        .downloadSize = narInfo ? narInfo->fileSize : 0,
-                        .narSize = info->narSize,
+                query.info = co_await callbackToAwaitable<ref<const ValidPathInfo>>(
+                    [&query](Callback<ref<const ValidPathInfo>> cb) {
+                        query.sub->queryPathInfo(query.subPath, std::move(cb));
                     });
-
-                break; /* We are done. */
             } catch (InvalidPath &) {
             } catch (SubstituterDisabled &) {
             } catch (Error & e) {
-                lastStoresException = std::make_optional(std::move(e));
+                query.error = std::move(e);
+            }
+        });
+
+        std::optional<Error> lastStoresException = std::nullopt;
+        for (auto & query : queries) {
+            if (lastStoresException.has_value()) {
+                logError(lastStoresException->info());
+                lastStoresException.reset();
             }
+
+            if (query.error) {
+                lastStoresException = std::move(query.error);
+                continue;
+            }
+
+            auto & info = query.info;
+            if (!info)
+                continue;
+
+            if (query.sub->storeDir != store.storeDir
+                && !(info->isContentAddressed(*query.sub) && info->references.empty()))
+                continue;
+
+            auto narInfo = std::dynamic_pointer_cast<const NarInfo>(info);
+            infos.insert_or_assign(
+                path.first,
+                SubstitutablePathInfo{
+                    .deriver = info->deriver,
+                    .references = info->references,
+                    .downloadSize = narInfo ? narInfo->fileSize : 0,
+                    .narSize = info->narSize,
+                });
+
+            break; /* We are done. */
         }
         if (lastStoresException.has_value()) {
             if (!settings.getWorkerSettings().tryFallback) {
@@ -249,8 +281,11 @@ MissingPaths Store::queryMissing(const std::vector<DerivedPath> & targets)
 
                             bool found = false;
                             for (auto & sub : getDefaultSubstituters()) {
-                                /* TODO: Asyncify this. */
-                                auto realisation = sub->queryRealisation({drvPath, outputName});
+                                auto realisation =
+                                    co_await callbackToAwaitable<std::shared_ptr<const UnkeyedRealisation>>(
+                                        [&](Callback<std::shared_ptr<const UnkeyedRealisation>> cb) {
+                                            sub->queryRealisation({drvPath, outputName}, std::move(cb));
+                                        });
                                 if (!realisation)
                                     continue;
                                 found = true;
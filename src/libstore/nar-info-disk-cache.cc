@@ -3,7 +3,11 @@
 #include "nix/util/sync.hh"
 #include "nix/store/sqlite.hh"
 #include "nix/store/globals.hh"
+#include "nix/util/pool.hh"
+#include "nix/util/lru-cache.hh"
 
+#include <boost/unordered/concurrent_flat_map.hpp>
+#include <thread>
 #include <sqlite3.h>
 #include <nlohmann/json.hpp>
 
@@ -36,6 +40,7 @@ create table if not exists NARs (
     deriver          text,
     sigs             text,
     ca               text,
+    deltas           text,
     timestamp        integer not null,
     present          integer not null,
     primary key (cache, hashPart),
@@ -64,6 +69,16 @@ create table if not exists LastPurge (
 
 )sql";
 
+static const char * queryNARSql =
+    "select present, namePart, url, compression, fileHash, fileSize, narHash, narSize, refs, deriver, sigs, ca, deltas, timestamp from NARs where cache = ? and hashPart = ? and ((present = 0 and timestamp > ?) or (present = 1 and timestamp > ?))";
+
+static const char * queryRealisationSql = R"(
+    select outputPath, sigs from BuildTrace
+        where cache = ? and drvPath = ? and outputName = ? and
+            ((outputPath is null and timestamp > ?) or
+             (outputPath is not null and timestamp > ?))
+)";
+
 struct NarInfoDiskCacheImpl : NarInfoDiskCache
 {
 private:
@@ -72,28 +87,90 @@ public:
     /* How often to purge expired entries from the cache. */
     const int purgeInterval = 24 * 3600;
 
+    /* Maximum number of NAR info lookups to remember in memory. */
+    const size_t maxMemoryEntries = 1 << 16;
+
+    /* Number of independently locked shards of the in-memory cache. */
+    const size_t memoryCacheShards = 64;
+
     struct Cache
     {
         std::string storeDir;
         CacheInfo info;
     };
 
+    /**
+     * The connection used for writing. Lookups don't use it.
+     */
     struct State
     {
         SQLite db;
-        SQLiteStmt insertCache, queryCache, insertNAR, insertMissingNAR, queryNAR, insertRealisation,
-            insertMissingRealisation, queryRealisation, purgeCache;
-        std::map<std::string, Cache> caches;
+        SQLiteStmt insertCache, queryCache, insertNAR, insertMissingNAR, insertRealisation, insertMissingRealisation,
+            purgeCache;
     };
 
     Sync<State> _state;
 
+    /**
+     * A read-only connection. If the database is in WAL mode (see
+     * `use-sqlite-wal`), these don't block each other or the writer.
+     */
+    struct Reader
+    {
+        SQLite db;
+        SQLiteStmt queryNAR, queryRealisation;
+    };
+
+    Pool<Reader> readers;
+
+    boost::concurrent_flat_map<std::string, Cache> caches;
+
+    /**
+     * A NAR info lookup result, keyed by cache id and hash part. A null
+     * `info` means that the path doesn't exist in the cache.
+     */
+    struct MemoryEntry
+    {
+        std::shared_ptr<const NarInfo> info;
+        time_t timestamp;
+    };
+
+    /**
+     * Recent lookups and inserts, so that repeated lookups of the same
+     * path (e.g. by concurrent substitution goals) don't hit SQLite.
+     * Since every lookup updates the LRU order, this is split into
+     * shards by hash part, so that concurrent lookups rarely contend
+     * for the same lock.
+     */
+    std::vector<Sync<LRUCache<std::pair<int, std::string>, MemoryEntry>>> memoryCache;
+
+    Sync<LRUCache<std::pair<int, std::string>, MemoryEntry>> & getMemoryCacheShard(const std::string & hashPart)
+    {
+        return memoryCache[std::hash<std::string>{}(hashPart) % memoryCache.size()];
+    }
+
     NarInfoDiskCacheImpl(
         const Settings & settings,
         SQLiteSettings sqliteSettings,
-        std::filesystem::path dbPath = getCacheDir() / "binary-cache-v8.sqlite")
+        std::filesystem::path dbPath = getCacheDir() / "binary-cache-v9.sqlite")
         : NarInfoDiskCache{settings}
+        /* Without WAL, readers block the writer, so don't have more
+           than one of them. */
+        , readers(
+              sqliteSettings.useWAL ? std::max(1U, std::thread::hardware_concurrency()) : 1,
+              [dbPath, sqliteSettings]() {
+                  auto reader = make_ref<Reader>();
+                  reader->db =
+                      SQLite(dbPath, {.mode = SQLiteOpenMode::ReadOnly, .useWAL = sqliteSettings.useWAL});
+                  reader->queryNAR.create(reader->db, queryNARSql);
+                  reader->queryRealisation.create(reader->db, queryRealisationSql);
+                  return reader;
+              })
     {
+        memoryCache.reserve(memoryCacheShards);
+        for (size_t i = 0; i < memoryCacheShards; ++i)
+            memoryCache.emplace_back(maxMemoryEntries / memoryCacheShards);
+
         auto state(_state.lock());
 
         createDirs(dbPath.parent_path());
@@ -115,15 +192,11 @@ public:
         state->insertNAR.create(
             state->db,
             "insert or replace into NARs(cache, hashPart, namePart, url, compression, fileHash, fileSize, narHash, "
-            "narSize, refs, deriver, sigs, ca, timestamp, present) values (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, 1)");
+            "narSize, refs, deriver, sigs, ca, deltas, timestamp, present) values (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, 1)");
 
         state->insertMissingNAR.create(
             state->db, "insert or replace into NARs(cache, hashPart, timestamp, present) values (?, ?, ?, 0)");
 
-        state->queryNAR.create(
-            state->db,
-            "select present, namePart, url, compression, fileHash, fileSize, narHash, narSize, refs, deriver, sigs, ca from NARs where cache = ? and hashPart = ? and ((present = 0 and timestamp > ?) or (present = 1 and timestamp > ?))");
-
         state->insertRealisation.create(
             state->db,
             R"(
@@ -138,15 +211,6 @@ public:
                     values (?, ?, ?, ?)
             )");
 
-        state->queryRealisation.create(
-            state->db,
-            R"(
-                select outputPath, sigs from BuildTrace
-                    where cache = ? and drvPath = ? and outputName = ? and
-                        ((outputPath is null and timestamp > ?) or
-                         (outputPath is not null and timestamp > ?))
-            )");
-
         /* Periodically purge expired entries from the database. */
         retrySQLite<void>([&]() {
             auto now = time(nullptr);
@@ -175,20 +239,22 @@ public:
         });
     }
 
-    Cache & getCache(State & state, const std::string & uri)
+    Cache getCache(const std::string & uri)
     {
-        auto i = state.caches.find(uri);
-        if (i == state.caches.end())
+        std::optional<Cache> cache;
+        caches.cvisit(uri, [&](auto & i) { cache = i.second; });
+        if (!cache)
             unreachable();
-        return i->second;
+        return std::move(*cache);
     }
 
 private:
 
     std::optional<Cache> queryCacheRaw(State & state, const std::string & uri)
     {
-        auto i = state.caches.find(uri);
-        if (i == state.caches.end()) {
+        std::optional<Cache> cache;
+        caches.cvisit(uri, [&](auto & i) { cache = i.second; });
+        if (!cache) {
             /* Important: always use int64_t even on 32 bit systems. Otherwise
                the the subtraction would promote time_t to unsigned if time_t is
                32 bit. */
@@ -196,16 +262,133 @@ private:
             auto queryCache(state.queryCache.use().apply(uri).apply(timestamp));
             if (!queryCache.next())
                 return std::nullopt;
-            auto cache = Cache{
+            cache = Cache{
                 .storeDir = queryCache.getStr(1),
                 .info = {
                     .id = (int) queryCache.getInt(0),
                     .wantMassQuery = queryCache.getInt(2) != 0,
                     .priority = (int) queryCache.getInt(3),
                 }};
-            state.caches.emplace(uri, cache);
+            caches.insert_or_assign(uri, *cache);
+        }
+        return cache;
+    }
+
+    bool isFresh(const MemoryEntry & entry, time_t now)
+    {
+        return entry.timestamp > now - (time_t) (entry.info ? settings.ttlPositive.get() : settings.ttlNegative.get());
+    }
+
+    void remember(int cacheId, const std::string & hashPart, MemoryEntry entry)
+    {
+        getMemoryCacheShard(hashPart).lock()->upsert(std::pair{cacheId, hashPart}, entry);
+    }
+
+    std::optional<std::pair<Outcome, std::shared_ptr<NarInfo>>>
+    lookupInMemory(int cacheId, const std::string & hashPart, time_t now)
+    {
+        auto entry = getMemoryCacheShard(hashPart).lock()->get(std::pair{cacheId, hashPart});
+        if (!entry || !isFresh(*entry, now))
+            return std::nullopt;
+        /* Return a copy, since callers may modify it. */
+        if (entry->info)
+            return {{oValid, std::make_shared<NarInfo>(*entry->info)}};
+        return {{oInvalid, nullptr}};
+    }
+
+    std::pair<Outcome, std::shared_ptr<NarInfo>>
+    queryNAR(Reader & reader, const Cache & cache, const std::string & hashPart, time_t now)
+    {
+        auto queryNAR(reader.queryNAR.use()
+                          .apply(cache.info.id)
+                          .apply(hashPart)
+                          .apply(now - settings.ttlNegative)
+                          .apply(now - settings.ttlPositive));
+
+        if (!queryNAR.next())
+            return {oUnknown, 0};
+
+        if (!queryNAR.getInt(0)) {
+            remember(cache.info.id, hashPart, {.timestamp = (time_t) queryNAR.getInt(13)});
+            return {oInvalid, 0};
+        }
+
+        auto namePart = queryNAR.getStr(1);
+        auto narInfo = make_ref<NarInfo>(
+            cache.storeDir, StorePath(hashPart + "-" + namePart), Hash::parseAnyPrefixed(queryNAR.getStr(6)));
+        narInfo->url = queryNAR.getStr(2);
+        narInfo->compression = parseCompressionAlgo(queryNAR.getStr(3));
+        if (!queryNAR.isNull(4))
+            narInfo->fileHash = Hash::parseAnyPrefixed(queryNAR.getStr(4));
+        narInfo->fileSize = queryNAR.getInt(5);
+        narInfo->narSize = queryNAR.getInt(7);
+        for (auto & r : tokenizeString<Strings>(queryNAR.getStr(8), " "))
+            narInfo->references.insert(StorePath(r));
+        if (!queryNAR.isNull(9))
+            narInfo->deriver = StorePath(queryNAR.getStr(9));
+        for (auto & sig : tokenizeString<Strings>(queryNAR.getStr(10), " "))
+            narInfo->sigs.insert(Signature::parse(sig));
+        narInfo->ca = ContentAddress::parseOpt(queryNAR.getStr(11));
+        if (!queryNAR.isNull(12))
+            for (auto & delta : tokenizeString<Strings>(queryNAR.getStr(12), "\n"))
+                narInfo->deltas.push_back(NarDelta::parse(delta));
+
+        remember(
+            cache.info.id,
+            hashPart,
+            {.info = std::make_shared<NarInfo>(*narInfo), .timestamp = (time_t) queryNAR.getInt(13)});
+
+        return {oValid, narInfo};
+    }
+
+    void insertNAR(State & state, const Cache & cache, const std::string & hashPart, const ValidPathInfo * info)
+    {
+        auto now = time(nullptr);
+
+        if (info) {
+
+            auto narInfo = dynamic_cast<const NarInfo *>(info);
+
+            // assert(hashPart == storePathToHash(info->path));
+
+            state.insertNAR.use()
+                .apply(cache.info.id)
+                .apply(hashPart)
+                .apply(std::string(info->path.name()))
+                .apply(narInfo ? narInfo->url : "", narInfo != 0)
+                .apply(
+                    /* TODO: Revisit the whole conditional on nullopt compression. This shouldn't happen. .narinfo
+                       parsing treats empty strings as bzip2 while other code treats it as "none"... */
+                    narInfo && narInfo->compression ? showCompressionAlgo(*narInfo->compression) : "",
+                    narInfo != 0)
+                .apply(
+                    narInfo && narInfo->fileHash ? narInfo->fileHash->to_string(HashFormat::Nix32, true) : "",
+                    narInfo && narInfo->fileHash)
+                .apply(narInfo ? narInfo->fileSize : 0, narInfo != 0 && narInfo->fileSize)
+                .apply(info->narHash.to_string(HashFormat::Nix32, true))
+                .apply(info->narSize)
+                .apply(concatStringsSep(" ", info->shortRefs()))
+                .apply(info->deriver ? std::string(info->deriver->to_string()) : "", (bool) info->deriver)
+                .apply(concatStringsSep(" ", Signature::toStrings(info->sigs)))
+                .apply(renderContentAddress(info->ca))
+                .apply(
+                    narInfo ? concatMapStringsSep("\n", narInfo->deltas, [](auto & delta) { return delta.to_string(); })
+                            : "",
+                    narInfo && !narInfo->deltas.empty())
+                .apply(now)
+                .exec();
+
+            /* Only remember full NAR infos, since lookups return a
+               `NarInfo`. */
+            if (narInfo)
+                remember(cache.info.id, hashPart, {.info = std::make_shared<NarInfo>(*narInfo), .timestamp = now});
+            else
+                getMemoryCacheShard(hashPart).lock()->erase(std::pair{cache.info.id, hashPart});
+
+        } else {
+            state.insertMissingNAR.use().apply(cache.info.id).apply(hashPart).apply(now).exec();
+            remember(cache.info.id, hashPart, {.timestamp = now});
         }
-        return getCache(state, uri);
     }
 
 public:
@@ -237,7 +420,7 @@ public:
                 ret.info.id = (int) r.getInt(0);
             }
 
-            state->caches[uri] = ret;
+            caches.insert_or_assign(uri, ret);
 
             txn.commit();
             return ret.info.id;
@@ -258,59 +441,65 @@ public:
     std::pair<Outcome, std::shared_ptr<NarInfo>>
     lookupNarInfo(const std::string & uri, const std::string & hashPart) override
     {
+        auto cache(getCache(uri));
+
+        auto now = time(nullptr);
+
+        if (auto res = lookupInMemory(cache.info.id, hashPart, now))
+            return *res;
+
         return retrySQLite<std::pair<Outcome, std::shared_ptr<NarInfo>>>(
             [&]() -> std::pair<Outcome, std::shared_ptr<NarInfo>> {
-                auto state(_state.lock());
+                auto reader(readers.get());
+                return queryNAR(*reader, cache, hashPart, now);
+            });
+    }
 
-                auto & cache(getCache(*state, uri));
+    std::map<std::string, std::pair<Outcome, std::shared_ptr<NarInfo>>>
+    lookupNarInfos(const std::string & uri, const std::set<std::string> & hashParts) override
+    {
+        auto cache(getCache(uri));
 
-                auto now = time(nullptr);
+        auto now = time(nullptr);
 
-                auto queryNAR(state->queryNAR.use()
-                                  .apply(cache.info.id)
-                                  .apply(hashPart)
-                                  .apply(now - settings.ttlNegative)
-                                  .apply(now - settings.ttlPositive));
-
-                if (!queryNAR.next())
-                    return {oUnknown, 0};
-
-                if (!queryNAR.getInt(0))
-                    return {oInvalid, 0};
-
-                auto namePart = queryNAR.getStr(1);
-                auto narInfo = make_ref<NarInfo>(
-                    cache.storeDir, StorePath(hashPart + "-" + namePart), Hash::parseAnyPrefixed(queryNAR.getStr(6)));
-                narInfo->url = queryNAR.getStr(2);
-                narInfo->compression = parseCompressionAlgo(queryNAR.getStr(3));
-                if (!queryNAR.isNull(4))
-                    narInfo->fileHash = Hash::parseAnyPrefixed(queryNAR.getStr(4));
-                narInfo->fileSize = queryNAR.getInt(5);
-                narInfo->narSize = queryNAR.getInt(7);
-                for (auto & r : tokenizeString<Strings>(queryNAR.getStr(8), " "))
-                    narInfo->references.insert(StorePath(r));
-                if (!queryNAR.isNull(9))
-                    narInfo->deriver = StorePath(queryNAR.getStr(9));
-                for (auto & sig : tokenizeString<Strings>(queryNAR.getStr(10), " "))
-                    narInfo->sigs.insert(Signature::parse(sig));
-                narInfo->ca = ContentAddress::parseOpt(queryNAR.getStr(11));
-
-                return {oValid, narInfo};
-            });
+        std::map<std::string, std::pair<Outcome, std::shared_ptr<NarInfo>>> res;
+        std::vector<std::string> missing;
+
+        for (auto & hashPart : hashParts) {
+            if (auto r = lookupInMemory(cache.info.id, hashPart, now))
+                res.insert_or_assign(hashPart, std::move(*r));
+            else
+                missing.push_back(hashPart);
+        }
+
+        if (missing.empty())
+            return res;
+
+        /* Do all queries in a single read transaction, rather than
+           implicitly starting one per query. */
+        retrySQLite<void>([&]() {
+            auto reader(readers.get());
+            SQLiteTxn txn(reader->db);
+            for (auto & hashPart : missing)
+                res.insert_or_assign(hashPart, queryNAR(*reader, cache, hashPart, now));
+            txn.commit();
+        });
+
+        return res;
     }
 
     std::pair<Outcome, std::shared_ptr<Realisation>>
     lookupRealisation(const std::string & uri, const DrvOutput & id) override
     {
+        auto cache(getCache(uri));
+
         return retrySQLite<std::pair<Outcome, std::shared_ptr<Realisation>>>(
             [&]() -> std::pair<Outcome, std::shared_ptr<Realisation>> {
-                auto state(_state.lock());
-
-                auto & cache(getCache(*state, uri));
+                auto reader(readers.get());
 
                 auto now = time(nullptr);
 
-                auto queryRealisation(state->queryRealisation.use()
+                auto queryRealisation(reader->queryRealisation.use()
                                           .apply(cache.info.id)
                                           .apply(id.drvPath.to_string())
                                           .apply(id.outputName)
@@ -343,53 +532,39 @@ public:
     void upsertNarInfo(
         const std::string & uri, const std::string & hashPart, std::shared_ptr<const ValidPathInfo> info) override
     {
+        auto cache(getCache(uri));
+
         retrySQLite<void>([&]() {
             auto state(_state.lock());
+            insertNAR(*state, cache, hashPart, info.get());
+        });
+    }
 
-            auto & cache(getCache(*state, uri));
-
-            if (info) {
-
-                auto narInfo = std::dynamic_pointer_cast<const NarInfo>(info);
-
-                // assert(hashPart == storePathToHash(info->path));
-
-                state->insertNAR.use()
-                    .apply(cache.info.id)
-                    .apply(hashPart)
-                    .apply(std::string(info->path.name()))
-                    .apply(narInfo ? narInfo->url : "", narInfo != 0)
-                    .apply(
-                        /* TODO: Revisit the whole conditional on nullopt compression. This shouldn't happen. .narinfo
-                           parsing treats empty strings as bzip2 while other code treats it as "none"... */
-                        narInfo && narInfo->compression ? showCompressionAlgo(*narInfo->compression) : "",
-                        narInfo != 0)
-                    .apply(
-                        narInfo && narInfo->fileHash ? narInfo->fileHash->to_string(HashFormat::Nix32, true) : "",
-                        narInfo && narInfo->fileHash)
-                    .apply(narInfo ? narInfo->fileSize : 0, narInfo != 0 && narInfo->fileSize)
-                    .apply(info->narHash.to_string(HashFormat::Nix32, true))
-                    .apply(info->narSize)
-                    .apply(concatStringsSep(" ", info->shortRefs()))
-                    .apply(info->deriver ? std::string(info->deriver->to_string()) : "", (bool) info->deriver)
-                    .apply(concatStringsSep(" ", Signature::toStrings(info->sigs)))
-                    .apply(renderContentAddress(info->ca))
-                    .apply(time(nullptr))
-                    .exec();
+    void upsertNarInfos(
+        const std::string & uri,
+        const std::vector<std::pair<std::string, std::shared_ptr<const ValidPathInfo>>> & infos) override
+    {
+        if (infos.empty())
+            return;
 
-            } else {
-                state->insertMissingNAR.use().apply(cache.info.id).apply(hashPart).apply(time(nullptr)).exec();
-            }
+        auto cache(getCache(uri));
+
+        retrySQLite<void>([&]() {
+            auto state(_state.lock());
+            SQLiteTxn txn(state->db);
+            for (auto & [hashPart, info] : infos)
+                insertNAR(*state, cache, hashPart, info.get());
+            txn.commit();
         });
     }
 
     void upsertRealisation(const std::string & uri, const Realisation & realisation) override
     {
+        auto cache(getCache(uri));
+
         retrySQLite<void>([&]() {
             auto state(_state.lock());
 
-            auto & cache(getCache(*state, uri));
-
             state->insertRealisation.use()
                 .apply(cache.info.id)
                 .apply(realisation.id.drvPath.to_string())
@@ -403,10 +578,11 @@ public:
 
     virtual void upsertAbsentRealisation(const std::string & uri, const DrvOutput & id) override
     {
+        auto cache(getCache(uri));
+
         retrySQLite<void>([&]() {
             auto state(_state.lock());
 
-            auto & cache(getCache(*state, uri));
             state->insertMissingRealisation.use()
                 .apply(cache.info.id)
                 .apply(id.drvPath.to_string())
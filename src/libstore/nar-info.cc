@@ -7,6 +7,28 @@ namespace nix {
 
 void NarInfo::anchor() {}
 
+std::string NarDelta::to_string() const
+{
+    return fmt(
+        "%s %s %s %d", base.to_string(), baseNarHash.to_string(HashFormat::Nix32, true), url, fileSize);
+}
+
+NarDelta NarDelta::parse(std::string_view s)
+{
+    auto fields = tokenizeString<std::vector<std::string>>(s, " ");
+    if (fields.size() != 4)
+        throw Error("invalid NAR delta '%s'", s);
+    auto fileSize = string2Int<uint64_t>(fields[3]);
+    if (!fileSize)
+        throw Error("invalid NAR delta '%s'", s);
+    return {
+        .base = StorePath(fields[0]),
+        .baseNarHash = Hash::parseAnyPrefixed(fields[1]),
+        .url = fields[2],
+        .fileSize = *fileSize,
+    };
+}
+
 NarInfo::NarInfo(const StoreDirConfig & store, const std::string & s, const std::string & whence)
     : UnkeyedValidPathInfo(store, Hash::dummy)                                          // FIXME: hack
     , ValidPathInfo(StorePath::dummy, static_cast<const UnkeyedValidPathInfo &>(*this)) // FIXME: hack
@@ -90,7 +112,12 @@ NarInfo::NarInfo(const StoreDirConfig & store, const std::string & s, const std:
                 throw corrupt("extra CA");
             // FIXME: allow blank ca or require skipping field?
             ca = ContentAddress::parseOpt(value);
-        }
+        } else if (name == "Delta")
+            try {
+                deltas.push_back(NarDelta::parse(value));
+            } catch (Error &) {
+                throw corrupt("invalid Delta");
+            }
 
         pos = eol + 1;
         line += 1;
@@ -138,6 +165,9 @@ std::string NarInfo::to_string(const StoreDirConfig & store) const
     if (ca)
         res += "CA: " + renderContentAddress(*ca) + "\n";
 
+    for (const auto & delta : deltas)
+        res += "Delta: " + delta.to_string() + "\n";
+
     return res;
 }
 
@@ -163,6 +193,21 @@ UnkeyedNarInfo::toJSON(const StoreDirConfig * store, bool includeImpureInfo, Pat
         }
         if (fileSize)
             jsonObject["downloadSize"] = fileSize;
+        if (!deltas.empty()) {
+            auto & jsonDeltas = jsonObject["deltas"] = json::array();
+            for (auto & delta : deltas)
+                jsonDeltas.push_back({
+                    {"base",
+                     format == PathInfoJsonFormat::V1 ? static_cast<json>(store->printStorePath(delta.base))
+                                                      : static_cast<json>(delta.base)},
+                    {"baseNarHash",
+                     format == PathInfoJsonFormat::V1
+                         ? static_cast<json>(delta.baseNarHash.to_string(HashFormat::SRI, true))
+                         : static_cast<json>(delta.baseNarHash)},
+                    {"url", delta.url},
+                    {"downloadSize", delta.fileSize},
+                });
+        }
     }
 
     return jsonObject;
@@ -195,6 +240,20 @@ UnkeyedNarInfo UnkeyedNarInfo::fromJSON(const StoreDirConfig * store, const nloh
     if (auto * downloadSize = get(obj, "downloadSize"))
         res.fileSize = getUnsigned(*downloadSize);
 
+    if (auto * rawDeltas = get(obj, "deltas"))
+        for (auto & rawDelta : getArray(*rawDeltas)) {
+            auto & delta = getObject(rawDelta);
+            res.deltas.push_back({
+                .base = format == PathInfoJsonFormat::V1 ? store->parseStorePath(getString(valueAt(delta, "base")))
+                                                         : static_cast<StorePath>(valueAt(delta, "base")),
+                .baseNarHash = format == PathInfoJsonFormat::V1
+                                   ? Hash::parseSRI(getString(valueAt(delta, "baseNarHash")))
+                                   : Hash(valueAt(delta, "baseNarHash")),
+                .url = getString(valueAt(delta, "url")),
+                .fileSize = getUnsigned(valueAt(delta, "downloadSize")),
+            });
+        }
+
     return res;
 }
 
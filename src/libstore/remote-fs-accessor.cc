@@ -4,9 +4,9 @@ namespace nix {
 
 void RemoteFSAccessor::anchor() {}
 
-RemoteFSAccessor::RemoteFSAccessor(ref<Store> store, bool requireValidPath, std::optional<AbsolutePath> cacheDir)
+RemoteFSAccessor::RemoteFSAccessor(ref<Store> store, bool requireValidPath, ref<NarCache> narCache)
     : store(store)
-    , narCache(cacheDir)
+    , narCache(narCache)
     , requireValidPath(requireValidPath)
 {
 }
@@ -21,18 +21,42 @@ std::pair<ref<SourceAccessor>, CanonPath> RemoteFSAccessor::fetch(const CanonPat
 
 std::shared_ptr<SourceAccessor> RemoteFSAccessor::accessObject(const StorePath & storePath)
 {
+    if (openSeekableNar) {
+        std::optional<std::shared_ptr<SourceAccessor>> accessor;
+        {
+            auto seekableNars_(seekableNars.lock());
+            if (auto * p = get(*seekableNars_, storePath.hashPart()))
+                accessor = *p;
+        }
+        if (!accessor) {
+            /* Don't hold the lock while opening the NAR, which may do
+               network I/O. If another thread opened it in the meantime,
+               use theirs. */
+            auto opened = openSeekableNar(storePath);
+            accessor = seekableNars.lock()->emplace(storePath.hashPart(), std::move(opened)).first->second;
+        }
+        if (*accessor)
+            return *accessor;
+    }
+
     // Check if we already have the NAR hash for this store path
-    if (auto * narHash = get(narHashes, storePath.hashPart()))
-        return narCache.getOrInsert(*narHash, [&](Sink & sink) { store->narFromPath(storePath, sink); });
+    std::optional<Hash> narHash;
+    {
+        auto narHashes_(narHashes.lock());
+        if (auto * p = get(*narHashes_, storePath.hashPart()))
+            narHash = *p;
+    }
+    if (narHash)
+        return narCache->getOrInsert(*narHash, [&](Sink & sink) { store->narFromPath(storePath, sink); });
 
     // Query the path info to get the NAR hash
     auto info = store->queryPathInfo(storePath);
 
     // Cache the mapping from store path to NAR hash
-    narHashes.emplace(storePath.hashPart(), info->narHash);
+    narHashes.lock()->emplace(storePath.hashPart(), info->narHash);
 
     // Get or create the NAR accessor
-    return narCache.getOrInsert(info->narHash, [&](Sink & sink) { store->narFromPath(storePath, sink); });
+    return narCache->getOrInsert(info->narHash, [&](Sink & sink) { store->narFromPath(storePath, sink); });
 }
 
 std::optional<SourceAccessor::Stat> RemoteFSAccessor::maybeLstat(const CanonPath & path)
@@ -13,6 +13,7 @@
 #include "nix/store/worker-protocol.hh"
 #include "nix/store/worker-protocol-impl.hh"
 #include "nix/util/archive.hh"
+#include "nix/util/compression.hh"
 #include "nix/store/globals.hh"
 #include "nix/store/derivations.hh"
 #include "nix/util/pool.hh"
@@ -22,6 +23,11 @@
 #include "nix/store/filetransfer.hh"
 #include "nix/util/signals.hh"
 #include "nix/util/socket.hh"
+#include "nix/util/thread-pool.hh"
+
+#include <condition_variable>
+#include <deque>
+#include <thread>
 #include <variant>
 
 #ifndef _WIN32
@@ -259,6 +265,30 @@ void RemoteStore::queryPathInfoUncached(
     }
 }
 
+std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+RemoteStore::queryPathInfosUncached(const StorePathSet & paths)
+{
+    if (!getConnection()->protoVersion.features.contains(WorkerProto::featureBatchQueryPathInfos))
+        return Store::queryPathInfosUncached(paths);
+
+    auto infos = ({
+        auto conn(getConnection());
+        conn->queryPathInfos(*this, &conn.daemonException, paths);
+    });
+
+    /* The daemon returns the full store paths, but the caller may have
+       omitted the name part, so match the results by hash part. */
+    std::map<std::string_view, const StorePath *> byHashPart;
+    for (auto & path : paths)
+        byHashPart.emplace(path.hashPart(), &path);
+
+    std::map<StorePath, std::shared_ptr<const ValidPathInfo>> res;
+    for (auto & info : infos)
+        if (auto i = byHashPart.find(info.path.hashPart()); i != byHashPart.end())
+            res.emplace(*i->second, std::make_shared<const ValidPathInfo>(std::move(info)));
+    return res;
+}
+
 void RemoteStore::queryReferrers(const StorePath & path, StorePathSet & referrers)
 {
     auto conn(getConnection());
@@ -269,6 +299,30 @@ void RemoteStore::queryReferrers(const StorePath & path, StorePathSet & referrer
         referrers.insert(i);
 }
 
+void RemoteStore::computeFSClosure(
+    const StorePathSet & paths, StorePathSet & out, bool flipDirection, bool includeOutputs, bool includeDerivers)
+{
+    if (!getConnection()->protoVersion.features.contains(WorkerProto::featureQueryClosure)) {
+        Store::computeFSClosure(paths, out, flipDirection, includeOutputs, includeDerivers);
+        return;
+    }
+
+    auto [closure, infos] = ({
+        auto conn(getConnection());
+        conn->queryClosure(*this, &conn.daemonException, paths, flipDirection, includeOutputs, includeDerivers);
+    });
+
+    out.insert(closure.begin(), closure.end());
+
+    /* Callers typically query the path infos of the closure next, so
+       keep the ones we got for free. */
+    for (auto & info : infos) {
+        if (pathInfoCache)
+            pathInfoCache->lock()->upsert(
+                info.path, PathInfoCacheValue{.value = std::make_shared<const ValidPathInfo>(std::move(info))});
+    }
+}
+
 StorePathSet RemoteStore::queryValidDerivers(const StorePath & path)
 {
     auto conn(getConnection());
@@ -435,6 +489,18 @@ StorePath RemoteStore::addToStoreFromDump(
     return storePath;
 }
 
+/**
+ * Send the level at which the NAR(s) of the current operation will be
+ * compressed, if the daemon supports compression, and return it.
+ */
+static unsigned int sendNarCompressionLevel(WorkerProto::BasicClientConnection & conn, unsigned int level)
+{
+    if (!conn.protoVersion.features.contains(WorkerProto::featureNarCompression))
+        return 0;
+    conn.to << level;
+    return level;
+}
+
 void RemoteStore::addToStore(const ValidPathInfo & info, Source & source, RepairFlag repair, CheckSigsFlag checkSigs)
 {
     auto conn(getConnection());
@@ -449,7 +515,15 @@ void RemoteStore::addToStore(const ValidPathInfo & info, Source & source, Repair
     conn->to << renderContentAddress(info.ca) << repair << !checkSigs;
 
     if (conn->protoVersion >= WorkerProto::Version{.number = {1, 23}}) {
-        conn.withFramedSink([&](Sink & sink) { copyNAR(source, sink); });
+        auto compressionLevel = sendNarCompressionLevel(*conn, config.narCompressionLevel);
+        conn.withFramedSink([&](Sink & sink) {
+            if (compressionLevel) {
+                auto compressionSink = makeCompressionSink(CompressionAlgo::zstd, sink, false, compressionLevel);
+                copyNAR(source, *compressionSink);
+                compressionSink->finish();
+            } else
+                copyNAR(source, sink);
+        });
     } else if (conn->protoVersion >= WorkerProto::Version{.number = {1, 21}}) {
         conn.processStderr(0, &source);
     } else {
@@ -458,6 +532,93 @@ void RemoteStore::addToStore(const ValidPathInfo & info, Source & source, Repair
     }
 }
 
+/**
+ * Call `produce` on a separate thread, and pass the data that it writes
+ * on to `sink` on the current thread. Up to `maxBuffered` bytes are
+ * queued in between, so that producing the data (e.g. serialising
+ * NARs) overlaps with consuming it (e.g. sending it to the daemon).
+ */
+static void pipeline(fun<void(Sink &)> produce, Sink & sink, size_t maxBuffered = 64 * 1024 * 1024)
+{
+    struct State
+    {
+        std::deque<std::string> chunks;
+        size_t buffered = 0;
+        bool done = false;
+        bool cancelled = false;
+        std::exception_ptr exception;
+    };
+
+    Sync<State> state_;
+    std::condition_variable wakeup;
+
+    struct QueueSink : BufferedSink
+    {
+        Sync<State> & state_;
+        std::condition_variable & wakeup;
+        size_t maxBuffered;
+
+        QueueSink(Sync<State> & state_, std::condition_variable & wakeup, size_t maxBuffered)
+            : BufferedSink(256 * 1024)
+            , state_(state_)
+            , wakeup(wakeup)
+            , maxBuffered(maxBuffered)
+        {
+        }
+
+        void writeUnbuffered(std::string_view data) override
+        {
+            auto state(state_.lock());
+            state.wait(wakeup, [&]() { return state->buffered < maxBuffered || state->cancelled; });
+            if (state->cancelled)
+                throw Interrupted("pipeline was cancelled");
+            state->chunks.emplace_back(data);
+            state->buffered += data.size();
+            wakeup.notify_all();
+        }
+    };
+
+    std::thread producer([&]() {
+        ReceiveInterrupts receiveInterrupts;
+        try {
+            QueueSink queueSink(state_, wakeup, maxBuffered);
+            produce(queueSink);
+            queueSink.flush();
+        } catch (...) {
+            state_.lock()->exception = std::current_exception();
+        }
+        state_.lock()->done = true;
+        wakeup.notify_all();
+    });
+
+    Finally joinProducer([&]() {
+        state_.lock()->cancelled = true;
+        wakeup.notify_all();
+        producer.join();
+    });
+
+    while (true) {
+        std::string chunk;
+        {
+            auto state(state_.lock());
+            while (state->chunks.empty() && !state->done) {
+                state.wait_for(wakeup, std::chrono::milliseconds(100));
+                checkInterrupt();
+            }
+            if (state->chunks.empty()) {
+                if (state->exception)
+                    std::rethrow_exception(state->exception);
+                break;
+            }
+            chunk = std::move(state->chunks.front());
+            state->chunks.pop_front();
+            state->buffered -= chunk.size();
+            wakeup.notify_all();
+        }
+        sink(chunk);
+    }
+}
+
 void RemoteStore::addMultipleToStore(
     PathsSource && pathsToCopy, Activity & act, RepairFlag repair, CheckSigsFlag checkSigs)
 {
@@ -466,38 +627,107 @@ void RemoteStore::addMultipleToStore(
         return;
     }
 
-    auto conn(getConnection());
-
-    // `addMultipleToStore` is single threaded
     size_t bytesExpected = 0;
     for (auto & [pathInfo, _] : pathsToCopy) {
         bytesExpected += pathInfo.narSize;
     }
     act.setExpected(actCopyPath, bytesExpected);
 
-    auto source = sinkToSource([&](Sink & sink) {
-        size_t nrTotal = pathsToCopy.size();
-        sink << nrTotal;
-        // Reverse, so we can release memory at the original start
-        std::reverse(pathsToCopy.begin(), pathsToCopy.end());
-        while (!pathsToCopy.empty()) {
-            act.progress(nrTotal - pathsToCopy.size(), nrTotal, size_t(1), size_t(0));
-
-            auto & [pathInfo, pathSource] = pathsToCopy.back();
-            WorkerProto::Serialise<ValidPathInfo>::write(
-                *this,
-                WorkerProto::WriteConn{
-                    .to = sink,
-                    .version = {.number = {.major = 1, .minor = 16}},
+    size_t nrTotal = pathsToCopy.size();
+    std::atomic<size_t> nrStarted{0};
+
+    /* Send some paths over one connection. Serialising (and possibly
+       compressing) the NARs happens on another thread, overlapping with
+       sending them. */
+    auto sendPaths = [&](PathsSource && paths) {
+        auto conn(getConnection());
+        conn->to << WorkerProto::Op::AddMultipleToStore << repair << !checkSigs;
+        auto compressionLevel = sendNarCompressionLevel(*conn, config.narCompressionLevel);
+        conn.withFramedSink([&](Sink & framedSink) {
+            pipeline(
+                [&](Sink & uncompressedSink) {
+                    std::shared_ptr<CompressionSink> compressionSink;
+                    if (compressionLevel)
+                        compressionSink =
+                            makeCompressionSink(CompressionAlgo::zstd, uncompressedSink, false, compressionLevel);
+                    Sink & sink = compressionSink ? *compressionSink : uncompressedSink;
+
+                    sink << paths.size();
+                    // Reverse, so we can release memory at the original start
+                    std::reverse(paths.begin(), paths.end());
+                    while (!paths.empty()) {
+                        act.progress(nrStarted++, nrTotal, size_t(1), size_t(0));
+
+                        auto & [pathInfo, pathSource] = paths.back();
+                        WorkerProto::Serialise<ValidPathInfo>::write(
+                            *this,
+                            WorkerProto::WriteConn{
+                                .to = sink,
+                                .version = {.number = {.major = 1, .minor = 16}},
+                            },
+                            pathInfo);
+                        pathSource->drainInto(sink);
+                        paths.pop_back();
+                    }
+
+                    if (compressionSink)
+                        compressionSink->finish();
                 },
-                pathInfo);
-            pathSource->drainInto(sink);
-            pathsToCopy.pop_back();
+                framedSink);
+        });
+    };
+
+    auto maxConnections = (size_t) std::max(1, config.maxConnections.get());
+
+    if (maxConnections == 1 || nrTotal == 1) {
+        sendPaths(std::move(pathsToCopy));
+        return;
+    }
+
+    /* Use multiple connections. The daemon registers each path as soon
+       as it has received it, so a path can only be sent once its
+       references have been registered. `pathsToCopy` is sorted
+       topologically, so assign each path to the wave after the last
+       one containing any of its references. Paths in the same wave are
+       independent, so they're sent in parallel. */
+    std::map<StorePath, size_t> waveOf;
+    std::vector<PathsSource> waves;
+    for (auto & item : pathsToCopy) {
+        size_t wave = 0;
+        for (auto & ref : item.first.references)
+            if (ref != item.first.path)
+                if (auto * refWave = get(waveOf, ref))
+                    wave = std::max(wave, *refWave + 1);
+        waveOf.emplace(item.first.path, wave);
+        if (waves.size() <= wave)
+            waves.resize(wave + 1);
+        waves[wave].push_back(std::move(item));
+    }
+    pathsToCopy.clear();
+
+    for (auto & wave : waves) {
+        /* Distribute the paths over the connections, largest first, to
+           balance the number of bytes sent over each. */
+        std::sort(wave.begin(), wave.end(), [](auto & a, auto & b) { return a.first.narSize > b.first.narSize; });
+
+        std::vector<PathsSource> streams(std::min(maxConnections, wave.size()));
+        std::vector<uint64_t> streamSizes(streams.size(), 0);
+        for (auto & item : wave) {
+            auto i = std::min_element(streamSizes.begin(), streamSizes.end()) - streamSizes.begin();
+            streamSizes[i] += item.first.narSize;
+            streams[i].push_back(std::move(item));
+        }
+
+        if (streams.size() == 1) {
+            sendPaths(std::move(streams[0]));
+            continue;
         }
-    });
 
-    conn->to << WorkerProto::Op::AddMultipleToStore << repair << !checkSigs;
-    conn.withFramedSink([&](Sink & sink) { source->drainInto(sink); });
+        ThreadPool pool(streams.size());
+        for (auto & stream : streams)
+            pool.enqueue([&]() { sendPaths(std::move(stream)); });
+        pool.process();
+    }
 }
 
 void RemoteStore::registerDrvOutputUnchecked(const Realisation & info)
@@ -913,12 +1143,17 @@ void RemoteStore::shutdownConnections()
 void RemoteStore::narFromPath(const StorePath & path, Sink & sink)
 {
     auto conn(getConnection());
-    conn->narFromPath(*this, &conn.daemonException, path, [&](Source & source) { copyNAR(conn->from, sink); });
+    conn->narFromPath(
+        *this,
+        &conn.daemonException,
+        path,
+        [&](Source & source) { copyNAR(source, sink); },
+        config.narCompressionLevel);
 }
 
 ref<RemoteFSAccessor> RemoteStore::getRemoteFSAccessor(bool requireValidPath)
 {
-    return make_ref<RemoteFSAccessor>(ref<Store>(shared_from_this()), requireValidPath);
+    return make_ref<RemoteFSAccessor>(ref<Store>(shared_from_this()), requireValidPath, narCache);
 }
 
 ref<SourceAccessor> RemoteStore::getFSAccessor(bool requireValidPath)
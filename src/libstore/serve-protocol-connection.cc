@@ -3,6 +3,7 @@
 #include "nix/store/build-result.hh"
 #include "nix/store/derivations.hh"
 #include "nix/store/derivation/aterm.hh"
+#include "nix/util/compression.hh"
 
 namespace nix {
 
@@ -86,12 +87,21 @@ BuildResult ServeProto::BasicClientConnection::getBuildDerivationResponse(const
 }
 
 void ServeProto::BasicClientConnection::narFromPath(
-    const StoreDirConfig & store, const StorePath & path, fun<void(Source &)> receiveNar)
+    const StoreDirConfig & store, const StorePath & path, fun<void(Source &)> receiveNar, unsigned int compressionLevel)
 {
     to << ServeProto::Command::DumpStorePath << store.printStorePath(path);
+    if (remoteVersion >= ServeProto::narCompressionVersion)
+        to << compressionLevel;
+    else
+        compressionLevel = 0;
     to.flush();
 
-    receiveNar(from);
+    if (compressionLevel) {
+        FramedSource framedSource(from);
+        auto source = makeDecompressionSource(CompressionAlgo::zstd, framedSource);
+        receiveNar(*source);
+    } else
+        receiveNar(from);
 }
 
 void ServeProto::BasicClientConnection::importPaths(const StoreDirConfig & store, fun<void(Sink &)> sendPaths)
@@ -94,7 +94,7 @@ SQLite::SQLite(const std::filesystem::path & path, Settings && settings)
     // for Linux (WSL) where useSQLiteWAL should be false by default.
     const char * vfs = settings.useWAL ? 0 : "unix-dotfile";
     bool immutable = settings.mode == SQLiteOpenMode::Immutable;
-    int flags = immutable ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE;
+    int flags = immutable || settings.mode == SQLiteOpenMode::ReadOnly ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE;
     if (settings.mode == SQLiteOpenMode::Normal)
         flags |= SQLITE_OPEN_CREATE;
     auto uri = "file:" + percentEncode(path.string()) + "?immutable=" + (immutable ? "1" : "0");
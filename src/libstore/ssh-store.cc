@@ -67,6 +67,17 @@ public:
         unsupported("getBuildLogExact");
     }
 
+    /**
+     * The connections are pipes to SSH rather than sockets, so kill
+     * the SSH processes instead of shutting down the sockets.
+     */
+    void shutdownConnections() override
+    {
+        for (auto & weak : *allConnections.lock())
+            if (auto conn = weak.lock(); conn && conn->sshConn)
+                conn->sshConn->shutdown();
+    }
+
 protected:
 
     struct Connection : RemoteStore::Connection
@@ -85,6 +96,12 @@ protected:
 
     ref<RemoteStore::Connection> openConnection() override;
 
+    /**
+     * All connections that have been opened, for
+     * `shutdownConnections()`.
+     */
+    Sync<std::vector<std::weak_ptr<Connection>>> allConnections;
+
     std::vector<std::string> extraRemoteProgramArgs;
 
     SSHMaster master;
@@ -234,6 +251,11 @@ ref<RemoteStore::Connection> SSHStore::openConnection()
     conn->sshConn = master.startCommand(toOsStrings(std::move(command)));
     conn->to = FdSink(conn->sshConn->in.get());
     conn->from = FdSource(conn->sshConn->out.get());
+    {
+        auto allConnections_(allConnections.lock());
+        std::erase_if(*allConnections_, [](auto & c) { return c.expired(); });
+        allConnections_->push_back(conn.get_ptr());
+    }
     return conn;
 }
 
@@ -307,4 +307,12 @@ void SSHMaster::Connection::trySetBufferSize(size_t size)
 #endif
 }
 
+void SSHMaster::Connection::shutdown()
+{
+#ifndef _WIN32
+    if (sshPid != -1)
+        ::kill(sshPid, SIGKILL);
+#endif
+}
+
 } // namespace nix
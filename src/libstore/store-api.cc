@@ -22,6 +22,7 @@
 #include "nix/util/signals.hh"
 #include "nix/util/environment-variables.hh"
 #include "nix/util/file-system.hh"
+#include "nix/util/file-descriptor.hh"
 
 #include "store-config-private.hh"
 
@@ -393,6 +394,16 @@ void Store::narFromPath(const StorePath & path, Sink & sink)
     dumpPath(sourcePath, sink, FileSerialisationMethod::NixArchive);
 }
 
+fun<void(Sink &)> Store::fetchNar(const StorePath & path, Store & baseStore)
+{
+    auto fd = std::make_shared<AutoCloseFD>(createAnonymousTempFile());
+    FdSink fileSink(fd->get());
+    narFromPathWithBase(path, baseStore, fileSink);
+    fileSink.flush();
+
+    return [fd, size = fileSink.written](Sink & sink) { copyFdRange(fd->get(), 0, size, sink); };
+}
+
 StringSet Store::Config::getDefaultSystemFeatures()
 {
     auto res = settings.systemFeatures.get();
@@ -675,6 +686,125 @@ void Store::queryPathInfo(const StorePath & storePath, Callback<ref<const ValidP
         }});
 }
 
+std::map<StorePath, ref<const ValidPathInfo>> Store::queryPathInfos(const StorePathSet & paths)
+{
+    std::map<StorePath, ref<const ValidPathInfo>> infos;
+    StorePathSet uncached;
+
+    if (pathInfoCache) {
+        auto cache(pathInfoCache->lock());
+        for (auto & path : paths) {
+            auto res = cache->get(path);
+            if (!res || !res->isKnownNow(settings.getNarInfoDiskCacheSettings()))
+                uncached.insert(path);
+            else if (res->didExist())
+                infos.emplace(path, ref(res->value));
+        }
+    } else
+        uncached = paths;
+
+    /* Look up the remaining paths in the disk cache in one go, rather
+       than doing a query per path. */
+    if (diskCache && !uncached.empty()) {
+        std::set<std::string> hashParts;
+        for (auto & path : uncached)
+            hashParts.insert(std::string(path.hashPart()));
+
+        auto cached =
+            diskCache->lookupNarInfos(config.getReference().render(/*FIXME withParams=*/false), hashParts);
+
+        StorePathSet uncached2;
+        for (auto & path : uncached) {
+            auto & [outcome, info] = cached.at(std::string(path.hashPart()));
+            if (outcome == NarInfoDiskCache::oUnknown) {
+                uncached2.insert(path);
+                continue;
+            }
+            if (pathInfoCache)
+                pathInfoCache->lock()->upsert(
+                    path,
+                    outcome == NarInfoDiskCache::oInvalid ? PathInfoCacheValue{} : PathInfoCacheValue{.value = info});
+            if (outcome == NarInfoDiskCache::oValid && goodStorePath(path, info->path))
+                infos.emplace(path, ref<const ValidPathInfo>(info));
+        }
+        std::swap(uncached, uncached2);
+    }
+
+    if (uncached.empty())
+        return infos;
+
+    auto fetched = queryPathInfosUncached(uncached);
+
+    std::vector<std::pair<std::string, std::shared_ptr<const ValidPathInfo>>> toCache;
+
+    for (auto & path : uncached) {
+        std::shared_ptr<const ValidPathInfo> info;
+        if (auto i = fetched.find(path); i != fetched.end())
+            info = i->second;
+
+        if (diskCache)
+            toCache.emplace_back(std::string(path.hashPart()), info);
+
+        if (pathInfoCache)
+            pathInfoCache->lock()->upsert(path, PathInfoCacheValue{.value = info});
+
+        if (info && goodStorePath(path, info->path))
+            infos.emplace(path, ref(info));
+    }
+
+    if (diskCache)
+        diskCache->upsertNarInfos(config.getReference().render(/*FIXME withParams=*/false), toCache);
+
+    return infos;
+}
+
+std::map<StorePath, std::shared_ptr<const ValidPathInfo>> Store::queryPathInfosUncached(const StorePathSet & paths)
+{
+    struct State
+    {
+        size_t left;
+        std::map<StorePath, std::shared_ptr<const ValidPathInfo>> infos;
+        std::exception_ptr exc;
+    };
+
+    Sync<State> state_(State{.left = paths.size()});
+
+    std::condition_variable wakeup;
+    ThreadPool pool;
+
+    auto doQuery = [&](const StorePath & path) {
+        checkInterrupt();
+        queryPathInfoUncached(
+            path, {[path, &state_, &wakeup](std::future<std::shared_ptr<const ValidPathInfo>> fut) {
+                auto state(state_.lock());
+                try {
+                    if (auto info = fut.get())
+                        state->infos.emplace(path, std::move(info));
+                } catch (...) {
+                    state->exc = std::current_exception();
+                }
+                assert(state->left);
+                if (!--state->left)
+                    wakeup.notify_one();
+            }});
+    };
+
+    for (auto & path : paths)
+        pool.enqueue(std::bind(doQuery, path));
+
+    pool.process();
+
+    while (true) {
+        auto state(state_.lock());
+        if (!state->left) {
+            if (state->exc)
+                std::rethrow_exception(state->exc);
+            return std::move(state->infos);
+        }
+        state.wait(wakeup);
+    }
+}
+
 void Store::queryRealisation(
     const DrvOutput & id, Callback<std::shared_ptr<const UnkeyedRealisation>> callback) noexcept
 {
@@ -918,29 +1048,14 @@ makeCopyPathMessage(const StoreConfig & srcCfg, const StoreConfig & dstCfg, std:
         "copying path '%s' from '%s' to '%s'", storePath, srcCfg.getHumanReadableURI(), dstCfg.getHumanReadableURI());
 }
 
-void copyStorePath(
-    Store & srcStore, Store & dstStore, const StorePath & storePath, RepairFlag repair, CheckSigsFlag checkSigs)
+/**
+ * Query the info of `storePath` in `srcStore`, adjusted for adding it
+ * to `dstStore`.
+ */
+static ref<const ValidPathInfo> queryInfoForCopy(Store & srcStore, Store & dstStore, const StorePath & storePath)
 {
-    /* Bail out early (before starting a download from srcStore) if
-       dstStore already has this path. */
-    if (!repair && dstStore.isValidPath(storePath))
-        return;
-
-    const auto & srcCfg = srcStore.config;
-    const auto & dstCfg = dstStore.config;
-    auto storePathS = srcStore.printStorePath(storePath);
-    Activity act(
-        *logger,
-        lvlInfo,
-        actCopyPath,
-        makeCopyPathMessage(srcCfg, dstCfg, storePathS),
-        std::to_array<Logger::Field>({storePathS, srcCfg.getHumanReadableURI(), dstCfg.getHumanReadableURI()}));
-    PushActivity pact(act.id);
-
     auto info = srcStore.queryPathInfo(storePath);
 
-    uint64_t total = 0;
-
     // recompute store path on the chance dstStore does it differently
     if (info->ca && info->references.empty()) {
         auto info2 = make_ref<ValidPathInfo>(*info);
@@ -957,26 +1072,118 @@ void copyStorePath(
         info = info2;
     }
 
-    if (getEnv("_NIX_TEST_CONCURRENT_SUBSTITUTION"))
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+    return info;
+}
+
+static std::shared_ptr<Activity>
+startCopyActivity(Store & srcStore, Store & dstStore, const std::string & storePathS)
+{
+    const auto & srcCfg = srcStore.config;
+    const auto & dstCfg = dstStore.config;
+    return std::make_shared<Activity>(
+        *logger,
+        lvlInfo,
+        actCopyPath,
+        makeCopyPathMessage(srcCfg, dstCfg, storePathS),
+        std::to_array<Logger::Field>({storePathS, srcCfg.getHumanReadableURI(), dstCfg.getHumanReadableURI()}));
+}
+
+/**
+ * Add the NAR written by `writeNar` to `dstStore`, reporting progress
+ * on `act`.
+ */
+static void addCopiedNar(
+    Store & dstStore,
+    const ValidPathInfo & info,
+    Activity & act,
+    const std::string & storePathS,
+    const std::string & srcUri,
+    fun<void(Sink &)> writeNar,
+    RepairFlag repair,
+    CheckSigsFlag checkSigs)
+{
+    uint64_t total = 0;
 
     auto source = sinkToSource(
         [&](Sink & sink) {
             LambdaSink progressSink([&](std::string_view data) {
                 total += data.size();
-                act.progress(total, info->narSize);
+                act.progress(total, info.narSize);
             });
             TeeSink tee{sink, progressSink};
-            srcStore.narFromPath(storePath, tee);
+            writeNar(tee);
         },
         [&]() {
-            throw EndOfFile(
-                "NAR for '%s' fetched from '%s' is incomplete",
-                srcStore.printStorePath(storePath),
-                srcStore.config.getHumanReadableURI());
+            throw EndOfFile("NAR for '%s' fetched from '%s' is incomplete", storePathS, srcUri);
         });
 
-    dstStore.addToStore(*info, *source, repair, checkSigs);
+    dstStore.addToStore(info, *source, repair, checkSigs);
+}
+
+void copyStorePath(
+    Store & srcStore, Store & dstStore, const StorePath & storePath, RepairFlag repair, CheckSigsFlag checkSigs)
+{
+    /* Bail out early (before starting a download from srcStore) if
+       dstStore already has this path. */
+    if (!repair && dstStore.isValidPath(storePath))
+        return;
+
+    auto storePathS = srcStore.printStorePath(storePath);
+    auto act = startCopyActivity(srcStore, dstStore, storePathS);
+    PushActivity pact(act->id);
+
+    auto info = queryInfoForCopy(srcStore, dstStore, storePath);
+
+    if (getEnv("_NIX_TEST_CONCURRENT_SUBSTITUTION"))
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+
+    addCopiedNar(
+        dstStore,
+        *info,
+        *act,
+        storePathS,
+        srcStore.config.getHumanReadableURI(),
+        [&](Sink & sink) { srcStore.narFromPathWithBase(storePath, dstStore, sink); },
+        repair,
+        checkSigs);
+}
+
+fun<void()> fetchStorePath(
+    Store & srcStore, Store & dstStore, const StorePath & storePath, RepairFlag repair, CheckSigsFlag checkSigs)
+{
+    if (!repair && dstStore.isValidPath(storePath))
+        return []() {};
+
+    auto storePathS = srcStore.printStorePath(storePath);
+    auto act = startCopyActivity(srcStore, dstStore, storePathS);
+    PushActivity pact(act->id);
+
+    auto info = queryInfoForCopy(srcStore, dstStore, storePath);
+
+    if (getEnv("_NIX_TEST_CONCURRENT_SUBSTITUTION"))
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+
+    /* Adding the path happens later, so lock it now to keep another
+       process from fetching it at the same time. It may have been
+       added while we were waiting for the lock. */
+    auto lock = dstStore.lockPathForAdding(info->path);
+    if (lock && !repair && dstStore.isValidPath(info->path))
+        return []() {};
+
+    auto writeNar = srcStore.fetchNar(storePath, dstStore);
+
+    return [&dstStore,
+            info,
+            act,
+            lock,
+            storePathS,
+            srcUri = srcStore.config.getHumanReadableURI(),
+            writeNar,
+            repair,
+            checkSigs]() {
+        PushActivity pact(act->id);
+        addCopiedNar(dstStore, *info, *act, storePathS, srcUri, writeNar, repair, checkSigs);
+    };
 }
 
 std::map<StorePath, StorePath> copyPaths(
@@ -29,11 +29,16 @@ gid_t ChrootDerivationBuilder::sandboxGid()
     return buildUser->getGID();
 }
 
+std::filesystem::path ChrootDerivationBuilder::getChrootParentDir()
+{
+    return store.toRealPath(drvPath) + ".chroot";
+}
+
 void ChrootDerivationBuilder::prepareSandbox()
 {
     // Set up chroot parameters
     BuildChrootParams params{
-        .chrootParentDir = store.toRealPath(drvPath) + ".chroot",
+        .chrootParentDir = getChrootParentDir(),
         .useUidRange = drvOptions.useUidRange(drv),
         .isSandboxed = derivationType.isSandboxed(),
         .buildUser = buildUser.get(),
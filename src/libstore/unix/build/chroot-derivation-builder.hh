@@ -39,6 +39,13 @@ public:
 
     virtual gid_t sandboxGid();
 
+    /**
+     * Return the directory in which the chroot is created. It must be
+     * on the same file system as the Nix store, so that outputs can be
+     * moved from the chroot to the store.
+     */
+    virtual std::filesystem::path getChrootParentDir();
+
     void prepareSandbox() override;
 
     Strings getPreBuildHookArgs() override;
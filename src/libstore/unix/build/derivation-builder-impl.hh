@@ -138,6 +138,12 @@ protected:
      */
     Sync<OutputPathMap> submittedOutputs;
 
+    /**
+     * Whether the out-of-memory killer killed a process of the build.
+     * Only known if the build ran in a cgroup.
+     */
+    bool oomKilled = false;
+
     static const std::filesystem::path homeDir;
 
     /**
@@ -271,6 +277,13 @@ protected:
         killSandbox(false);
     }
 
+    /**
+     * Create the temporary build directory, choose the scratch output
+     * paths and fill in the environment for the builder. Called by
+     * startBuild() after the build user has been acquired.
+     */
+    void prepareBuild();
+
     /**
      * Called by prepareBuild() to do any setup in the parent to
      * prepare for a sandboxed build.
@@ -396,7 +409,7 @@ protected:
      */
     virtual void execBuilder(const Strings & args, const Strings & envStrs);
 
-private:
+protected:
 
     /**
      * Check that the derivation outputs all exist and register them
@@ -404,6 +417,8 @@ private:
      */
     SingleDrvOutputs registerOutputs();
 
+private:
+
     /**
      * Check that the derivation outputs submitted by recursive-nix exist
      * and attach them to the derivation
@@ -231,11 +231,16 @@ SingleDrvOutputs DerivationBuilderImpl::unprepareBuild()
 
         cleanupBuild(false);
 
+        /* A build that was killed for lack of memory may well succeed
+           when fewer builds run at the same time. */
         throw BuilderFailureError{
-            !derivationType.isSandboxed() || diskFull ? BuildResult::Failure::TransientFailure
-                                                      : BuildResult::Failure::PermanentFailure,
+            !derivationType.isSandboxed() || diskFull || oomKilled ? BuildResult::Failure::TransientFailure
+                                                                   : BuildResult::Failure::PermanentFailure,
             status,
-            diskFull ? "\nnote: build failure may have been caused by lack of free disk space" : "",
+            diskFull    ? "\nnote: build failure may have been caused by lack of free disk space"
+            : oomKilled ? "\nnote: a process of the build was killed by the out-of-memory killer"
+                        : "",
+            oomKilled,
         };
     }
 
@@ -353,21 +358,8 @@ static void checkNotWorldWritable(std::filesystem::path path)
     return;
 }
 
-std::optional<Descriptor> DerivationBuilderImpl::startBuild()
+void DerivationBuilderImpl::prepareBuild()
 {
-    if (useBuildUsers(localSettings)) {
-        if (!buildUser)
-            buildUser = getBuildUser();
-
-        if (!buildUser)
-            return std::nullopt;
-    }
-
-    /* Make sure that no other processes are executing under the
-       sandbox uids. This must be done before any chownToBuilder()
-       calls. */
-    prepareUser();
-
     auto buildDir = store.config->getBuildDir();
 
     createDirs(buildDir);
@@ -446,6 +438,24 @@ std::optional<Descriptor> DerivationBuilderImpl::startBuild()
 
     /* Construct the environment passed to the builder. */
     initEnv();
+}
+
+std::optional<Descriptor> DerivationBuilderImpl::startBuild()
+{
+    if (useBuildUsers(localSettings)) {
+        if (!buildUser)
+            buildUser = getBuildUser();
+
+        if (!buildUser)
+            return std::nullopt;
+    }
+
+    /* Make sure that no other processes are executing under the
+       sandbox uids. This must be done before any chownToBuilder()
+       calls. */
+    prepareUser();
+
+    prepareBuild();
 
     prepareSandbox();
 
@@ -1839,6 +1849,15 @@ std::unique_ptr<DerivationBuilder, DerivationBuilderDeleter> makeDerivationBuild
 
     const bool isRelocatedStore = store.storeDir != store.config->realStoreDir.get();
 
+    /* Builtin builders that only write their outputs don't need a
+       sandbox or even a child process. They still need a sandbox if
+       the store is relocated, since the store paths in their
+       attributes only exist there. */
+    if (params.drv.isBuiltin() && !isRelocatedStore
+        && RegisterBuiltinBuilder::inProcessBuiltinBuilders().count(params.drv.builder.substr(8))
+        && params.drvOptions.getRequiredSystemFeatures(params.drv).empty())
+        return makeInProcessDerivationBuilder(store, miscMethods, std::move(params));
+
     if (isRelocatedStore) {
 #if defined(__linux__) || defined(__FreeBSD__)
         useSandbox = true;
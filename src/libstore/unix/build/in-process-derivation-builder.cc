@@ -0,0 +1,111 @@
+#include "derivation-builder-impl.hh"
+#include "nix/store/builtins.hh"
+#include "nix/util/signals.hh"
+
+namespace nix {
+
+namespace {
+
+/**
+ * Runs a builtin builder that only writes its outputs (see
+ * `RegisterBuiltinBuilder::inProcessBuiltinBuilders()`) in the worker
+ * process, without forking a child or setting up a sandbox.
+ */
+struct InProcessDerivationBuilder : DerivationBuilderImpl
+{
+    /**
+     * The error thrown by the builtin builder, if any.
+     */
+    std::optional<std::string> error;
+
+    using DerivationBuilderImpl::DerivationBuilderImpl;
+
+    std::optional<Descriptor> startBuild() override
+    {
+        /* There is no build user, since the builder doesn't run any
+           untrusted code. */
+        prepareBuild();
+
+        miscMethods->openLogFile();
+
+        buildResult.startTime = time(nullptr);
+
+        BuiltinBuilderContext ctx{
+            .drv = drv,
+            .hashedMirrors = settings.getLocalSettings().hashedMirrors,
+            .tmpDirInSandbox = tmpDir,
+        };
+
+        for (auto & e : drv.outputs)
+            ctx.outputs.insert_or_assign(e.first, store.toRealPath(scratchOutputs.at(e.first)));
+
+        ctx.inputPaths.emplace();
+        for (auto & path : inputPaths)
+            ctx.inputPaths->insert(store.toRealPath(path));
+
+        printMsg(lvlChatty, "running builder '%1%' in-process", drv.builder);
+
+        try {
+            auto builtinName = drv.builder.substr(8);
+            if (auto builtin = get(RegisterBuiltinBuilder::builtinBuilders(), builtinName))
+                (*builtin)(ctx);
+            else
+                throw Error("unsupported builtin builder '%1%'", builtinName);
+        } catch (Error & e) {
+            error = e.msg();
+        } catch (Interrupted &) {
+            throw;
+        } catch (std::exception & e) {
+            /* E.g. JSON parse errors or std::filesystem errors, which
+               the forked builder also reports as a build failure. */
+            error = e.what();
+        }
+
+        /* The goal waits for EOF on the builder output, so hand it a
+           pipe that has already been closed, with the error message
+           (if any) as the build log. The message is truncated so that
+           it fits in the pipe buffer. */
+        Pipe pipe;
+        pipe.create();
+        if (error)
+            writeFull(pipe.writeSide.get(), error->substr(0, 4096) + "\n");
+        pipe.writeSide.close();
+        builderOut = std::move(pipe.readSide);
+
+        return builderOut.get();
+    }
+
+    SingleDrvOutputs unprepareBuild() override
+    {
+        buildResult.timesBuilt++;
+        buildResult.stopTime = time(nullptr);
+
+        miscMethods->childTerminated();
+
+        builderOut.close();
+
+        miscMethods->closeLogFile();
+
+        if (error) {
+            cleanupBuild(false);
+            /* Same as a forked builtin builder exiting with status 1. */
+            throw BuilderFailureError{BuildResult::Failure::PermanentFailure, 1 << 8, ""};
+        }
+
+        auto builtOutputs = registerOutputs();
+
+        cleanupBuild(true);
+
+        return builtOutputs;
+    }
+};
+
+} // namespace
+
+DerivationBuilderUnique makeInProcessDerivationBuilder(
+    LocalStore & store, std::shared_ptr<DerivationBuilderCallbacks> miscMethods, DerivationBuilderParams params)
+{
+    return DerivationBuilderUnique(new InProcessDerivationBuilder(store, miscMethods, std::move(params)));
+}
+
+} // namespace nix
@@ -3,6 +3,7 @@
 #include "nix/store/build-result.hh"
 #include "nix/store/derivations.hh"
 #include "nix/store/derivation/aterm.hh"
+#include "nix/util/compression.hh"
 
 namespace nix {
 
@@ -269,6 +270,34 @@ std::optional<UnkeyedValidPathInfo> WorkerProto::BasicClientConnection::queryPat
     return WorkerProto::Serialise<UnkeyedValidPathInfo>::read(store, *this);
 }
 
+std::vector<ValidPathInfo> WorkerProto::BasicClientConnection::queryPathInfos(
+    const StoreDirConfig & store, bool * daemonException, const StorePathSet & paths)
+{
+    assert(protoVersion.features.contains(WorkerProto::featureBatchQueryPathInfos));
+    to << WorkerProto::Op::BatchQueryPathInfos;
+    WorkerProto::write(store, *this, paths);
+    processStderr(daemonException);
+    return WorkerProto::Serialise<std::vector<ValidPathInfo>>::read(store, *this);
+}
+
+std::pair<StorePathSet, std::vector<ValidPathInfo>> WorkerProto::BasicClientConnection::queryClosure(
+    const StoreDirConfig & store,
+    bool * daemonException,
+    const StorePathSet & paths,
+    bool flipDirection,
+    bool includeOutputs,
+    bool includeDerivers)
+{
+    assert(protoVersion.features.contains(WorkerProto::featureQueryClosure));
+    to << WorkerProto::Op::QueryClosure;
+    WorkerProto::write(store, *this, paths);
+    to << flipDirection << includeOutputs << includeDerivers;
+    processStderr(daemonException);
+    auto closure = WorkerProto::Serialise<StorePathSet>::read(store, *this);
+    auto infos = WorkerProto::Serialise<std::vector<ValidPathInfo>>::read(store, *this);
+    return {std::move(closure), std::move(infos)};
+}
+
 StorePathSet WorkerProto::BasicClientConnection::queryValidPaths(
     const StoreDirConfig & store, bool * daemonException, const StorePathSet & paths, SubstituteFlag maybeSubstitute)
 {
@@ -309,12 +338,25 @@ WorkerProto::BasicClientConnection::getBuildDerivationResponse(const StoreDirCon
 }
 
 void WorkerProto::BasicClientConnection::narFromPath(
-    const StoreDirConfig & store, bool * daemonException, const StorePath & path, fun<void(Source &)> receiveNar)
+    const StoreDirConfig & store,
+    bool * daemonException,
+    const StorePath & path,
+    fun<void(Source &)> receiveNar,
+    unsigned int compressionLevel)
 {
     to << WorkerProto::Op::NarFromPath << store.printStorePath(path);
+    if (protoVersion.features.contains(WorkerProto::featureNarCompression))
+        to << compressionLevel;
+    else
+        compressionLevel = 0;
     processStderr(daemonException);
 
-    receiveNar(from);
+    if (compressionLevel) {
+        FramedSource framedSource(from);
+        auto source = makeDecompressionSource(CompressionAlgo::zstd, framedSource);
+        receiveNar(*source);
+    } else
+        receiveNar(from);
 }
 
 } // namespace nix
@@ -27,6 +27,10 @@ const WorkerProto::Version WorkerProto::latest = {
         {
             std::string{WorkerProto::featureRealisationWithPath},
             std::string{WorkerProto::featureDeleteDeadSpecificReferrers},
+            std::string{WorkerProto::featureBatchQueryPathInfos},
+            std::string{WorkerProto::featureQueryClosure},
+            std::string{WorkerProto::featureNarCompression},
+            std::string{WorkerProto::featureBuildResources},
         },
 };
 
@@ -204,6 +208,42 @@ void WorkerProto::Serialise<std::optional<std::chrono::microseconds>>::write(
     }
 }
 
+std::chrono::microseconds
+WorkerProto::Serialise<std::chrono::microseconds>::read(const StoreDirConfig & store, WorkerProto::ReadConn conn)
+{
+    return std::chrono::microseconds(readNum<int64_t>(conn.from));
+}
+
+void WorkerProto::Serialise<std::chrono::microseconds>::write(
+    const StoreDirConfig & store, WorkerProto::WriteConn conn, const std::chrono::microseconds & duration)
+{
+    conn.to << duration.count();
+}
+
+std::optional<uint64_t>
+WorkerProto::Serialise<std::optional<uint64_t>>::read(const StoreDirConfig & store, WorkerProto::ReadConn conn)
+{
+    auto tag = readNum<uint8_t>(conn.from);
+    switch (tag) {
+    case 0:
+        return std::nullopt;
+    case 1:
+        return readNum<uint64_t>(conn.from);
+    default:
+        throw Error("Invalid optional tag from remote");
+    }
+}
+
+void WorkerProto::Serialise<std::optional<uint64_t>>::write(
+    const StoreDirConfig & store, WorkerProto::WriteConn conn, const std::optional<uint64_t> & optValue)
+{
+    if (!optValue.has_value()) {
+        conn.to << uint8_t{0};
+    } else {
+        conn.to << uint8_t{1} << *optValue;
+    }
+}
+
 DerivedPath WorkerProto::Serialise<DerivedPath>::read(const StoreDirConfig & store, WorkerProto::ReadConn conn)
 {
     auto s = readString(conn.from);
@@ -316,6 +356,15 @@ BuildResult WorkerProto::Serialise<BuildResult>::read(const StoreDirConfig & sto
         res.cpuUser = WorkerProto::Serialise<std::optional<std::chrono::microseconds>>::read(store, conn);
         res.cpuSystem = WorkerProto::Serialise<std::optional<std::chrono::microseconds>>::read(store, conn);
     }
+    if (conn.version.features.contains(WorkerProto::featureBuildResources)) {
+        res.memoryPeak = WorkerProto::Serialise<std::optional<uint64_t>>::read(store, conn);
+        res.ioReadBytes = WorkerProto::Serialise<std::optional<uint64_t>>::read(store, conn);
+        res.ioWriteBytes = WorkerProto::Serialise<std::optional<uint64_t>>::read(store, conn);
+        res.cpuStall = WorkerProto::Serialise<std::optional<std::chrono::microseconds>>::read(store, conn);
+        res.memoryStall = WorkerProto::Serialise<std::optional<std::chrono::microseconds>>::read(store, conn);
+        res.ioStall = WorkerProto::Serialise<std::optional<std::chrono::microseconds>>::read(store, conn);
+        res.phaseTimes = WorkerProto::Serialise<std::map<std::string, std::chrono::microseconds>>::read(store, conn);
+    }
 
     if (conn.version.features.contains(WorkerProto::featureRealisationWithPath)) {
         success.builtOutputs = WorkerProto::Serialise<std::map<OutputName, UnkeyedRealisation>>::read(store, conn);
@@ -367,6 +416,15 @@ void WorkerProto::Serialise<BuildResult>::write(
             WorkerProto::write(store, conn, res.cpuUser);
             WorkerProto::write(store, conn, res.cpuSystem);
         }
+        if (conn.version.features.contains(WorkerProto::featureBuildResources)) {
+            WorkerProto::write(store, conn, res.memoryPeak);
+            WorkerProto::write(store, conn, res.ioReadBytes);
+            WorkerProto::write(store, conn, res.ioWriteBytes);
+            WorkerProto::write(store, conn, res.cpuStall);
+            WorkerProto::write(store, conn, res.memoryStall);
+            WorkerProto::write(store, conn, res.ioStall);
+            WorkerProto::write(store, conn, res.phaseTimes);
+        }
 
         if (conn.version.features.contains(WorkerProto::featureRealisationWithPath)) {
             WorkerProto::write(store, conn, builtOutputs);
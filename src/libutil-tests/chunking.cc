@@ -0,0 +1,77 @@
+#include "nix/util/chunking.hh"
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+namespace nix {
+
+static std::string randomData(size_t size, unsigned int seed = 42)
+{
+    std::mt19937 gen(seed);
+    std::string s(size, 0);
+    for (auto & c : s)
+        c = gen();
+    return s;
+}
+
+static std::vector<std::string> chunk(std::string_view data, size_t writeSize = 4096)
+{
+    std::vector<std::string> chunks;
+    ChunkingSink sink([&](std::string_view chunk) { chunks.emplace_back(chunk); });
+    for (; !data.empty(); data.remove_prefix(std::min(writeSize, data.size())))
+        sink(data.substr(0, writeSize));
+    sink.finish();
+    return chunks;
+}
+
+TEST(ChunkingSink, empty)
+{
+    ASSERT_TRUE(chunk("").empty());
+}
+
+TEST(ChunkingSink, reassemblesAndRespectsBounds)
+{
+    auto data = randomData(8 * 1024 * 1024);
+    auto chunks = chunk(data);
+
+    ChunkingSink::Params params;
+    std::string reassembled;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        if (i + 1 < chunks.size())
+            ASSERT_GE(chunks[i].size(), params.minSize);
+        ASSERT_LE(chunks[i].size(), params.maxSize);
+        reassembled += chunks[i];
+    }
+    ASSERT_EQ(reassembled, data);
+
+    // Roughly `avgSize` bytes per chunk.
+    ASSERT_GT(chunks.size(), data.size() / params.maxSize);
+    ASSERT_LT(chunks.size(), data.size() / params.minSize);
+}
+
+TEST(ChunkingSink, independentOfWriteSize)
+{
+    auto data = randomData(4 * 1024 * 1024);
+    ASSERT_EQ(chunk(data, 1), chunk(data, 1024 * 1024));
+}
+
+TEST(ChunkingSink, boundariesResynchroniseAfterEdit)
+{
+    auto data = randomData(8 * 1024 * 1024);
+    auto edited = data;
+    edited.insert(1000, "some inserted bytes");
+
+    auto chunks1 = chunk(data);
+    auto chunks2 = chunk(edited);
+
+    std::set<std::string> set1(chunks1.begin(), chunks1.end());
+    size_t shared = 0;
+    for (auto & c : chunks2)
+        shared += set1.count(c);
+
+    // Only the chunk containing the edit should differ.
+    ASSERT_GE(shared + 1, chunks2.size());
+}
+
+} // namespace nix
@@ -114,6 +114,131 @@ TEST(compress, zstdExactFrameBoundary)
     ASSERT_EQ(frameSize, compressed.size());
 }
 
+TEST(decompress, zstdParallelMatchesSingleThreaded)
+{
+    // Several frames, the last one partial.
+    std::string str(40 * 1024 * 1024, 'x');
+    for (size_t i = 0; i < str.size(); i += 997)
+        str[i] = 'a' + i % 26;
+    auto compressed = compress(CompressionAlgo::zstd, str);
+
+    for (unsigned int threads : {1, 2, 8}) {
+        StringSink strSink;
+        auto sink = makeZstdDecompressionSink(strSink, threads);
+        // Feed odd-sized chunks so that frames are split across writes.
+        for (std::string_view data = compressed; !data.empty();) {
+            auto n = std::min<size_t>(data.size(), 12345);
+            (*sink)(data.substr(0, n));
+            data.remove_prefix(n);
+        }
+        sink->finish();
+        ASSERT_EQ(strSink.s, str);
+    }
+}
+
+TEST(decompress, zstdUnknownContentSizeFallsBackToStreaming)
+{
+    std::string str(1024 * 1024, 'x');
+    for (size_t i = 0; i < str.size(); i += 997)
+        str[i] = 'y';
+
+    // A single frame without `Frame_Content_Size`, like `zstd` produces
+    // when compressing a pipe.
+    std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> cctx{ZSTD_createCCtx(), ZSTD_freeCCtx};
+    std::string compressed(ZSTD_compressBound(str.size()), 0);
+    ZSTD_outBuffer out = {compressed.data(), compressed.size(), 0};
+    ZSTD_inBuffer in = {str.data(), str.size(), 0};
+    ZSTD_compressStream2(cctx.get(), &out, &in, ZSTD_e_continue);
+    while (ZSTD_compressStream2(cctx.get(), &out, &in, ZSTD_e_end) != 0)
+        ;
+    compressed.resize(out.pos);
+    ASSERT_EQ(ZSTD_getFrameContentSize(compressed.data(), compressed.size()), ZSTD_CONTENTSIZE_UNKNOWN);
+
+    ASSERT_EQ(decompress(CompressionAlgo::zstd, compressed), str);
+}
+
+TEST(decompress, zstdTruncatedMultiFrameInput)
+{
+    std::string str(20 * 1024 * 1024, 'x');
+    auto compressed = compress(CompressionAlgo::zstd, str);
+    ASSERT_THROW(decompress(CompressionAlgo::zstd, compressed.substr(0, compressed.size() - 3)), CompressionError);
+}
+
+TEST(listZstdFrames, multiFrame)
+{
+    std::string str(40 * 1024 * 1024, 'x');
+    for (size_t i = 0; i < str.size(); i += 997)
+        str[i] = 'a' + i % 26;
+    auto compressed = compress(CompressionAlgo::zstd, str);
+
+    StringSource source(compressed);
+    auto frames = listZstdFrames(source);
+    ASSERT_TRUE(frames);
+    ASSERT_EQ(frames->size(), 3);
+
+    uint64_t compressedOffset = 0, contentOffset = 0;
+    for (auto & frame : *frames) {
+        ASSERT_EQ(frame.compressedOffset, compressedOffset);
+        ASSERT_EQ(frame.contentOffset, contentOffset);
+        // Each frame decompresses on its own to its slice of the input.
+        auto o = decompress(
+            CompressionAlgo::zstd, std::string_view(compressed).substr(frame.compressedOffset, frame.compressedSize));
+        ASSERT_EQ(o, str.substr(frame.contentOffset, frame.contentSize));
+        compressedOffset += frame.compressedSize;
+        contentOffset += frame.contentSize;
+    }
+    ASSERT_EQ(compressedOffset, compressed.size());
+    ASSERT_EQ(contentOffset, str.size());
+}
+
+TEST(listZstdFrames, unknownContentSize)
+{
+    std::string str(1024, 'x');
+    std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> cctx{ZSTD_createCCtx(), ZSTD_freeCCtx};
+    std::string compressed(ZSTD_compressBound(str.size()), 0);
+    ZSTD_outBuffer out = {compressed.data(), compressed.size(), 0};
+    ZSTD_inBuffer in = {str.data(), str.size(), 0};
+    ZSTD_compressStream2(cctx.get(), &out, &in, ZSTD_e_continue);
+    while (ZSTD_compressStream2(cctx.get(), &out, &in, ZSTD_e_end) != 0)
+        ;
+    compressed.resize(out.pos);
+
+    StringSource source(compressed);
+    ASSERT_FALSE(listZstdFrames(source));
+}
+
+TEST(listZstdFrames, notZstd)
+{
+    StringSource source(std::string_view("this is not zstd"));
+    ASSERT_THROW(listZstdFrames(source), CompressionError);
+}
+
+/* ----------------------------------------------------------------------------
+ * makeZstdDelta / applyZstdDelta
+ * --------------------------------------------------------------------------*/
+
+TEST(makeZstdDelta, roundTrip)
+{
+    std::string base;
+    for (int i = 0; i < 100000; ++i)
+        base += std::to_string(i * 7919 % 100003) + "\n";
+    auto target = base;
+    target.replace(1000, 5, "hello");
+    target += "some more data";
+
+    auto delta = makeZstdDelta(base, target);
+    ASSERT_LT(delta.size(), compress(CompressionAlgo::zstd, target).size() / 10);
+    ASSERT_EQ(applyZstdDelta(base, delta, target.size()), target);
+}
+
+TEST(applyZstdDelta, wrongSize)
+{
+    std::string base = "hello world";
+    std::string target = "hello world!";
+    auto delta = makeZstdDelta(base, target);
+    ASSERT_THROW(applyZstdDelta(base, delta, target.size() + 1), CompressionError);
+}
+
 /* ----------------------------------------------------------------------------
  * compression sinks
  * --------------------------------------------------------------------------*/
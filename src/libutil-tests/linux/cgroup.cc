@@ -0,0 +1,49 @@
+#include <gtest/gtest.h>
+
+#include "nix/util/cgroup.hh"
+
+namespace nix::linux {
+
+TEST(parsePressureStats, someAndFull)
+{
+    auto stats = parsePressureStats(
+        "some avg10=12.34 avg60=5.00 avg300=1.00 total=123456\n"
+        "full avg10=0.50 avg60=0.10 avg300=0.00 total=789\n");
+    ASSERT_DOUBLE_EQ(stats.someAvg10, 12.34);
+    ASSERT_DOUBLE_EQ(stats.fullAvg10, 0.50);
+    ASSERT_EQ(stats.someTotal, std::chrono::microseconds(123456));
+    ASSERT_EQ(stats.fullTotal, std::chrono::microseconds(789));
+}
+
+TEST(parsePressureStats, someOnly)
+{
+    /* Older kernels don't report "full" for CPU. */
+    auto stats = parsePressureStats("some avg10=1.50 avg60=0.00 avg300=0.00 total=0\n");
+    ASSERT_DOUBLE_EQ(stats.someAvg10, 1.50);
+    ASSERT_DOUBLE_EQ(stats.fullAvg10, 0);
+}
+
+TEST(parsePressureStats, empty)
+{
+    auto stats = parsePressureStats("");
+    ASSERT_DOUBLE_EQ(stats.someAvg10, 0);
+    ASSERT_DOUBLE_EQ(stats.fullAvg10, 0);
+}
+
+TEST(parseIoStat, multipleDevices)
+{
+    auto [read, written] = parseIoStat(
+        "8:0 rbytes=1000 wbytes=2000 rios=1 wios=2 dbytes=0 dios=0\n"
+        "259:0 rbytes=30 wbytes=40 rios=3 wios=4 dbytes=0 dios=0\n");
+    ASSERT_EQ(read, 1030);
+    ASSERT_EQ(written, 2040);
+}
+
+TEST(parseIoStat, empty)
+{
+    auto [read, written] = parseIoStat("");
+    ASSERT_EQ(read, 0);
+    ASSERT_EQ(written, 0);
+}
+
+} // namespace nix::linux
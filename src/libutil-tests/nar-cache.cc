@@ -0,0 +1,181 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "nix/util/archive.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/nar-cache.hh"
+
+namespace nix {
+
+static std::string makeNar(std::string_view contents)
+{
+    StringSink sink;
+    dumpString(contents, sink);
+    return std::move(sink.s);
+}
+
+TEST(NarCache, hitsAndMisses)
+{
+    NarCache cache;
+    auto nar = makeNar("hello");
+    auto narHash = hashString(HashAlgorithm::SHA256, nar);
+
+    int populated = 0;
+    auto populate = [&](Sink & sink) {
+        ++populated;
+        sink(nar);
+    };
+
+    auto accessor = cache.getOrInsert(narHash, populate);
+    ASSERT_EQ(accessor->readFile(CanonPath::root), "hello");
+    cache.getOrInsert(narHash, populate);
+
+    ASSERT_EQ(populated, 1);
+    auto stats = cache.getStats();
+    ASSERT_EQ(stats.hits, 1);
+    ASSERT_EQ(stats.misses, 1);
+}
+
+TEST(NarCache, evictsLeastRecentlyUsed)
+{
+    auto narA = makeNar(std::string(1000, 'a'));
+    auto narB = makeNar(std::string(1000, 'b'));
+    auto narC = makeNar(std::string(1000, 'c'));
+
+    NarCache cache({}, {.maxMemorySize = narA.size() * 2});
+
+    int populated = 0;
+    auto get = [&](const std::string & nar) {
+        return cache.getOrInsert(hashString(HashAlgorithm::SHA256, nar), [&](Sink & sink) {
+            ++populated;
+            sink(nar);
+        });
+    };
+
+    get(narA);
+    get(narB);
+    get(narA);
+    /* This evicts B, which was used less recently than A. */
+    get(narC);
+    ASSERT_EQ(populated, 3);
+    ASSERT_EQ(cache.getStats().evictions, 1);
+
+    get(narA);
+    ASSERT_EQ(populated, 3);
+    get(narB);
+    ASSERT_EQ(populated, 4);
+}
+
+TEST(NarCache, coalescesConcurrentRequests)
+{
+    NarCache cache;
+    auto nar = makeNar("hello");
+    auto narHash = hashString(HashAlgorithm::SHA256, nar);
+
+    std::atomic<int> populated = 0;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; ++i)
+        threads.emplace_back([&]() {
+            auto accessor = cache.getOrInsert(narHash, [&](Sink & sink) {
+                ++populated;
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                sink(nar);
+            });
+            ASSERT_EQ(accessor->readFile(CanonPath::root), "hello");
+        });
+    for (auto & thread : threads)
+        thread.join();
+
+    ASSERT_EQ(populated, 1);
+}
+
+TEST(NarCache, failedPopulateIsNotCached)
+{
+    NarCache cache;
+    auto nar = makeNar("hello");
+    auto narHash = hashString(HashAlgorithm::SHA256, nar);
+
+    ASSERT_THROW(cache.getOrInsert(narHash, [&](Sink & sink) { throw Error("oops"); }), Error);
+
+    auto accessor = cache.getOrInsert(narHash, [&](Sink & sink) { sink(nar); });
+    ASSERT_EQ(accessor->readFile(CanonPath::root), "hello");
+}
+
+TEST(NarCache, diskCache)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir, true);
+
+    auto narA = makeNar(std::string(1000, 'a'));
+    auto narB = makeNar(std::string(1000, 'b'));
+    auto hashA = hashString(HashAlgorithm::SHA256, narA);
+    auto hashB = hashString(HashAlgorithm::SHA256, narB);
+
+    /* Room for one NAR and its listing, but not two. */
+    NarCache::Limits limits{.maxDiskSize = narA.size() + 500};
+
+    {
+        NarCache cache(tmpDir, limits);
+        cache.getOrInsert(hashA, [&](Sink & sink) { sink(narA); });
+        cache.getOrInsert(hashB, [&](Sink & sink) { sink(narB); });
+        ASSERT_EQ(cache.getStats().diskEvictions, 1);
+    }
+
+    ASSERT_FALSE(pathExists(tmpDir / (hashA.to_string(HashFormat::Nix32, false) + ".nar")));
+    ASSERT_TRUE(pathExists(tmpDir / (hashB.to_string(HashFormat::Nix32, false) + ".nar")));
+
+    NarCache cache(tmpDir, limits);
+    auto accessor = cache.getOrInsert(hashB, [&](Sink & sink) { FAIL() << "NAR should be cached on disk"; });
+    ASSERT_EQ(accessor->readFile(CanonPath::root), std::string(1000, 'b'));
+    ASSERT_EQ(cache.getStats().diskHits, 1);
+}
+
+TEST(NarCache, diskBackedNarsOnlyCountWithTheirListing)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir, true);
+
+    auto narA = makeNar(std::string(1000, 'a'));
+    auto narB = makeNar(std::string(1000, 'b'));
+
+    /* Not enough room for one NAR in memory, but plenty for the
+       listings of both. */
+    NarCache cache(tmpDir, {.maxMemorySize = narA.size() / 2});
+    cache.getOrInsert(hashString(HashAlgorithm::SHA256, narA), [&](Sink & sink) { sink(narA); });
+    cache.getOrInsert(hashString(HashAlgorithm::SHA256, narB), [&](Sink & sink) { sink(narB); });
+
+    auto stats = cache.getStats();
+    ASSERT_EQ(stats.evictions, 0);
+    ASSERT_LT(stats.memorySize, narA.size());
+    ASSERT_EQ(stats.openFiles, 2);
+}
+
+TEST(NarCache, openFilesAreBounded)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir, true);
+
+    auto narA = makeNar(std::string(1000, 'a'));
+    auto narB = makeNar(std::string(1000, 'b'));
+    auto hashA = hashString(HashAlgorithm::SHA256, narA);
+
+    NarCache cache(tmpDir, {.maxOpenFiles = 1});
+    cache.getOrInsert(hashA, [&](Sink & sink) { sink(narA); });
+    cache.getOrInsert(hashString(HashAlgorithm::SHA256, narB), [&](Sink & sink) { sink(narB); });
+
+    auto stats = cache.getStats();
+    ASSERT_EQ(stats.evictions, 1);
+    ASSERT_EQ(stats.openFiles, 1);
+    ASSERT_EQ(stats.diskEvictions, 0);
+
+    /* The evicted NAR is still on disk. */
+    auto accessor = cache.getOrInsert(hashA, [&](Sink & sink) { FAIL() << "NAR should be cached on disk"; });
+    ASSERT_EQ(accessor->readFile(CanonPath::root), std::string(1000, 'a'));
+    ASSERT_EQ(cache.getStats().diskHits, 1);
+}
+
+} // namespace nix
@@ -0,0 +1,85 @@
+#include "nix/util/chunking.hh"
+
+#include <array>
+#include <bit>
+#include <cassert>
+
+namespace nix {
+
+/**
+ * The table of random values that the gear hash adds for each byte,
+ * generated with splitmix64 so that chunk boundaries are stable
+ * across builds.
+ */
+static constexpr std::array<uint64_t, 256> gearTable = []() {
+    std::array<uint64_t, 256> table;
+    uint64_t state = 0x6e69782d63646321; /* "nix-cdc!" */
+    for (auto & entry : table) {
+        uint64_t z = (state += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        entry = z ^ (z >> 31);
+    }
+    return table;
+}();
+
+/**
+ * Return a mask of the `bits` most significant bits. We use the high
+ * bits because bit `n` of the gear hash only depends on the last
+ * `n + 1` bytes.
+ */
+static uint64_t highBits(unsigned int bits)
+{
+    return bits == 0 ? 0 : ~(uint64_t) 0 << (64 - bits);
+}
+
+ChunkingSink::ChunkingSink(fun<void(std::string_view chunk)> onChunk, Params params)
+    : onChunk(std::move(onChunk))
+    , params(params)
+{
+    assert(params.minSize > 0 && params.minSize <= params.avgSize && params.avgSize <= params.maxSize);
+    /* A mask with `n` bits matches with probability 2^-n per byte. */
+    unsigned int bits = std::bit_width(params.avgSize) - 1;
+    maskSmall = highBits(std::min(bits + 2, 63U));
+    maskLarge = highBits(std::max(bits, 3U) - 2);
+    chunk.reserve(params.maxSize);
+}
+
+void ChunkingSink::operator()(std::string_view data)
+{
+    while (!data.empty()) {
+        /* Find the next cut point in `data`, if any. */
+        size_t n = 0;
+        bool cut = false;
+        while (n < data.size()) {
+            hash = (hash << 1) + gearTable[(unsigned char) data[n++]];
+            auto size = chunk.size() + n;
+            if (size < params.minSize)
+                continue;
+            if (size >= params.maxSize || (hash & (size < params.avgSize ? maskSmall : maskLarge)) == 0) {
+                cut = true;
+                break;
+            }
+        }
+
+        chunk.append(data.substr(0, n));
+        data.remove_prefix(n);
+
+        if (cut) {
+            onChunk(chunk);
+            chunk.clear();
+            hash = 0;
+        }
+    }
+}
+
+void ChunkingSink::finish()
+{
+    if (!chunk.empty()) {
+        onChunk(chunk);
+        chunk.clear();
+    }
+    hash = 0;
+}
+
+} // namespace nix
@@ -13,6 +13,11 @@
 #include <brotli/encode.h>
 
 #include <zstd.h>
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <bit>
+#include <deque>
+#include <future>
 #include <thread>
 
 namespace nix {
@@ -80,9 +85,8 @@ struct ArchiveDecompressionSource : Source
 
 /* Algorithms whose *compression* is handled by libarchive.  zstd is
    intentionally absent: ZstdMultiFrameCompressionSink compresses it
-   directly so the output is split into independent frames; zstd
-   *decompression* is still handled by libarchive via
-   ArchiveDecompressionSource. */
+   directly so the output is split into independent frames, and
+   ZstdDecompressionSink decompresses those frames in parallel. */
 #define NIX_FOR_EACH_LA_ALGO(MACRO) \
     MACRO(bzip2)                    \
     MACRO(compress)                 \
@@ -252,8 +256,215 @@ struct BrotliDecompressionSink : ChunkedCompressionSink
     }
 };
 
+static void checkZstd(size_t ret)
+{
+    if (ZSTD_isError(ret))
+        throw CompressionError("zstd error: %s", ZSTD_getErrorName(ret));
+}
+
+/**
+ * Zstd decompression that decodes the independent frames written by
+ * ZstdMultiFrameCompressionSink on a thread pool.  Frames are
+ * dispatched as soon as they have been fully received, and their
+ * output is written to `nextSink` in order.  At most `threads + 1`
+ * frames are in flight, which bounds memory use to roughly that many
+ * times the frame size.
+ *
+ * Parallel decoding requires every frame to record its decompressed
+ * size (`Frame_Content_Size`), and that size to be at most
+ * `maxFrameContentSize`.  As soon as a frame doesn't qualify (e.g. a
+ * single-frame archive produced by the zstd command line tool), the
+ * remaining input is decompressed as a stream instead.
+ */
+struct ZstdDecompressionSink : CompressionSink
+{
+    Sink & nextSink;
+
+    static constexpr uint64_t maxFrameContentSize = 64 * 1024 * 1024;
+
+    /**
+     * Large enough to hold any frame header (`ZSTD_FRAMEHEADERSIZE_MAX`,
+     * which is only available with `ZSTD_STATIC_LINKING_ONLY`).
+     */
+    static constexpr size_t maxFrameHeaderSize = 18;
+
+    size_t maxInFlight;
+
+    /**
+     * Unlike `ThreadPool`, this runs submitted work without anybody
+     * calling `process()`, which we can't do since we need to write
+     * out frames while later ones are being decompressed.
+     */
+    boost::asio::thread_pool pool;
+
+    /**
+     * Input that does not yet form a complete frame.
+     */
+    std::string inbuf;
+
+    /**
+     * Decompressed frames, in input order.
+     */
+    std::deque<std::future<std::string>> inFlight;
+
+    bool sawFrame = false;
+
+    /**
+     * Set once we've fallen back to streaming decompression.
+     */
+    std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx{nullptr, ZSTD_freeDCtx};
+    std::vector<char> outbuf;
+    size_t streamStatus = 0;
+
+    ZstdDecompressionSink(Sink & nextSink, unsigned int threads)
+        : nextSink(nextSink)
+        , maxInFlight(threads + 1)
+        , pool(threads)
+    {
+    }
+
+    void writeUnbuffered(std::string_view data) override
+    {
+        if (dctx)
+            return decompressStream(data);
+        inbuf.append(data);
+        dispatchFrames(false);
+    }
+
+    void finish() override
+    {
+        flush();
+
+        if (!dctx) {
+            dispatchFrames(true);
+            if (!dctx) {
+                if (!inbuf.empty())
+                    startStreaming();
+                else if (!sawFrame)
+                    throw CompressionError("zstd input is empty");
+            }
+        }
+
+        writeFrames(0);
+
+        if (dctx && streamStatus != 0)
+            throw CompressionError("zstd input is truncated");
+    }
+
+    void dispatchFrames(bool finishing)
+    {
+        while (!dctx && !inbuf.empty()) {
+            checkInterrupt();
+
+            auto contentSize = ZSTD_getFrameContentSize(inbuf.data(), inbuf.size());
+
+            if (contentSize == ZSTD_CONTENTSIZE_ERROR && inbuf.size() < maxFrameHeaderSize && !finishing)
+                /* Possibly an incomplete frame header. */
+                return;
+
+            if (contentSize == ZSTD_CONTENTSIZE_ERROR || contentSize == ZSTD_CONTENTSIZE_UNKNOWN
+                || contentSize > maxFrameContentSize)
+                /* Let the streaming decoder handle this frame and
+                   report any errors. */
+                return startStreaming();
+
+            auto frameSize = ZSTD_findFrameCompressedSize(inbuf.data(), inbuf.size());
+
+            if (ZSTD_isError(frameSize)) {
+                if (!finishing && inbuf.size() <= ZSTD_compressBound(contentSize) + maxFrameHeaderSize)
+                    /* Wait for the rest of the frame. */
+                    return;
+                return startStreaming();
+            }
+
+            auto frame = std::make_shared<std::string>(inbuf, 0, frameSize);
+            inbuf.erase(0, frameSize);
+            sawFrame = true;
+
+            auto promise = std::make_shared<std::promise<std::string>>();
+            inFlight.push_back(promise->get_future());
+            boost::asio::post(pool, [frame, contentSize, promise]() {
+                try {
+                    std::string out(contentSize, 0);
+                    auto n = ZSTD_decompress(out.data(), out.size(), frame->data(), frame->size());
+                    checkZstd(n);
+                    if (n != contentSize)
+                        throw CompressionError("zstd frame is %d bytes instead of %d", n, contentSize);
+                    promise->set_value(std::move(out));
+                } catch (...) {
+                    promise->set_exception(std::current_exception());
+                }
+            });
+
+            writeFrames(maxInFlight - 1);
+        }
+    }
+
+    /**
+     * Write out decompressed frames until at most `keep` are in
+     * flight, as well as any further frames that are already done.
+     */
+    void writeFrames(size_t keep)
+    {
+        while (!inFlight.empty()
+               && (inFlight.size() > keep
+                   || inFlight.front().wait_for(std::chrono::seconds(0)) == std::future_status::ready)) {
+            auto data = inFlight.front().get();
+            inFlight.pop_front();
+            nextSink(data);
+        }
+    }
+
+    void startStreaming()
+    {
+        writeFrames(0);
+
+        dctx.reset(ZSTD_createDCtx());
+        if (!dctx)
+            throw CompressionError("unable to initialise zstd decoder");
+        /* Allow the largest window zstd supports, so that archives
+           made with `zstd --long` can be decompressed. */
+        checkZstd(ZSTD_DCtx_setParameter(dctx.get(), ZSTD_d_windowLogMax, sizeof(size_t) == 4 ? 30 : 31));
+        outbuf.resize(ZSTD_DStreamOutSize());
+
+        auto data = std::move(inbuf);
+        inbuf.clear();
+        decompressStream(data);
+    }
+
+    void decompressStream(std::string_view data)
+    {
+        ZSTD_inBuffer in = {data.data(), data.size(), 0};
+        while (true) {
+            checkInterrupt();
+            ZSTD_outBuffer out = {outbuf.data(), outbuf.size(), 0};
+            streamStatus = ZSTD_decompressStream(dctx.get(), &out, &in);
+            checkZstd(streamStatus);
+            if (out.pos > 0)
+                nextSink({outbuf.data(), out.pos});
+            /* The decoder may buffer input internally, so keep going
+               until it stops producing output. */
+            if (in.pos == in.size && (out.pos == 0 || streamStatus == 0))
+                break;
+        }
+    }
+};
+
 } // namespace
 
+std::unique_ptr<FinishSink> makeZstdDecompressionSink(Sink & nextSink, unsigned int threads)
+{
+    if (threads == 0) {
+        threads = getMaxCPU();
+        if (threads == 0)
+            threads = std::thread::hardware_concurrency();
+        /* Each thread holds a decompressed frame in memory, and
+           substitutions already run in parallel. */
+        threads = std::clamp(threads, 1u, 4u);
+    }
+    return std::make_unique<ZstdDecompressionSink>(nextSink, threads);
+}
+
 std::string decompress(CompressionAlgo method, std::string_view in)
 {
     StringSink ssink;
@@ -263,12 +474,23 @@ std::string decompress(CompressionAlgo method, std::string_view in)
     return std::move(ssink.s);
 }
 
+std::unique_ptr<Source> makeDecompressionSource(CompressionAlgo method, Source & source)
+{
+    return sinkToSource([method, &source](Sink & sink) {
+        auto decompressionSink = makeDecompressionSink(method, sink);
+        source.drainInto(*decompressionSink);
+        decompressionSink->finish();
+    });
+}
+
 std::unique_ptr<FinishSink> makeDecompressionSink(CompressionAlgo method, Sink & nextSink)
 {
     if (method == CompressionAlgo::none)
         return std::make_unique<NoneSink>(nextSink);
     else if (method == CompressionAlgo::brotli)
         return std::make_unique<BrotliDecompressionSink>(nextSink);
+    else if (method == CompressionAlgo::zstd)
+        return makeZstdDecompressionSink(nextSink);
     else
         return sourceToSink([method, &nextSink](Source & source) {
             auto decompressionSource = std::make_unique<ArchiveDecompressionSource>(source, method);
@@ -397,12 +619,6 @@ struct ZstdMultiFrameCompressionSink : CompressionSink
         }
     }
 
-    void checkZstd(size_t ret)
-    {
-        if (ZSTD_isError(ret))
-            throw CompressionError("zstd error: %s", ZSTD_getErrorName(ret));
-    }
-
     /**
      * Compress all of `inbuf` as one complete frame, pledged at its
      * exact size so `Frame_Content_Size` lands in the header.
@@ -455,6 +671,161 @@ struct ZstdMultiFrameCompressionSink : CompressionSink
 
 } // namespace
 
+std::optional<std::vector<ZstdFrame>> listZstdFrames(Source & source)
+{
+    /* Walk the frame and block headers described in RFC 8878 §3.1.1.
+       Block contents are skipped, not decompressed. */
+    std::vector<ZstdFrame> frames;
+    uint64_t compressedOffset = 0;
+    uint64_t contentOffset = 0;
+
+    unsigned char buf[16];
+
+    auto read = [&](size_t len) {
+        assert(len <= sizeof(buf));
+        source((char *) buf, len);
+        compressedOffset += len;
+    };
+
+    auto skip = [&](uint64_t len) {
+        source.skip(len);
+        compressedOffset += len;
+    };
+
+    auto readLE = [&](size_t start, size_t len) {
+        uint64_t n = 0;
+        for (size_t i = 0; i < len; ++i)
+            n |= (uint64_t) buf[start + i] << (8 * i);
+        return n;
+    };
+
+    while (true) {
+        auto frameStart = compressedOffset;
+
+        try {
+            source((char *) buf, 1);
+        } catch (EndOfFile &) {
+            break;
+        }
+        source((char *) buf + 1, 3);
+        compressedOffset += 4;
+        auto magic = readLE(0, 4);
+
+        /* Skippable frames carry no content. */
+        if ((magic & 0xfffffff0) == 0x184d2a50) {
+            read(4);
+            skip(readLE(0, 4));
+            continue;
+        }
+
+        if (magic != ZSTD_MAGICNUMBER)
+            throw CompressionError("invalid zstd frame magic number at offset %d", frameStart);
+
+        read(1);
+        auto descriptor = buf[0];
+        auto fcsFlag = descriptor >> 6;
+        bool singleSegment = descriptor & 0x20;
+        bool hasChecksum = descriptor & 0x04;
+        auto didFlag = descriptor & 0x03;
+
+        size_t windowSize = singleSegment ? 0 : 1;
+        size_t didSize = didFlag == 3 ? 4 : didFlag;
+        size_t fcsSize = fcsFlag == 0 ? (singleSegment ? 1 : 0) : (size_t) 1 << fcsFlag;
+
+        /* Without `Frame_Content_Size` there is no way to map
+           decompressed offsets to frames short of decompressing. */
+        if (fcsSize == 0)
+            return std::nullopt;
+
+        read(windowSize + didSize + fcsSize);
+        uint64_t contentSize = readLE(windowSize + didSize, fcsSize) + (fcsSize == 2 ? 256 : 0);
+
+        bool lastBlock = false;
+        while (!lastBlock) {
+            read(3);
+            auto header = readLE(0, 3);
+            lastBlock = header & 1;
+            auto blockType = (header >> 1) & 3;
+            uint64_t blockSize = header >> 3;
+            if (blockType == 3)
+                throw CompressionError("invalid zstd block type at offset %d", compressedOffset - 3);
+            /* RLE blocks store a single byte that is repeated `blockSize` times. */
+            skip(blockType == 1 ? 1 : blockSize);
+        }
+
+        if (hasChecksum)
+            skip(4);
+
+        frames.push_back({
+            .compressedOffset = frameStart,
+            .compressedSize = compressedOffset - frameStart,
+            .contentOffset = contentOffset,
+            .contentSize = contentSize,
+        });
+        contentOffset += contentSize;
+    }
+
+    return frames;
+}
+
+/**
+ * The zstd window size needed to refer back to the start of `baseSize`
+ * bytes of reference data while producing `targetSize` bytes.
+ */
+static int zstdDeltaWindowLog(uint64_t baseSize, uint64_t targetSize)
+{
+    int maxWindowLog = sizeof(size_t) == 4 ? 30 : 31;
+    int windowLog = std::max(static_cast<int>(std::bit_width(baseSize + targetSize)), 10);
+    if (windowLog > maxWindowLog)
+        throw CompressionError(
+            "cannot create a zstd delta from %d to %d bytes, since that exceeds the maximum window size",
+            baseSize,
+            targetSize);
+    return windowLog;
+}
+
+std::string makeZstdDelta(std::string_view base, std::string_view target, int level)
+{
+    std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> cctx{ZSTD_createCCtx(), ZSTD_freeCCtx};
+    if (!cctx)
+        throw CompressionError("unable to initialise zstd encoder");
+
+    checkZstd(ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_compressionLevel, level == -1 ? ZSTD_CLEVEL_DEFAULT : level));
+    checkZstd(
+        ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_windowLog, zstdDeltaWindowLog(base.size(), target.size())));
+    checkZstd(ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_enableLongDistanceMatching, 1));
+    checkZstd(ZSTD_CCtx_refPrefix(cctx.get(), base.data(), base.size()));
+
+    std::string delta(ZSTD_compressBound(target.size()), '\0');
+    auto n = ZSTD_compress2(cctx.get(), delta.data(), delta.size(), target.data(), target.size());
+    checkZstd(n);
+    delta.resize(n);
+    return delta;
+}
+
+std::string applyZstdDelta(std::string_view base, std::string_view delta, uint64_t size)
+{
+    auto contentSize = ZSTD_getFrameContentSize(delta.data(), delta.size());
+    if (contentSize == ZSTD_CONTENTSIZE_ERROR || contentSize == ZSTD_CONTENTSIZE_UNKNOWN)
+        throw CompressionError("zstd delta does not record its decompressed size");
+    if (contentSize != size)
+        throw CompressionError("zstd delta decompresses to %d bytes instead of %d", contentSize, size);
+
+    std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx{ZSTD_createDCtx(), ZSTD_freeDCtx};
+    if (!dctx)
+        throw CompressionError("unable to initialise zstd decoder");
+
+    checkZstd(ZSTD_DCtx_setParameter(dctx.get(), ZSTD_d_windowLogMax, zstdDeltaWindowLog(base.size(), size)));
+    checkZstd(ZSTD_DCtx_refPrefix(dctx.get(), base.data(), base.size()));
+
+    std::string target(size, '\0');
+    auto n = ZSTD_decompressDCtx(dctx.get(), target.data(), target.size(), delta.data(), delta.size());
+    checkZstd(n);
+    if (n != size)
+        throw CompressionError("zstd delta decompresses to %d bytes instead of %d", n, size);
+    return target;
+}
+
 ref<CompressionSink> makeCompressionSink(CompressionAlgo method, Sink & nextSink, const bool parallel, int level)
 {
     switch (method) {
@@ -0,0 +1,63 @@
+#pragma once
+///@file
+
+#include "nix/util/fun.hh"
+#include "nix/util/serialise.hh"
+
+#include <string>
+
+namespace nix {
+
+/**
+ * A sink that splits the data written to it into chunks using
+ * content-defined chunking, calling `onChunk` for each chunk in order.
+ *
+ * Chunk boundaries are determined by a rolling "gear" hash over the
+ * data itself (as in FastCDC), so inserting or removing bytes only
+ * changes the chunks around the edit. This makes it possible to
+ * deduplicate chunks between similar files.
+ *
+ * Chunks are at least `minSize` (except for the last one) and at most
+ * `maxSize` bytes, and on average about `avgSize` bytes.
+ */
+struct ChunkingSink : FinishSink
+{
+    struct Params
+    {
+        size_t minSize = 64 * 1024;
+        size_t avgSize = 256 * 1024;
+        size_t maxSize = 1024 * 1024;
+    };
+
+    ChunkingSink(fun<void(std::string_view chunk)> onChunk, Params params);
+
+    ChunkingSink(fun<void(std::string_view chunk)> onChunk)
+        : ChunkingSink(std::move(onChunk), Params{})
+    {
+    }
+
+    void operator()(std::string_view data) override;
+
+    /**
+     * Emit the final chunk, if any.
+     */
+    void finish() override;
+
+private:
+
+    fun<void(std::string_view chunk)> onChunk;
+    Params params;
+
+    /**
+     * Cut-point masks for chunks smaller and larger than `avgSize`.
+     * Using a stricter mask below the average size and a looser one
+     * above it narrows the chunk size distribution ("normalised
+     * chunking").
+     */
+    uint64_t maskSmall, maskLarge;
+
+    std::string chunk;
+    uint64_t hash = 0;
+};
+
+} // namespace nix
@@ -6,7 +6,9 @@
 #include "nix/util/serialise.hh"
 #include "nix/util/compression-algo.hh"
 
+#include <optional>
 #include <string>
+#include <vector>
 
 namespace nix {
 
@@ -24,6 +26,55 @@ std::string decompress(CompressionAlgo method, std::string_view in);
 
 std::unique_ptr<FinishSink> makeDecompressionSink(CompressionAlgo method, Sink & nextSink);
 
+/**
+ * Create a source that decompresses the data read from `source`.
+ */
+std::unique_ptr<Source> makeDecompressionSource(CompressionAlgo method, Source & source);
+
+/**
+ * Create a zstd decompression sink. Input consisting of independent
+ * frames that record their decompressed size, as produced by
+ * `makeCompressionSink()`, is decompressed on up to `threads` threads
+ * (0 meaning the number of available cores, up to 4). Other input is
+ * decompressed as a stream.
+ */
+std::unique_ptr<FinishSink> makeZstdDecompressionSink(Sink & nextSink, unsigned int threads = 0);
+
+/**
+ * The position of a zstd frame within a compressed file, and of its
+ * contents within the decompressed data.
+ */
+struct ZstdFrame
+{
+    uint64_t compressedOffset;
+    uint64_t compressedSize;
+    uint64_t contentOffset;
+    uint64_t contentSize;
+};
+
+/**
+ * List the frames of the zstd data in `source` by walking its frame
+ * and block headers, without decompressing it. Since each frame can be
+ * decompressed on its own, this allows seeking in the decompressed
+ * data. Returns `std::nullopt` if a frame doesn't record its
+ * decompressed size.
+ */
+std::optional<std::vector<ZstdFrame>> listZstdFrames(Source & source);
+
+/**
+ * Compress `target` as a zstd frame that refers back to `base`, as done
+ * by `zstd --patch-from`. If the two are similar (e.g. two versions of
+ * the same package), the result is much smaller than `target`
+ * compressed on its own.
+ */
+std::string makeZstdDelta(std::string_view base, std::string_view target, int level = -1);
+
+/**
+ * Reconstruct the `size` bytes from which `delta` was made by
+ * `makeZstdDelta()` using the same `base`.
+ */
+std::string applyZstdDelta(std::string_view base, std::string_view delta, uint64_t size);
+
 std::string compress(CompressionAlgo method, std::string_view in, const bool parallel = false, int level = -1);
 
 std::string compress(CompressionAlgo method, Source & in, const bool parallel = false, int level = -1);
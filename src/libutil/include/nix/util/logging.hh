@@ -55,6 +55,16 @@ typedef enum {
     /* The resulting store path of an actFetchToStore activity, emitted once the
        operation completes. Fields: [0] = store path (string). */
     resFetchToStore = 109,
+    /* The estimated number of seconds until all builds of an actRealise
+       activity are done, based on the durations of previous builds.
+       Fields: [0] = seconds (int). */
+    resEstimatedTime = 110,
+    /* The resource usage of an actBuild activity, emitted once the
+       builder has finished. Fields: [0] = JSON object with the CPU,
+       memory and I/O usage, stall times and phase times of the build,
+       using the same keys as the JSON representation of build results
+       (string). */
+    resBuildResources = 111,
 } ResultType;
 
 typedef uint64_t ActivityId;
@@ -84,6 +94,30 @@ public:
           Concurrent writes to the same file by multiple Nix processes are not supported and
           may result in interleaved or corrupted log records.
         )"};
+
+    Setting<std::optional<AbsolutePath>> traceFile{
+        this,
+        {},
+        "trace-file",
+        R"(
+          A file to which a timeline of Nix's activities (such as builds,
+          substitutions, downloads and copies) is written in the
+          [Chrome Trace Event format](https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU),
+          which can be viewed with [Perfetto](https://ui.perfetto.dev) or
+          `chrome://tracing`.
+
+          Activities are shown on tracks that represent the slots in which
+          they ran, linked to the activity that started them, together with
+          the throughput of downloads and copies.
+          The file is overwritten.
+
+          This only applies to the Nix command that is being traced, not
+          to the Nix daemon, since the daemon handles each connection in
+          a separate process and these would overwrite each other's
+          trace. The activities that the daemon performs on behalf of a
+          client are forwarded to the client, and therefore appear in
+          the client's trace.
+        )"};
 };
 
 extern LoggerSettings loggerSettings;
@@ -286,8 +320,23 @@ std::unique_ptr<Logger> makeJSONLogger(Descriptor fd, bool includeNixPrefix = tr
 
 std::unique_ptr<Logger> makeJSONLogger(const std::filesystem::path & path, bool includeNixPrefix = true);
 
+/**
+ * Replace `logger` by a tee logger that also sends log messages to the
+ * logger returned by `makeExtraLogger`. If that throws, the error is
+ * printed and `logger` is left unchanged.
+ */
+void addExtraLogger(fun<std::unique_ptr<Logger>()> makeExtraLogger);
+
 void applyJSONLogger();
 
+/**
+ * Create a logger that writes a timeline of all activities to `path` in
+ * the Chrome Trace Event format (see the `trace-file` setting).
+ */
+std::unique_ptr<Logger> makeTraceLogger(const std::filesystem::path & path);
+
+void applyTraceLogger();
+
 /**
  * @param source A noun phrase describing the source of the message, e.g. "the builder".
  */
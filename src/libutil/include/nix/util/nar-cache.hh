@@ -5,35 +5,148 @@
 #include "nix/util/nar-accessor.hh"
 #include "nix/util/ref.hh"
 #include "nix/util/source-accessor.hh"
+#include "nix/util/sync.hh"
 
 #include <filesystem>
 #include <functional>
+#include <future>
+#include <list>
 #include <map>
 #include <optional>
 
 namespace nix {
 
 /**
- * A cache for NAR accessors with optional disk caching.
+ * A thread-safe cache for NAR accessors with optional disk caching.
+ *
+ * Both the in-memory and the on-disk tier can be bounded in size, in
+ * which case the least recently used NARs are evicted first.
  */
 class NarCache
 {
+public:
+
+    struct Limits
+    {
+        /**
+         * Maximum total size of the NAR accessors kept in memory. NARs
+         * that are backed by a file in the disk cache only count with
+         * the size of their listing. 0 means unlimited.
+         */
+        uint64_t maxMemorySize = 512 * 1024 * 1024;
+
+        /**
+         * Maximum total size of the files in the cache directory. 0
+         * means unlimited.
+         */
+        uint64_t maxDiskSize = 0;
+
+        /**
+         * Maximum number of NARs backed by a file in the disk cache
+         * that are kept in memory, since each of them keeps its file
+         * open. 0 means unlimited.
+         */
+        size_t maxOpenFiles = 256;
+    };
+
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t diskHits = 0;
+        uint64_t evictions = 0;
+        uint64_t diskEvictions = 0;
+        uint64_t memorySize = 0;
+        uint64_t diskSize = 0;
+        size_t openFiles = 0;
+    };
+
+private:
+
     /**
      * Optional directory for caching NARs and listings on disk.
      */
     std::optional<std::filesystem::path> cacheDir;
 
+    Limits limits;
+
+    struct Entry
+    {
+        /**
+         * Ready once the NAR has been loaded. Concurrent requests for
+         * a NAR that is still being loaded wait for this rather than
+         * loading it again.
+         */
+        std::shared_future<ref<SourceAccessor>> accessor;
+
+        uint64_t size = 0;
+
+        /**
+         * Whether the accessor keeps a file in the disk cache open.
+         */
+        bool openFile = false;
+
+        /**
+         * Position in `State::lru`, once ready.
+         */
+        std::optional<std::list<Hash>::iterator> lru;
+    };
+
+    struct DiskEntry
+    {
+        uint64_t size = 0;
+        std::list<std::string>::iterator lru;
+    };
+
+    struct State
+    {
+        std::map<Hash, Entry> entries;
+
+        /**
+         * Hashes of the loaded NARs, most recently used first.
+         */
+        std::list<Hash> lru;
+
+        /**
+         * Files in the cache directory, keyed by the base name shared
+         * by the NAR and its listing.
+         */
+        std::map<std::string, DiskEntry> diskEntries;
+
+        std::list<std::string> diskLru;
+
+        Stats stats;
+    };
+
+    Sync<State> state_;
+
+    struct Loaded
+    {
+        ref<SourceAccessor> accessor;
+
+        /**
+         * The size for the purpose of `Limits::maxMemorySize`.
+         */
+        uint64_t size;
+
+        bool openFile = false;
+    };
+
     /**
-     * Map from NAR hash to NAR accessor.
+     * Load a NAR from disk or by calling `populate`.
      */
-    std::map<Hash, ref<SourceAccessor>> nars;
+    Loaded load(const Hash & narHash, fun<void(Sink &)> populate);
+
+    void touchDiskEntry(const std::string & name);
+
+    void addDiskEntry(const std::string & name, uint64_t size);
 
 public:
 
     /**
      * Create a NAR cache with an optional cache directory for disk storage.
      */
-    NarCache(std::optional<std::filesystem::path> cacheDir = {});
+    NarCache(std::optional<std::filesystem::path> cacheDir = {}, Limits limits = {});
 
     /**
      * Lookup or create a NAR accessor, optionally using disk cache.
@@ -43,6 +156,8 @@ public:
      * @return The cached or newly created accessor
      */
     ref<SourceAccessor> getOrInsert(const Hash & narHash, fun<void(Sink &)> populate);
+
+    Stats getStats();
 };
 
 } // namespace nix
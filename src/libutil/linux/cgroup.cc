@@ -73,9 +73,110 @@ CgroupStats getCgroupStats(const std::filesystem::path & cgroup)
         }
     }
 
+    auto eventsPath = cgroup / "memory.events";
+
+    if (pathExists(eventsPath)) {
+        for (auto & line : tokenizeString<std::vector<std::string>>(readFile(eventsPath), "\n")) {
+            std::string_view oomKillPrefix = "oom_kill ";
+            if (hasPrefix(line, oomKillPrefix))
+                stats.oomKills = string2Int<uint64_t>(line.substr(oomKillPrefix.size())).value_or(0);
+        }
+    }
+
+    auto peakPath = cgroup / "memory.peak";
+
+    if (pathExists(peakPath))
+        stats.memoryPeak = string2Int<uint64_t>(trim(readFile(peakPath)));
+
+    auto ioStatPath = cgroup / "io.stat";
+
+    if (pathExists(ioStatPath)) {
+        auto [read, written] = parseIoStat(readFile(ioStatPath));
+        stats.ioReadBytes = read;
+        stats.ioWriteBytes = written;
+    }
+
+    for (auto [resource, stall] : {
+             std::pair{"cpu", &stats.cpuStall},
+             std::pair{"memory", &stats.memoryStall},
+             std::pair{"io", &stats.ioStall},
+         }) {
+        auto pressurePath = cgroup / (std::string(resource) + ".pressure");
+        if (pathExists(pressurePath))
+            *stall = parsePressureStats(readFile(pressurePath)).someTotal;
+    }
+
     return stats;
 }
 
+std::optional<uint64_t> getCgroupMemoryUsage(const std::filesystem::path & cgroup)
+{
+    auto currentPath = cgroup / "memory.current";
+    if (!pathExists(currentPath))
+        return std::nullopt;
+    return string2Int<uint64_t>(trim(readFile(currentPath)));
+}
+
+PressureStats parsePressureStats(std::string_view s)
+{
+    PressureStats stats;
+
+    /* The format is:
+
+       some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+       full avg10=0.00 avg60=0.00 avg300=0.00 total=0 */
+    for (auto & line : tokenizeString<std::vector<std::string>>(s, "\n")) {
+        auto fields = tokenizeString<std::vector<std::string>>(line, " ");
+        if (fields.empty())
+            continue;
+        bool some = fields[0] == "some";
+        if (!some && fields[0] != "full")
+            continue;
+        auto & avg10 = some ? stats.someAvg10 : stats.fullAvg10;
+        auto & total = some ? stats.someTotal : stats.fullTotal;
+        for (auto & field : fields) {
+            std::string_view avg10Prefix = "avg10=";
+            if (hasPrefix(field, avg10Prefix))
+                avg10 = string2Float<double>(field.substr(avg10Prefix.size())).value_or(0);
+            std::string_view totalPrefix = "total=";
+            if (hasPrefix(field, totalPrefix))
+                total = std::chrono::microseconds(string2Int<uint64_t>(field.substr(totalPrefix.size())).value_or(0));
+        }
+    }
+
+    return stats;
+}
+
+std::pair<uint64_t, uint64_t> parseIoStat(std::string_view s)
+{
+    uint64_t read = 0, written = 0;
+
+    /* The format is one line per device:
+
+       8:0 rbytes=1459200 wbytes=314773504 rios=192 wios=353 dbytes=0 dios=0 */
+    for (auto & line : tokenizeString<std::vector<std::string>>(s, "\n")) {
+        for (auto & field : tokenizeString<std::vector<std::string>>(line, " ")) {
+            std::string_view rbytesPrefix = "rbytes=";
+            if (hasPrefix(field, rbytesPrefix))
+                read += string2Int<uint64_t>(field.substr(rbytesPrefix.size())).value_or(0);
+            std::string_view wbytesPrefix = "wbytes=";
+            if (hasPrefix(field, wbytesPrefix))
+                written += string2Int<uint64_t>(field.substr(wbytesPrefix.size())).value_or(0);
+        }
+    }
+
+    return {read, written};
+}
+
+std::optional<PressureStats> getPressureStats(std::string_view resource)
+{
+    try {
+        return parsePressureStats(readFile(std::filesystem::path("/proc/pressure") / resource));
+    } catch (SystemError &) {
+        return std::nullopt;
+    }
+}
+
 static CgroupStats destroyCgroup(const std::filesystem::path & cgroup, bool returnStats)
 {
     if (!pathExists(cgroup))
@@ -17,6 +17,28 @@ StringMap getCgroups(const std::filesystem::path & cgroupFile);
 struct CgroupStats
 {
     std::optional<std::chrono::microseconds> cpuUser, cpuSystem;
+
+    /**
+     * Number of processes in the cgroup killed by the OOM killer.
+     */
+    uint64_t oomKills = 0;
+
+    /**
+     * Peak memory usage of the cgroup in bytes (`memory.peak`).
+     */
+    std::optional<uint64_t> memoryPeak;
+
+    /**
+     * Bytes read from and written to block devices by the cgroup
+     * (`io.stat`).
+     */
+    std::optional<uint64_t> ioReadBytes, ioWriteBytes;
+
+    /**
+     * Total time during which some processes of the cgroup were
+     * stalled on the CPU, memory or I/O (the `*.pressure` files).
+     */
+    std::optional<std::chrono::microseconds> cpuStall, memoryStall, ioStall;
 };
 
 /**
@@ -32,6 +54,45 @@ CgroupStats getCgroupStats(const std::filesystem::path & cgroup);
  */
 CgroupStats destroyCgroup(const std::filesystem::path & cgroup);
 
+/**
+ * Return the current memory usage of the given cgroup in bytes, or
+ * `std::nullopt` if the memory controller is not enabled for it.
+ */
+std::optional<uint64_t> getCgroupMemoryUsage(const std::filesystem::path & cgroup);
+
+/**
+ * Pressure stall information, as found in `/proc/pressure/*` or the
+ * `*.pressure` files of a cgroup. The values are the percentage of
+ * time in the last 10 seconds that some or all tasks were stalled on
+ * the resource.
+ */
+struct PressureStats
+{
+    double someAvg10 = 0;
+    double fullAvg10 = 0;
+
+    /**
+     * The total time that some or all tasks were stalled.
+     */
+    std::chrono::microseconds someTotal{0};
+    std::chrono::microseconds fullTotal{0};
+};
+
+PressureStats parsePressureStats(std::string_view s);
+
+/**
+ * Parse the `io.stat` file of a cgroup, returning the total number of
+ * bytes read and written on all devices.
+ */
+std::pair<uint64_t, uint64_t> parseIoStat(std::string_view s);
+
+/**
+ * Read the system-wide pressure stall information for `resource`
+ * (`cpu`, `memory` or `io`). Returns `std::nullopt` if the kernel
+ * doesn't support PSI.
+ */
+std::optional<PressureStats> getPressureStats(std::string_view resource);
+
 CanonPath getCurrentCgroup();
 
 /**
@@ -387,24 +387,28 @@ std::unique_ptr<Logger> makeJSONLogger(const std::filesystem::path & path, bool
     return std::make_unique<JSONFileLogger>(std::move(fd), includeNixPrefix);
 }
 
-void applyJSONLogger()
+void addExtraLogger(fun<std::unique_ptr<Logger>()> makeExtraLogger)
 {
-    if (auto & opt = loggerSettings.jsonLogPath.get()) {
+    try {
+        std::vector<std::unique_ptr<Logger>> loggers;
+        loggers.push_back(makeExtraLogger());
         try {
-            std::vector<std::unique_ptr<Logger>> loggers;
-            loggers.push_back(makeJSONLogger(*opt, false));
-            try {
-                logger = makeTeeLogger(std::unique_ptr<Logger>(logger), std::move(loggers)).release();
-            } catch (...) {
-                // `logger` is now gone so give up.
-                abort();
-            }
+            logger = makeTeeLogger(std::unique_ptr<Logger>(logger), std::move(loggers)).release();
         } catch (...) {
-            ignoreExceptionExceptInterrupt();
+            // `logger` is now gone so give up.
+            abort();
         }
+    } catch (...) {
+        ignoreExceptionExceptInterrupt();
     }
 }
 
+void applyJSONLogger()
+{
+    if (auto & opt = loggerSettings.jsonLogPath.get())
+        addExtraLogger([&]() { return makeJSONLogger(*opt, false); });
+}
+
 static auto getFields(nlohmann::json & json)
 {
     std::vector<Logger::Field> fields;
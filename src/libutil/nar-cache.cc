@@ -1,5 +1,9 @@
 #include "nix/util/nar-cache.hh"
 #include "nix/util/file-system.hh"
+#include "nix/util/logging.hh"
+#include "nix/util/util.hh"
+
+#include <algorithm>
 
 #include <nlohmann/json.hpp>
 #include <sys/types.h>
@@ -8,77 +12,256 @@
 
 namespace nix {
 
-NarCache::NarCache(std::optional<std::filesystem::path> cacheDir_)
+NarCache::NarCache(std::optional<std::filesystem::path> cacheDir_, Limits limits)
     : cacheDir(std::move(cacheDir_))
+    , limits(limits)
+{
+    if (!cacheDir)
+        return;
+
+    createDirs(*cacheDir);
+
+    /* Index the NARs already in the cache directory, oldest first, so
+       that they can be evicted in LRU order. */
+    std::vector<std::tuple<std::filesystem::file_time_type, std::string, uint64_t>> files;
+
+    for (auto & entry : DirectoryIterator{*cacheDir}) {
+        auto path = entry.path();
+        if (path.extension() != ".nar")
+            continue;
+        try {
+            auto size = std::filesystem::file_size(path);
+            auto listingFile = path;
+            listingFile.replace_extension(".ls");
+            std::error_code ec;
+            if (auto listingSize = std::filesystem::file_size(listingFile, ec); !ec)
+                size += listingSize;
+            files.emplace_back(std::filesystem::last_write_time(path), path.stem().string(), size);
+        } catch (std::filesystem::filesystem_error &) {
+        }
+    }
+
+    std::sort(files.begin(), files.end());
+
+    for (auto & [time, name, size] : files)
+        addDiskEntry(name, size);
+}
+
+void NarCache::touchDiskEntry(const std::string & name)
 {
-    if (cacheDir)
-        createDirs(*cacheDir);
+    {
+        auto state(state_.lock());
+        if (auto * entry = get(state->diskEntries, name))
+            state->diskLru.splice(state->diskLru.begin(), state->diskLru, entry->lru);
+    }
+
+    /* Record the access in the file system, so that the LRU order
+       survives restarts. */
+    std::error_code ec;
+    std::filesystem::last_write_time(
+        *cacheDir / (name + ".nar"), std::filesystem::file_time_type::clock::now(), ec);
 }
 
-ref<SourceAccessor> NarCache::getOrInsert(const Hash & narHash, fun<void(Sink &)> populate)
+void NarCache::addDiskEntry(const std::string & name, uint64_t size)
 {
-    // Check in-memory cache first
-    if (auto * accessor = get(nars, narHash))
-        return *accessor;
+    std::vector<std::string> evicted;
 
-    auto cacheAccessor = [&](ref<SourceAccessor> accessor) {
-        nars.emplace(narHash, accessor);
-        return accessor;
-    };
+    {
+        auto state(state_.lock());
 
+        if (auto * entry = get(state->diskEntries, name)) {
+            state->stats.diskSize -= entry->size;
+            state->diskLru.erase(entry->lru);
+            state->diskEntries.erase(name);
+        }
+
+        state->diskEntries.emplace(
+            name,
+            DiskEntry{
+                .size = size,
+                .lru = state->diskLru.insert(state->diskLru.begin(), name),
+            });
+        state->stats.diskSize += size;
+
+        while (limits.maxDiskSize && state->stats.diskSize > limits.maxDiskSize && state->diskLru.size() > 1) {
+            auto victim = std::move(state->diskLru.back());
+            state->diskLru.pop_back();
+            state->stats.diskSize -= state->diskEntries.at(victim).size;
+            state->diskEntries.erase(victim);
+            state->stats.diskEvictions++;
+            evicted.push_back(std::move(victim));
+        }
+    }
+
+    /* Accessors that are still using an evicted NAR keep it open, so
+       it's safe to delete it. */
+    for (auto & victim : evicted) {
+        debug("evicting NAR '%s' from the NAR cache", victim);
+        std::error_code ec;
+        std::filesystem::remove(*cacheDir / (victim + ".nar"), ec);
+        std::filesystem::remove(*cacheDir / (victim + ".ls"), ec);
+    }
+}
+
+NarCache::Loaded NarCache::load(const Hash & narHash, fun<void(Sink &)> populate)
+{
     auto getNar = [&]() {
         StringSink sink;
         populate(sink);
         return std::move(sink.s);
     };
 
-    if (cacheDir) {
-        auto makeCacheFile = [&](const std::string & ext) {
-            auto res = *cacheDir / narHash.to_string(HashFormat::Nix32, false);
-            res += ".";
-            res += ext;
-            return res;
-        };
-
-        auto cacheFile = makeCacheFile("nar");
-        auto listingFile = makeCacheFile("ls");
-
-        if (nix::pathExists(cacheFile)) {
-            try {
-                return cacheAccessor(makeLazyNarAccessor(
-                    nlohmann::json::parse(nix::readFile(listingFile)).template get<NarListing>(),
-                    seekableGetNarBytes(cacheFile)));
-            } catch (SystemError &) {
-            }
+    if (!cacheDir) {
+        auto nar = getNar();
+        auto size = nar.size();
+        return {makeNarAccessor(std::move(nar)), size};
+    }
 
-            try {
-                return cacheAccessor(makeNarAccessor(nix::readFile(cacheFile)));
-            } catch (SystemError &) {
-            }
-        }
+    auto name = narHash.to_string(HashFormat::Nix32, false);
+    auto cacheFile = *cacheDir / (name + ".nar");
+    auto listingFile = *cacheDir / (name + ".ls");
 
-        auto nar = getNar();
+    if (nix::pathExists(cacheFile)) {
+        try {
+            auto listing = nix::readFile(listingFile);
+            auto accessor = makeLazyNarAccessor(
+                nlohmann::json::parse(listing).template get<NarListing>(), seekableGetNarBytes(cacheFile));
+            touchDiskEntry(name);
+            state_.lock()->stats.diskHits++;
+            return {accessor, listing.size(), true};
+        } catch (SystemError &) {
+        } catch (std::filesystem::filesystem_error &) {
+        }
 
         try {
-            /* FIXME: do this asynchronously. */
-            writeFile(cacheFile, nar);
-        } catch (...) {
-            ignoreExceptionExceptInterrupt();
+            auto nar = nix::readFile(cacheFile);
+            auto size = nar.size();
+            auto accessor = makeNarAccessor(std::move(nar));
+            touchDiskEntry(name);
+            state_.lock()->stats.diskHits++;
+            return {accessor, size};
+        } catch (SystemError &) {
         }
+    }
 
-        auto narAccessor = makeNarAccessor(std::move(nar));
+    auto nar = getNar();
+    auto narSize = nar.size();
 
-        try {
-            nlohmann::json j = narAccessor->getListing();
-            writeFile(listingFile, j.dump());
-        } catch (...) {
-            ignoreExceptionExceptInterrupt();
+    /* Write the files atomically, since other processes may be using
+       the same cache directory. */
+    auto writeCacheFile = [&](const std::filesystem::path & path, std::string_view contents) {
+        auto tmp = makeTempPath(path);
+        writeFile(tmp, contents);
+        std::filesystem::rename(tmp, path);
+    };
+
+    bool haveCacheFile = false;
+    try {
+        /* FIXME: do this asynchronously. */
+        writeCacheFile(cacheFile, nar);
+        haveCacheFile = true;
+    } catch (...) {
+        ignoreExceptionExceptInterrupt();
+    }
+
+    auto narAccessor = makeNarAccessor(std::move(nar));
+
+    try {
+        nlohmann::json j = narAccessor->getListing();
+        auto listing = j.dump();
+        writeCacheFile(listingFile, listing);
+
+        if (haveCacheFile) {
+            addDiskEntry(name, narSize + listing.size());
+
+            /* Read from the cache file from now on, so that the NAR
+               doesn't need to be kept in memory. */
+            return {
+                makeLazyNarAccessor(NarListing(narAccessor->getListing()), seekableGetNarBytes(cacheFile)),
+                listing.size(),
+                true};
         }
+    } catch (...) {
+        ignoreExceptionExceptInterrupt();
+    }
 
-        return cacheAccessor(narAccessor);
+    return {narAccessor, narSize};
+}
+
+ref<SourceAccessor> NarCache::getOrInsert(const Hash & narHash, fun<void(Sink &)> populate)
+{
+    std::optional<std::promise<ref<SourceAccessor>>> promise;
+    std::shared_future<ref<SourceAccessor>> future;
+
+    {
+        auto state(state_.lock());
+        auto [i, inserted] = state->entries.try_emplace(narHash);
+        if (inserted) {
+            state->stats.misses++;
+            promise.emplace();
+            i->second.accessor = promise->get_future().share();
+        } else {
+            state->stats.hits++;
+            if (i->second.lru)
+                state->lru.splice(state->lru.begin(), state->lru, *i->second.lru);
+            future = i->second.accessor;
+        }
     }
 
-    return cacheAccessor(makeNarAccessor(getNar()));
+    /* Another thread is already loading this NAR, or has loaded it. */
+    if (!promise)
+        return future.get();
+
+    try {
+        auto loaded = load(narHash, populate);
+
+        {
+            auto state(state_.lock());
+
+            auto & entry = state->entries.at(narHash);
+            entry.size = loaded.size;
+            entry.openFile = loaded.openFile;
+            entry.lru = state->lru.insert(state->lru.begin(), narHash);
+            state->stats.memorySize += loaded.size;
+            if (loaded.openFile)
+                state->stats.openFiles++;
+
+            auto evict = [&](std::list<Hash>::iterator i) {
+                auto victim = state->entries.find(*i);
+                state->stats.memorySize -= victim->second.size;
+                if (victim->second.openFile)
+                    state->stats.openFiles--;
+                state->entries.erase(victim);
+                state->lru.erase(i);
+                state->stats.evictions++;
+            };
+
+            while (limits.maxMemorySize && state->stats.memorySize > limits.maxMemorySize
+                   && state->lru.size() > 1)
+                evict(std::prev(state->lru.end()));
+
+            /* The entry that was just added is at the front, so this
+               always finds an older one to evict. */
+            while (limits.maxOpenFiles && state->stats.openFiles > limits.maxOpenFiles) {
+                auto i = std::prev(state->lru.end());
+                while (!state->entries.at(*i).openFile)
+                    --i;
+                evict(i);
+            }
+        }
+
+        promise->set_value(loaded.accessor);
+        return loaded.accessor;
+    } catch (...) {
+        state_.lock()->entries.erase(narHash);
+        promise->set_exception(std::current_exception());
+        throw;
+    }
+}
+
+NarCache::Stats NarCache::getStats()
+{
+    return state_.lock()->stats;
 }
 
 } // namespace nix
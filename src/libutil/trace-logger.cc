@@ -0,0 +1,397 @@
+#include "nix/util/logging.hh"
+#include "nix/util/file-descriptor.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/sync.hh"
+#include "nix/util/util.hh"
+
+#include <chrono>
+#include <fcntl.h>
+
+#include <nlohmann/json.hpp>
+
+namespace nix {
+
+namespace {
+
+/**
+ * A logger that writes a timeline of all activities in the Chrome
+ * Trace Event format, which can be viewed in Perfetto or
+ * `chrome://tracing`.
+ *
+ * Activities are shown as slices on tracks ("slots") that are reused
+ * once an activity has finished, so the number of tracks of a group is
+ * the maximum number of its activities that ran at the same time. The
+ * parent of an activity is linked to it by a flow arrow, and the
+ * throughput of downloads and copies is shown as counters.
+ */
+struct TraceLogger : Logger
+{
+    /**
+     * The groups of activities that are shown as separate processes,
+     * each with its own tracks.
+     */
+    enum Group : unsigned int {
+        grBuilds = 1,
+        grTransfers = 2,
+        grOther = 3,
+    };
+
+    struct RunningActivity
+    {
+        uint64_t start;
+        ActivityType type;
+        std::string name;
+        nlohmann::json args;
+        Group group;
+        unsigned int track;
+
+        /**
+         * The number of bytes transferred so far, for activities that
+         * count towards a throughput counter.
+         */
+        uint64_t done = 0;
+    };
+
+    struct Counter
+    {
+        /**
+         * The total number of bytes transferred by all activities.
+         */
+        uint64_t bytes = 0;
+
+        /**
+         * The total at the time the counter was last written.
+         */
+        uint64_t lastBytes = 0;
+        uint64_t lastTime = 0;
+
+        unsigned int running = 0;
+    };
+
+    struct State
+    {
+        std::map<ActivityId, RunningActivity> running;
+
+        /**
+         * The tracks of each group, and whether they're in use.
+         */
+        std::map<Group, std::vector<bool>> tracks;
+
+        std::map<std::string, Counter> counters;
+
+        /**
+         * Events that haven't been written to the file yet.
+         */
+        std::string buffer;
+
+        bool empty = true;
+
+        bool stopped = false;
+    };
+
+    AutoCloseFD fd;
+
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    Sync<State> _state;
+
+    /**
+     * Don't write counter events more often than this, in
+     * microseconds.
+     */
+    static constexpr uint64_t counterInterval = 100000;
+
+    TraceLogger(AutoCloseFD && fd)
+        : fd(std::move(fd))
+    {
+        auto state(_state.lock());
+        state->buffer = "[\n";
+        for (auto [group, name] : {
+                 std::pair{grBuilds, "builds"},
+                 std::pair{grTransfers, "transfers"},
+                 std::pair{grOther, "other"},
+             })
+            emit(
+                *state,
+                {
+                    {"name", "process_name"},
+                    {"ph", "M"},
+                    {"pid", group},
+                    {"args", {{"name", name}}},
+                });
+    }
+
+    uint64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    static Group getGroup(ActivityType type)
+    {
+        switch (type) {
+        case actBuild:
+        case actBuildWaiting:
+        case actPostBuildHook:
+            return grBuilds;
+        case actSubstitute:
+        case actCopyPath:
+        case actFileTransfer:
+        case actQueryPathInfo:
+            return grTransfers;
+        default:
+            return grOther;
+        }
+    }
+
+    static std::optional<std::string> getCounter(ActivityType type)
+    {
+        switch (type) {
+        case actFileTransfer:
+            return "download";
+        case actCopyPath:
+            return "copy";
+        default:
+            return std::nullopt;
+        }
+    }
+
+    void flush(State & state)
+    {
+        if (state.buffer.empty())
+            return;
+        try {
+            writeFull(fd.get(), state.buffer);
+        } catch (...) {
+            state.stopped = true;
+            ignoreExceptionExceptInterrupt();
+            logger->warn("disabling the trace file due to write errors");
+        }
+        state.buffer.clear();
+    }
+
+    void emit(State & state, const nlohmann::json & event)
+    {
+        if (!state.empty)
+            state.buffer += ",\n";
+        state.empty = false;
+        state.buffer += event.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+        if (state.buffer.size() >= 65536)
+            flush(state);
+    }
+
+    unsigned int allocateTrack(State & state, Group group)
+    {
+        auto & tracks = state.tracks[group];
+        for (unsigned int i = 0; i < tracks.size(); ++i)
+            if (!tracks[i]) {
+                tracks[i] = true;
+                return i + 1;
+            }
+        tracks.push_back(true);
+        unsigned int track = tracks.size();
+        emit(
+            state,
+            {
+                {"name", "thread_name"},
+                {"ph", "M"},
+                {"pid", group},
+                {"tid", track},
+                {"args", {{"name", fmt("slot %d", track)}}},
+            });
+        return track;
+    }
+
+    void emitCounter(State & state, const std::string & name, Counter & counter, uint64_t time, bool force)
+    {
+        if (!force && time - counter.lastTime < counterInterval)
+            return;
+        double rate = time > counter.lastTime
+                          ? (double) (counter.bytes - counter.lastBytes) * 1000000 / (time - counter.lastTime)
+                          : 0;
+        emit(
+            state,
+            {
+                {"name", name},
+                {"ph", "C"},
+                {"ts", time},
+                {"pid", grTransfers},
+                {"args", {{"bytes/s", counter.running ? rate : 0}}},
+            });
+        counter.lastBytes = counter.bytes;
+        counter.lastTime = time;
+    }
+
+    void finishActivity(State & state, const RunningActivity & activity, uint64_t time)
+    {
+        emit(
+            state,
+            {
+                {"name", activity.name},
+                {"cat", activity.group == grBuilds ? "build" : activity.group == grTransfers ? "transfer" : "other"},
+                {"ph", "X"},
+                {"ts", activity.start},
+                {"dur", time - activity.start},
+                {"pid", activity.group},
+                {"tid", activity.track},
+                {"args", activity.args},
+            });
+
+        state.tracks[activity.group][activity.track - 1] = false;
+
+        if (auto name = getCounter(activity.type)) {
+            auto & counter = state.counters[*name];
+            counter.running--;
+            emitCounter(state, *name, counter, time, counter.running == 0);
+        }
+    }
+
+    void stop() override
+    {
+        auto state(_state.lock());
+        if (state->stopped)
+            return;
+
+        /* Show the activities that are still running as ending now. */
+        auto time = now();
+        for (auto & [_, activity] : state->running)
+            finishActivity(*state, activity, time);
+        state->running.clear();
+
+        state->buffer += "\n]\n";
+        flush(*state);
+        state->stopped = true;
+    }
+
+    void log(Verbosity lvl, std::string_view s) noexcept override {}
+
+    void logEI(const ErrorInfo & ei) noexcept override {}
+
+    void startActivity(
+        ActivityId act,
+        Verbosity lvl,
+        ActivityType type,
+        const std::string & s,
+        std::span<const Field> fields,
+        ActivityId parent) noexcept override
+    {
+        auto state(_state.lock());
+        if (state->stopped)
+            return;
+
+        auto time = now();
+        auto group = getGroup(type);
+
+        RunningActivity activity{
+            .start = time,
+            .type = type,
+            .name = s.empty() ? fmt("activity type %d", (unsigned int) type) : s,
+            .args = {{"type", type}},
+            .group = group,
+            .track = allocateTrack(*state, group),
+        };
+
+        if (!fields.empty()) {
+            auto & args = activity.args["fields"] = nlohmann::json::array();
+            for (auto & f : fields)
+                std::visit([&](const auto & v) { args.push_back(v); }, f);
+        }
+
+        if (auto i = state->running.find(parent); i != state->running.end()) {
+            emit(
+                *state,
+                {
+                    {"name", "parent"},
+                    {"cat", "flow"},
+                    {"ph", "s"},
+                    {"id", act},
+                    {"ts", time},
+                    {"pid", i->second.group},
+                    {"tid", i->second.track},
+                });
+            emit(
+                *state,
+                {
+                    {"name", "parent"},
+                    {"cat", "flow"},
+                    {"ph", "f"},
+                    {"bp", "e"},
+                    {"id", act},
+                    {"ts", time},
+                    {"pid", activity.group},
+                    {"tid", activity.track},
+                });
+        }
+
+        if (auto name = getCounter(type))
+            state->counters[*name].running++;
+
+        state->running.insert_or_assign(act, std::move(activity));
+    }
+
+    void stopActivity(ActivityId act) noexcept override
+    {
+        auto state(_state.lock());
+        if (state->stopped)
+            return;
+
+        auto i = state->running.find(act);
+        if (i == state->running.end())
+            return;
+
+        finishActivity(*state, i->second, now());
+        state->running.erase(i);
+    }
+
+    void result(ActivityId act, ResultType type, std::span<const Field> fields) noexcept override
+    {
+        if (type != resProgress || fields.empty())
+            return;
+
+        auto done = std::get_if<uint64_t>(&fields[0]);
+        if (!done)
+            return;
+
+        auto state(_state.lock());
+        if (state->stopped)
+            return;
+
+        auto i = state->running.find(act);
+        if (i == state->running.end())
+            return;
+
+        auto name = getCounter(i->second.type);
+        if (!name || *done < i->second.done)
+            return;
+
+        auto & counter = state->counters[*name];
+        counter.bytes += *done - i->second.done;
+        i->second.done = *done;
+        emitCounter(*state, *name, counter, now(), false);
+    }
+};
+
+} // namespace
+
+std::unique_ptr<Logger> makeTraceLogger(const std::filesystem::path & path)
+{
+    AutoCloseFD fd = toDescriptor(open(
+        path.string().c_str(),
+        O_CREAT | O_TRUNC | O_WRONLY
+#ifndef _WIN32
+            | O_CLOEXEC
+#endif
+        ,
+        0644));
+    if (!fd)
+        throw SysError("opening trace file %1%", PathFmt(path));
+
+    return std::make_unique<TraceLogger>(std::move(fd));
+}
+
+void applyTraceLogger()
+{
+    if (auto & opt = loggerSettings.traceFile.get())
+        addExtraLogger([&]() { return makeTraceLogger(*opt); });
+}
+
+} // namespace nix
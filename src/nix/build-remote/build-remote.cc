@@ -23,6 +23,7 @@
 #include "nix/store/derivation/full-inputs.hh"
 #include "nix/store/local-store.hh"
 #include "nix/store/build.hh"
+#include "nix/store/build/remote-builders.hh"
 #include "nix/cmd/legacy.hh"
 #include "nix/util/experimental-features.hh"
 #include "nix/store/globals.hh"
@@ -319,121 +320,10 @@ static int main_build_remote(int argc, char ** argv)
 
         uploadLock = -1;
 
-        auto drv = store->readDerivation(*drvPath);
-
-        std::optional<BuildResult> optResult;
-
-        // If we don't know whether we are trusted (e.g. `ssh://`
-        // stores), we assume we are. This is necessary for backwards
-        // compat.
-        bool trustedOrLegacy = ({
-            std::optional trusted = sshStore->isTrustedClient();
-            !trusted || *trusted;
-        });
-
-        // See the very large comment in `case WorkerProto::Op::BuildDerivation:` in
-        // `src/libstore/daemon.cc` that explains the trust model here.
-        //
-        // This condition mirrors that: that code enforces the "rules" outlined there;
-        // we do the best we can given those "rules".
-        if (trustedOrLegacy || type(drv).isCA()) {
-            // Check if there are any derivation inputs
-            bool hasInputDrvs = std::ranges::any_of(drv.inputs, [](const auto & input) {
-                return std::holds_alternative<SingleDerivedPath::Built>(input.raw());
-            });
-
-            BasicDerivation resolvedDrv{
-                .outputs = drv.outputs,
-                // Hijack the inputs paths of the derivation to include
-                // all the paths that come from the `inputDrvs` set. We
-                // don't do that for the derivations whose `inputDrvs`
-                // is empty because:
-                //
-                // 1. It's not needed
-                //
-                // 2. Changing the `inputSrcs` set changes the
-                //    associated output ids, which break CA derivations
-                .inputs =
-                    hasInputDrvs ? inputs : [&] {
-                        StorePathSet srcs;
-                        for (auto & input : drv.inputs)
-                            if (auto * op = std::get_if<SingleDerivedPath::Opaque>(&input.raw()))
-                                srcs.insert(op->path);
-                        return srcs;
-                    }(),
-                .platform = drv.platform,
-                .builder = drv.builder,
-                .args = drv.args,
-                .env = drv.env,
-                .structuredAttrs = drv.structuredAttrs,
-                .name = drv.name,
-            };
-            optResult = sshStore->getBuilder()->buildDerivation(*drvPath, resolvedDrv);
-            auto & result = *optResult;
-            if (auto * failureP = result.tryGetFailure()) {
-                if (settings.keepFailed) {
-                    warn(
-                        "The failed build directory was kept on the remote builder due to `--keep-failed`.%s",
-                        (settings.thisSystem == drv.platform || settings.extraPlatforms.get().count(drv.platform) > 0)
-                            ? " You can re-run the command with `--builders ''` to disable remote building for this invocation."
-                            : "");
-                }
-                throw Error(
-                    "build of '%s' on '%s' failed: %s", store->printStorePath(*drvPath), storeUri, failureP->message());
-            }
-        } else {
-            copyClosure(*store, *sshStore, StorePathSet{*drvPath}, NoRepair, NoCheckSigs, substitute);
-            auto res = sshStore->getBuilder()->buildPathsWithResults({DerivedPath::Built{
-                .drvPath = makeConstantStorePathRef(*drvPath),
-                .outputs = OutputsSpec::All{},
-            }});
-            // One path to build should produce exactly one build result
-            assert(res.size() == 1);
-            optResult = std::move(res[0]);
-        }
-
-        std::set<Realisation> missingRealisations;
-        StorePathSet missingPaths;
-        if (experimentalFeatureSettings.isEnabled(Xp::CaDerivations) && !type(drv).hasKnownOutputPaths()) {
-            for (auto & outputName : wantedOutputs) {
-                auto thisOutputId = DrvOutput{*drvPath, outputName};
-                if (!store->queryRealisation(thisOutputId)) {
-                    debug("missing output %s", outputName);
-                    assert(optResult);
-                    auto & result = *optResult;
-                    if (auto * successP = result.tryGetSuccess()) {
-                        auto & success = *successP;
-                        auto i = success.builtOutputs.find(outputName);
-                        assert(i != success.builtOutputs.end());
-                        auto & newRealisation = i->second;
-                        missingRealisations.insert({newRealisation, thisOutputId});
-                        missingPaths.insert(newRealisation.outPath);
-                    }
-                }
-            }
-        } else {
-            auto outputPaths = outputsAndOptPaths(drv, *store);
-            for (auto & [outputName, hopefullyOutputPath] : outputPaths) {
-                assert(hopefullyOutputPath.second);
-                if (!store->isValidPath(*hopefullyOutputPath.second))
-                    missingPaths.insert(*hopefullyOutputPath.second);
-            }
-        }
-
-        if (!missingPaths.empty()) {
-            Activity act(*logger, lvlTalkative, actUnknown, fmt("copying outputs from '%s'", storeUri));
-            if (auto localStore = store.dynamic_pointer_cast<LocalStore>())
-                for (auto & path : missingPaths)
-                    localStore->locksHeld.insert(store->printStorePath(path)); /* FIXME: ugly */
-            copyPaths(*sshStore, *store, missingPaths, NoRepair, NoCheckSigs, NoSubstitute);
-        }
-        // XXX: Should be done as part of `copyPaths`
-        for (auto & realisation : missingRealisations) {
-            // Should hold, because if the feature isn't enabled the set
-            // of missing realisations should be empty
-            experimentalFeatureSettings.require(Xp::CaDerivations);
-            store->registerDrvOutput(realisation, NoCheckSigs);
-        }
+        auto result = buildOnRemoteStore(*store, *sshStore, *drvPath, inputs, wantedOutputs);
+        if (auto * failureP = result.tryGetFailure())
+            throw Error(
+                "build of '%s' on '%s' failed: %s", store->printStorePath(*drvPath), storeUri, failureP->message());
 
         return 0;
     }
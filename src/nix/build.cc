@@ -100,6 +100,20 @@ builtPathsWithResultToJSON(const std::vector<BuiltPathWithResult> & buildables,
                 j["cpuUser"] = ((double) b.result->cpuUser->count()) / 1000000;
             if (b.result->cpuSystem)
                 j["cpuSystem"] = ((double) b.result->cpuSystem->count()) / 1000000;
+            if (b.result->memoryPeak)
+                j["memoryPeak"] = *b.result->memoryPeak;
+            if (b.result->ioReadBytes)
+                j["ioReadBytes"] = *b.result->ioReadBytes;
+            if (b.result->ioWriteBytes)
+                j["ioWriteBytes"] = *b.result->ioWriteBytes;
+            if (b.result->cpuStall)
+                j["cpuStall"] = ((double) b.result->cpuStall->count()) / 1000000;
+            if (b.result->memoryStall)
+                j["memoryStall"] = ((double) b.result->memoryStall->count()) / 1000000;
+            if (b.result->ioStall)
+                j["ioStall"] = ((double) b.result->ioStall->count()) / 1000000;
+            for (auto & [phase, time] : b.result->phaseTimes)
+                j["phaseTimes"][phase] = ((double) time.count()) / 1000000;
         }
         res.push_back(j);
     }
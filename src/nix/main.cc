@@ -523,6 +523,7 @@ void mainWrapped(int argc, char ** argv)
     }
 
     applyJSONLogger();
+    applyTraceLogger();
 
     if (args.helpRequested) {
         std::vector<std::string> subcommand;
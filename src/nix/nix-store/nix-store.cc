@@ -1,4 +1,5 @@
 #include "nix/util/archive.hh"
+#include "nix/util/compression.hh"
 #include "nix/store/derivations.hh"
 #include "nix/store/derivation/aterm.hh"
 #include "nix/store/outputs-query.hh"
@@ -813,16 +814,25 @@ static void opVerify(Strings opFlags, Strings opArgs)
 
     bool checkContents = false;
     RepairFlag repair = NoRepair;
+    std::optional<time_t> registeredBefore;
 
-    for (auto & i : opFlags)
-        if (i == "--check-contents")
+    for (auto i = opFlags.begin(); i != opFlags.end(); ++i)
+        if (*i == "--check-contents")
             checkContents = true;
-        else if (i == "--repair")
+        else if (*i == "--repair")
             repair = Repair;
+        else if (*i == "--registered-before")
+            registeredBefore = getIntArg<time_t>(*i, i, opFlags.end(), false);
         else
-            throw UsageError("unknown flag '%1%'", i);
+            throw UsageError("unknown flag '%1%'", *i);
+
+    if (registeredBefore && !checkContents)
+        throw UsageError("option --registered-before requires --check-contents");
+
+    bool errors = registeredBefore ? ensureLocalStore()->verifyStore(checkContents, repair, registeredBefore)
+                                   : store->verifyStore(checkContents, repair);
 
-    if (store->verifyStore(checkContents, repair)) {
+    if (errors) {
         warn("not all store errors were fixed");
         throw Exit(1);
     }
@@ -905,6 +915,14 @@ static void opServe(Strings opFlags, Strings opArgs)
         .version = clientVersion,
     };
 
+    /* The zstd level at which the client wants NARs to be sent, or 0
+       if it wants them uncompressed. */
+    auto readNarCompressionLevel = [&]() -> unsigned int {
+        if (clientVersion < ServeProto::narCompressionVersion)
+            return 0;
+        return std::min(readNum<unsigned int>(in), ServeProto::maxNarCompressionLevel);
+    };
+
     auto getBuildSettings = [&]() {
         // FIXME: changing options here doesn't work if we're
         // building through the daemon.
@@ -982,9 +1000,18 @@ static void opServe(Strings opFlags, Strings opArgs)
             break;
         }
 
-        case ServeProto::Command::DumpStorePath:
-            store->narFromPath(store->parseStorePath(readString(in)), out);
+        case ServeProto::Command::DumpStorePath: {
+            auto path = store->parseStorePath(readString(in));
+            auto compressionLevel = readNarCompressionLevel();
+            if (compressionLevel) {
+                FramedSink framedSink(out, []() {});
+                auto compressionSink = makeCompressionSink(CompressionAlgo::zstd, framedSink, false, compressionLevel);
+                store->narFromPath(path, *compressionSink);
+                compressionSink->finish();
+            } else
+                store->narFromPath(path, out);
             break;
+        }
 
         case ServeProto::Command::ImportPaths: {
             if (!writeAllowed)
@@ -1072,6 +1099,14 @@ static void opServe(Strings opFlags, Strings opArgs)
             if (info.narSize == 0)
                 throw Error("narInfo is too old and missing the narSize field");
 
+            if (auto compressionLevel = readNarCompressionLevel(); compressionLevel) {
+                FramedSource framedSource(in);
+                auto source = makeDecompressionSource(CompressionAlgo::zstd, framedSource);
+                store->addToStore(info, *source, NoRepair, NoCheckSigs);
+                out << 1; // indicate success
+                break;
+            }
+
             SizedSource sizedSource(in, info.narSize);
 
             store->addToStore(info, sizedSource, NoRepair, NoCheckSigs);
@@ -1212,7 +1247,8 @@ static int main_nix_store(int argc, char ** argv)
                 noOutput = true;
             else if (*arg != "" && arg->at(0) == '-') {
                 opFlags.push_back(*arg);
-                if (*arg == "--max-freed" || *arg == "--max-links" || *arg == "--max-atime") /* !!! hack */
+                if (*arg == "--max-freed" || *arg == "--max-links" || *arg == "--max-atime"
+                    || *arg == "--registered-before") /* !!! hack */
                     opFlags.push_back(getArg(*arg, arg, end));
             } else
                 opArgs.push_back(*arg);
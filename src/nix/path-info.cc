@@ -22,8 +22,11 @@ using nlohmann::json;
 static uint64_t getStoreObjectsTotalSize(Store & store, const StorePathSet & closure)
 {
     uint64_t totalNarSize = 0;
+    auto infos = store.queryPathInfos(closure);
     for (auto & p : closure) {
-        totalNarSize += store.queryPathInfo(p)->narSize;
+        auto i = infos.find(p);
+        /* Let queryPathInfo() throw the usual error for invalid paths. */
+        totalNarSize += i != infos.end() ? i->second->narSize : store.queryPathInfo(p)->narSize;
     }
     return totalNarSize;
 }
@@ -45,6 +48,10 @@ pathInfoToJSON(Store & store, const StorePathSet & storePaths, bool showClosureS
         return format == PathInfoJsonFormat::V1 ? store.printStorePath(path) : std::string(path.to_string());
     };
 
+    /* Fetch the path infos in bulk so that the queryPathInfo() calls
+       below are answered from the client cache. */
+    store.queryPathInfos(storePaths);
+
     for (auto & storePath : storePaths) {
         json jsonObject;
 
@@ -204,6 +211,10 @@ struct CmdPathInfo : StorePathsCommand, MixJSON
 
         else {
 
+            /* Fetch the path infos in bulk so that the queryPathInfo()
+               calls below are answered from the client cache. */
+            store->queryPathInfos(StorePathSet(storePaths.begin(), storePaths.end()));
+
             for (auto & storePath : storePaths) {
                 auto info = store->queryPathInfo(storePath);
                 auto storePathS = store->printStorePath(info->path);
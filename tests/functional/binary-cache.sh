@@ -99,6 +99,26 @@ wait "$pid2"
 [[ $(cat "$TEST_ROOT/log1" "$TEST_ROOT/log2" | grep -c "downloading.*nar.xz") -eq 1 ]]
 
 
+# Test that many substitutions can be in flight at once, even though
+# unpacking them happens on a pool of only one thread per core.
+clearStore
+manyCacheDir="$TEST_ROOT/many-cache"
+rm -rf "$manyCacheDir"
+manyPaths=()
+for i in $(seq 1 64); do
+    echo "$i" > "$TEST_ROOT/many-$i"
+    manyPaths+=("$(nix-store --add "$TEST_ROOT/many-$i")")
+done
+nix copy --to "file://$manyCacheDir" "${manyPaths[@]}"
+clearStore
+start=$SECONDS
+_NIX_TEST_CONCURRENT_SUBSTITUTION=1 nix-store -r "${manyPaths[@]}" --substituters "file://$manyCacheDir" --no-require-sigs \
+    --option max-substitution-jobs 64
+# Every fetch sleeps for a second, so doing them one by one would take over a minute.
+(( SECONDS - start < 30 ))
+nix-store --check-validity "${manyPaths[@]}"
+
+
 # Test whether Nix notices if the NAR doesn't match the hash in the NAR info.
 clearStore
 
@@ -297,6 +317,72 @@ diff -u \
 EOF
     )
 
+# Test reading individual files using the NAR frame index.
+clearBinaryCache
+
+nix copy --to "file://$cacheDir?compression=zstd&write-nar-listing=1&write-nar-frame-index=1" "$outPath"
+
+jq -e '.version == 1 and (.frames | length) == 1 and .frames[0] == [0, 0]' \
+    < "$cacheDir/$(basename "$outPath" | cut -c1-32).frames"
+
+[[ $(nix store cat --store "file://$cacheDir" "$outPath/bar") = foo ]]
+_NIX_FORCE_HTTP=1 nix store cat --debug --store "file://$cacheDir" "$outPath/bar" 2>&1 | grepQuiet "using range requests"
+[[ $(_NIX_FORCE_HTTP=1 nix store cat --store "file://$cacheDir" "$outPath/bar") = foo ]]
+
+# Test chunked NARs.
+clearBinaryCache
+
+nix copy --to "file://$cacheDir?compression=zstd&nar-chunking=1" "$outPath"
+
+grepQuiet "^URL: nar/.*\.chunks$" "$cacheDir/$(basename "$outPath" | cut -c1-32).narinfo"
+[[ -n $(ls "$cacheDir/chunks") ]]
+
+cmp <(nix store dump-path "$outPath") <(nix store dump-path --store "file://$cacheDir" "$outPath")
+cmp <(nix store dump-path "$outPath") <(_NIX_FORCE_HTTP=1 nix store dump-path --store "file://$cacheDir?local-chunk-cache=$TEST_ROOT/chunk-cache" "$outPath")
+[[ -n $(ls "$TEST_ROOT/chunk-cache") ]]
+
+# The chunk cache is trimmed to its maximum size.
+rm -rf "$TEST_ROOT/chunk-cache"
+cmp <(nix store dump-path "$outPath") <(_NIX_FORCE_HTTP=1 nix store dump-path --store "file://$cacheDir?local-chunk-cache=$TEST_ROOT/chunk-cache&local-chunk-cache-size=1" "$outPath")
+[[ -z $(ls "$TEST_ROOT/chunk-cache") ]]
+[[ $(nix store cat --store "file://$cacheDir" "$outPath/bar") = foo ]]
+
+# Test NAR deltas.
+clearBinaryCache
+
+mkDeltaTest() {
+    nix-build --no-out-link -E "
+      with import ${config_nix};
+      mkDerivation {
+        name = \"delta-test\";
+        buildCommand = \"mkdir \$out; seq 1 100000 > \$out/data; echo $1 >> \$out/data\";
+      }
+    "
+}
+
+v1=$(mkDeltaTest 1)
+v2=$(mkDeltaTest 2)
+
+nix copy --to "file://$cacheDir?compression=zstd&write-nar-deltas=1" "$v1"
+nix copy --to "file://$cacheDir?compression=zstd&write-nar-deltas=1" "$v2"
+
+grepQuiet "^Delta: $(basename "$v1") " "$cacheDir/$(basename "$v2" | cut -c1-32).narinfo"
+[[ $(nix path-info --json --json-format 1 --store "file://$cacheDir" "$v2" | jq -r ".\"$v2\".deltas[0].base") = "$v1" ]]
+
+# No deltas are created for NARs above nar-delta-max-size.
+v3=$(mkDeltaTest 3)
+nix copy --to "file://$cacheDir?compression=zstd&write-nar-deltas=1&nar-delta-max-size=1024" "$v3"
+grepQuietInverse "^Delta:" "$cacheDir/$(basename "$v3" | cut -c1-32).narinfo"
+
+nix-store --delete "$v2"
+nix copy --debug --from "file://$cacheDir" --no-require-sigs "$v2" 2>&1 | grepQuiet "as a delta of"
+[[ $(tail -n1 "$v2/data") = 2 ]]
+
+# If the delta is missing, fall back to the full NAR.
+nix-store --delete "$v2"
+rm "$cacheDir"/nar/*.delta
+nix copy --from "file://$cacheDir" --no-require-sigs "$v2" 2>&1 | grepQuiet "fetching the full NAR"
+[[ $(tail -n1 "$v2/data") = 2 ]]
 
 # Test debug info index generation.
 clearBinaryCache
@@ -0,0 +1,51 @@
+{ busybox }:
+with import ./config.nix;
+let
+
+  mkDerivation =
+    args:
+    derivation (
+      {
+        inherit system;
+        builder = busybox;
+        args = [
+          "sh"
+          "-e"
+          (builtins.toFile "builder-${args.name}.sh" ''
+            eval "$buildCommand"
+          '')
+        ];
+      }
+      // args
+    );
+
+in
+{
+  # Fails once the other builds are running.
+  failing = mkDerivation {
+    name = "build-remote-cancel-failing";
+    buildCommand = ''
+      sleep 2
+      exit 1
+    '';
+    requiredSystemFeatures = [ "bar" ];
+  };
+
+  slow1 = mkDerivation {
+    name = "build-remote-cancel-slow-1";
+    buildCommand = ''
+      sleep 600
+      touch $out
+    '';
+    requiredSystemFeatures = [ "foo" ];
+  };
+
+  slow3 = mkDerivation {
+    name = "build-remote-cancel-slow-3";
+    buildCommand = ''
+      sleep 600
+      touch $out
+    '';
+    requiredSystemFeatures = [ "baz" ];
+  };
+}
@@ -0,0 +1,81 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+requireSandboxSupport
+requiresUnprivilegedUserNamespaces
+[[ "${busybox-}" =~ busybox ]] || skipTest "no busybox"
+
+# Avoid store dir being inside sandbox build-dir
+unset NIX_STORE_DIR
+
+file=build-hook.nix
+
+builders=(
+  "ssh://localhost?remote-store=$TEST_ROOT/machine1?system-features=foo - - 1 1 foo"
+  "$TEST_ROOT/machine2 - - 1 1 bar"
+  "ssh-ng://localhost?remote-store=$TEST_ROOT/machine3?system-features=baz - - 1 1 baz"
+)
+
+chmod -R +w "$TEST_ROOT/machine"* || true
+rm -rf "$TEST_ROOT/machine"* || true
+
+nix build -L -v -f "$file" -o "$TEST_ROOT/result" --max-jobs 0 \
+  --arg busybox "$busybox" \
+  --store "$TEST_ROOT/machine0" \
+  --builders "$(IFS=';'; echo "${builders[*]}")" \
+  --builders-in-process
+
+outPath=$(readlink -f "$TEST_ROOT/result")
+
+grep 'FOO BAR BAZ' "$TEST_ROOT/machine0/$outPath"
+
+# Ensure that every input was built on the machine with the required feature.
+for i in 1 2 3; do
+  output=$(nix path-info --store "$TEST_ROOT/machine$i" --all)
+  for j in 1 2 3; do
+    if [[ $i == "$j" ]]; then
+      echo "$output" | grepQuiet "builder-build-remote-input-$j.sh"
+    else
+      echo "$output" | grepQuietInverse "builder-build-remote-input-$j.sh"
+    fi
+  done
+done
+
+# A failing remote build reports the machine it failed on.
+out="$(nix-build failing.nix --no-out-link -j0 \
+  --arg busybox "$busybox" \
+  --store "$TEST_ROOT/machine0" \
+  --builders "$(IFS=';'; echo "${builders[*]}")" \
+  --builders-in-process 2>&1)" && fail "the build should have failed"
+grepQuiet "' on '.*' failed: " <<< "$out"
+
+# An unreachable machine is skipped, even if it is the preferred one.
+chmod -R +w "$TEST_ROOT/machine"* || true
+rm -rf "$TEST_ROOT/machine"* || true
+
+buildersWithUnreachable=(
+  "ssh-ng://nonexistent.invalid - - 1 100 foo,bar,baz"
+  "${builders[@]}"
+)
+
+nix build -f "$file" -o "$TEST_ROOT/result" --max-jobs 0 \
+  --arg busybox "$busybox" \
+  --store "$TEST_ROOT/machine0" \
+  --builders "$(IFS=';'; echo "${buildersWithUnreachable[*]}")" \
+  --builders-in-process 2>&1 | grepQuiet "cannot build on 'ssh-ng://nonexistent.invalid'"
+
+grep 'FOO BAR BAZ' "$TEST_ROOT/machine0/$(readlink -f "$TEST_ROOT/result")"
+
+# When a build fails without --keep-going, builds that are still running
+# on other machines are abandoned rather than waited for.
+chmod -R +w "$TEST_ROOT/machine"* || true
+rm -rf "$TEST_ROOT/machine"* || true
+
+start=$SECONDS
+nix-build build-remote-cancel.nix --no-out-link -j0 \
+  --arg busybox "$busybox" \
+  --store "$TEST_ROOT/machine0" \
+  --builders "$(IFS=';'; echo "${builders[*]}")" \
+  --builders-in-process && fail "the build should have failed"
+(( SECONDS - start < 60 )) || fail "abandoned remote builds were waited for"
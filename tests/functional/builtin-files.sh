@@ -0,0 +1,117 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+clearStore
+
+# Write a file.
+outPath=$(nix-build --no-out-link --expr '
+  builtins.derivation {
+    name = "write-file";
+    system = "builtin";
+    builder = "builtin:write-file";
+    text = "hello\n";
+  }')
+
+[[ $(cat "$outPath") = hello ]]
+[[ ! -x "$outPath" ]]
+
+# Write an executable file to a subdirectory.
+outPath=$(nix-build --no-out-link --expr '
+  builtins.derivation {
+    name = "write-script";
+    system = "builtin";
+    builder = "builtin:write-file";
+    text = "#! /bin/sh\n";
+    executable = true;
+    destination = "/bin/script";
+  }')
+
+[[ -x "$outPath/bin/script" ]]
+
+# The destination must stay inside the output.
+expectStderr 1 nix-build --no-out-link --expr '
+  builtins.derivation {
+    name = "write-file-escape";
+    system = "builtin";
+    builder = "builtin:write-file";
+    text = "";
+    destination = "../escape";
+  }' | grepQuiet "must not contain"
+
+# Concatenate files from the input closure.
+outPath=$(nix-build --no-out-link --expr '
+  let
+    f = name: text: builtins.derivation {
+      inherit name text;
+      system = "builtin";
+      builder = "builtin:write-file";
+    };
+  in builtins.derivation {
+    name = "concat-files";
+    system = "builtin";
+    builder = "builtin:concat-files";
+    srcs = [ (f "a" "foo\n") (f "b" "bar\n") ];
+  }')
+
+[[ $(cat "$outPath") = "foo
+bar" ]]
+
+# Inputs outside the input closure are refused.
+expectStderr 1 nix-build --no-out-link --expr '
+  builtins.derivation {
+    name = "concat-files-escape";
+    system = "builtin";
+    builder = "builtin:concat-files";
+    srcs = [ "/etc/passwd" ];
+  }' | grepQuiet "not in the input closure"
+
+# Create a symlink farm.
+outPath=$(nix-build --no-out-link --expr '
+  builtins.derivation {
+    name = "symlink-farm";
+    system = "builtin";
+    builder = "builtin:symlink-farm";
+    links = builtins.toJSON [
+      { name = "a"; target = "foo"; }
+      { name = "sub/b"; target = "../bar"; }
+    ];
+  }')
+
+[[ $(readlink "$outPath/a") = foo ]]
+[[ $(readlink "$outPath/sub/b") = ../bar ]]
+
+# Malformed links are a build failure, not a crash of the worker.
+expectStderr 1 nix-build --no-out-link --expr '
+  builtins.derivation {
+    name = "symlink-farm-malformed";
+    system = "builtin";
+    builder = "builtin:symlink-farm";
+    links = "not json";
+  }' | grepQuiet "parse error"
+
+expectStderr 1 nix-build --no-out-link --expr '
+  builtins.derivation {
+    name = "symlink-farm-no-target";
+    system = "builtin";
+    builder = "builtin:symlink-farm";
+    links = builtins.toJSON [ { name = "a"; } ];
+  }' | grepQuiet "target"
+
+# So is a missing input file.
+expectStderr 1 nix-build --no-out-link --expr '
+  builtins.derivation {
+    name = "concat-files-missing";
+    system = "builtin";
+    builder = "builtin:concat-files";
+    srcs = [ "/non-existent" ];
+  }' | grepQuiet "No such file or directory"
+
+# The worker is still usable afterwards.
+[[ $(cat "$(nix-build --no-out-link --expr '
+  builtins.derivation {
+    name = "write-file-after-failure";
+    system = "builtin";
+    builder = "builtin:write-file";
+    text = "ok";
+  }')") = ok ]]
@@ -0,0 +1,63 @@
+#!/usr/bin/env bash
+
+# Test batched invalidation and background deletion of dead paths.
+source common.sh
+
+TODO_NixOS
+
+needLocalStore "the GC test needs a synchronisation point"
+
+clearStore
+
+export NIX_CONFIG="gc-delete-jobs = 4"
+
+root=$(nix store add-path ./simple.nix)
+ln -sfn "$root" "$NIX_STATE_DIR/gcroots/root"
+
+dead=()
+for i in $(seq 1 50); do
+    mkdir -p "$TEST_ROOT/garbage-$i/dir"
+    for j in $(seq 1 10); do
+        echo "$i $j" > "$TEST_ROOT/garbage-$i/dir/$j"
+    done
+    dead+=("$(nix store add-path "$TEST_ROOT/garbage-$i")")
+done
+
+# This FIFO is read after the big GC lock has been released, but before
+# the background deletions have finished.
+fifo=$TEST_ROOT/gc-sync.fifo
+mkfifo "$fifo"
+
+(_NIX_TEST_GC_SYNC_3=$fifo nix-store --gc 2> "$TEST_ROOT/gc.out") &
+pid=$!
+
+# Wait until all dead paths have been invalidated and moved out of the
+# store, which happens before the GC releases its lock.
+allGone() {
+    for path in "${dead[@]}"; do
+        if [[ -e "$path" ]] || nix-store --check-validity "$path" 2> /dev/null; then return 1; fi
+    done
+}
+for _ in $(seq 1 60); do
+    if allGone; then break; fi
+    sleep 1
+done
+allGone || fail "the dead paths were not removed from the store"
+
+# Another collection doesn't block on the first one, and doesn't touch
+# the paths that it's still deleting.
+nix-store --gc
+[[ -e "$root" ]]
+
+echo > "$fifo"
+wait $pid
+
+for path in "${dead[@]}"; do
+    grepQuiet "$path" "$TEST_ROOT/gc.out"
+done
+
+[[ -e "$root" ]]
+nix-store --verify --check-contents
+
+# The directory the dead paths were moved to is gone.
+if find "$NIX_STORE_DIR" -maxdepth 1 -name 'tmp-*' | grep .; then false; fi
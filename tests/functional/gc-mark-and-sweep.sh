@@ -0,0 +1,53 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+TODO_NixOS
+
+clearStore
+
+export NIX_CONFIG="gc-mark-and-sweep = true"
+
+outPath=$(nix-build dependencies.nix --no-out-link)
+input2=$(readLink "$outPath/reference-to-input-2")
+input0=$(cat "$input2/input0")
+
+# Root a path that is only referenced by garbage.
+ln -sfn "$input2" "$NIX_STATE_DIR/gcroots/input2"
+
+nix-store --gc --print-live | grepQuiet "$input2"
+nix-store --gc --print-live | grepQuiet "$input0"
+nix-store --gc --print-dead | grepQuiet "$outPath"
+if nix-store --gc --print-dead | grep -E "($input2|$input0)$"; then false; fi
+
+nix-collect-garbage
+
+# The root and its closure survive, their referrers don't.
+[[ -e "$input2/bar" ]]
+[[ -e "$input0/bar" ]]
+[[ ! -e "$outPath" ]]
+nix-store --verify-path "$input2"
+nix-store --verify-path "$input0"
+
+# A live path with both a live and a dead referrer.
+garbage=$(nix-build --no-out-link -E "
+  with import ./config.nix;
+  mkDerivation {
+    name = \"garbage\";
+    input0 = builtins.storePath \"$input0\";
+    buildCommand = \"echo \$input0 > \$out\";
+  }
+")
+nix-store -q --references "$garbage" | grepQuiet "$input0"
+
+nix-collect-garbage
+[[ -e "$input2/bar" ]]
+[[ -e "$input0/bar" ]]
+[[ ! -e "$garbage" ]]
+
+rm "$NIX_STATE_DIR/gcroots/input2"
+
+nix-collect-garbage
+
+[[ ! -e "$input2" ]]
+[[ ! -e "$input0" ]]
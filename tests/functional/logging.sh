@@ -40,3 +40,10 @@ if [[ "$NIX_REMOTE" != "daemon" ]]; then
     grep '{"action":"start","fields":\[".*-dependencies-top.drv","",1,1\],"id":.*,"level":3,"parent":0' "$TEST_ROOT/log.json" >&2
     (( $(grep -c '{"action":"msg","level":5,"msg":"executing builder .*"}' "$TEST_ROOT/log.json" ) == 5 ))
 fi
+
+# Test trace-file.
+clearStore
+nix build --file dependencies.nix --no-link --trace-file "$TEST_ROOT/trace.json"
+# Every build is a complete event on a track of the "builds" group.
+(( $(jq '[.[] | select(.ph == "X" and .cat == "build" and (.name | startswith("building ")))] | length' < "$TEST_ROOT/trace.json") == 5 ))
+jq -e '.[] | select(.ph == "M" and .name == "process_name" and .args.name == "builds")' < "$TEST_ROOT/trace.json" > /dev/null
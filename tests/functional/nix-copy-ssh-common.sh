@@ -68,3 +68,16 @@ chmod -w "$corruptPath"
 # order to avoid errors.
 NIX_CONFIG=$(echo -e "substituters = local\nrequire-sigs = false") \
     nix copy --no-check-sigs --from "$corruptedStore" --to "$remoteStore" --substitute-on-destination "$outPath"
+
+# Copy back and forth with NAR compression on the wire
+
+clearRemoteStore
+
+nix copy --no-check-sigs --to "$remoteStore&nar-compression-level=3" "$outPath"
+[ -f "${remoteRoot}""${outPath}"/foobar ]
+
+clearStore
+
+[ ! -f "$outPath"/foobar ]
+nix copy --no-check-sigs --from "$remoteStore&nar-compression-level=3" "$outPath"
+[ -f "$outPath"/foobar ]
@@ -17,3 +17,10 @@ nix copy --to "$remoteStore" "$outPath" --no-check-sigs &
 pid2="$!"
 wait "$pid1"
 wait "$pid2"
+
+# Copy a closure over multiple connections. Paths must still be
+# registered after their references.
+clearRemoteStore
+nix copy --to "$remoteStore&max-connections=4" "$outPath" --no-check-sigs
+[ -f "${remoteRoot}""${outPath}"/foobar ]
+nix path-info --store "$remoteStore" --recursive "$outPath" > /dev/null
@@ -34,6 +34,20 @@ nix-env -p "$TEST_ROOT/daemon-profile" -q '*' | grepQuiet foo-1.0
 
 NIX_REMOTE_=$NIX_REMOTE $SHELL ./user-envs-test-case.sh
 
+# Bulk path info queries through the daemon.
+outPath=$(nix-build dependencies.nix --no-out-link)
+nix path-info --json --closure-size -r "$outPath" > "$TEST_ROOT"/path-info-daemon.json
+NIX_REMOTE='' nix path-info --json --closure-size -r "$outPath" > "$TEST_ROOT"/path-info-local.json
+diff <(jq -S . "$TEST_ROOT"/path-info-daemon.json) <(jq -S . "$TEST_ROOT"/path-info-local.json)
+expectStderr 1 nix path-info --closure-size "$NIX_STORE_DIR"/g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-invalid \
+    | grepQuiet "is not valid"
+
+# Closures computed by the daemon.
+input2=$(readLink "$outPath/reference-to-input-2")
+diff <(nix-store -qR "$outPath" | sort) <(NIX_REMOTE='' nix-store -qR "$outPath" | sort)
+diff <(nix-store -q --referrers-closure "$input2" | sort) <(NIX_REMOTE='' nix-store -q --referrers-closure "$input2" | sort)
+expectStderr 1 nix-store -qR "$NIX_STORE_DIR"/g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-invalid | grepQuiet "is not valid"
+
 nix-store --gc --max-freed 1K
 
 nix-store --dump-db > "$TEST_ROOT"/d1
@@ -0,0 +1,42 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+needLocalStore "--repair needs a local store"
+
+TODO_NixOS
+
+clearStore
+
+# Everything in the store is registered from now on.
+cutoff=$(date +%s)
+
+path=$(nix-build dependencies.nix -o "$TEST_ROOT"/result)
+path2=$(nix-store -qR "$path" | grep input-2)
+
+hash=$(nix-hash "$path2")
+
+chmod u+w "$path2"
+touch "$path2"/bad
+
+# Paths registered at or after the cutoff are skipped, so the corruption
+# goes unnoticed.
+nix-store --verify --check-contents --registered-before "$cutoff" 2>&1 | grepQuiet "checking 0 of"
+
+expectStderr 1 nix-store --verify --check-contents --registered-before "$((cutoff + 3600))" \
+    | grepQuiet "path '$path2' was modified"
+
+# Corrupted paths are reported and repaired when hashing in parallel.
+export NIX_CONFIG="verify-jobs = 4"
+
+expectStderr 1 nix-store --verify --check-contents | grepQuiet "path '$path2' was modified"
+
+nix-store --verify --check-contents --repair
+
+# shellcheck disable=SC2166
+if [ "$(nix-hash "$path2")" != "$hash" -o -e "$path2"/bad ]; then
+    echo "path not repaired properly" >&2
+    exit 1
+fi
+
+nix-store --verify --check-contents
@@ -13,6 +13,8 @@
           extra-system-features = uid-range
         '';
         nix.settings.use-cgroups = true;
+        nix.settings.cgroup-memory-high = "default=1G";
+        nix.settings.cgroup-cpu-weight = "default=200";
         nix.nixPath = [ "nixpkgs=${nixpkgs}" ];
       };
   };
@@ -36,6 +38,10 @@
       host.succeed(f'[ -z "$(cat {service}/cgroup.procs)" ]')
       host.succeed(f'[ -n "$(cat {service}/nix-daemon/cgroup.procs)" ]')
       host.succeed(f'[ -n "$(cat {service}/nix-build-uid-*/cgroup.procs)" ]')
+
+      # Check that the resource limits of the build were applied
+      host.succeed(f'[ "$(cat {service}/nix-build-uid-*/memory.high)" = 1073741824 ]')
+      host.succeed(f'[ "$(cat {service}/nix-build-uid-*/cpu.weight)" = 200 ]')
     '';
 
 }
@@ -200,6 +200,8 @@ in
 
   cgroups = runNixOSTest ./cgroups;
 
+  sandbox-namespace-pool = runNixOSTest ./sandbox-namespace-pool;
+
   fetchurl = runNixOSTest ./fetchurl.nix;
 
   fetchersSubstitute = runNixOSTest ./fetchers-substitute.nix;
@@ -0,0 +1,34 @@
+# Test that builds that reuse the network namespace of their build user
+# (`sandbox-namespace-pool`) don't see anything of earlier builds.
+{ lib, nixpkgs, ... }:
+
+{
+  name = "sandbox-namespace-pool";
+
+  nodes = {
+    host =
+      { pkgs, ... }:
+      {
+        virtualisation.writableStore = true;
+        virtualisation.additionalPaths = [
+          pkgs.stdenvNoCC
+          pkgs.busybox
+        ];
+        nix.settings.substituters = lib.mkForce [ ];
+        nix.settings.sandbox-namespace-pool = true;
+        nix.nixPath = [ "nixpkgs=${nixpkgs}" ];
+      };
+  };
+
+  testScript =
+    { nodes }:
+    ''
+      start_all()
+
+      host.wait_for_unit("multi-user.target")
+
+      # Both builds run in the same process, so the second one reuses
+      # the network namespace of the first one's build user.
+      host.succeed("nix-build ${./pool-test.nix} --no-out-link -L >&2")
+    '';
+}
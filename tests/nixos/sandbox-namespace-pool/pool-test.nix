@@ -0,0 +1,28 @@
+with import <nixpkgs> { };
+
+let
+
+  # Leaves a TCP listener behind when the build ends.
+  first = runCommand "pool-test-first" { nativeBuildInputs = [ busybox ]; } ''
+    busybox nc -l -p 4711 > /dev/null &
+    for i in $(seq 10); do
+      grep -qs ':126F ' /proc/net/tcp /proc/net/tcp6 && break
+      sleep 1
+    done
+    grep -qs ':126F ' /proc/net/tcp /proc/net/tcp6
+    readlink /proc/self/ns/net > $out
+  '';
+
+in
+
+runCommand "pool-test-second" { } ''
+  # The network namespace of the first build is reused...
+  [ "$(readlink /proc/self/ns/net)" = "$(cat ${first})" ]
+
+  # ...but its listener is gone, and there are no interfaces besides
+  # the loopback interface.
+  ! grep -qs ':126F ' /proc/net/tcp /proc/net/tcp6
+  [ "$(tail -n +3 /proc/net/dev | cut -d: -f1 | tr -d ' ')" = lo ]
+
+  touch $out
+''